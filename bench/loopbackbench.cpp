@@ -0,0 +1,391 @@
+#include "uinputdevice.h"
+#include "evdevdevice.h"
+#include "moduleprofiler.h"
+#include "cxxopts.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// Runs the whole stack on one machine: a source uinput device, funkeymonkey
+// grabbing it with a plugin, and the plugin's output device read back
+// through evdev. Key events are written to the source at increasing rates,
+// and the time from each write to the kernel's timestamp of its counterpart
+// on the output device is reported, along with events that never came out.
+// The highest rate without losses is the one funkeymonkey sustains. Needs
+// access to uinput and the input devices, eg. as root.
+//
+// The plugin has to turn every key event into exactly one, like the default
+// passthrough through librules.so does. Every configuration given with -C
+// runs it with other funkeymonkey options, eg. -C 'sandbox=-s', and every
+// frame size given with -f, where more key events per frame show what
+// writing each frame out in one go saves.
+
+#ifndef FKM_PLUGIN_DIR
+#define FKM_PLUGIN_DIR "."
+#endif
+
+namespace
+{
+  std::string const SOURCE_NAME = "FunKeyMonkey loopback source";
+  // Key codes from KEY_A on the source has, the keys of a frame cycle
+  // through them
+  unsigned int const KEYS = 26;
+
+  struct Configuration
+  {
+    std::string name;
+    std::vector<std::string> options;
+  };
+
+  struct Step
+  {
+    unsigned int rate;
+    unsigned long long sent;
+    unsigned long long lost;
+    double achieved;
+    ModuleProfiler::Histogram latency;
+  };
+
+  // Path of the event device named name, once it shows up
+  std::string findDevice(std::string const& name)
+  {
+    for(unsigned int attempt = 0; attempt < 50; ++attempt)
+    {
+      for(EvdevDevice::Information const& device : EvdevDevice::availableDevices())
+      {
+        if(device.name == name)
+          return device.path;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return "";
+  }
+
+  std::vector<std::string> split(std::string const& text)
+  {
+    std::istringstream words(text);
+    return std::vector<std::string>(std::istream_iterator<std::string>(words),
+        std::istream_iterator<std::string>());
+  }
+
+  // Key event timestamps read back from the output device
+  class Reader
+  {
+  public:
+    explicit Reader(int fd) :
+      _fd(fd), _stop(false), _mutex(), _received(), _thread(&Reader::run, this)
+    {
+    }
+
+    ~Reader()
+    {
+      _stop = true;
+      _thread.join();
+    }
+
+    std::vector<unsigned long long> take()
+    {
+      std::lock_guard<std::mutex> lk(_mutex);
+      std::vector<unsigned long long> received;
+      received.swap(_received);
+      return received;
+    }
+
+  private:
+    void run()
+    {
+      std::array<input_event, 64> events;
+      pollfd fds = {_fd, POLLIN, 0};
+      while(!_stop)
+      {
+        if(::poll(&fds, 1, 100) <= 0)
+          continue;
+
+        ssize_t bytes = read(_fd, events.data(), sizeof(events));
+        if(bytes <= 0)
+          continue;
+
+        std::lock_guard<std::mutex> lk(_mutex);
+        for(unsigned int i = 0; i < bytes / sizeof(input_event); ++i)
+        {
+          if(events[i].type == EV_KEY)
+            _received.push_back(timestamp(events[i]));
+        }
+      }
+    }
+
+    static unsigned long long timestamp(input_event const& e)
+    {
+      return e.time.tv_sec * 1000000000ull + e.time.tv_usec * 1000ull;
+    }
+
+    int _fd;
+    std::atomic<bool> _stop;
+    std::mutex _mutex;
+    std::vector<unsigned long long> _received;
+    std::thread _thread;
+  };
+
+  // Writes frames of key events to the source at rate events per second
+  // for a while, and matches what came out in order
+  Step inject(UinputDevice& source, Reader& reader, unsigned int rate,
+      unsigned int frameSize, double seconds)
+  {
+    Step step = {rate, 0, 0, 0, {0, 0, 0, {}}};
+    std::vector<unsigned long long> sent;
+    std::vector<input_event> frame(frameSize + 1);
+    memset(frame.data(), 0, sizeof(input_event) * frame.size());
+    frame.back().type = EV_SYN;
+    frame.back().code = SYN_REPORT;
+
+    reader.take();
+    unsigned long long const interval = 1000000000ull * frameSize / rate;
+    unsigned long long const frames = seconds * rate / frameSize;
+    unsigned long long const start = ModuleProfiler::now();
+    for(unsigned long long i = 0; i < frames; ++i)
+    {
+      unsigned long long const due = start + i * interval;
+      timespec const until = {static_cast<time_t>(due / 1000000000),
+        static_cast<long>(due % 1000000000)};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+
+      // Press the keys in one frame, release them in the next
+      for(unsigned int j = 0; j < frameSize; ++j)
+      {
+        frame[j].type = EV_KEY;
+        frame[j].code = KEY_A + j % KEYS;
+        frame[j].value = i % 2 == 0;
+      }
+      unsigned long long const now = ModuleProfiler::now();
+      source.send(frame.data(), frame.size());
+      sent.insert(sent.end(), frameSize, now);
+    }
+    unsigned long long const end = ModuleProfiler::now();
+
+    // Whatever is still on the way
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    std::vector<unsigned long long> received = reader.take();
+
+    step.sent = sent.size();
+    step.lost = sent.size() > received.size() ? sent.size() - received.size() : 0;
+    step.achieved = sent.size() / ((end - start) / 1e9);
+    for(unsigned int i = 0; i < sent.size() && i < received.size(); ++i)
+    {
+      step.latency.add(received[i] > sent[i] ? received[i] - sent[i] : 0);
+    }
+
+    // Leave every key released for the next step
+    if(frames % 2)
+    {
+      for(unsigned int j = 0; j < frameSize; ++j)
+      {
+        frame[j].value = 0;
+      }
+      source.send(frame.data(), frame.size());
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      reader.take();
+    }
+    return step;
+  }
+
+  // Starts funkeymonkey on the source, steps through the rates and stops at
+  // the first one losing events. Returns the highest rate without losses.
+  unsigned int measure(Configuration const& configuration, std::string const& binary,
+      std::string const& plugin, std::vector<std::string> const& pluginArgs,
+      std::string const& outputName, unsigned int frameSize,
+      std::vector<unsigned int> const& rates, double seconds)
+  {
+    std::vector<UinputDevice::PossibleEvent> keys = {{EV_KEY, {}}};
+    for(unsigned int code = KEY_A; code < KEY_A + KEYS; ++code)
+    {
+      keys.front().codes.push_back(code);
+    }
+    UinputDevice source("/dev/uinput", BUS_VIRTUAL, SOURCE_NAME, 1, 1, 1, keys);
+    std::string const sourcePath = source.ready() ? findDevice(SOURCE_NAME) : "";
+    if(sourcePath.empty())
+    {
+      std::cerr << "ERROR: Could not create the source device" << std::endl;
+      return 0;
+    }
+
+    std::vector<std::string> args = {binary, "-g", "-i", sourcePath, "-p", plugin};
+    for(std::string const& arg : pluginArgs)
+    {
+      args.push_back("-X");
+      args.push_back(arg);
+    }
+    args.insert(args.end(), configuration.options.begin(), configuration.options.end());
+
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+      std::vector<char*> argv;
+      for(std::string& arg : args)
+      {
+        argv.push_back(&arg[0]);
+      }
+      argv.push_back(nullptr);
+      freopen("/dev/null", "w", stdout);
+      execv(argv[0], argv.data());
+      _exit(EXIT_FAILURE);
+    }
+
+    unsigned int sustained = 0;
+    std::string const outputPath = findDevice(outputName);
+    int fd = outputPath.empty() ? -1 : open(outputPath.data(), O_RDONLY | O_NONBLOCK);
+    if(fd < 0)
+    {
+      std::cerr << "ERROR: Could not open the output device '" << outputName << "'" << std::endl;
+    }
+    else
+    {
+      int clock = CLOCK_MONOTONIC;
+      ioctl(fd, EVIOCSCLOCKID, &clock);
+      Reader reader(fd);
+      for(unsigned int rate : rates)
+      {
+        Step step = inject(source, reader, rate, frameSize, seconds);
+        std::cout << std::left << std::setw(16) << configuration.name
+          << std::right << std::setw(6) << frameSize
+          << std::setw(10) << rate
+          << std::setw(10) << static_cast<unsigned long long>(step.achieved)
+          << std::setw(10) << step.sent
+          << std::setw(8) << step.lost
+          << std::setw(10) << step.latency.percentile(0.5) / 1000
+          << std::setw(10) << step.latency.percentile(0.99) / 1000
+          << std::setw(10) << step.latency.max / 1000 << std::endl;
+        if(step.lost)
+          break;
+        sustained = rate;
+      }
+      close(fd);
+    }
+
+    kill(pid, SIGINT);
+    waitpid(pid, nullptr, 0);
+    return sustained;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  cxxopts::Options options(argv[0], " - Measures latency through funkeymonkey end to end");
+  options.add_options()
+    ("b,binary", "funkeymonkey to run", cxxopts::value<std::string>(), "PATH")
+    ("p,plugin", "Plugin turning each key event into one, default a passthrough",
+     cxxopts::value<std::string>(), "PATH")
+    ("X,plugin-parameter", "Plugin parameter", cxxopts::value<std::vector<std::string>>(), "ARG")
+    ("n,output-name", "Name of the plugin's output device", cxxopts::value<std::string>(), "NAME")
+    ("C,configuration", "NAME=OPTIONS to run funkeymonkey with, multiple can be provided",
+     cxxopts::value<std::vector<std::string>>(), "CONFIGURATION")
+    ("f,frame", "Key events per frame, multiple can be provided",
+     cxxopts::value<std::vector<unsigned int>>(), "EVENTS")
+    ("r,rate", "Events per second to try, multiple can be provided",
+     cxxopts::value<std::vector<unsigned int>>(), "RATE")
+    ("d,duration", "Seconds per rate", cxxopts::value<double>(), "SECONDS")
+    ("h,help", "Print help");
+
+  try
+  {
+    options.parse(argc, argv);
+  }
+  catch(cxxopts::OptionException const& e)
+  {
+    std::cerr << "ERROR: parsing options failed: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(options.count("h"))
+  {
+    std::cout << options.help({""}) << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  std::string const binary = options.count("b") ? options["b"].as<std::string>()
+    : std::string(FKM_PLUGIN_DIR) + "/funkeymonkey";
+  std::string const plugin = options.count("p") ? options["p"].as<std::string>()
+    : std::string(FKM_PLUGIN_DIR) + "/librules.so";
+  std::string const outputName = options.count("n") ? options["n"].as<std::string>()
+    : "FunKeyMonkey rules";
+
+  // The rules plugin passes everything through without any rules
+  std::string passthrough;
+  std::vector<std::string> pluginArgs = options["X"].as<std::vector<std::string>>();
+  if(!options.count("p") && pluginArgs.empty())
+  {
+    passthrough = "/tmp/fkm-loopback-" + std::to_string(getpid()) + ".rules";
+    std::ofstream(passthrough) << "# Passthrough\n";
+    pluginArgs.push_back("rules=" + passthrough);
+  }
+
+  std::vector<Configuration> configurations;
+  for(std::string const& text : options["C"].as<std::vector<std::string>>())
+  {
+    std::size_t equals = text.find('=');
+    configurations.push_back({text.substr(0, equals),
+        equals == std::string::npos ? std::vector<std::string>() : split(text.substr(equals + 1))});
+  }
+  if(configurations.empty())
+  {
+    configurations = {{"in process", {}}, {"epoll", {"--input-backend", "epoll"}},
+      {"sandbox", {"-s"}}};
+  }
+
+  std::vector<unsigned int> frames = options["f"].as<std::vector<unsigned int>>();
+  if(frames.empty())
+    frames = {1, 8};
+  std::vector<unsigned int> rates = options["r"].as<std::vector<unsigned int>>();
+  if(rates.empty())
+    rates = {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000};
+  double const seconds = options.count("d") ? options["d"].as<double>() : 1;
+
+  std::cout << std::left << std::setw(16) << "configuration"
+    << std::right << std::setw(6) << "frame"
+    << std::setw(10) << "rate/s"
+    << std::setw(10) << "actual/s"
+    << std::setw(10) << "sent"
+    << std::setw(8) << "lost"
+    << std::setw(10) << "p50 us"
+    << std::setw(10) << "p99 us"
+    << std::setw(10) << "max us" << std::endl;
+
+  std::vector<std::string> summary;
+  for(Configuration const& configuration : configurations)
+  {
+    for(unsigned int frameSize : frames)
+    {
+      unsigned int sustained = measure(configuration, binary, plugin, pluginArgs,
+          outputName, frameSize, rates, seconds);
+      std::ostringstream line;
+      line << std::left << std::setw(16) << configuration.name
+        << std::right << std::setw(6) << frameSize << std::setw(12) << sustained;
+      summary.push_back(line.str());
+    }
+  }
+
+  std::cout << std::endl << std::left << std::setw(16) << "sustained"
+    << std::right << std::setw(6) << "frame" << std::setw(12) << "max rate/s" << std::endl;
+  for(std::string const& line : summary)
+  {
+    std::cout << line << std::endl;
+  }
+
+  if(!passthrough.empty())
+    unlink(passthrough.data());
+  return EXIT_SUCCESS;
+}
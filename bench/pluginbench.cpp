@@ -0,0 +1,1217 @@
+#include "funkeymonkeymoduleloader.h"
+#include "hostoutputs.h"
+#include "moduleprofiler.h"
+#include "eventcodes.h"
+#include "stickresponse.h"
+#include "allocationcounter.h"
+#include "framearena.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <regex>
+
+// Compares the per-event cost of every bundled plugin on synthetic
+// workloads: typing bursts, chord storms, 1 kHz stick sweeps and 8 kHz mouse
+// motion, and eg. the rules plugin against the hand-written plugin it
+// replaces. Each case runs twice: once against a host that discards
+// everything, which leaves the plugin's handle() alone, and once against the
+// real host outputs writing to stub uinput devices, which adds the host
+// buffering and one write per output and frame. The second run also counts
+// heap allocations and read and write system calls per event, of the whole
+// process including plugin threads, once a first round warmed up the
+// plugin's buffers. Build with -DCMAKE_BUILD_TYPE=Release for meaningful
+// numbers. With --json only these cases run and the results are printed as
+// JSON, for tracking them between releases. With --check only these cases
+// run as well, and any plugin that still allocates fails the benchmark.
+//
+// A second part replays typing with realistic timing through the keyboard
+// plugin with tap-hold keys and chords, firing host timers on a virtual
+// clock, and reports how long plain key presses are held back. It also
+// reloads the config with keys held down and fails on any key left stuck.
+//
+// A third part holds the modal gamepad's stick at a few deflections for a
+// while in real time and reports how often its mouse thread wakes up and
+// how evenly the pointer moves. The response curves it maps stick
+// positions through are timed against evaluating the curves directly.
+//
+// Last, the modal gamepad reloads its config from text and from the binary
+// config cache, next to the regex based line splitting it used to do.
+
+#ifndef FKM_PLUGIN_DIR
+#define FKM_PLUGIN_DIR "."
+#endif
+
+struct Case
+{
+  std::string name;
+  std::string plugin;
+  std::string workload;
+  std::vector<std::string> args;
+  std::vector<input_event> events;
+};
+
+struct Result
+{
+  double ns;
+  // Negative where they could not be counted
+  double allocations;
+  double syscalls;
+};
+
+input_event event(unsigned int type, unsigned int code, int value,
+    unsigned long long time = 0)
+{
+  input_event e;
+  memset(&e, 0, sizeof(e));
+  e.time.tv_sec = time / 1000000000;
+  e.time.tv_usec = time % 1000000000 / 1000;
+  e.type = type;
+  e.code = code;
+  e.value = value;
+  return e;
+}
+
+// Typing over the letter keys, holding modifier every other round
+std::vector<input_event> typing(unsigned int rounds, unsigned int modifier = KEY_RESERVED)
+{
+  static unsigned int const keys[] = {
+    KEY_H, KEY_E, KEY_L, KEY_L, KEY_O, KEY_K, KEY_BACKSPACE, KEY_W, KEY_O,
+    KEY_R, KEY_L, KEY_D, KEY_K, KEY_BACKSPACE, KEY_SPACE, KEY_O
+  };
+
+  std::vector<input_event> events;
+  for(unsigned int round = 0; round < rounds; ++round)
+  {
+    bool const modified = modifier != KEY_RESERVED && round % 2;
+    if(modified)
+    {
+      events.push_back(event(EV_KEY, modifier, 1));
+      events.push_back(event(EV_SYN, SYN_REPORT, 0));
+    }
+    for(unsigned int key : keys)
+    {
+      events.push_back(event(EV_MSC, MSC_SCAN, key));
+      events.push_back(event(EV_KEY, key, 1));
+      events.push_back(event(EV_SYN, SYN_REPORT, 0));
+      events.push_back(event(EV_MSC, MSC_SCAN, key));
+      events.push_back(event(EV_KEY, key, 0));
+      events.push_back(event(EV_SYN, SYN_REPORT, 0));
+    }
+    if(modified)
+    {
+      events.push_back(event(EV_KEY, modifier, 0));
+      events.push_back(event(EV_SYN, SYN_REPORT, 0));
+    }
+  }
+  return events;
+}
+
+// Counts instead of buffering, the count keeps the calls from being elided
+class DiscardHost : public FunKeyMonkeyHost
+{
+public:
+  OutputId output(std::string const&, unsigned int, unsigned int, unsigned int,
+      unsigned int, std::vector<UinputDevice::PossibleEvent> const&,
+      std::vector<UinputDevice::AbsoluteAxisCalibrationData> const&) override
+  {
+    return 0;
+  }
+  void emit(OutputId, unsigned int, unsigned int, int) override
+  {
+    events += 1;
+  }
+  void flush(OutputId) override
+  {
+  }
+  TimerId timer(unsigned long long, void (*)(void*), void*) override
+  {
+    return INVALID_TIMER;
+  }
+  void cancel(TimerId) override
+  {
+  }
+  void* scratch(std::size_t size, std::size_t alignment) override
+  {
+    return arena.allocate(size, alignment);
+  }
+  using FunKeyMonkeyHost::scratch;
+  unsigned long long events = 0;
+  FrameArena arena;
+};
+
+// Mouse buttons, beyond the keyboard keys
+std::vector<input_event> buttons(unsigned int rounds)
+{
+  std::vector<input_event> events;
+  for(unsigned int round = 0; round < rounds * 8; ++round)
+  {
+    unsigned int button = BTN_LEFT + round % 8;
+    events.push_back(event(EV_KEY, button, 1));
+    events.push_back(event(EV_SYN, SYN_REPORT, 0));
+    events.push_back(event(EV_KEY, button, 0));
+    events.push_back(event(EV_SYN, SYN_REPORT, 0));
+  }
+  return events;
+}
+
+// A stick circling once a second, sampled at rate Hz, between min and max
+// on both axes
+std::vector<input_event> stickSweep(unsigned int samples, unsigned int rate,
+    int min, int max)
+{
+  std::vector<input_event> events;
+  double const center = (min + max) / 2.0;
+  double const radius = (max - min) / 2.0;
+  unsigned long long const interval = 1000000000ull / rate;
+  for(unsigned int i = 0; i < samples; ++i)
+  {
+    unsigned long long const t = i * interval;
+    double const angle = 2 * M_PI * (i % rate) / rate;
+    events.push_back(event(EV_ABS, ABS_X, std::lround(center + radius * std::cos(angle)), t));
+    events.push_back(event(EV_ABS, ABS_Y, std::lround(center + radius * std::sin(angle)), t));
+    events.push_back(event(EV_SYN, SYN_REPORT, 0, t));
+  }
+  return events;
+}
+
+// Mouse motion at rate Hz, wandering a little in both directions
+std::vector<input_event> mouseMotion(unsigned int samples, unsigned int rate)
+{
+  std::vector<input_event> events;
+  unsigned long long const interval = 1000000000ull / rate;
+  for(unsigned int i = 0; i < samples; ++i)
+  {
+    unsigned long long const t = i * interval;
+    events.push_back(event(EV_REL, REL_X, static_cast<int>(i % 7) - 3, t));
+    events.push_back(event(EV_REL, REL_Y, static_cast<int>(i % 5) - 2, t));
+    events.push_back(event(EV_SYN, SYN_REPORT, 0, t));
+  }
+  return events;
+}
+
+// The first distinct chords of manyChords() pressed one after another until
+// there were as many as asked for, the keys of each a few milliseconds apart
+std::vector<input_event> chordStorm(unsigned int chords, unsigned int distinct)
+{
+  static unsigned int const letters[] = {
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J,
+    KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T,
+    KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z
+  };
+
+  std::vector<std::array<unsigned int, 3>> triples;
+  for(unsigned int a = 0; a < 26 && triples.size() < distinct; ++a)
+  {
+    for(unsigned int b = a + 1; b < 26 && triples.size() < distinct; ++b)
+    {
+      for(unsigned int c = b + 1; c < 26 && triples.size() < distinct; ++c)
+      {
+        triples.push_back({{letters[a], letters[b], letters[c]}});
+      }
+    }
+  }
+
+  unsigned long long const MS = 1000000;
+  unsigned long long t = 0;
+  std::vector<input_event> events;
+  for(unsigned int n = 0; n < chords; ++n)
+  {
+    for(int value : {1, 0})
+    {
+      for(unsigned int key : triples[n % triples.size()])
+      {
+        t += 3 * MS;
+        events.push_back(event(EV_KEY, key, value, t));
+        events.push_back(event(EV_SYN, SYN_REPORT, 0, t));
+      }
+    }
+  }
+  return events;
+}
+
+// SNES pad buttons as the Cave Story mapping expects them
+std::vector<input_event> snesButtons(unsigned int rounds)
+{
+  std::vector<input_event> events;
+  for(unsigned int round = 0; round < rounds * 6; ++round)
+  {
+    unsigned int button = BTN_TRIGGER + round % 6;
+    events.push_back(event(EV_KEY, button, 1));
+    events.push_back(event(EV_SYN, SYN_REPORT, 0));
+    events.push_back(event(EV_KEY, button, 0));
+    events.push_back(event(EV_SYN, SYN_REPORT, 0));
+  }
+  return events;
+}
+
+// Writes to /dev/null the way a uinput device is written to, one write per
+// flush, so the host's system calls are counted without creating devices
+class StubUinputSink : public OutputSink
+{
+public:
+  StubUinputSink() : _fd(open("/dev/null", O_WRONLY | O_CLOEXEC)) {}
+  ~StubUinputSink() { close(_fd); }
+  bool write(input_event const* events, unsigned int count) override
+  {
+    return ::write(_fd, events, sizeof(*events) * count) >= 0;
+  }
+  bool ready() const override
+  {
+    return _fd >= 0;
+  }
+
+private:
+  int _fd;
+};
+
+// Read and write system calls of the process so far, -1 without I/O
+// accounting in the kernel
+long long ioSyscalls()
+{
+  std::ifstream io("/proc/self/io");
+  std::string key;
+  unsigned long long value;
+  long long total = -1;
+  while(io >> key >> value)
+  {
+    if(key == "syscr:" || key == "syscw:")
+      total = (total < 0 ? 0 : total) + value;
+  }
+  return total;
+}
+
+std::string rulesFile(std::string const& name, std::string const& rules)
+{
+  std::string path = "/tmp/fkm-bench-" + name + "-" + std::to_string(getpid()) + ".rules";
+  std::ofstream(path) << rules;
+  return path;
+}
+
+// Best of several runs in ns per input event, and allocations and system
+// calls per event over all but the first
+Result run(Case const& c, unsigned int runs, bool discard)
+{
+  FunKeyMonkeyModule module(std::string(FKM_PLUGIN_DIR) + "/" + c.plugin);
+  if(!module.ready())
+    return {-1, -1, -1};
+
+  DiscardHost discardHost;
+  HostOutputs outputs;
+  outputs.sinks(HostOutputs::MEMORY_SINK);
+  if(discard)
+    module.host(&discardHost);
+  else
+    module.host(&outputs);
+
+  std::vector<char const*> argv;
+  for(std::string const& arg : c.args)
+  {
+    argv.push_back(arg.data());
+  }
+
+  // Plugins chatting on stdout pay for it as they would running detached
+  std::cout.flush();
+  int const stdoutFd = dup(STDOUT_FILENO);
+  int const devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  dup2(devNull, STDOUT_FILENO);
+  module.init(argv.data(), argv.size());
+
+  for(FunKeyMonkeyHost::OutputId id = 0; outputs.sink(id); ++id)
+  {
+    outputs.sink(id, std::unique_ptr<OutputSink>(new StubUinputSink));
+  }
+
+  double best = 0;
+  unsigned long long allocations = 0;
+  long long syscalls = 0;
+  for(unsigned int i = 0; i < runs; ++i)
+  {
+    if(i == 1)
+    {
+      // Reading the system calls allocates, it goes first
+      syscalls = ioSyscalls();
+      allocations = AllocationCounter::count();
+    }
+
+    unsigned long long start = ModuleProfiler::now();
+    for(input_event const& e : c.events)
+    {
+      module.handle(e, 0);
+      if(e.type == EV_SYN && discard)
+      {
+        discardHost.arena.reset();
+      }
+      else if(e.type == EV_SYN)
+      {
+        outputs.flushAll();
+      }
+    }
+    double ns = static_cast<double>(ModuleProfiler::now() - start) / c.events.size();
+    if(i == 0 || ns < best)
+      best = ns;
+  }
+  double const events = static_cast<double>(runs - 1) * c.events.size();
+  Result result = {best,
+    AllocationCounter::available() ? (AllocationCounter::count() - allocations) / events : -1,
+    syscalls >= 0 ? (ioSyscalls() - syscalls) / events : -1};
+
+  module.destroy();
+  std::cout.flush();
+  dup2(stdoutFd, STDOUT_FILENO);
+  close(stdoutFd);
+  close(devNull);
+  return result;
+}
+
+// Typing at about 80 words per minute with keys overlapping now and then.
+// Caps lock is tapped every now and then and held for ctrl-c every once in
+// a while.
+std::vector<input_event> timedTyping(unsigned int strokes)
+{
+  static unsigned int const keys[] = {
+    KEY_T, KEY_H, KEY_E, KEY_SPACE, KEY_F, KEY_O, KEY_X, KEY_SPACE, KEY_J,
+    KEY_U, KEY_M, KEY_P, KEY_S, KEY_SPACE, KEY_O, KEY_F, KEY_F, KEY_SPACE,
+    KEY_A, KEY_SPACE, KEY_J, KEY_E, KEY_T, KEY_SPACE
+  };
+
+  struct Stroke
+  {
+    unsigned int code;
+    unsigned long long down;
+    unsigned long long up;
+  };
+  std::vector<Stroke> plan;
+
+  unsigned int random = 12345;
+  auto uniform = [&random](unsigned int min, unsigned int max) {
+    random = random * 1103515245 + 12345;
+    return min + (random >> 8) % (max - min + 1);
+  };
+
+  unsigned long long const MS = 1000000;
+  unsigned long long t = 1000 * MS;
+  for(unsigned int i = 0; i < strokes; ++i)
+  {
+    if(i % 97 == 96)
+    {
+      plan.push_back({KEY_CAPSLOCK, t, t + 400 * MS});
+      plan.push_back({KEY_C, t + 250 * MS, t + 330 * MS});
+      t += 600 * MS;
+    }
+    else if(i % 41 == 40)
+    {
+      plan.push_back({KEY_CAPSLOCK, t, t + uniform(50, 120) * MS});
+      t += 300 * MS;
+    }
+
+    unsigned int code = keys[i % (sizeof(keys) / sizeof(*keys))];
+    plan.push_back({code, t, t + uniform(60, 140) * MS});
+    t += uniform(80, 220) * MS;
+  }
+
+  std::vector<std::pair<unsigned long long, input_event>> timed;
+  for(Stroke const& stroke : plan)
+  {
+    timed.push_back({stroke.down, event(EV_KEY, stroke.code, 1, stroke.down)});
+    timed.push_back({stroke.up, event(EV_KEY, stroke.code, 0, stroke.up)});
+  }
+  std::stable_sort(timed.begin(), timed.end(),
+      [](std::pair<unsigned long long, input_event> const& a,
+        std::pair<unsigned long long, input_event> const& b) {
+      return a.first < b.first;
+  });
+
+  std::vector<input_event> events;
+  for(auto const& e : timed)
+  {
+    events.push_back(e.second);
+    events.push_back(event(EV_SYN, SYN_REPORT, 0, e.first));
+  }
+  return events;
+}
+
+// Chords of three letters each, as many as asked for
+std::string manyChords(unsigned int count)
+{
+  static unsigned int const letters[] = {
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J,
+    KEY_K, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T,
+    KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z
+  };
+
+  std::string config;
+  unsigned int n = 0;
+  for(unsigned int a = 0; a < 26 && n < count; ++a)
+  {
+    for(unsigned int b = a + 1; b < 26 && n < count; ++b)
+    {
+      for(unsigned int c = b + 1; c < 26 && n < count; ++c, ++n)
+      {
+        config += std::string("base.") + eventCodeName(EV_KEY, letters[a])
+          + "+" + eventCodeName(EV_KEY, letters[b])
+          + "+" + eventCodeName(EV_KEY, letters[c])
+          + " = " + eventCodeName(EV_KEY, KEY_F13 + n % 12) + "\n";
+      }
+    }
+  }
+  return config;
+}
+
+// Abbreviations of a semicolon and four letters, plus "hello" which the
+// typing workload triggers every round
+std::string manyExpansions(unsigned int count)
+{
+  std::string expansions = "hello Hi!\n";
+  unsigned int random = 54321;
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    expansions += ";";
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+      random = random * 1103515245 + 12345;
+      expansions += static_cast<char>('a' + (random >> 8) % 26);
+    }
+    expansions += " expansion number " + std::to_string(i) + "\n";
+  }
+  return expansions;
+}
+
+// Replays events through the keyboard plugin on a virtual clock and prints
+// how long plain key presses took to come out. Presses that never came out
+// as themselves, eg. because a tap-hold key was taken as held, are counted
+// as misfires.
+bool replay(std::string const& name, std::string const& config,
+    std::vector<input_event> const& events)
+{
+  FunKeyMonkeyModule module(std::string(FKM_PLUGIN_DIR) + "/libkeyboard.so");
+  if(!module.ready())
+    return false;
+
+  HostOutputs outputs;
+  outputs.sinks(HostOutputs::MEMORY_SINK);
+  module.host(&outputs);
+
+  std::string path = rulesFile(name, config);
+  std::string arg = "config=" + path;
+  char const* argv[] = { arg.data() };
+  module.init(argv, 1);
+  unlink(path.data());
+
+  // Plain keys come out in the order they went in, so an output press
+  // belongs to the oldest pending press of that key and any pending presses
+  // before it are never coming out
+  MemorySink* sink = static_cast<MemorySink*>(outputs.sink(0));
+  std::deque<std::pair<unsigned int, unsigned long long>> presses;
+  std::vector<unsigned long long> latencies;
+  unsigned int misfired = 0;
+  auto collect = [&](unsigned long long now) {
+    outputs.flushAll();
+    for(input_event const& e : sink->events)
+    {
+      if(e.type != EV_KEY || e.value != 1)
+        continue;
+
+      auto press = std::find_if(presses.begin(), presses.end(),
+          [&e](std::pair<unsigned int, unsigned long long> const& p) {
+          return p.first == e.code;
+      });
+      if(press == presses.end())
+        continue;
+
+      latencies.push_back(now - press->second);
+      misfired += press - presses.begin();
+      presses.erase(presses.begin(), press + 1);
+    }
+    sink->events.clear();
+  };
+
+  unsigned int plain = 0;
+  HostTimers& timers = outputs.timers();
+  for(input_event const& e : events)
+  {
+    unsigned long long t = HostOutputs::timestamp(e);
+    while(timers.pending() && timers.next() <= t)
+    {
+      unsigned long long next = timers.next();
+      timers.fire(next);
+      collect(next);
+    }
+
+    if(e.type == EV_KEY && e.value == 1 && e.code != KEY_CAPSLOCK)
+    {
+      presses.push_back({e.code, t});
+      plain += 1;
+    }
+    module.handle(e, 0);
+    collect(t);
+  }
+  module.destroy();
+  misfired += presses.size();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    if(latencies.empty())
+      return 0.0;
+    unsigned int rank = std::ceil(p * latencies.size());
+    return latencies[rank ? rank - 1 : 0] / 1e6;
+  };
+  unsigned int delayed = std::count_if(latencies.begin(), latencies.end(),
+      [](unsigned long long ns) { return ns > 0; });
+
+  std::cout << std::left << std::setw(24) << name
+    << std::right << std::setw(10) << plain
+    << std::setw(10) << delayed
+    << std::setw(10) << misfired
+    << std::fixed << std::setprecision(1)
+    << std::setw(10) << percentile(0.5)
+    << std::setw(10) << percentile(0.99)
+    << std::setw(10) << percentile(1.0) << std::endl;
+  return true;
+}
+
+// Presses keys through the keyboard plugin, reloads its config while they
+// are down and releases them. Whatever the presses produced has to be
+// released again, a key left down on the output is stuck for the desktop.
+bool reloadHeld(std::string const& name, std::string const& config,
+    std::vector<unsigned int> const& keys)
+{
+  FunKeyMonkeyModule module(std::string(FKM_PLUGIN_DIR) + "/libkeyboard.so");
+  if(!module.ready())
+    return false;
+
+  HostOutputs outputs;
+  outputs.sinks(HostOutputs::MEMORY_SINK);
+  module.host(&outputs);
+
+  std::string path = rulesFile(name, config);
+  std::string arg = "config=" + path;
+  char const* argv[] = { arg.data() };
+  module.init(argv, 1);
+
+  std::vector<bool> down(KEY_CNT, false);
+  MemorySink* sink = static_cast<MemorySink*>(outputs.sink(0));
+  auto collect = [&]() {
+    outputs.flushAll();
+    for(input_event const& e : sink->events)
+    {
+      if(e.type == EV_KEY)
+        down[e.code] = e.value != 0;
+    }
+    sink->events.clear();
+  };
+
+  unsigned long long t = 0;
+  for(int value : {1, 0})
+  {
+    for(unsigned int code : keys)
+    {
+      t += 10000000;
+      module.handle(event(EV_KEY, code, value, t), 0);
+      module.handle(event(EV_SYN, SYN_REPORT, 0, t), 0);
+      collect();
+    }
+    if(value)
+    {
+      module.user1();
+      collect();
+    }
+  }
+  module.destroy();
+  collect();
+  unlink(path.data());
+
+  unsigned int stuck = std::count(down.begin(), down.end(), true);
+  std::cout << std::left << std::setw(24) << name
+    << std::right << std::setw(10) << keys.size()
+    << std::setw(10) << stuck << std::endl;
+  return stuck == 0;
+}
+
+// Collects the pointer reports the modal gamepad flushes from its mouse
+// thread, with the time each arrived
+class PointerHost : public FunKeyMonkeyHost
+{
+public:
+  OutputId output(std::string const&, unsigned int, unsigned int, unsigned int,
+      unsigned int, std::vector<UinputDevice::PossibleEvent> const&,
+      std::vector<UinputDevice::AbsoluteAxisCalibrationData> const&) override
+  {
+    return outputs++;
+  }
+  void emit(OutputId, unsigned int type, unsigned int code, int value) override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(type == EV_REL && code == REL_X)
+      pending += value;
+  }
+  void flush(OutputId) override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    reports.push_back({ModuleProfiler::now(), pending});
+    pending = 0;
+  }
+  TimerId timer(unsigned long long, void (*)(void*), void*) override
+  {
+    return INVALID_TIMER;
+  }
+  void cancel(TimerId) override
+  {
+  }
+  // Never released, the modal gamepad asks for none
+  void* scratch(std::size_t size, std::size_t alignment) override
+  {
+    return arena.allocate(size, alignment);
+  }
+  using FunKeyMonkeyHost::scratch;
+
+  OutputId outputs = 0;
+  FrameArena arena;
+  std::mutex mutex;
+  int pending = 0;
+  std::vector<std::pair<unsigned long long, int>> reports;
+};
+
+// Voluntary context switches of all threads but the main one, ie. how often
+// plugin threads went to sleep
+unsigned long long threadWakeups()
+{
+  unsigned long long total = 0;
+  DIR* tasks = opendir("/proc/self/task");
+  if(!tasks)
+    return 0;
+
+  while(dirent* task = readdir(tasks))
+  {
+    if(task->d_name[0] == '.' || std::atoi(task->d_name) == getpid())
+      continue;
+
+    std::ifstream status(std::string("/proc/self/task/") + task->d_name + "/status");
+    std::string line;
+    while(std::getline(status, line))
+    {
+      if(line.compare(0, 24, "voluntary_ctxt_switches:") == 0)
+        total += std::strtoull(line.data() + 24, nullptr, 10);
+    }
+  }
+  closedir(tasks);
+  return total;
+}
+
+// Holds the left stick of the modal gamepad at value for a while and prints
+// the mouse thread's wakeups and reports per second, the pointer speed and
+// the spread of report intervals and per report movement
+bool pointer(std::string const& name, unsigned int rate, int value)
+{
+  FunKeyMonkeyModule module(std::string(FKM_PLUGIN_DIR) + "/libmodalgamepad.so");
+  if(!module.ready())
+    return false;
+
+  PointerHost host;
+  module.host(&host);
+
+  std::string path = rulesFile("pointer", "nubs.left.x = mouse_x\n"
+      "mouse.rate = " + std::to_string(rate) + "\n");
+  std::string arg = "config=" + path;
+  char const* argv[] = { arg.data() };
+  module.init(argv, 1);
+  unlink(path.data());
+
+  double const seconds = 0.5;
+  unsigned long long wakeups = threadWakeups();
+  unsigned long long start = ModuleProfiler::now();
+  module.handle(event(EV_ABS, ABS_X, value), 0);
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  wakeups = threadWakeups() - wakeups;
+  module.handle(event(EV_ABS, ABS_X, 0), 0);
+  module.destroy();
+
+  std::vector<std::pair<unsigned long long, int>> reports;
+  {
+    std::lock_guard<std::mutex> lock(host.mutex);
+    reports.swap(host.reports);
+  }
+
+  long long counts = 0;
+  std::vector<double> intervals;
+  std::vector<double> steps;
+  unsigned long long last = start;
+  for(auto const& report : reports)
+  {
+    counts += report.second;
+    intervals.push_back((report.first - last) / 1e6);
+    steps.push_back(report.second);
+    last = report.first;
+  }
+  auto deviation = [](std::vector<double> const& values) {
+    if(values.size() < 2)
+      return 0.0;
+    double mean = 0;
+    for(double v : values)
+      mean += v;
+    mean /= values.size();
+    double squares = 0;
+    for(double v : values)
+      squares += (v - mean) * (v - mean);
+    return std::sqrt(squares / (values.size() - 1));
+  };
+  // The first interval includes the thread waking up from idle
+  if(!intervals.empty())
+    intervals.erase(intervals.begin());
+
+  std::cout << std::left << std::setw(24) << name
+    << std::right << std::fixed << std::setprecision(0)
+    << std::setw(10) << wakeups / seconds
+    << std::setw(10) << reports.size() / seconds
+    << std::setw(10) << counts / seconds
+    << std::setprecision(2)
+    << std::setw(12) << deviation(intervals)
+    << std::setw(10) << deviation(steps) << std::endl;
+  return true;
+}
+
+// Maps stick positions through a response table and by evaluating the curve
+// directly, and prints the ns per position of both and their largest
+// difference
+void response(std::string const& name, std::string const& curve, std::string const& shape)
+{
+  int const deadzone = 3000;
+  int const range = 32767;
+  StickResponse r;
+  r.curve(curve);
+  r.shape(shape);
+  r.antiDeadzone = 0.05f;
+  r.build(deadzone, range);
+
+  auto direct = [&r, deadzone, range](int x, int y, float& outX, float& outY) {
+    auto speed = [&r](float deflection) {
+      return r.antiDeadzone + (1 - r.antiDeadzone) * r.evaluate(std::min(deflection, 1.0f));
+    };
+    outX = 0;
+    outY = 0;
+    if(r.shapeType == StickResponse::AXIAL)
+    {
+      if(std::abs(x) > deadzone)
+        outX = std::copysign(speed((std::abs(x) - deadzone) / float(range - deadzone)), x);
+      if(std::abs(y) > deadzone)
+        outY = std::copysign(speed((std::abs(y) - deadzone) / float(range - deadzone)), y);
+    }
+    else if(r.active(x, y))
+    {
+      float magnitude = std::sqrt(float(x) * x + float(y) * y);
+      float v = speed(r.shapeType == StickResponse::RADIAL ? magnitude / range
+          : (magnitude - deadzone) / (range - deadzone));
+      outX = x / magnitude * v;
+      outY = y / magnitude * v;
+    }
+  };
+
+  // The stick circling while pushed further out and back, as a thumb would
+  // rather than jumping around at random
+  std::vector<std::pair<int, int>> positions;
+  for(unsigned int i = 0; i < 1 << 16; ++i)
+  {
+    double angle = i * 0.01;
+    double radius = range * std::abs(std::sin(i * 0.0007));
+    positions.push_back({static_cast<int>(radius * std::cos(angle)),
+        static_cast<int>(radius * std::sin(angle))});
+  }
+
+  double tableNs = 0;
+  double directNs = 0;
+  float sum = 0;
+  for(unsigned int run = 0; run < 5; ++run)
+  {
+    float outX;
+    float outY;
+    unsigned long long start = ModuleProfiler::now();
+    for(auto const& p : positions)
+    {
+      r.apply(p.first, p.second, outX, outY);
+      sum += outX + outY;
+    }
+    double ns = static_cast<double>(ModuleProfiler::now() - start) / positions.size();
+    tableNs = run == 0 ? ns : std::min(tableNs, ns);
+
+    start = ModuleProfiler::now();
+    for(auto const& p : positions)
+    {
+      direct(p.first, p.second, outX, outY);
+      sum += outX + outY;
+    }
+    ns = static_cast<double>(ModuleProfiler::now() - start) / positions.size();
+    directNs = run == 0 ? ns : std::min(directNs, ns);
+  }
+
+  float error = 0;
+  for(auto const& p : positions)
+  {
+    float tableX, tableY, directX, directY;
+    r.apply(p.first, p.second, tableX, tableY);
+    direct(p.first, p.second, directX, directY);
+    error = std::max(error, std::max(std::abs(tableX - directX), std::abs(tableY - directY)));
+  }
+
+  std::cout << std::left << std::setw(24) << name
+    << std::right << std::fixed << std::setprecision(1)
+    << std::setw(10) << tableNs
+    << std::setw(10) << directNs
+    << std::scientific << std::setprecision(1)
+    << std::setw(12) << error
+    // Keeps the loops from being optimized away
+    << (sum == 12345 ? " " : "") << std::fixed << std::endl;
+}
+
+// Modal gamepad settings repeated until the file has about the given number
+// of lines
+std::string gamepadConfig(unsigned int lines)
+{
+  std::string const settings =
+    "[nubs]\n"
+    "left.x = mouse_x\n"
+    "left.y = mouse_y\n"
+    "left.click = mouse_right\n"
+    "right.x = scroll_x\n"
+    "right.y = scroll_y\n"
+    "right.click = mouse_left\n"
+    "[mouse]\n"
+    "sensitivity = 20\n"
+    "deadzone = 200\n"
+    "wheel.deadzone = 700\n"
+    "rate = 250\n"
+    "curve = power 2\n"
+    "deadzone.shape = scaled_radial\n"
+    "antideadzone = 0.02\n"
+    "wheel.curve = points 0.5:0.2 1:1\n"
+    "wheel.antideadzone = 0.1\n"
+    "wheel.speed = 40\n"
+    "[]\n";
+  std::string config;
+  for(unsigned int i = 0; i < lines; i += 19)
+  {
+    config += settings;
+  }
+  return config;
+}
+
+// Prints the us per reload of the modal gamepad with and without the config
+// cache, and the old regex line splitting alone for comparison
+bool reload(std::string const& name, std::string const& config)
+{
+  std::string path = rulesFile("reload", config);
+  std::string cache = path + ".cache";
+  unsigned int const reloads = 200;
+
+  auto regexSplit = [&path]() {
+    std::regex re("^([\\w.]+)\\s*=\\s*(.*)$");
+    std::regex emptyRe("^\\s*$");
+    std::ifstream file(path);
+    std::string line;
+    unsigned int matched = 0;
+    while(std::getline(file, line))
+    {
+      std::smatch match;
+      if(!line.empty() && line[0] != '#' && !std::regex_match(line, emptyRe)
+          && std::regex_match(line, match, re))
+        matched += 1;
+    }
+    return matched;
+  };
+
+  auto reloadUs = [&](std::vector<std::string> const& args) {
+    FunKeyMonkeyModule module(std::string(FKM_PLUGIN_DIR) + "/libmodalgamepad.so");
+    if(!module.ready())
+      return -1.0;
+    HostOutputs outputs;
+    outputs.sinks(HostOutputs::MEMORY_SINK);
+    module.host(&outputs);
+    std::vector<char const*> argv;
+    for(std::string const& arg : args)
+    {
+      argv.push_back(arg.data());
+    }
+    module.init(argv.data(), argv.size());
+
+    unsigned long long start = ModuleProfiler::now();
+    for(unsigned int i = 0; i < reloads; ++i)
+    {
+      module.user1();
+    }
+    double us = (ModuleProfiler::now() - start) / 1000.0 / reloads;
+    module.destroy();
+    return us;
+  };
+
+  unsigned long long start = ModuleProfiler::now();
+  unsigned int matched = 0;
+  for(unsigned int i = 0; i < reloads / 10; ++i)
+  {
+    matched += regexSplit();
+  }
+  double regexUs = (ModuleProfiler::now() - start) / 1000.0 / (reloads / 10);
+  double textUs = reloadUs({ "config=" + path });
+  double cacheUs = reloadUs({ "config=" + path, "cache=" + cache });
+  unlink(path.data());
+  unlink(cache.data());
+
+  std::cout << std::left << std::setw(24) << name
+    << std::right << std::fixed << std::setprecision(1)
+    << std::setw(10) << regexUs
+    << std::setw(10) << textUs
+    << std::setw(10) << cacheUs
+    << (matched == 0 ? " " : "") << std::endl;
+  return textUs >= 0 && cacheUs >= 0;
+}
+
+// Plain JSON string, the names here never need escaping beyond quotes
+std::string quoted(std::string const& text)
+{
+  std::string result = "\"";
+  for(char ch : text)
+  {
+    if(ch == '"' || ch == '\\')
+      result += '\\';
+    result += ch;
+  }
+  return result + "\"";
+}
+
+int main(int argc, char** argv)
+{
+  bool json = false;
+  bool check = false;
+  unsigned int rounds = 2000;
+  for(int i = 1; i < argc; ++i)
+  {
+    std::string const arg(argv[i]);
+    char* end = nullptr;
+    long const value = std::strtol(arg.data(), &end, 10);
+    if(arg == "--json")
+      json = true;
+    else if(arg == "--check")
+      check = true;
+    else if(arg == "-h" || arg == "--help")
+    {
+      std::cout << "Usage: " << argv[0] << " [--json] [--check] [ROUNDS]" << std::endl;
+      return EXIT_SUCCESS;
+    }
+    else if(!arg.empty() && *end == '\0' && value > 0)
+      rounds = value;
+    else
+    {
+      std::cerr << "ERROR: Expected a positive number of rounds, --json or --check, got '"
+        << arg << "'" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  unsigned int const runs = 5;
+
+  // Samples as many as typing() has events
+  unsigned int const samples = rounds * 32;
+  std::string const gamepad = rulesFile("gamepad",
+      "nubs.left.x = mouse_x\nnubs.left.y = mouse_y\n");
+  std::string const chords = rulesFile("chords", manyChords(300));
+  std::vector<Case> cases = {
+    { "testmodule", "libtestmodule.so", "typing", {}, typing(rounds) },
+    { "testmodule: mouse", "libtestmodule.so", "mouse 8 kHz", {}, mouseMotion(samples, 8000) },
+    { "toymodule", "libtoymodule.so", "typing", {}, typing(rounds) },
+    { "keyboard", "libkeyboard.so", "typing", {}, typing(rounds) },
+    { "keyboard: buttons", "libkeyboard.so", "buttons", {}, buttons(rounds) },
+    { "keyboard: mouse", "libkeyboard.so", "mouse 8 kHz", {}, mouseMotion(samples, 8000) },
+    { "keyboard: 300 chords", "libkeyboard.so", "typing", { "config=" + chords }, typing(rounds) },
+    { "keyboard: chord storm", "libkeyboard.so", "chord storm",
+      { "config=" + chords }, chordStorm(rounds * 16, 300) },
+    { "keyboard: 5000 expands", "libkeyboard.so", "typing",
+      { "expansions=" + rulesFile("expansions", manyExpansions(5000)) }, typing(rounds) },
+    { "cavestorysnes", "libcavestorysnes.so", "buttons", {}, snesButtons(rounds) },
+    { "cavestorysnes: stick", "libcavestorysnes.so", "stick 1 kHz", {},
+      stickSweep(samples, 1000, 0, 255) },
+    { "modalgamepad: stick", "libmodalgamepad.so", "stick 1 kHz", { "config=" + gamepad },
+      stickSweep(samples, 1000, -32767, 32767) },
+    { "rules: keyboard", "librules.so", "typing",
+      { "rules=" + rulesFile("keyboard", "map KEY_K KEY_L\n") }, typing(rounds) },
+    { "rules: mouse", "librules.so", "mouse 8 kHz",
+      { "rules=" + rulesFile("mouse", "map BTN_LEFT BTN_RIGHT\n") }, mouseMotion(samples, 8000) },
+    { "ctrlbackdel", "libctrlbackdel.so", "typing", {}, typing(rounds, KEY_LEFTCTRL) },
+    { "rules: ctrlbackdel", "librules.so", "typing",
+      { "rules=" + rulesFile("ctrlbackdel", "map KEY_BACKSPACE KEY_DELETE if KEY_LEFTCTRL\n") },
+      typing(rounds, KEY_LEFTCTRL) },
+    { "rules: layers", "librules.so", "typing",
+      { "rules=" + rulesFile("layers",
+          "map KEY_CAPSLOCK KEY_ESC\n"
+          "hold KEY_LEFTSHIFT nav\n"
+          "sequence KEY_W KEY_O KEY_R KEY_L KEY_D = KEY_ENTER\n"
+          "layer nav\n"
+          "map KEY_H KEY_LEFT\n"
+          "map KEY_L KEY_RIGHT\n"
+          "map KEY_K KEY_UP if KEY_RIGHTALT\n") },
+      typing(rounds, KEY_LEFTSHIFT) },
+  };
+
+  if(!json)
+  {
+    std::cout << std::left << std::setw(24) << "plugin"
+      << std::right << std::setw(12) << "events"
+      << std::setw(14) << "plugin ns/ev"
+      << std::setw(14) << "host ns/ev"
+      << std::setw(12) << "allocs/ev"
+      << std::setw(12) << "syscalls/ev" << std::endl;
+  }
+  else
+  {
+    std::cout << "{\n  \"rounds\": " << rounds << ",\n  \"cases\": [";
+  }
+
+  bool ok = true;
+  std::vector<std::string> allocating;
+  for(unsigned int i = 0; i < cases.size(); ++i)
+  {
+    Case const& c = cases[i];
+    Result const plugin = run(c, runs, true);
+    Result const host = run(c, runs, false);
+    ok = ok && plugin.ns >= 0 && host.ns >= 0;
+    if(host.allocations != 0)
+      allocating.push_back(c.name);
+
+    // Unavailable numbers are a dash in the table and null in JSON
+    auto number = [json](double value, unsigned int width, unsigned int precision) {
+      std::ostringstream text;
+      if(!json)
+        text << std::setw(width);
+      if(value < 0)
+        text << (json ? "null" : "-");
+      else
+        text << std::fixed << std::setprecision(precision) << value;
+      return text.str();
+    };
+
+    if(json)
+    {
+      std::cout << (i ? "," : "") << "\n    {\"name\": " << quoted(c.name)
+        << ", \"plugin\": " << quoted(c.plugin)
+        << ", \"workload\": " << quoted(c.workload)
+        << ", \"events\": " << c.events.size()
+        << ", \"plugin_ns_per_event\": " << number(plugin.ns, 0, 1)
+        << ", \"host_ns_per_event\": " << number(host.ns, 0, 1)
+        << ", \"allocations_per_event\": " << number(host.allocations, 0, 4)
+        << ", \"syscalls_per_event\": " << number(host.syscalls, 0, 4) << "}";
+    }
+    else
+    {
+      std::cout << std::left << std::setw(24) << c.name
+        << std::right << std::setw(12) << c.events.size()
+        << number(plugin.ns, 14, 1) << number(host.ns, 14, 1)
+        << number(host.allocations, 12, 3) << number(host.syscalls, 12, 3) << std::endl;
+    }
+
+    for(std::string const& arg : c.args)
+    {
+      if(arg.compare(0, 6, "rules=") == 0)
+        unlink(arg.substr(6).data());
+      else if(arg.compare(0, 11, "expansions=") == 0)
+        unlink(arg.substr(11).data());
+    }
+  }
+  unlink(gamepad.data());
+  unlink(chords.data());
+
+  if(json)
+  {
+    std::cout << "\n  ]\n}" << std::endl;
+  }
+
+  if(check)
+  {
+    if(!AllocationCounter::available())
+    {
+      std::cerr << "ERROR: Allocations are not counted in this build" << std::endl;
+      return EXIT_FAILURE;
+    }
+    for(std::string const& name : allocating)
+    {
+      std::cerr << "ERROR: " << name << " allocates while handling events" << std::endl;
+    }
+    ok = ok && allocating.empty();
+  }
+
+  if(json || check)
+  {
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  std::vector<input_event> typed = timedTyping(rounds);
+  std::string const homeRow =
+    "base.KEY_CAPSLOCK = taphold KEY_ESC KEY_LEFTCTRL\n"
+    "base.KEY_F = taphold KEY_F KEY_LEFTCTRL";
+  std::cout << std::endl << std::left << std::setw(24) << "typing replay"
+    << std::right << std::setw(10) << "presses"
+    << std::setw(10) << "delayed"
+    << std::setw(10) << "misfired"
+    << std::setw(10) << "p50 ms"
+    << std::setw(10) << "p99 ms"
+    << std::setw(10) << "max ms" << std::endl;
+  ok = replay("plain", "base.KEY_CAPSLOCK = KEY_ESC\n", typed) && ok;
+  ok = replay("tap-hold caps lock", "base.KEY_CAPSLOCK = taphold KEY_ESC KEY_LEFTCTRL\n", typed) && ok;
+  ok = replay("tap-hold home row", homeRow + "\n", typed) && ok;
+  ok = replay("  permissive", homeRow + " 200 permissive\n", typed) && ok;
+  ok = replay("  interrupt", homeRow + " 200 interrupt\n", typed) && ok;
+  ok = replay("chord j+k", "base.KEY_J+KEY_K = KEY_ESC\n", typed) && ok;
+  ok = replay("300 chords", manyChords(300), typed) && ok;
+
+  std::cout << std::endl << std::left << std::setw(24) << "reload while held"
+    << std::right << std::setw(10) << "keys"
+    << std::setw(10) << "stuck" << std::endl;
+  std::string const layered =
+    "base.KEY_CAPSLOCK = momentary fn\n"
+    "fn.KEY_H = KEY_LEFT\n";
+  ok = reloadHeld("layer", layered, {KEY_CAPSLOCK, KEY_H}) && ok;
+  ok = reloadHeld("tap-hold", homeRow + "\n", {KEY_F}) && ok;
+  ok = reloadHeld("tap-hold and key", homeRow + "\n", {KEY_F, KEY_J}) && ok;
+  ok = reloadHeld("chord", "base.KEY_J+KEY_K = KEY_ESC\n", {KEY_J, KEY_K}) && ok;
+  ok = reloadHeld("pending chord", "base.KEY_J+KEY_K = KEY_ESC\n", {KEY_J}) && ok;
+
+  std::cout << std::endl << std::left << std::setw(24) << "stick to pointer"
+    << std::right << std::setw(10) << "wakeup/s"
+    << std::setw(10) << "report/s"
+    << std::setw(10) << "counts/s"
+    << std::setw(12) << "interval sd"
+    << std::setw(10) << "step sd" << std::endl;
+  ok = pointer("in deadzone", 125, 80) && ok;
+  ok = pointer("slow, 60 Hz", 60, 150) && ok;
+  ok = pointer("slow, 1000 Hz", 1000, 150) && ok;
+  ok = pointer("fast, 60 Hz", 60, 20000) && ok;
+  ok = pointer("fast, 125 Hz", 125, 20000) && ok;
+  ok = pointer("fast, 1000 Hz", 1000, 20000) && ok;
+
+  std::cout << std::endl << std::left << std::setw(24) << "stick response"
+    << std::right << std::setw(10) << "table ns"
+    << std::setw(10) << "direct ns"
+    << std::setw(12) << "max error" << std::endl;
+  response("linear, axial", "linear", "axial");
+  response("power 2.5, axial", "power 2.5", "axial");
+  response("power 2.5, radial", "power 2.5", "radial");
+  response("classic 1, scaled radial", "classic 1", "scaled_radial");
+  response("points, scaled radial", "points 0.2:0.02 0.5:0.15 0.8:0.5 1:1", "scaled_radial");
+
+  std::cout << std::endl << std::left << std::setw(24) << "config reload"
+    << std::right << std::setw(10) << "regex us"
+    << std::setw(10) << "text us"
+    << std::setw(10) << "cache us" << std::endl;
+  ok = reload("20 lines", gamepadConfig(20)) && ok;
+  ok = reload("2000 lines", gamepadConfig(2000)) && ok;
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,98 @@
+#include "sharedring.h"
+#include "pluginsandbox.h"
+#include "moduleprofiler.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Measures the latency the plugin sandbox transport adds: messages are
+// bounced off a forked echo process over two rings and half of the round
+// trip is reported.
+
+struct Ping
+{
+  unsigned long long sent;
+  input_event event;
+};
+typedef SharedRing<Ping, 1024> Ring;
+
+void echo(Ring* in, Ring* out)
+{
+  Ping ping;
+  while(true)
+  {
+    in->wait(PluginSandbox::RUNNER_SPINS);
+    while(in->pop(ping))
+    {
+      if(!ping.sent)
+        _exit(EXIT_SUCCESS);
+      while(!out->push(ping));
+    }
+  }
+}
+
+void run(Ring* to, Ring* from, char const* name, unsigned int count, unsigned int gapUs)
+{
+  ModuleProfiler::Histogram histogram = {0, 0, 0, {}};
+  Ping ping = {0, {}};
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    if(gapUs)
+      usleep(gapUs);
+
+    ping.sent = ModuleProfiler::now();
+    while(!to->push(ping));
+    while(!from->pop(ping))
+      from->wait(PluginSandbox::RUNNER_SPINS);
+    histogram.add((ModuleProfiler::now() - ping.sent) / 2);
+  }
+
+  std::cout << std::left << std::setw(24) << name
+    << std::right << std::setw(10) << histogram.count
+    << std::setw(12) << histogram.total / histogram.count
+    << std::setw(12) << histogram.percentile(0.5)
+    << std::setw(12) << histogram.percentile(0.99)
+    << std::setw(12) << histogram.max << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned int count = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+  Ring* to = Ring::create();
+  Ring* from = Ring::create();
+  if(!to || !from)
+  {
+    std::cerr << "ERROR: Could not create rings" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  pid_t pid = fork();
+  if(pid == 0)
+  {
+    echo(to, from);
+  }
+
+  std::cout << std::left << std::setw(24) << "one-way latency"
+    << std::right << std::setw(10) << "count"
+    << std::setw(12) << "mean ns"
+    << std::setw(12) << "p50 ns"
+    << std::setw(12) << "p99 ns"
+    << std::setw(12) << "max ns" << std::endl;
+
+  // Back to back messages find the runner spinning, spaced out ones have
+  // to wake it up through the eventfd like typical input does
+  run(to, from, "back-to-back", count, 0);
+  run(to, from, "spaced 5 ms (sleeping)", count / 100 ? count / 100 : 1, 5000);
+
+  Ping stop = {0, {}};
+  while(!to->push(stop));
+  waitpid(pid, nullptr, 0);
+
+  Ring::destroy(to);
+  Ring::destroy(from);
+  return EXIT_SUCCESS;
+}
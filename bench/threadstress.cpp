@@ -0,0 +1,144 @@
+#include "funkeymonkeymoduleloader.h"
+#include "hostoutputs.h"
+#include "moduleprofiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+
+// Hammers the modal gamepad, whose mouse thread runs alongside the dispatch
+// thread, with stick movement in and out of the deadzones, clicks and
+// config reloads through the real host outputs. Meant to be run in a build
+// configured with -DFKM_SANITIZE=thread, which reports any data race. It
+// also fails if the mouse thread ever misses the stick leaving the
+// deadzone.
+
+#ifndef FKM_PLUGIN_DIR
+#define FKM_PLUGIN_DIR "."
+#endif
+
+input_event event(unsigned int type, unsigned int code, int value)
+{
+  input_event e = {};
+  e.type = type;
+  e.code = code;
+  e.value = value;
+  return e;
+}
+
+std::string writeConfig(std::string const& path, unsigned int variant)
+{
+  std::ofstream(path)
+    << "nubs.left.x = mouse_x\n"
+    << "nubs.left.y = mouse_y\n"
+    << "nubs.right.x = scroll_x\n"
+    << "nubs.right.y = scroll_y\n"
+    << "nubs.left.click = mouse_right\n"
+    << "nubs.right.click = mouse_left\n"
+    << "mouse.rate = " << (variant % 2 ? 1000 : 500) << "\n"
+    << "mouse.deadzone = " << 100 + variant % 3 * 50 << "\n"
+    << "mouse.sensitivity = " << 10 + variant % 5 << "\n";
+  return path;
+}
+
+// Mouse events written so far, taken from the host report
+unsigned long long mouseEvents(HostOutputs const& outputs)
+{
+  std::ostringstream report;
+  outputs.report(report);
+  std::istringstream lines(report.str());
+  std::string line;
+  while(std::getline(lines, line))
+  {
+    if(line.compare(0, 19, "Modal Gamepad Mouse") == 0)
+      return std::strtoull(line.data() + 24, nullptr, 10);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  double seconds = argc > 1 ? std::atof(argv[1]) : 5;
+
+  FunKeyMonkeyModule module(std::string(FKM_PLUGIN_DIR) + "/libmodalgamepad.so");
+  if(!module.ready())
+    return EXIT_FAILURE;
+
+  HostOutputs outputs;
+  if(!outputs.sinks(HostOutputs::FILE_SINK, "/dev/null"))
+    return EXIT_FAILURE;
+  module.host(&outputs);
+
+  std::string path = writeConfig("/tmp/fkm-stress-" + std::to_string(getpid()) + ".conf", 0);
+  std::string arg = "config=" + path;
+  char const* args[] = { arg.data() };
+  module.init(args, 1);
+
+  unsigned int random = 4242;
+  auto next = [&random](int range) {
+    random = random * 1103515245 + 12345;
+    return static_cast<int>((random >> 8) % (2 * range + 1)) - range;
+  };
+
+  static unsigned int const axes[] = { ABS_X, ABS_Y, ABS_RX, ABS_RY };
+  static unsigned int const buttons[] = { BTN_THUMBL, BTN_THUMBR };
+
+  unsigned long long const end = ModuleProfiler::now()
+    + static_cast<unsigned long long>(seconds * 1e9);
+  unsigned long long events = 0;
+  unsigned int reloads = 0;
+  unsigned int wakeups = 0;
+  unsigned int missed = 0;
+  for(unsigned int round = 0; ModuleProfiler::now() < end; ++round)
+  {
+    // A burst of stick movement and clicks, mostly around the deadzones
+    for(unsigned int i = 0; i < 64; ++i)
+    {
+      module.handle(event(EV_ABS, axes[i % 4], next(round % 4 ? 300 : 30000)), 0);
+      if(i % 16 == 0)
+        module.handle(event(EV_KEY, buttons[i / 16 % 2], i / 32 % 2), 0);
+      module.handle(event(EV_SYN, SYN_REPORT, 0), 0);
+      outputs.flushAll();
+      events += 2;
+    }
+
+    if(round % 50 == 0)
+    {
+      writeConfig(path, ++reloads);
+      module.user1();
+    }
+
+    if(round % 20 == 0)
+    {
+      // Back to rest so the mouse thread goes to sleep, then out of the
+      // deadzone again, which must wake it up
+      for(unsigned int axis : axes)
+      {
+        module.handle(event(EV_ABS, axis, 0), 0);
+      }
+      module.handle(event(EV_SYN, SYN_REPORT, 0), 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+      unsigned long long before = mouseEvents(outputs);
+      module.handle(event(EV_ABS, ABS_X, 30000), 0);
+      module.handle(event(EV_SYN, SYN_REPORT, 0), 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      wakeups += 1;
+      if(mouseEvents(outputs) == before)
+        missed += 1;
+    }
+  }
+
+  module.destroy();
+  unlink(path.data());
+
+  std::cout << events << " events, " << reloads << " reloads, "
+    << missed << " of " << wakeups << " wakeups missed" << std::endl;
+  outputs.report(std::cout);
+  return missed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
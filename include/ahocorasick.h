@@ -0,0 +1,142 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <vector>
+#include <deque>
+
+// Matches many patterns over small integer symbols at once. Patterns are
+// added first, build() then turns them into a complete transition table so
+// every step is one lookup however many patterns there are. Only symbols
+// that occur in some pattern get a column, all others lead to the root.
+class AhoCorasick
+{
+public:
+  static constexpr unsigned int ROOT = 0;
+  static constexpr int NO_MATCH = -1;
+
+  AhoCorasick();
+  void add(std::vector<unsigned int> const& pattern, int id);
+  void build();
+
+  unsigned int step(unsigned int state, unsigned int symbol) const;
+  // Id of the longest pattern ending in state, or NO_MATCH
+  int match(unsigned int state) const;
+  unsigned int states() const;
+
+private:
+  std::vector<std::pair<std::vector<unsigned int>, int>> _patterns;
+  // Column of each symbol, -1 for symbols in no pattern
+  std::vector<int> _columns;
+  unsigned int _numColumns;
+  std::vector<unsigned int> _table;
+  std::vector<int> _matches;
+};
+
+constexpr unsigned int AhoCorasick::ROOT;
+constexpr int AhoCorasick::NO_MATCH;
+
+AhoCorasick::AhoCorasick() :
+  _patterns(), _columns(), _numColumns(0), _table(), _matches()
+{
+}
+
+void AhoCorasick::add(std::vector<unsigned int> const& pattern, int id)
+{
+  if(!pattern.empty())
+  {
+    _patterns.push_back({pattern, id});
+  }
+}
+
+void AhoCorasick::build()
+{
+  _columns.clear();
+  _numColumns = 0;
+  for(auto const& pattern : _patterns)
+  {
+    for(unsigned int symbol : pattern.first)
+    {
+      if(symbol >= _columns.size())
+        _columns.resize(symbol + 1, -1);
+      if(_columns[symbol] < 0)
+        _columns[symbol] = _numColumns++;
+    }
+  }
+
+  // Trie first, with missing edges marked as the root which can never be
+  // a child
+  _table.assign(_numColumns, ROOT);
+  _matches.assign(1, NO_MATCH);
+  for(auto const& pattern : _patterns)
+  {
+    unsigned int state = ROOT;
+    for(unsigned int symbol : pattern.first)
+    {
+      unsigned int& next = _table[state * _numColumns + _columns[symbol]];
+      if(next == ROOT)
+      {
+        next = _matches.size();
+        _table.resize(_table.size() + _numColumns, ROOT);
+        _matches.push_back(NO_MATCH);
+      }
+      state = _table[state * _numColumns + _columns[symbol]];
+    }
+    _matches[state] = pattern.second;
+  }
+
+  // Breadth first, fill in missing edges from the longest proper suffix
+  // state, which is complete by then
+  std::vector<unsigned int> fail(_matches.size(), ROOT);
+  std::deque<unsigned int> queue;
+  for(unsigned int c = 0; c < _numColumns; ++c)
+  {
+    if(_table[c] != ROOT)
+      queue.push_back(_table[c]);
+  }
+
+  while(!queue.empty())
+  {
+    unsigned int state = queue.front();
+    queue.pop_front();
+
+    // A pattern ending here is longer than any ending in the suffix
+    if(_matches[state] == NO_MATCH)
+      _matches[state] = _matches[fail[state]];
+
+    for(unsigned int c = 0; c < _numColumns; ++c)
+    {
+      unsigned int& next = _table[state * _numColumns + c];
+      unsigned int suffixNext = _table[fail[state] * _numColumns + c];
+      if(next == ROOT)
+      {
+        next = suffixNext;
+      }
+      else
+      {
+        fail[next] = suffixNext;
+        queue.push_back(next);
+      }
+    }
+  }
+
+  _patterns.clear();
+}
+
+unsigned int AhoCorasick::step(unsigned int state, unsigned int symbol) const
+{
+  if(symbol >= _columns.size() || _columns[symbol] < 0)
+    return ROOT;
+  return _table[state * _numColumns + _columns[symbol]];
+}
+
+int AhoCorasick::match(unsigned int state) const
+{
+  return _matches[state];
+}
+
+unsigned int AhoCorasick::states() const
+{
+  return _matches.size();
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cerrno>
+
+// Counts the heap allocations of the whole process, including those made
+// by plugins and by operator new, which ends up in malloc. This defines
+// malloc and its relatives on top of glibc's own, so it is included by
+// exactly one file of an executable, eg. a benchmark, and never by a plugin.
+// Sanitizer builds bring their own malloc, there nothing is counted, and
+// neither where ALLOCATION_COUNTER_DISABLED is defined, eg. by a host that
+// only counts in debug builds.
+class AllocationCounter
+{
+public:
+  static bool available();
+  static unsigned long long count();
+};
+
+#if defined(__SANITIZE_THREAD__) || defined(__SANITIZE_ADDRESS__) \
+  || defined(ALLOCATION_COUNTER_DISABLED)
+
+bool AllocationCounter::available()
+{
+  return false;
+}
+
+unsigned long long AllocationCounter::count()
+{
+  return 0;
+}
+
+#else
+
+namespace
+{
+  std::atomic<unsigned long long> allocations(0);
+
+  void countAllocation()
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+extern "C"
+{
+  void* __libc_malloc(std::size_t size);
+  void* __libc_calloc(std::size_t count, std::size_t size);
+  void* __libc_realloc(void* pointer, std::size_t size);
+  void* __libc_memalign(std::size_t alignment, std::size_t size);
+
+  void* malloc(std::size_t size)
+  {
+    countAllocation();
+    return __libc_malloc(size);
+  }
+
+  void* calloc(std::size_t count, std::size_t size)
+  {
+    countAllocation();
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* pointer, std::size_t size)
+  {
+    countAllocation();
+    return __libc_realloc(pointer, size);
+  }
+
+  void* aligned_alloc(std::size_t alignment, std::size_t size)
+  {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+  }
+
+  int posix_memalign(void** pointer, std::size_t alignment, std::size_t size)
+  {
+    countAllocation();
+    void* allocated = __libc_memalign(alignment, size);
+    if(!allocated)
+      return ENOMEM;
+    *pointer = allocated;
+    return 0;
+  }
+}
+
+bool AllocationCounter::available()
+{
+  return true;
+}
+
+unsigned long long AllocationCounter::count()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef ASCII_KEYS_H
+#define ASCII_KEYS_H
+
+#include <linux/input.h>
+
+// Keys that type printable ASCII characters, tabs and newlines on a US
+// keyboard layout
+struct AsciiKey
+{
+  unsigned short code;
+  bool shift;
+};
+
+// False for characters the layout cannot type
+bool asciiKey(char c, AsciiKey& key);
+
+bool asciiKey(char c, AsciiKey& key)
+{
+  static AsciiKey const PRINTABLE[] = {
+    { KEY_SPACE, false }, { KEY_1, true }, { KEY_APOSTROPHE, true },
+    { KEY_3, true }, { KEY_4, true }, { KEY_5, true }, { KEY_7, true },
+    { KEY_APOSTROPHE, false }, { KEY_9, true }, { KEY_0, true },
+    { KEY_8, true }, { KEY_EQUAL, true }, { KEY_COMMA, false },
+    { KEY_MINUS, false }, { KEY_DOT, false }, { KEY_SLASH, false },
+    { KEY_0, false }, { KEY_1, false }, { KEY_2, false }, { KEY_3, false },
+    { KEY_4, false }, { KEY_5, false }, { KEY_6, false }, { KEY_7, false },
+    { KEY_8, false }, { KEY_9, false }, { KEY_SEMICOLON, true },
+    { KEY_SEMICOLON, false }, { KEY_COMMA, true }, { KEY_EQUAL, false },
+    { KEY_DOT, true }, { KEY_SLASH, true }, { KEY_2, true },
+    { KEY_A, true }, { KEY_B, true }, { KEY_C, true }, { KEY_D, true },
+    { KEY_E, true }, { KEY_F, true }, { KEY_G, true }, { KEY_H, true },
+    { KEY_I, true }, { KEY_J, true }, { KEY_K, true }, { KEY_L, true },
+    { KEY_M, true }, { KEY_N, true }, { KEY_O, true }, { KEY_P, true },
+    { KEY_Q, true }, { KEY_R, true }, { KEY_S, true }, { KEY_T, true },
+    { KEY_U, true }, { KEY_V, true }, { KEY_W, true }, { KEY_X, true },
+    { KEY_Y, true }, { KEY_Z, true }, { KEY_LEFTBRACE, false },
+    { KEY_BACKSLASH, false }, { KEY_RIGHTBRACE, false }, { KEY_6, true },
+    { KEY_MINUS, true }, { KEY_GRAVE, false },
+    { KEY_A, false }, { KEY_B, false }, { KEY_C, false }, { KEY_D, false },
+    { KEY_E, false }, { KEY_F, false }, { KEY_G, false }, { KEY_H, false },
+    { KEY_I, false }, { KEY_J, false }, { KEY_K, false }, { KEY_L, false },
+    { KEY_M, false }, { KEY_N, false }, { KEY_O, false }, { KEY_P, false },
+    { KEY_Q, false }, { KEY_R, false }, { KEY_S, false }, { KEY_T, false },
+    { KEY_U, false }, { KEY_V, false }, { KEY_W, false }, { KEY_X, false },
+    { KEY_Y, false }, { KEY_Z, false }, { KEY_LEFTBRACE, true },
+    { KEY_BACKSLASH, true }, { KEY_RIGHTBRACE, true }, { KEY_GRAVE, true }
+  };
+
+  if(c == '\n')
+    key = { KEY_ENTER, false };
+  else if(c == '\t')
+    key = { KEY_TAB, false };
+  else if(c >= ' ' && c <= '~')
+    key = PRINTABLE[c - ' '];
+  else
+    return false;
+  return true;
+}
+
+#endif
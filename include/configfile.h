@@ -0,0 +1,740 @@
+#ifndef CONFIG_FILE_H
+#define CONFIG_FILE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+/*
+Settings files for plugins, one setting per line:
+
+  # comment
+  key = value
+  [section]
+  key = value         the key is section.key, [] goes back to the top
+  include FILE        relative to the including file
+
+Keys are case insensitive. A ConfigSchema declares the keys a plugin
+knows with their types and where they go in its settings struct, and
+reports unknown keys and invalid values with file and line. A schema can
+keep a binary cache of a loaded config, which is used instead as long as
+none of the files changed, so reloading skips reading and validating the
+text. Published hands settings to plugin threads without locks.
+*/
+
+// One key = value line, with sections already applied to the key
+struct ConfigLine
+{
+  std::string key;
+  std::string value;
+  unsigned int file;
+  unsigned int line;
+};
+
+// A file a config was read from, and its state when it was read
+struct ConfigSource
+{
+  std::string path;
+  long long mtime;
+  long long size;
+};
+
+// Splits config files into lines, following includes
+class ConfigReader
+{
+public:
+  static constexpr unsigned int MAX_INCLUDE_DEPTH = 8;
+
+  ConfigReader();
+  // False if a file cannot be read or has syntax errors, which are printed
+  bool read(std::string const& path);
+
+  std::vector<ConfigLine> const& lines() const;
+  std::vector<ConfigSource> const& sources() const;
+  // Location of a line for messages, eg. "foo.conf:12"
+  std::string where(ConfigLine const& line) const;
+
+  static bool stat(std::string const& path, ConfigSource& source);
+
+private:
+  bool readFile(std::string const& path, unsigned int depth);
+
+  std::vector<ConfigLine> _lines;
+  std::vector<ConfigSource> _sources;
+  // Files being read, to catch include cycles
+  std::vector<std::string> _including;
+};
+
+// A value as stored in the binary cache
+struct ConfigValue
+{
+  enum Kind : std::uint8_t { INTEGER, NUMBER, TEXT };
+  Kind kind;
+  long long integer;
+  double number;
+  std::string text;
+};
+
+template<typename T>
+class ConfigSchema
+{
+public:
+  ConfigSchema();
+
+  void integer(std::string const& key, int T::*field, int min, int max);
+  void number(std::string const& key, float T::*field, float min, float max);
+  void flag(std::string const& key, bool T::*field);
+  void text(std::string const& key, std::string T::*field);
+  // One of the given names, case insensitive
+  template<typename E>
+  void choice(std::string const& key, E T::*field,
+      std::vector<std::pair<std::string, E>> const& names);
+  // Anything else, apply returns false for invalid values. Each value has
+  // to replace whatever an earlier one for the key set, the cache only keeps
+  // the last one.
+  void custom(std::string const& key, std::function<bool(std::string const&, T&)> apply);
+
+  // Applies the config in path to settings. With a cache path the cache
+  // is used if it is up to date and rewritten otherwise. False if there
+  // were any errors, settings are then partially applied.
+  bool load(std::string const& path, T& settings, std::string const& cache = "") const;
+  // Applies a single setting, eg. one changed at runtime. False if the key
+  // is unknown or the value invalid.
+  bool set(std::string const& key, std::string const& value, T& settings) const;
+
+private:
+  struct Key
+  {
+    std::string name;
+    ConfigValue::Kind kind;
+    // Text to value, false if invalid
+    std::function<bool(std::string const&, ConfigValue&)> parse;
+    // Value into settings, false if invalid
+    std::function<bool(ConfigValue const&, T&)> set;
+  };
+  typedef std::pair<unsigned int, ConfigValue> Entry;
+
+  static constexpr char const* CACHE_MAGIC = "FKMC";
+  static constexpr std::uint32_t CACHE_VERSION = 2;
+
+  void add(Key const& key);
+  // Reports errors prefixed with where, the index of the key and the parsed
+  // value are left in entry
+  bool apply(std::string const& key, std::string const& value, T& settings,
+      std::string const& where, Entry& entry) const;
+  std::uint64_t fingerprint() const;
+  // A cache is only valid for the config it was written for, read from path
+  bool readCache(std::string const& cache, std::string const& path,
+      std::vector<Entry>& entries) const;
+  void writeCache(std::string const& cache, std::string const& path,
+      std::vector<ConfigSource> const& sources, std::vector<Entry> const& entries) const;
+
+  std::vector<Key> _keys;
+  std::unordered_map<std::string, unsigned int> _index;
+};
+
+// Settings shared with a plugin thread. Published settings are never
+// modified, a reload publishes a new version. The reader thread pins the
+// version it got with acquire() until its next acquire(), every other old
+// version is freed by the next publish().
+template<typename T>
+class Published
+{
+public:
+  Published();
+  Published(Published const&) = delete;
+
+  // On the publishing thread. Null before the first publish().
+  T const* get() const;
+  // On the one other thread reading the settings, valid until it calls
+  // acquire() again
+  T const* acquire() const;
+  // From one thread at a time, normally the dispatch thread
+  void publish(std::unique_ptr<T> settings);
+  // Only once no other thread reads the settings any more
+  void clear();
+
+private:
+  std::atomic<T const*> _current;
+  // The version the reader thread is using
+  mutable std::atomic<T const*> _pinned;
+  std::vector<std::unique_ptr<T>> _versions;
+};
+
+constexpr unsigned int ConfigReader::MAX_INCLUDE_DEPTH;
+
+ConfigReader::ConfigReader() :
+  _lines(), _sources(), _including()
+{
+}
+
+bool ConfigReader::read(std::string const& path)
+{
+  _lines.clear();
+  _sources.clear();
+  _including.clear();
+  return readFile(path, 0);
+}
+
+std::vector<ConfigLine> const& ConfigReader::lines() const
+{
+  return _lines;
+}
+
+std::vector<ConfigSource> const& ConfigReader::sources() const
+{
+  return _sources;
+}
+
+std::string ConfigReader::where(ConfigLine const& line) const
+{
+  return _sources[line.file].path + ":" + std::to_string(line.line);
+}
+
+bool ConfigReader::stat(std::string const& path, ConfigSource& source)
+{
+  struct stat st;
+  if(::stat(path.data(), &st) < 0)
+    return false;
+  source.path = path;
+  source.mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+  source.size = st.st_size;
+  return true;
+}
+
+bool ConfigReader::readFile(std::string const& path, unsigned int depth)
+{
+  std::ifstream file(path);
+  ConfigSource source;
+  if(!file || !stat(path, source))
+  {
+    std::cerr << "ERROR: Could not open config file " << path << std::endl;
+    return false;
+  }
+
+  unsigned int const index = _sources.size();
+  _sources.push_back(source);
+  _including.push_back(path);
+
+  auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+  auto isKey = [](char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+      || (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '-';
+  };
+
+  bool ok = true;
+  std::string section;
+  std::string text;
+  unsigned int number = 0;
+  while(std::getline(file, text))
+  {
+    ++number;
+    auto fail = [&](std::string const& message) {
+      std::cerr << "ERROR: " << path << ":" << number << ": " << message << std::endl;
+      ok = false;
+    };
+
+    char const* c = text.data();
+    char const* end = c + text.size();
+    while(end > c && isSpace(end[-1]))
+      --end;
+    while(c < end && isSpace(*c))
+      ++c;
+    if(c == end || *c == '#' || *c == ';')
+      continue;
+
+    if(*c == '[')
+    {
+      char const* close = std::find(c, end, ']');
+      if(close + 1 != end)
+      {
+        fail("invalid section " + std::string(c, end));
+        continue;
+      }
+      char const* first = c + 1;
+      char const* last = close;
+      while(first < last && isSpace(*first))
+        ++first;
+      while(last > first && isSpace(last[-1]))
+        --last;
+      if(!std::all_of(first, last, isKey))
+      {
+        fail("invalid section " + std::string(c, end));
+        continue;
+      }
+      section.assign(first, last);
+      if(!section.empty())
+        section += '.';
+      continue;
+    }
+
+    char const* keyEnd = c;
+    while(keyEnd < end && isKey(*keyEnd))
+      ++keyEnd;
+    std::string key(c, keyEnd);
+    std::transform(key.begin(), key.end(), key.begin(), tolower);
+
+    char const* rest = keyEnd;
+    while(rest < end && isSpace(*rest))
+      ++rest;
+
+    if(key == "include" && rest > keyEnd && rest < end && *rest != '=')
+    {
+      std::string included(rest, end);
+      if(included[0] != '/')
+      {
+        auto slash = path.rfind('/');
+        if(slash != std::string::npos)
+          included = path.substr(0, slash + 1) + included;
+      }
+
+      if(std::find(_including.begin(), _including.end(), included) != _including.end())
+        fail("include cycle through " + included);
+      else if(depth + 1 >= MAX_INCLUDE_DEPTH)
+        fail("includes nested too deep");
+      else if(!readFile(included, depth + 1))
+        fail("in file included from here");
+      continue;
+    }
+
+    if(key.empty() || rest == end || *rest != '=')
+    {
+      fail("invalid line: " + std::string(c, end));
+      continue;
+    }
+
+    ++rest;
+    while(rest < end && isSpace(*rest))
+      ++rest;
+    _lines.push_back({section + key, std::string(rest, end), index, number});
+  }
+
+  _including.pop_back();
+  return ok;
+}
+
+template<typename T>
+constexpr char const* ConfigSchema<T>::CACHE_MAGIC;
+template<typename T>
+constexpr std::uint32_t ConfigSchema<T>::CACHE_VERSION;
+
+template<typename T>
+ConfigSchema<T>::ConfigSchema() :
+  _keys(), _index()
+{
+}
+
+template<typename T>
+void ConfigSchema<T>::add(Key const& key)
+{
+  std::string name(key.name);
+  std::transform(name.begin(), name.end(), name.begin(), tolower);
+  _index[name] = _keys.size();
+  _keys.push_back(key);
+  _keys.back().name = name;
+}
+
+template<typename T>
+void ConfigSchema<T>::integer(std::string const& key, int T::*field, int min, int max)
+{
+  add({key, ConfigValue::INTEGER,
+    [min, max](std::string const& text, ConfigValue& value) {
+      char* end = nullptr;
+      errno = 0;
+      value.integer = std::strtoll(text.data(), &end, 10);
+      return !text.empty() && *end == '\0' && errno == 0
+        && value.integer >= min && value.integer <= max;
+    },
+    [field](ConfigValue const& value, T& settings) {
+      settings.*field = static_cast<int>(value.integer);
+      return true;
+    }
+  });
+}
+
+template<typename T>
+void ConfigSchema<T>::number(std::string const& key, float T::*field, float min, float max)
+{
+  add({key, ConfigValue::NUMBER,
+    [min, max](std::string const& text, ConfigValue& value) {
+      char* end = nullptr;
+      value.number = std::strtod(text.data(), &end);
+      return !text.empty() && *end == '\0' && std::isfinite(value.number)
+        && value.number >= min && value.number <= max;
+    },
+    [field](ConfigValue const& value, T& settings) {
+      settings.*field = static_cast<float>(value.number);
+      return true;
+    }
+  });
+}
+
+template<typename T>
+void ConfigSchema<T>::flag(std::string const& key, bool T::*field)
+{
+  choice<bool>(key, field, {
+    { "true", true }, { "yes", true }, { "on", true }, { "1", true },
+    { "false", false }, { "no", false }, { "off", false }, { "0", false }
+  });
+}
+
+template<typename T>
+void ConfigSchema<T>::text(std::string const& key, std::string T::*field)
+{
+  add({key, ConfigValue::TEXT,
+    [](std::string const& text, ConfigValue& value) {
+      value.text = text;
+      return true;
+    },
+    [field](ConfigValue const& value, T& settings) {
+      settings.*field = value.text;
+      return true;
+    }
+  });
+}
+
+template<typename T>
+template<typename E>
+void ConfigSchema<T>::choice(std::string const& key, E T::*field,
+    std::vector<std::pair<std::string, E>> const& names)
+{
+  add({key, ConfigValue::INTEGER,
+    [names](std::string const& text, ConfigValue& value) {
+      std::string lower(text);
+      std::transform(lower.begin(), lower.end(), lower.begin(), tolower);
+      for(unsigned int i = 0; i < names.size(); ++i)
+      {
+        if(names[i].first == lower)
+        {
+          value.integer = i;
+          return true;
+        }
+      }
+      return false;
+    },
+    [field, names](ConfigValue const& value, T& settings) {
+      if(value.integer < 0 || value.integer >= static_cast<long long>(names.size()))
+        return false;
+      settings.*field = names[value.integer].second;
+      return true;
+    }
+  });
+}
+
+template<typename T>
+void ConfigSchema<T>::custom(std::string const& key,
+    std::function<bool(std::string const&, T&)> apply)
+{
+  add({key, ConfigValue::TEXT,
+    [](std::string const& text, ConfigValue& value) {
+      value.text = text;
+      return true;
+    },
+    [apply](ConfigValue const& value, T& settings) {
+      return apply(value.text, settings);
+    }
+  });
+}
+
+template<typename T>
+bool ConfigSchema<T>::load(std::string const& path, T& settings, std::string const& cache) const
+{
+  std::vector<Entry> entries;
+  if(!cache.empty() && readCache(cache, path, entries))
+  {
+    bool ok = true;
+    for(Entry const& entry : entries)
+    {
+      ok = _keys[entry.first].set(entry.second, settings) && ok;
+    }
+    return ok;
+  }
+
+  ConfigReader reader;
+  bool ok = reader.read(path);
+  for(ConfigLine const& line : reader.lines())
+  {
+    Entry entry;
+    if(apply(line.key, line.value, settings, reader.where(line) + ": ", entry))
+      entries.push_back(entry);
+    else
+      ok = false;
+  }
+
+  if(ok && !cache.empty())
+  {
+    // Only the last value of each key has any effect
+    std::vector<bool> seen(_keys.size(), false);
+    std::vector<Entry> last;
+    for(auto entry = entries.rbegin(); entry != entries.rend(); ++entry)
+    {
+      if(!seen[entry->first])
+        last.push_back(*entry);
+      seen[entry->first] = true;
+    }
+    std::reverse(last.begin(), last.end());
+    writeCache(cache, path, reader.sources(), last);
+  }
+  return ok;
+}
+
+template<typename T>
+bool ConfigSchema<T>::set(std::string const& key, std::string const& value, T& settings) const
+{
+  std::string lower(key);
+  std::transform(lower.begin(), lower.end(), lower.begin(), tolower);
+  Entry entry;
+  return apply(lower, value, settings, "", entry);
+}
+
+template<typename T>
+bool ConfigSchema<T>::apply(std::string const& key, std::string const& value, T& settings,
+    std::string const& where, Entry& entry) const
+{
+  auto index = _index.find(key);
+  if(index == _index.end())
+  {
+    std::cerr << "ERROR: " << where << "unknown setting " << key << std::endl;
+    return false;
+  }
+
+  Key const& k = _keys[index->second];
+  entry = {index->second, {k.kind, 0, 0, std::string()}};
+  if(!k.parse(value, entry.second) || !k.set(entry.second, settings))
+  {
+    std::cerr << "ERROR: " << where << "invalid value " << value << " for " << key << std::endl;
+    return false;
+  }
+  return true;
+}
+
+template<typename T>
+std::uint64_t ConfigSchema<T>::fingerprint() const
+{
+  // FNV-1a over the keys and their kinds, a cache written for a different
+  // set of keys is never used
+  std::uint64_t hash = 14695981039346656037ull;
+  for(Key const& key : _keys)
+  {
+    for(char c : key.name)
+    {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    hash = (hash ^ key.kind) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// The cache is a header followed by the sources and the entries:
+//
+//   "FKMC" version fingerprint sources entries (path length, path)
+//   (path length, path, mtime, size) * sources
+//   (key, kind, integer | number | (length, text)) * entries
+//
+// in native byte order, like the macro store it is only meant for the
+// machine that wrote it. The path after the header is the config file
+// loaded, so a cache shared by mistake between configs is not used for
+// the wrong one.
+template<typename T>
+bool ConfigSchema<T>::readCache(std::string const& cache, std::string const& path,
+    std::vector<Entry>& entries) const
+{
+  int fd = open(cache.data(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return false;
+  std::string data;
+  struct stat st;
+  if(fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    data.resize(st.st_size);
+    if(::read(fd, &data[0], data.size()) != static_cast<ssize_t>(data.size()))
+      data.clear();
+  }
+  close(fd);
+
+  std::size_t offset = 0;
+  auto get = [&data, &offset](void* out, std::size_t size) {
+    if(data.size() - offset < size)
+      return false;
+    std::memcpy(out, data.data() + offset, size);
+    offset += size;
+    return true;
+  };
+  auto getText = [&](std::string& out) {
+    std::uint32_t length = 0;
+    if(!get(&length, sizeof(length)) || data.size() - offset < length)
+      return false;
+    out.assign(data, offset, length);
+    offset += length;
+    return true;
+  };
+
+  char magic[4];
+  std::uint32_t version = 0;
+  std::uint64_t schema = 0;
+  std::uint32_t sources = 0;
+  std::uint32_t count = 0;
+  std::string mainPath;
+  if(!get(magic, 4) || std::memcmp(magic, CACHE_MAGIC, 4) != 0
+      || !get(&version, sizeof(version)) || version != CACHE_VERSION
+      || !get(&schema, sizeof(schema)) || schema != fingerprint()
+      || !get(&sources, sizeof(sources)) || !get(&count, sizeof(count))
+      || !getText(mainPath) || mainPath != path)
+    return false;
+
+  for(std::uint32_t i = 0; i < sources; ++i)
+  {
+    ConfigSource cached;
+    ConfigSource current;
+    if(!getText(cached.path) || !get(&cached.mtime, sizeof(cached.mtime))
+        || !get(&cached.size, sizeof(cached.size))
+        || !ConfigReader::stat(cached.path, current)
+        || current.mtime != cached.mtime || current.size != cached.size)
+      return false;
+  }
+
+  entries.clear();
+  for(std::uint32_t i = 0; i < count; ++i)
+  {
+    std::uint32_t key = 0;
+    ConfigValue value = {ConfigValue::INTEGER, 0, 0, std::string()};
+    if(!get(&key, sizeof(key)) || key >= _keys.size()
+        || !get(&value.kind, sizeof(value.kind)) || value.kind != _keys[key].kind)
+      return false;
+
+    bool valid = value.kind == ConfigValue::INTEGER ? get(&value.integer, sizeof(value.integer))
+      : value.kind == ConfigValue::NUMBER ? get(&value.number, sizeof(value.number))
+      : getText(value.text);
+    if(!valid)
+      return false;
+    entries.push_back({key, value});
+  }
+  return offset == data.size();
+}
+
+template<typename T>
+void ConfigSchema<T>::writeCache(std::string const& cache, std::string const& path,
+    std::vector<ConfigSource> const& sources, std::vector<Entry> const& entries) const
+{
+  std::string data;
+  auto put = [&data](void const* in, std::size_t size) {
+    data.append(static_cast<char const*>(in), size);
+  };
+  auto putText = [&put](std::string const& text) {
+    std::uint32_t length = text.size();
+    put(&length, sizeof(length));
+    put(text.data(), text.size());
+  };
+
+  std::uint32_t const version = CACHE_VERSION;
+  std::uint64_t const schema = fingerprint();
+  std::uint32_t const numSources = sources.size();
+  std::uint32_t const count = entries.size();
+  put(CACHE_MAGIC, 4);
+  put(&version, sizeof(version));
+  put(&schema, sizeof(schema));
+  put(&numSources, sizeof(numSources));
+  put(&count, sizeof(count));
+  putText(path);
+
+  for(ConfigSource const& source : sources)
+  {
+    putText(source.path);
+    put(&source.mtime, sizeof(source.mtime));
+    put(&source.size, sizeof(source.size));
+  }
+
+  for(Entry const& entry : entries)
+  {
+    std::uint32_t const key = entry.first;
+    put(&key, sizeof(key));
+    put(&entry.second.kind, sizeof(entry.second.kind));
+    if(entry.second.kind == ConfigValue::INTEGER)
+      put(&entry.second.integer, sizeof(entry.second.integer));
+    else if(entry.second.kind == ConfigValue::NUMBER)
+      put(&entry.second.number, sizeof(entry.second.number));
+    else
+      putText(entry.second.text);
+  }
+
+  // Replace the cache in one go, a half written one would only be ignored
+  // but a concurrent reader should see the old or the new one
+  std::string tmp = cache + ".tmp";
+  std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+  file.write(data.data(), data.size());
+  file.close();
+  if(!file || std::rename(tmp.data(), cache.data()) != 0)
+  {
+    std::cerr << "ERROR: Could not write config cache " << cache << std::endl;
+    unlink(tmp.data());
+  }
+}
+
+template<typename T>
+Published<T>::Published() :
+  _current(nullptr), _pinned(nullptr), _versions()
+{
+}
+
+template<typename T>
+T const* Published<T>::get() const
+{
+  return _current.load(std::memory_order_acquire);
+}
+
+template<typename T>
+T const* Published<T>::acquire() const
+{
+  // Pinned only counts once it is seen still current afterwards, otherwise
+  // publish() may have looked at the pin before it was set. Both sides are
+  // sequentially consistent so one of them sees the other's store.
+  T const* current = _current.load();
+  while(true)
+  {
+    _pinned.store(current);
+    T const* check = _current.load();
+    if(check == current)
+      return current;
+    current = check;
+  }
+}
+
+template<typename T>
+void Published<T>::publish(std::unique_ptr<T> settings)
+{
+  _current.store(settings.get());
+  _versions.push_back(std::move(settings));
+
+  // The reader moves on to the new version at its next acquire(), until
+  // then only the one it pinned is kept
+  T const* pinned = _pinned.load();
+  _versions.erase(std::remove_if(_versions.begin(), _versions.end() - 1,
+        [pinned](std::unique_ptr<T> const& version) { return version.get() != pinned; }),
+      _versions.end() - 1);
+}
+
+template<typename T>
+void Published<T>::clear()
+{
+  _current.store(nullptr);
+  _pinned.store(nullptr);
+  _versions.clear();
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Runtime commands over a unix stream socket. A client connects, writes one
+// command line and reads the reply until the host closes the connection.
+// Nothing here blocks: the host waits on fds() along with its input devices
+// and calls service() when one of them is readable, so an idle or slow
+// client costs the event path nothing.
+class ControlSocket
+{
+public:
+  typedef std::function<void(std::string const& command, std::ostream& reply)> Handler;
+
+  // Longest command accepted, longer ones are answered with an error
+  static constexpr unsigned int MAX_COMMAND = 4096;
+  // Connections waiting for the rest of their command, further ones wait
+  // in the listen backlog
+  static constexpr unsigned int MAX_CLIENTS = 8;
+
+  explicit ControlSocket(std::string const& path);
+  ControlSocket(ControlSocket const&) = delete;
+  ~ControlSocket();
+
+  bool ready() const;
+  std::string const& path() const;
+  // The listening socket and connections with a partial command
+  std::vector<int> fds() const;
+  // Accepts connections and answers complete commands
+  void service(Handler const& handler);
+
+private:
+  struct Client
+  {
+    int fd;
+    std::string command;
+  };
+
+  // Removes a socket left behind by an earlier run. False if something
+  // else is at the path, or another instance is still listening there.
+  static bool removeStale(sockaddr_un const& address);
+  void accept();
+  // False once the client is done with, either answered or gone
+  bool receive(Client& client, Handler const& handler);
+  static void send(int fd, std::string const& reply);
+
+  std::string _path;
+  int _fd;
+  std::vector<Client> _clients;
+};
+
+constexpr unsigned int ControlSocket::MAX_COMMAND;
+constexpr unsigned int ControlSocket::MAX_CLIENTS;
+
+ControlSocket::ControlSocket(std::string const& path) :
+  _path(path), _fd(-1), _clients()
+{
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(address.sun_path))
+  {
+    std::cerr << "ERROR: Control socket path too long: " << path << std::endl;
+    return;
+  }
+  std::strcpy(address.sun_path, path.data());
+
+  if(!removeStale(address))
+    return;
+
+  _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(_fd < 0 || bind(_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+      || listen(_fd, MAX_CLIENTS) < 0)
+  {
+    std::cerr << "ERROR: Could not create control socket " << path
+      << ", error code " << errno << std::endl;
+    if(_fd >= 0)
+      close(_fd);
+    _fd = -1;
+  }
+}
+
+bool ControlSocket::removeStale(sockaddr_un const& address)
+{
+  struct stat info;
+  if(lstat(address.sun_path, &info) < 0)
+    return errno == ENOENT;
+  if(!S_ISSOCK(info.st_mode))
+  {
+    std::cerr << "ERROR: " << address.sun_path << " exists and is not a socket" << std::endl;
+    return false;
+  }
+
+  // Only a socket nobody listens on any more is stale
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  bool const refused = probe >= 0
+    && connect(probe, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) < 0
+    && errno == ECONNREFUSED;
+  if(probe >= 0)
+    close(probe);
+  if(!refused)
+  {
+    std::cerr << "ERROR: Control socket " << address.sun_path
+      << " is in use, is FunKeyMonkey running already?" << std::endl;
+    return false;
+  }
+  return unlink(address.sun_path) == 0 || errno == ENOENT;
+}
+
+ControlSocket::~ControlSocket()
+{
+  for(Client const& client : _clients)
+  {
+    close(client.fd);
+  }
+  if(_fd >= 0)
+  {
+    close(_fd);
+    unlink(_path.data());
+  }
+}
+
+bool ControlSocket::ready() const
+{
+  return _fd >= 0;
+}
+
+std::string const& ControlSocket::path() const
+{
+  return _path;
+}
+
+std::vector<int> ControlSocket::fds() const
+{
+  std::vector<int> fds;
+  if(_clients.size() < MAX_CLIENTS)
+    fds.push_back(_fd);
+  for(Client const& client : _clients)
+  {
+    fds.push_back(client.fd);
+  }
+  return fds;
+}
+
+void ControlSocket::service(Handler const& handler)
+{
+  accept();
+  _clients.erase(std::remove_if(_clients.begin(), _clients.end(),
+        [this, &handler](Client& client) {
+          if(receive(client, handler))
+            return false;
+          close(client.fd);
+          return true;
+        }), _clients.end());
+}
+
+void ControlSocket::accept()
+{
+  while(_clients.size() < MAX_CLIENTS)
+  {
+    int fd = accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0)
+      return;
+    _clients.push_back({fd, std::string()});
+  }
+}
+
+bool ControlSocket::receive(Client& client, Handler const& handler)
+{
+  char buffer[512];
+  while(true)
+  {
+    ssize_t received = recv(client.fd, buffer, sizeof(buffer), 0);
+    if(received < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    // A command ends at a newline or when the client stops writing
+    char* end = std::find(buffer, buffer + received, '\n');
+    client.command.append(buffer, end - buffer);
+    if(client.command.size() > MAX_COMMAND)
+    {
+      send(client.fd, "ERROR: Command too long\n");
+      return false;
+    }
+    if(end < buffer + received || received == 0)
+      break;
+  }
+
+  if(!client.command.empty() && client.command.back() == '\r')
+    client.command.pop_back();
+
+  std::ostringstream reply;
+  handler(client.command, reply);
+  send(client.fd, reply.str());
+  return false;
+}
+
+void ControlSocket::send(int fd, std::string const& reply)
+{
+  // Replies fit in the socket buffer, a client that does not read them
+  // loses the rest rather than stalling the host
+  std::size_t sent = 0;
+  while(sent < reply.size())
+  {
+    ssize_t written = ::send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+    if(written <= 0)
+      return;
+    sent += written;
+  }
+}
+
+#endif
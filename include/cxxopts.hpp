@@ -398,6 +398,13 @@ namespace cxxopts
       }
     }
 
+    inline
+    void
+    parse_value(const std::string& text, std::string& value)
+    {
+      value = text;
+    }
+
     template <typename T>
     void
     parse_value(const std::string& text, std::vector<T>& value)
@@ -416,13 +423,6 @@ namespace cxxopts
       value = true;
     }
 
-    inline
-    void
-    parse_value(const std::string& text, std::string& value)
-    {
-      value = text;
-    }
-
     template <typename T>
     struct value_has_arg
     {
@@ -1,16 +1,30 @@
 #ifndef EVDEV_DEVICE_H
 #define EVDEV_DEVICE_H
 
+#include "metrics.h"
+#include "recording.h"
+#include "inputsource.h"
+
 #include <linux/input.h>
 #include <string>
 #include <array>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <regex>
+#include <cstring>
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
 
 namespace
 {
@@ -42,7 +56,16 @@ public:
     std::string path;
   };
 
-  enum PollStatus { POLL_OK, POLL_TIMEOUT, POLL_ERROR };
+  // How devices are opened and waited on. EVDEV_BACKEND and EPOLL_BACKEND
+  // read /dev/input devices, waiting with select() and epoll respectively.
+  // PIPE_BACKEND and RING_BACKEND take generator:typing|mouse|stick[:FRAMES]
+  // or a recording as the path of a device, see InputGenerator, and feed it
+  // through a socket pair or an in-process ring.
+  enum Backend { EVDEV_BACKEND, EPOLL_BACKEND, PIPE_BACKEND, RING_BACKEND };
+
+  // POLL_WATCHED: one of the watched descriptors is readable
+  // POLL_END: a device's input ended and it was removed
+  enum PollStatus { POLL_OK, POLL_TIMEOUT, POLL_INTERRUPTED, POLL_ERROR, POLL_WATCHED, POLL_END };
   struct PollResult
   {
     PollStatus status;
@@ -50,29 +73,99 @@ public:
     unsigned int role;
   };
 
+  struct DeviceState
+  {
+    std::string path;
+    unsigned int role;
+    bool grabbed;
+  };
+
   static std::vector<Information> availableDevices();
 
-  explicit EvdevDevice(std::vector<Input> const& inputs);
-  explicit EvdevDevice(std::initializer_list<Input> const& inputs);
+  explicit EvdevDevice(std::vector<Input> const& inputs, Backend backend = EVDEV_BACKEND);
+  explicit EvdevDevice(std::initializer_list<Input> const& inputs, Backend backend = EVDEV_BACKEND);
   EvdevDevice(EvdevDevice const&) = delete;
   ~EvdevDevice();
   bool addDevice(Input const& path);
+  bool removeDevice(std::string const& path);
+  std::vector<DeviceState> devices() const;
   PollResult poll(bool blocking = true);
+  // Wait at most timeoutNs for an event
+  PollResult pollFor(unsigned long long timeoutNs);
+  // Whether poll() has events left from the last read
+  bool pending() const;
   bool ready() const;
   bool grab(bool value);
+  bool grab(std::string const& path, bool value);
+  // Release the grabbed devices from another thread, eg. a watchdog's while
+  // the dispatching thread is stuck, and grab just those again on the
+  // dispatching thread with restore(). False if none were released.
+  bool release();
+  void restore();
+  // Other descriptors to wait on along with the devices, eg. a control
+  // socket. poll() reports them before reading any device.
+  void watch(std::vector<int> const& fds);
+  // Count events, frames, SYN_DROPPEDs and grabs per device into metrics
+  void metrics(Metrics* metrics);
+  // Record the devices and every event read from them
+  void record(InputRecorder* recorder);
 
 private:
+  // Blocks indefinitely without a timeout
+  PollResult poll(timeval* timeout);
+  // Wait for a device to read from, setting ready to its index
+  PollStatus waitSelect(timeval* timeout, unsigned int& ready);
+  PollStatus waitEpoll(timeval* timeout, unsigned int& ready);
+  // Let every device sleep before waiting. False, with ready set, if one has
+  // something to read already.
+  bool sleep(unsigned int& ready);
+  // Whether a watched descriptor is readable, checked without waiting once
+  // every WATCH_INTERVAL reads that needed no waiting
+  bool watchedReady();
+  bool rebuildEpoll();
+
   struct Device
   {
-    int fd;
+    std::unique_ptr<InputSource> source;
     unsigned int role;
+    std::string path;
+    bool grabbed;
+    // Released by release(), grabbed again by restore()
+    bool released;
+    Metrics::Counter events;
+    Metrics::Counter frames;
+    Metrics::Counter dropped;
+    Metrics::Gauge grabState;
+    // Id in the recording
+    unsigned int recorded;
   };
+  void declareMetrics(Device& device);
+  void setGrabbed(Device& device, bool grabbed);
+  void recordDevice(Device& device);
+
+  // Epoll data of the watched descriptors, devices have their index
+  static unsigned int const WATCHED_INDEX = 0xffffffff;
+  static unsigned int const WATCH_INTERVAL = 64;
+
+  Backend _backend;
   std::vector<Device> _devices;
+  // Held while _devices changes and by whatever grabs from another thread
+  mutable std::mutex _devicesMutex;
+  std::vector<int> _watched;
   std::array<input_event, 64> _events;
   int _numEvents;
   int _currentEvent;
   unsigned int _currentRole;
   int _previousDevice;
+  Metrics* _metrics;
+  Metrics::Gauge _queued;
+  InputRecorder* _recorder;
+  int _epoll;
+  // Devices or watched descriptors changed since _epoll was set up
+  bool _stale;
+  std::vector<epoll_event> _epollEvents;
+  std::vector<bool> _signalled;
+  unsigned int _unwatched;
 };
 
 std::vector<EvdevDevice::Information> EvdevDevice::availableDevices()
@@ -133,16 +226,22 @@ std::vector<EvdevDevice::Information> EvdevDevice::availableDevices()
   return std::move(devices);
 }
 
-EvdevDevice::EvdevDevice(std::initializer_list<Input> const& inputs) :
-  _devices(), _events(), _numEvents(0), _currentEvent(0), _currentRole(0), _previousDevice(0)
+unsigned int const EvdevDevice::WATCHED_INDEX;
+
+EvdevDevice::EvdevDevice(std::initializer_list<Input> const& inputs, Backend backend) :
+  _backend(backend), _devices(), _devicesMutex(), _watched(), _events(), _numEvents(0), _currentEvent(0),
+  _currentRole(0), _previousDevice(0), _metrics(nullptr), _queued(), _recorder(nullptr),
+  _epoll(-1), _stale(true), _epollEvents(), _signalled(), _unwatched(0)
 {
   for(Input const& input : inputs)
   {
     addDevice(input);
   }
 }
-EvdevDevice::EvdevDevice(std::vector<Input> const& inputs) :
-  _devices(), _events(), _numEvents(0), _currentEvent(0), _currentRole(0), _previousDevice(0)
+EvdevDevice::EvdevDevice(std::vector<Input> const& inputs, Backend backend) :
+  _backend(backend), _devices(), _devicesMutex(), _watched(), _events(), _numEvents(0), _currentEvent(0),
+  _currentRole(0), _previousDevice(0), _metrics(nullptr), _queued(), _recorder(nullptr),
+  _epoll(-1), _stale(true), _epollEvents(), _signalled(), _unwatched(0)
 {
   for(Input const& input : inputs)
   {
@@ -150,107 +249,420 @@ EvdevDevice::EvdevDevice(std::vector<Input> const& inputs) :
   }
 }
 EvdevDevice::~EvdevDevice()
-{ 
+{
+  if(_epoll >= 0)
+    close(_epoll);
+}
+bool EvdevDevice::addDevice(Input const& input)
+{
+  std::unique_ptr<InputSource> source;
+  switch(_backend)
+  {
+    case EVDEV_BACKEND:
+    case EPOLL_BACKEND:
+      if(access(input.path.data(), F_OK ) == -1)
+      {
+        std::cerr << "ERROR: Cannot access '" << input.path << "'. Does it exist?" << std::endl;
+        return false;
+      }
+      source.reset(new EvdevSource(input.path));
+      break;
+    case PIPE_BACKEND:
+      source.reset(new PipeSource(input.path));
+      break;
+    case RING_BACKEND:
+      source.reset(new RingSource(input.path));
+      break;
+  }
+
+  if(!source->ready())
+  {
+    std::cerr << "ERROR: Cannot open '" << input.path << "'." << std::endl;
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(_devicesMutex);
+    _devices.push_back({std::move(source), input.role, input.path, false, false, {}, {}, {}, {}, 0});
+  }
+  _stale = true;
+  declareMetrics(_devices.back());
+  recordDevice(_devices.back());
+  std::cout << "Successfully added device '" << input.path << "'." << std::endl;
+  return true;
+}
+bool EvdevDevice::removeDevice(std::string const& path)
+{
+  std::lock_guard<std::mutex> lk(_devicesMutex);
+  auto device = std::find_if(_devices.begin(), _devices.end(),
+      [&path](Device const& d) { return d.path == path; });
+  if(device == _devices.end())
+    return false;
+
+  _devices.erase(device);
+  _previousDevice = 0;
+  _stale = true;
+  return true;
+}
+
+std::vector<EvdevDevice::DeviceState> EvdevDevice::devices() const
+{
+  std::lock_guard<std::mutex> lk(_devicesMutex);
+  std::vector<DeviceState> states;
   for(Device const& device : _devices)
   {
-    close(device.fd);
+    states.push_back({device.path, device.role, device.grabbed});
   }
+  return states;
 }
-bool EvdevDevice::addDevice(Input const& input)
+
+void EvdevDevice::watch(std::vector<int> const& fds)
 {
-  if(access(input.path.data(), F_OK ) != -1)
+  // Called after every control request, mostly with the same descriptors
+  if(fds != _watched)
   {
-    int fd = open(input.path.data(), O_RDONLY | O_NDELAY);
-    if(!fd)
-    {
-      std::cerr << "ERROR: Cannot open '" << input.path << "'." << std::endl;
-      return false;
-    }
+    _watched = fds;
+    _stale = true;
+  }
+}
 
-    _devices.push_back({fd, input.role});
-    std::cout << "Successfully added device '" << input.path << "'." << std::endl;
+void EvdevDevice::metrics(Metrics* metrics)
+{
+  _metrics = metrics;
+  _queued = metrics ? metrics->gauge("funkeymonkey_input_queued_events",
+      "Events read from a device and not yet dispatched") : Metrics::Gauge();
+  for(Device& device : _devices)
+  {
+    declareMetrics(device);
   }
+}
 
-  else
+void EvdevDevice::declareMetrics(Device& device)
+{
+  if(!_metrics)
+    return;
+
+  // A device added again continues its old series
+  std::string const labels = Metrics::label("device", device.path) + ","
+    + Metrics::label("role", device.role);
+  device.events = _metrics->counter("funkeymonkey_input_events_total",
+      "Events read from input devices", labels);
+  device.frames = _metrics->counter("funkeymonkey_input_frames_total",
+      "Input frames read, ie. SYN_REPORTs", labels);
+  device.dropped = _metrics->counter("funkeymonkey_input_syn_dropped_total",
+      "SYN_DROPPEDs, events lost to the kernel's buffer overflowing", labels);
+  device.grabState = _metrics->gauge("funkeymonkey_input_grabbed",
+      "Whether the device is grabbed", labels);
+  device.grabState.set(device.grabbed);
+}
+
+void EvdevDevice::record(InputRecorder* recorder)
+{
+  _recorder = recorder;
+  for(Device& device : _devices)
   {
-    std::cerr << "ERROR: Cannot access '" << input.path << "'. Does it exist?" << std::endl;
-    return false;
+    recordDevice(device);
   }
+}
 
-  return true;
+void EvdevDevice::recordDevice(Device& device)
+{
+  if(_recorder)
+    device.recorded = _recorder->device(device.path, device.role, device.source->fd());
+}
+
+void EvdevDevice::setGrabbed(Device& device, bool grabbed)
+{
+  device.grabbed = grabbed;
+  device.grabState.set(grabbed);
 }
+
 EvdevDevice::PollResult EvdevDevice::poll(bool blocking)
+{
+  timeval timeout = {1, 0};
+  return poll(blocking ? nullptr : &timeout);
+}
+EvdevDevice::PollResult EvdevDevice::pollFor(unsigned long long timeoutNs)
+{
+  // Round up, waking before the deadline would only mean waiting again
+  unsigned long long us = (timeoutNs + 999) / 1000;
+  timeval timeout = {static_cast<time_t>(us / 1000000),
+    static_cast<suseconds_t>(us % 1000000)};
+  return poll(&timeout);
+}
+EvdevDevice::PollResult EvdevDevice::poll(timeval* timeout)
 {
   if(_devices.empty())
     return {POLL_ERROR, {0}, 0};
 
   if(_currentEvent >= _numEvents)
   {
-    // Poll for a ready device
-    fd_set fds;
-    timeval timeout = {1, 0};
-    FD_ZERO(&fds);
-    for(auto const& device : _devices)
+    unsigned int ready = 0;
+    PollStatus status = _backend == EPOLL_BACKEND ? waitEpoll(timeout, ready)
+      : waitSelect(timeout, ready);
+    if(status != POLL_OK)
     {
-      FD_SET(device.fd, &fds);
+      return {status, {0}, 0};
     }
 
-    int readyFds = select(FD_SETSIZE, &fds, NULL, NULL, 
-        blocking ? NULL : &timeout);
+    Device& device = _devices.at(ready);
+
+    // Read a set of events from device
+    int numEvents = device.source->read(_events.data(), _events.size());
 
-    if(readyFds == 0)
+    if(numEvents == 0)
     {
+      // Woken for events that were already read
       return {POLL_TIMEOUT, {0}, 0};
     }
-    else if(readyFds < 0)
+    else if(numEvents == InputSource::END)
     {
-      return {POLL_ERROR, {0}, 0};
+      unsigned int role = device.role;
+      std::cout << "Input from '" << device.path << "' ended." << std::endl;
+      removeDevice(std::string(device.path));
+      return {POLL_END, {0}, role};
+    }
+    else if(numEvents < 0)
+    {
+      return {POLL_ERROR, {0}, device.role};
     }
 
-    // Round-robin next device to read from
-    unsigned int ready = 0;
-    if(_devices.size() > 1)
+    _numEvents = numEvents;
+    _currentEvent = 0;
+    _currentRole = device.role;
+    _previousDevice = ready;
+
+    if(_recorder)
+      _recorder->record(device.recorded, _events.data(), _numEvents);
+
+    if(_metrics)
     {
-      for(int i = 0; i < _devices.size(); ++i)
+      // Once per read, not per event
+      unsigned int frames = 0;
+      unsigned int dropped = 0;
+      for(int i = 0; i < _numEvents; ++i)
       {
-        unsigned int di = (i + _previousDevice + 1) % _devices.size();
-        int fd = _devices.at(di).fd;
-        if(FD_ISSET(fd, &fds))
+        if(_events[i].type == EV_SYN)
         {
-          ready = di;
-          break;
+          frames += _events[i].code == SYN_REPORT;
+          dropped += _events[i].code == SYN_DROPPED;
         }
       }
+      device.events.add(_numEvents);
+      device.frames.add(frames);
+      device.dropped.add(dropped);
     }
+  }
+  _queued.set(_numEvents - _currentEvent - 1);
+  return {POLL_OK, _events[_currentEvent++], _currentRole};
+}
 
-    Device const& device = _devices.at(ready);
+bool EvdevDevice::sleep(unsigned int& ready)
+{
+  // Round-robin, starting after the device read last
+  for(unsigned int i = 0; i < _devices.size(); ++i)
+  {
+    unsigned int di = (i + _previousDevice + 1) % _devices.size();
+    if(!_devices.at(di).source->sleep())
+    {
+      for(unsigned int j = 0; j < i; ++j)
+      {
+        _devices.at((j + _previousDevice + 1) % _devices.size()).source->wake(false);
+      }
+      ready = di;
+      return false;
+    }
+  }
+  return true;
+}
 
-    // Read a set of events from device
-    int numBytes = read(device.fd, _events.data(), sizeof(input_event) * _events.size());
+bool EvdevDevice::watchedReady()
+{
+  if(_watched.empty() || ++_unwatched < WATCH_INTERVAL)
+    return false;
+
+  _unwatched = 0;
+  fd_set fds;
+  FD_ZERO(&fds);
+  for(int fd : _watched)
+  {
+    FD_SET(fd, &fds);
+  }
+  timeval timeout = {0, 0};
+  return select(FD_SETSIZE, &fds, NULL, NULL, &timeout) > 0;
+}
+
+EvdevDevice::PollStatus EvdevDevice::waitSelect(timeval* timeout, unsigned int& ready)
+{
+  if(!sleep(ready))
+    return watchedReady() ? POLL_WATCHED : POLL_OK;
 
-    if(numBytes <= 0)
+  // Poll for a ready device
+  fd_set fds;
+  FD_ZERO(&fds);
+  for(auto const& device : _devices)
+  {
+    FD_SET(device.source->fd(), &fds);
+  }
+  for(int fd : _watched)
+  {
+    FD_SET(fd, &fds);
+  }
+
+  int readyFds = select(FD_SETSIZE, &fds, NULL, NULL, timeout);
+  int error = errno;
+  for(auto const& device : _devices)
+  {
+    device.source->wake(readyFds > 0 && FD_ISSET(device.source->fd(), &fds));
+  }
+
+  if(readyFds == 0)
+  {
+    return POLL_TIMEOUT;
+  }
+  else if(readyFds < 0)
+  {
+    return error == EINTR ? POLL_INTERRUPTED : POLL_ERROR;
+  }
+
+  for(int fd : _watched)
+  {
+    if(FD_ISSET(fd, &fds))
+      return POLL_WATCHED;
+  }
+
+  // Round-robin next device to read from
+  ready = 0;
+  for(unsigned int i = 0; i < _devices.size(); ++i)
+  {
+    unsigned int di = (i + _previousDevice + 1) % _devices.size();
+    if(FD_ISSET(_devices.at(di).source->fd(), &fds))
     {
-      return {POLL_ERROR, {0}, device.role};
+      ready = di;
+      break;
     }
+  }
+  return POLL_OK;
+}
 
-    _numEvents = numBytes / sizeof(input_event);
-    _currentEvent = 0;
-    _currentRole = device.role;
-    _previousDevice = ready;
+bool EvdevDevice::rebuildEpoll()
+{
+  // Devices and watched descriptors change seldom, only on control requests
+  if(_epoll >= 0)
+    close(_epoll);
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  if(_epoll < 0)
+    return false;
+
+  for(unsigned int i = 0; i < _devices.size() + _watched.size(); ++i)
+  {
+    bool const device = i < _devices.size();
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = device ? i : WATCHED_INDEX;
+    int fd = device ? _devices.at(i).source->fd() : _watched.at(i - _devices.size());
+    if(epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+      return false;
   }
-  return {POLL_OK, _events[_currentEvent++], _currentRole};
+  _epollEvents.resize(_devices.size() + _watched.size());
+  _signalled.resize(_devices.size());
+  _stale = false;
+  return true;
+}
+
+EvdevDevice::PollStatus EvdevDevice::waitEpoll(timeval* timeout, unsigned int& ready)
+{
+  if(_stale && !rebuildEpoll())
+  {
+    std::cerr << "ERROR: Could not set up epoll: " << strerror(errno) << std::endl;
+    return POLL_ERROR;
+  }
+
+  if(!sleep(ready))
+    return watchedReady() ? POLL_WATCHED : POLL_OK;
+
+  int readyFds = -1;
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 35)
+#define EVDEV_DEVICE_EPOLL_PWAIT2
+#endif
+#endif
+#ifdef EVDEV_DEVICE_EPOLL_PWAIT2
+  // Nanosecond timeouts, where the kernel has them
+  timespec nanoTimeout = {};
+  if(timeout)
+  {
+    nanoTimeout.tv_sec = timeout->tv_sec;
+    nanoTimeout.tv_nsec = timeout->tv_usec * 1000;
+  }
+  readyFds = epoll_pwait2(_epoll, _epollEvents.data(), _epollEvents.size(),
+      timeout ? &nanoTimeout : nullptr, nullptr);
+  if(readyFds < 0 && errno == ENOSYS)
+#endif
+  {
+    // Milliseconds, rounded up like pollFor() does
+    int ms = timeout ? timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000 : -1;
+    readyFds = epoll_wait(_epoll, _epollEvents.data(), _epollEvents.size(), ms);
+  }
+  int error = errno;
+
+  std::fill(_signalled.begin(), _signalled.end(), false);
+  bool watched = false;
+  for(int i = 0; i < readyFds; ++i)
+  {
+    unsigned int index = _epollEvents.at(i).data.u32;
+    if(index == WATCHED_INDEX)
+      watched = true;
+    else
+      _signalled.at(index) = true;
+  }
+  for(unsigned int i = 0; i < _devices.size(); ++i)
+  {
+    _devices.at(i).source->wake(_signalled.at(i));
+  }
+
+  if(readyFds == 0)
+  {
+    return POLL_TIMEOUT;
+  }
+  else if(readyFds < 0)
+  {
+    return error == EINTR ? POLL_INTERRUPTED : POLL_ERROR;
+  }
+  else if(watched)
+  {
+    return POLL_WATCHED;
+  }
+
+  // Round-robin next device to read from
+  ready = 0;
+  for(unsigned int i = 0; i < _devices.size(); ++i)
+  {
+    unsigned int di = (i + _previousDevice + 1) % _devices.size();
+    if(_signalled.at(di))
+    {
+      ready = di;
+      break;
+    }
+  }
+  return POLL_OK;
 }
 
+bool EvdevDevice::pending() const
+{
+  return _currentEvent < _numEvents;
+}
 bool EvdevDevice::ready() const
 {
   return !_devices.empty();
 }
 bool EvdevDevice::grab(bool value)
 {
+  std::lock_guard<std::mutex> lk(_devicesMutex);
   bool success = true;
   for(auto const& device : _devices)
   {
-    success &= ioctl(device.fd, EVIOCGRAB, value ? 1 : 0) >= 0;
+    success &= device.source->grab(value);
   }
 
   // If unsuccessful, attempt to revert
@@ -258,11 +670,55 @@ bool EvdevDevice::grab(bool value)
   {
     for(auto const& device : _devices)
     {
-      ioctl(device.fd, EVIOCGRAB, value ? 0 : 1);
+      device.source->grab(!value);
     }
   }
 
+  for(auto& device : _devices)
+  {
+    setGrabbed(device, success ? value : !value);
+    device.released = false;
+  }
   return success && !_devices.empty();
 }
+bool EvdevDevice::grab(std::string const& path, bool value)
+{
+  std::lock_guard<std::mutex> lk(_devicesMutex);
+  for(auto& device : _devices)
+  {
+    if(device.path == path && device.source->grab(value))
+    {
+      setGrabbed(device, value);
+      device.released = false;
+      return true;
+    }
+  }
+  return false;
+}
+bool EvdevDevice::release()
+{
+  std::lock_guard<std::mutex> lk(_devicesMutex);
+  bool released = false;
+  for(auto& device : _devices)
+  {
+    if(device.grabbed && device.source->grab(false))
+    {
+      setGrabbed(device, false);
+      device.released = true;
+      released = true;
+    }
+  }
+  return released;
+}
+void EvdevDevice::restore()
+{
+  std::lock_guard<std::mutex> lk(_devicesMutex);
+  for(auto& device : _devices)
+  {
+    if(device.released && device.source->grab(true))
+      setGrabbed(device, true);
+    device.released = false;
+  }
+}
 
 #endif
@@ -0,0 +1,746 @@
+#ifndef EVENT_CODES_H
+#define EVENT_CODES_H
+
+#include <linux/input.h>
+#include <string>
+#include <cstdlib>
+
+// Symbolic names of key, button, relative and absolute axis codes as used
+// in configuration files, eg. KEY_A, BTN_SOUTH or ABS_X. The values are
+// part of the kernel ABI and listed here so that configurations can name
+// codes newer than the headers the plugin was built with.
+struct EventCode
+{
+  char const* name;
+  unsigned int type;
+  unsigned int code;
+};
+
+// Resolve a name or a plain key code number, returns false if unknown
+bool parseEventCode(std::string const& name, EventCode& result);
+// Name of a code, or nullptr if there is none
+char const* eventCodeName(unsigned int type, unsigned int code);
+
+static EventCode const EVENT_CODES[] = {
+  { "KEY_RESERVED", EV_KEY, 0 },
+  { "KEY_ESC", EV_KEY, 1 },
+  { "KEY_1", EV_KEY, 2 },
+  { "KEY_2", EV_KEY, 3 },
+  { "KEY_3", EV_KEY, 4 },
+  { "KEY_4", EV_KEY, 5 },
+  { "KEY_5", EV_KEY, 6 },
+  { "KEY_6", EV_KEY, 7 },
+  { "KEY_7", EV_KEY, 8 },
+  { "KEY_8", EV_KEY, 9 },
+  { "KEY_9", EV_KEY, 10 },
+  { "KEY_0", EV_KEY, 11 },
+  { "KEY_MINUS", EV_KEY, 12 },
+  { "KEY_EQUAL", EV_KEY, 13 },
+  { "KEY_BACKSPACE", EV_KEY, 14 },
+  { "KEY_TAB", EV_KEY, 15 },
+  { "KEY_Q", EV_KEY, 16 },
+  { "KEY_W", EV_KEY, 17 },
+  { "KEY_E", EV_KEY, 18 },
+  { "KEY_R", EV_KEY, 19 },
+  { "KEY_T", EV_KEY, 20 },
+  { "KEY_Y", EV_KEY, 21 },
+  { "KEY_U", EV_KEY, 22 },
+  { "KEY_I", EV_KEY, 23 },
+  { "KEY_O", EV_KEY, 24 },
+  { "KEY_P", EV_KEY, 25 },
+  { "KEY_LEFTBRACE", EV_KEY, 26 },
+  { "KEY_RIGHTBRACE", EV_KEY, 27 },
+  { "KEY_ENTER", EV_KEY, 28 },
+  { "KEY_LEFTCTRL", EV_KEY, 29 },
+  { "KEY_A", EV_KEY, 30 },
+  { "KEY_S", EV_KEY, 31 },
+  { "KEY_D", EV_KEY, 32 },
+  { "KEY_F", EV_KEY, 33 },
+  { "KEY_G", EV_KEY, 34 },
+  { "KEY_H", EV_KEY, 35 },
+  { "KEY_J", EV_KEY, 36 },
+  { "KEY_K", EV_KEY, 37 },
+  { "KEY_L", EV_KEY, 38 },
+  { "KEY_SEMICOLON", EV_KEY, 39 },
+  { "KEY_APOSTROPHE", EV_KEY, 40 },
+  { "KEY_GRAVE", EV_KEY, 41 },
+  { "KEY_LEFTSHIFT", EV_KEY, 42 },
+  { "KEY_BACKSLASH", EV_KEY, 43 },
+  { "KEY_Z", EV_KEY, 44 },
+  { "KEY_X", EV_KEY, 45 },
+  { "KEY_C", EV_KEY, 46 },
+  { "KEY_V", EV_KEY, 47 },
+  { "KEY_B", EV_KEY, 48 },
+  { "KEY_N", EV_KEY, 49 },
+  { "KEY_M", EV_KEY, 50 },
+  { "KEY_COMMA", EV_KEY, 51 },
+  { "KEY_DOT", EV_KEY, 52 },
+  { "KEY_SLASH", EV_KEY, 53 },
+  { "KEY_RIGHTSHIFT", EV_KEY, 54 },
+  { "KEY_KPASTERISK", EV_KEY, 55 },
+  { "KEY_LEFTALT", EV_KEY, 56 },
+  { "KEY_SPACE", EV_KEY, 57 },
+  { "KEY_CAPSLOCK", EV_KEY, 58 },
+  { "KEY_F1", EV_KEY, 59 },
+  { "KEY_F2", EV_KEY, 60 },
+  { "KEY_F3", EV_KEY, 61 },
+  { "KEY_F4", EV_KEY, 62 },
+  { "KEY_F5", EV_KEY, 63 },
+  { "KEY_F6", EV_KEY, 64 },
+  { "KEY_F7", EV_KEY, 65 },
+  { "KEY_F8", EV_KEY, 66 },
+  { "KEY_F9", EV_KEY, 67 },
+  { "KEY_F10", EV_KEY, 68 },
+  { "KEY_NUMLOCK", EV_KEY, 69 },
+  { "KEY_SCROLLLOCK", EV_KEY, 70 },
+  { "KEY_KP7", EV_KEY, 71 },
+  { "KEY_KP8", EV_KEY, 72 },
+  { "KEY_KP9", EV_KEY, 73 },
+  { "KEY_KPMINUS", EV_KEY, 74 },
+  { "KEY_KP4", EV_KEY, 75 },
+  { "KEY_KP5", EV_KEY, 76 },
+  { "KEY_KP6", EV_KEY, 77 },
+  { "KEY_KPPLUS", EV_KEY, 78 },
+  { "KEY_KP1", EV_KEY, 79 },
+  { "KEY_KP2", EV_KEY, 80 },
+  { "KEY_KP3", EV_KEY, 81 },
+  { "KEY_KP0", EV_KEY, 82 },
+  { "KEY_KPDOT", EV_KEY, 83 },
+  { "KEY_ZENKAKUHANKAKU", EV_KEY, 85 },
+  { "KEY_102ND", EV_KEY, 86 },
+  { "KEY_F11", EV_KEY, 87 },
+  { "KEY_F12", EV_KEY, 88 },
+  { "KEY_RO", EV_KEY, 89 },
+  { "KEY_KATAKANA", EV_KEY, 90 },
+  { "KEY_HIRAGANA", EV_KEY, 91 },
+  { "KEY_HENKAN", EV_KEY, 92 },
+  { "KEY_KATAKANAHIRAGANA", EV_KEY, 93 },
+  { "KEY_MUHENKAN", EV_KEY, 94 },
+  { "KEY_KPJPCOMMA", EV_KEY, 95 },
+  { "KEY_KPENTER", EV_KEY, 96 },
+  { "KEY_RIGHTCTRL", EV_KEY, 97 },
+  { "KEY_KPSLASH", EV_KEY, 98 },
+  { "KEY_SYSRQ", EV_KEY, 99 },
+  { "KEY_RIGHTALT", EV_KEY, 100 },
+  { "KEY_LINEFEED", EV_KEY, 101 },
+  { "KEY_HOME", EV_KEY, 102 },
+  { "KEY_UP", EV_KEY, 103 },
+  { "KEY_PAGEUP", EV_KEY, 104 },
+  { "KEY_LEFT", EV_KEY, 105 },
+  { "KEY_RIGHT", EV_KEY, 106 },
+  { "KEY_END", EV_KEY, 107 },
+  { "KEY_DOWN", EV_KEY, 108 },
+  { "KEY_PAGEDOWN", EV_KEY, 109 },
+  { "KEY_INSERT", EV_KEY, 110 },
+  { "KEY_DELETE", EV_KEY, 111 },
+  { "KEY_MACRO", EV_KEY, 112 },
+  { "KEY_MUTE", EV_KEY, 113 },
+  { "KEY_VOLUMEDOWN", EV_KEY, 114 },
+  { "KEY_VOLUMEUP", EV_KEY, 115 },
+  { "KEY_POWER", EV_KEY, 116 },
+  { "KEY_KPEQUAL", EV_KEY, 117 },
+  { "KEY_KPPLUSMINUS", EV_KEY, 118 },
+  { "KEY_PAUSE", EV_KEY, 119 },
+  { "KEY_SCALE", EV_KEY, 120 },
+  { "KEY_KPCOMMA", EV_KEY, 121 },
+  { "KEY_HANGEUL", EV_KEY, 122 },
+  { "KEY_HANGUEL", EV_KEY, 122 },
+  { "KEY_HANJA", EV_KEY, 123 },
+  { "KEY_YEN", EV_KEY, 124 },
+  { "KEY_LEFTMETA", EV_KEY, 125 },
+  { "KEY_RIGHTMETA", EV_KEY, 126 },
+  { "KEY_COMPOSE", EV_KEY, 127 },
+  { "KEY_STOP", EV_KEY, 128 },
+  { "KEY_AGAIN", EV_KEY, 129 },
+  { "KEY_PROPS", EV_KEY, 130 },
+  { "KEY_UNDO", EV_KEY, 131 },
+  { "KEY_FRONT", EV_KEY, 132 },
+  { "KEY_COPY", EV_KEY, 133 },
+  { "KEY_OPEN", EV_KEY, 134 },
+  { "KEY_PASTE", EV_KEY, 135 },
+  { "KEY_FIND", EV_KEY, 136 },
+  { "KEY_CUT", EV_KEY, 137 },
+  { "KEY_HELP", EV_KEY, 138 },
+  { "KEY_MENU", EV_KEY, 139 },
+  { "KEY_CALC", EV_KEY, 140 },
+  { "KEY_SETUP", EV_KEY, 141 },
+  { "KEY_SLEEP", EV_KEY, 142 },
+  { "KEY_WAKEUP", EV_KEY, 143 },
+  { "KEY_FILE", EV_KEY, 144 },
+  { "KEY_SENDFILE", EV_KEY, 145 },
+  { "KEY_DELETEFILE", EV_KEY, 146 },
+  { "KEY_XFER", EV_KEY, 147 },
+  { "KEY_PROG1", EV_KEY, 148 },
+  { "KEY_PROG2", EV_KEY, 149 },
+  { "KEY_WWW", EV_KEY, 150 },
+  { "KEY_MSDOS", EV_KEY, 151 },
+  { "KEY_COFFEE", EV_KEY, 152 },
+  { "KEY_SCREENLOCK", EV_KEY, 152 },
+  { "KEY_ROTATE_DISPLAY", EV_KEY, 153 },
+  { "KEY_DIRECTION", EV_KEY, 153 },
+  { "KEY_CYCLEWINDOWS", EV_KEY, 154 },
+  { "KEY_MAIL", EV_KEY, 155 },
+  { "KEY_BOOKMARKS", EV_KEY, 156 },
+  { "KEY_COMPUTER", EV_KEY, 157 },
+  { "KEY_BACK", EV_KEY, 158 },
+  { "KEY_FORWARD", EV_KEY, 159 },
+  { "KEY_CLOSECD", EV_KEY, 160 },
+  { "KEY_EJECTCD", EV_KEY, 161 },
+  { "KEY_EJECTCLOSECD", EV_KEY, 162 },
+  { "KEY_NEXTSONG", EV_KEY, 163 },
+  { "KEY_PLAYPAUSE", EV_KEY, 164 },
+  { "KEY_PREVIOUSSONG", EV_KEY, 165 },
+  { "KEY_STOPCD", EV_KEY, 166 },
+  { "KEY_RECORD", EV_KEY, 167 },
+  { "KEY_REWIND", EV_KEY, 168 },
+  { "KEY_PHONE", EV_KEY, 169 },
+  { "KEY_ISO", EV_KEY, 170 },
+  { "KEY_CONFIG", EV_KEY, 171 },
+  { "KEY_HOMEPAGE", EV_KEY, 172 },
+  { "KEY_REFRESH", EV_KEY, 173 },
+  { "KEY_EXIT", EV_KEY, 174 },
+  { "KEY_MOVE", EV_KEY, 175 },
+  { "KEY_EDIT", EV_KEY, 176 },
+  { "KEY_SCROLLUP", EV_KEY, 177 },
+  { "KEY_SCROLLDOWN", EV_KEY, 178 },
+  { "KEY_KPLEFTPAREN", EV_KEY, 179 },
+  { "KEY_KPRIGHTPAREN", EV_KEY, 180 },
+  { "KEY_NEW", EV_KEY, 181 },
+  { "KEY_REDO", EV_KEY, 182 },
+  { "KEY_F13", EV_KEY, 183 },
+  { "KEY_F14", EV_KEY, 184 },
+  { "KEY_F15", EV_KEY, 185 },
+  { "KEY_F16", EV_KEY, 186 },
+  { "KEY_F17", EV_KEY, 187 },
+  { "KEY_F18", EV_KEY, 188 },
+  { "KEY_F19", EV_KEY, 189 },
+  { "KEY_F20", EV_KEY, 190 },
+  { "KEY_F21", EV_KEY, 191 },
+  { "KEY_F22", EV_KEY, 192 },
+  { "KEY_F23", EV_KEY, 193 },
+  { "KEY_F24", EV_KEY, 194 },
+  { "KEY_PLAYCD", EV_KEY, 200 },
+  { "KEY_PAUSECD", EV_KEY, 201 },
+  { "KEY_PROG3", EV_KEY, 202 },
+  { "KEY_PROG4", EV_KEY, 203 },
+  { "KEY_ALL_APPLICATIONS", EV_KEY, 204 },
+  { "KEY_DASHBOARD", EV_KEY, 204 },
+  { "KEY_SUSPEND", EV_KEY, 205 },
+  { "KEY_CLOSE", EV_KEY, 206 },
+  { "KEY_PLAY", EV_KEY, 207 },
+  { "KEY_FASTFORWARD", EV_KEY, 208 },
+  { "KEY_BASSBOOST", EV_KEY, 209 },
+  { "KEY_PRINT", EV_KEY, 210 },
+  { "KEY_HP", EV_KEY, 211 },
+  { "KEY_CAMERA", EV_KEY, 212 },
+  { "KEY_SOUND", EV_KEY, 213 },
+  { "KEY_QUESTION", EV_KEY, 214 },
+  { "KEY_EMAIL", EV_KEY, 215 },
+  { "KEY_CHAT", EV_KEY, 216 },
+  { "KEY_SEARCH", EV_KEY, 217 },
+  { "KEY_CONNECT", EV_KEY, 218 },
+  { "KEY_FINANCE", EV_KEY, 219 },
+  { "KEY_SPORT", EV_KEY, 220 },
+  { "KEY_SHOP", EV_KEY, 221 },
+  { "KEY_ALTERASE", EV_KEY, 222 },
+  { "KEY_CANCEL", EV_KEY, 223 },
+  { "KEY_BRIGHTNESSDOWN", EV_KEY, 224 },
+  { "KEY_BRIGHTNESSUP", EV_KEY, 225 },
+  { "KEY_MEDIA", EV_KEY, 226 },
+  { "KEY_SWITCHVIDEOMODE", EV_KEY, 227 },
+  { "KEY_KBDILLUMTOGGLE", EV_KEY, 228 },
+  { "KEY_KBDILLUMDOWN", EV_KEY, 229 },
+  { "KEY_KBDILLUMUP", EV_KEY, 230 },
+  { "KEY_SEND", EV_KEY, 231 },
+  { "KEY_REPLY", EV_KEY, 232 },
+  { "KEY_FORWARDMAIL", EV_KEY, 233 },
+  { "KEY_SAVE", EV_KEY, 234 },
+  { "KEY_DOCUMENTS", EV_KEY, 235 },
+  { "KEY_BATTERY", EV_KEY, 236 },
+  { "KEY_BLUETOOTH", EV_KEY, 237 },
+  { "KEY_WLAN", EV_KEY, 238 },
+  { "KEY_UWB", EV_KEY, 239 },
+  { "KEY_UNKNOWN", EV_KEY, 240 },
+  { "KEY_VIDEO_NEXT", EV_KEY, 241 },
+  { "KEY_VIDEO_PREV", EV_KEY, 242 },
+  { "KEY_BRIGHTNESS_CYCLE", EV_KEY, 243 },
+  { "KEY_BRIGHTNESS_AUTO", EV_KEY, 244 },
+  { "KEY_BRIGHTNESS_ZERO", EV_KEY, 244 },
+  { "KEY_DISPLAY_OFF", EV_KEY, 245 },
+  { "KEY_WWAN", EV_KEY, 246 },
+  { "KEY_WIMAX", EV_KEY, 246 },
+  { "KEY_RFKILL", EV_KEY, 247 },
+  { "KEY_MICMUTE", EV_KEY, 248 },
+  { "BTN_MISC", EV_KEY, 256 },
+  { "BTN_0", EV_KEY, 256 },
+  { "BTN_1", EV_KEY, 257 },
+  { "BTN_2", EV_KEY, 258 },
+  { "BTN_3", EV_KEY, 259 },
+  { "BTN_4", EV_KEY, 260 },
+  { "BTN_5", EV_KEY, 261 },
+  { "BTN_6", EV_KEY, 262 },
+  { "BTN_7", EV_KEY, 263 },
+  { "BTN_8", EV_KEY, 264 },
+  { "BTN_9", EV_KEY, 265 },
+  { "BTN_MOUSE", EV_KEY, 272 },
+  { "BTN_LEFT", EV_KEY, 272 },
+  { "BTN_RIGHT", EV_KEY, 273 },
+  { "BTN_MIDDLE", EV_KEY, 274 },
+  { "BTN_SIDE", EV_KEY, 275 },
+  { "BTN_EXTRA", EV_KEY, 276 },
+  { "BTN_FORWARD", EV_KEY, 277 },
+  { "BTN_BACK", EV_KEY, 278 },
+  { "BTN_TASK", EV_KEY, 279 },
+  { "BTN_JOYSTICK", EV_KEY, 288 },
+  { "BTN_TRIGGER", EV_KEY, 288 },
+  { "BTN_THUMB", EV_KEY, 289 },
+  { "BTN_THUMB2", EV_KEY, 290 },
+  { "BTN_TOP", EV_KEY, 291 },
+  { "BTN_TOP2", EV_KEY, 292 },
+  { "BTN_PINKIE", EV_KEY, 293 },
+  { "BTN_BASE", EV_KEY, 294 },
+  { "BTN_BASE2", EV_KEY, 295 },
+  { "BTN_BASE3", EV_KEY, 296 },
+  { "BTN_BASE4", EV_KEY, 297 },
+  { "BTN_BASE5", EV_KEY, 298 },
+  { "BTN_BASE6", EV_KEY, 299 },
+  { "BTN_DEAD", EV_KEY, 303 },
+  { "BTN_GAMEPAD", EV_KEY, 304 },
+  { "BTN_SOUTH", EV_KEY, 304 },
+  { "BTN_A", EV_KEY, 304 },
+  { "BTN_EAST", EV_KEY, 305 },
+  { "BTN_B", EV_KEY, 305 },
+  { "BTN_C", EV_KEY, 306 },
+  { "BTN_NORTH", EV_KEY, 307 },
+  { "BTN_X", EV_KEY, 307 },
+  { "BTN_WEST", EV_KEY, 308 },
+  { "BTN_Y", EV_KEY, 308 },
+  { "BTN_Z", EV_KEY, 309 },
+  { "BTN_TL", EV_KEY, 310 },
+  { "BTN_TR", EV_KEY, 311 },
+  { "BTN_TL2", EV_KEY, 312 },
+  { "BTN_TR2", EV_KEY, 313 },
+  { "BTN_SELECT", EV_KEY, 314 },
+  { "BTN_START", EV_KEY, 315 },
+  { "BTN_MODE", EV_KEY, 316 },
+  { "BTN_THUMBL", EV_KEY, 317 },
+  { "BTN_THUMBR", EV_KEY, 318 },
+  { "BTN_DIGI", EV_KEY, 320 },
+  { "BTN_TOOL_PEN", EV_KEY, 320 },
+  { "BTN_TOOL_RUBBER", EV_KEY, 321 },
+  { "BTN_TOOL_BRUSH", EV_KEY, 322 },
+  { "BTN_TOOL_PENCIL", EV_KEY, 323 },
+  { "BTN_TOOL_AIRBRUSH", EV_KEY, 324 },
+  { "BTN_TOOL_FINGER", EV_KEY, 325 },
+  { "BTN_TOOL_MOUSE", EV_KEY, 326 },
+  { "BTN_TOOL_LENS", EV_KEY, 327 },
+  { "BTN_TOOL_QUINTTAP", EV_KEY, 328 },
+  { "BTN_STYLUS3", EV_KEY, 329 },
+  { "BTN_TOUCH", EV_KEY, 330 },
+  { "BTN_STYLUS", EV_KEY, 331 },
+  { "BTN_STYLUS2", EV_KEY, 332 },
+  { "BTN_TOOL_DOUBLETAP", EV_KEY, 333 },
+  { "BTN_TOOL_TRIPLETAP", EV_KEY, 334 },
+  { "BTN_TOOL_QUADTAP", EV_KEY, 335 },
+  { "BTN_WHEEL", EV_KEY, 336 },
+  { "BTN_GEAR_DOWN", EV_KEY, 336 },
+  { "BTN_GEAR_UP", EV_KEY, 337 },
+  { "KEY_OK", EV_KEY, 352 },
+  { "KEY_SELECT", EV_KEY, 353 },
+  { "KEY_GOTO", EV_KEY, 354 },
+  { "KEY_CLEAR", EV_KEY, 355 },
+  { "KEY_POWER2", EV_KEY, 356 },
+  { "KEY_OPTION", EV_KEY, 357 },
+  { "KEY_INFO", EV_KEY, 358 },
+  { "KEY_TIME", EV_KEY, 359 },
+  { "KEY_VENDOR", EV_KEY, 360 },
+  { "KEY_ARCHIVE", EV_KEY, 361 },
+  { "KEY_PROGRAM", EV_KEY, 362 },
+  { "KEY_CHANNEL", EV_KEY, 363 },
+  { "KEY_FAVORITES", EV_KEY, 364 },
+  { "KEY_EPG", EV_KEY, 365 },
+  { "KEY_PVR", EV_KEY, 366 },
+  { "KEY_MHP", EV_KEY, 367 },
+  { "KEY_LANGUAGE", EV_KEY, 368 },
+  { "KEY_TITLE", EV_KEY, 369 },
+  { "KEY_SUBTITLE", EV_KEY, 370 },
+  { "KEY_ANGLE", EV_KEY, 371 },
+  { "KEY_FULL_SCREEN", EV_KEY, 372 },
+  { "KEY_ZOOM", EV_KEY, 372 },
+  { "KEY_MODE", EV_KEY, 373 },
+  { "KEY_KEYBOARD", EV_KEY, 374 },
+  { "KEY_ASPECT_RATIO", EV_KEY, 375 },
+  { "KEY_SCREEN", EV_KEY, 375 },
+  { "KEY_PC", EV_KEY, 376 },
+  { "KEY_TV", EV_KEY, 377 },
+  { "KEY_TV2", EV_KEY, 378 },
+  { "KEY_VCR", EV_KEY, 379 },
+  { "KEY_VCR2", EV_KEY, 380 },
+  { "KEY_SAT", EV_KEY, 381 },
+  { "KEY_SAT2", EV_KEY, 382 },
+  { "KEY_CD", EV_KEY, 383 },
+  { "KEY_TAPE", EV_KEY, 384 },
+  { "KEY_RADIO", EV_KEY, 385 },
+  { "KEY_TUNER", EV_KEY, 386 },
+  { "KEY_PLAYER", EV_KEY, 387 },
+  { "KEY_TEXT", EV_KEY, 388 },
+  { "KEY_DVD", EV_KEY, 389 },
+  { "KEY_AUX", EV_KEY, 390 },
+  { "KEY_MP3", EV_KEY, 391 },
+  { "KEY_AUDIO", EV_KEY, 392 },
+  { "KEY_VIDEO", EV_KEY, 393 },
+  { "KEY_DIRECTORY", EV_KEY, 394 },
+  { "KEY_LIST", EV_KEY, 395 },
+  { "KEY_MEMO", EV_KEY, 396 },
+  { "KEY_CALENDAR", EV_KEY, 397 },
+  { "KEY_RED", EV_KEY, 398 },
+  { "KEY_GREEN", EV_KEY, 399 },
+  { "KEY_YELLOW", EV_KEY, 400 },
+  { "KEY_BLUE", EV_KEY, 401 },
+  { "KEY_CHANNELUP", EV_KEY, 402 },
+  { "KEY_CHANNELDOWN", EV_KEY, 403 },
+  { "KEY_FIRST", EV_KEY, 404 },
+  { "KEY_LAST", EV_KEY, 405 },
+  { "KEY_AB", EV_KEY, 406 },
+  { "KEY_NEXT", EV_KEY, 407 },
+  { "KEY_RESTART", EV_KEY, 408 },
+  { "KEY_SLOW", EV_KEY, 409 },
+  { "KEY_SHUFFLE", EV_KEY, 410 },
+  { "KEY_BREAK", EV_KEY, 411 },
+  { "KEY_PREVIOUS", EV_KEY, 412 },
+  { "KEY_DIGITS", EV_KEY, 413 },
+  { "KEY_TEEN", EV_KEY, 414 },
+  { "KEY_TWEN", EV_KEY, 415 },
+  { "KEY_VIDEOPHONE", EV_KEY, 416 },
+  { "KEY_GAMES", EV_KEY, 417 },
+  { "KEY_ZOOMIN", EV_KEY, 418 },
+  { "KEY_ZOOMOUT", EV_KEY, 419 },
+  { "KEY_ZOOMRESET", EV_KEY, 420 },
+  { "KEY_WORDPROCESSOR", EV_KEY, 421 },
+  { "KEY_EDITOR", EV_KEY, 422 },
+  { "KEY_SPREADSHEET", EV_KEY, 423 },
+  { "KEY_GRAPHICSEDITOR", EV_KEY, 424 },
+  { "KEY_PRESENTATION", EV_KEY, 425 },
+  { "KEY_DATABASE", EV_KEY, 426 },
+  { "KEY_NEWS", EV_KEY, 427 },
+  { "KEY_VOICEMAIL", EV_KEY, 428 },
+  { "KEY_ADDRESSBOOK", EV_KEY, 429 },
+  { "KEY_MESSENGER", EV_KEY, 430 },
+  { "KEY_DISPLAYTOGGLE", EV_KEY, 431 },
+  { "KEY_BRIGHTNESS_TOGGLE", EV_KEY, 431 },
+  { "KEY_SPELLCHECK", EV_KEY, 432 },
+  { "KEY_LOGOFF", EV_KEY, 433 },
+  { "KEY_DOLLAR", EV_KEY, 434 },
+  { "KEY_EURO", EV_KEY, 435 },
+  { "KEY_FRAMEBACK", EV_KEY, 436 },
+  { "KEY_FRAMEFORWARD", EV_KEY, 437 },
+  { "KEY_CONTEXT_MENU", EV_KEY, 438 },
+  { "KEY_MEDIA_REPEAT", EV_KEY, 439 },
+  { "KEY_10CHANNELSUP", EV_KEY, 440 },
+  { "KEY_10CHANNELSDOWN", EV_KEY, 441 },
+  { "KEY_IMAGES", EV_KEY, 442 },
+  { "KEY_NOTIFICATION_CENTER", EV_KEY, 444 },
+  { "KEY_PICKUP_PHONE", EV_KEY, 445 },
+  { "KEY_HANGUP_PHONE", EV_KEY, 446 },
+  { "KEY_LINK_PHONE", EV_KEY, 447 },
+  { "KEY_DEL_EOL", EV_KEY, 448 },
+  { "KEY_DEL_EOS", EV_KEY, 449 },
+  { "KEY_INS_LINE", EV_KEY, 450 },
+  { "KEY_DEL_LINE", EV_KEY, 451 },
+  { "KEY_FN", EV_KEY, 464 },
+  { "KEY_FN_ESC", EV_KEY, 465 },
+  { "KEY_FN_F1", EV_KEY, 466 },
+  { "KEY_FN_F2", EV_KEY, 467 },
+  { "KEY_FN_F3", EV_KEY, 468 },
+  { "KEY_FN_F4", EV_KEY, 469 },
+  { "KEY_FN_F5", EV_KEY, 470 },
+  { "KEY_FN_F6", EV_KEY, 471 },
+  { "KEY_FN_F7", EV_KEY, 472 },
+  { "KEY_FN_F8", EV_KEY, 473 },
+  { "KEY_FN_F9", EV_KEY, 474 },
+  { "KEY_FN_F10", EV_KEY, 475 },
+  { "KEY_FN_F11", EV_KEY, 476 },
+  { "KEY_FN_F12", EV_KEY, 477 },
+  { "KEY_FN_1", EV_KEY, 478 },
+  { "KEY_FN_2", EV_KEY, 479 },
+  { "KEY_FN_D", EV_KEY, 480 },
+  { "KEY_FN_E", EV_KEY, 481 },
+  { "KEY_FN_F", EV_KEY, 482 },
+  { "KEY_FN_S", EV_KEY, 483 },
+  { "KEY_FN_B", EV_KEY, 484 },
+  { "KEY_FN_RIGHT_SHIFT", EV_KEY, 485 },
+  { "KEY_BRL_DOT1", EV_KEY, 497 },
+  { "KEY_BRL_DOT2", EV_KEY, 498 },
+  { "KEY_BRL_DOT3", EV_KEY, 499 },
+  { "KEY_BRL_DOT4", EV_KEY, 500 },
+  { "KEY_BRL_DOT5", EV_KEY, 501 },
+  { "KEY_BRL_DOT6", EV_KEY, 502 },
+  { "KEY_BRL_DOT7", EV_KEY, 503 },
+  { "KEY_BRL_DOT8", EV_KEY, 504 },
+  { "KEY_BRL_DOT9", EV_KEY, 505 },
+  { "KEY_BRL_DOT10", EV_KEY, 506 },
+  { "KEY_NUMERIC_0", EV_KEY, 512 },
+  { "KEY_NUMERIC_1", EV_KEY, 513 },
+  { "KEY_NUMERIC_2", EV_KEY, 514 },
+  { "KEY_NUMERIC_3", EV_KEY, 515 },
+  { "KEY_NUMERIC_4", EV_KEY, 516 },
+  { "KEY_NUMERIC_5", EV_KEY, 517 },
+  { "KEY_NUMERIC_6", EV_KEY, 518 },
+  { "KEY_NUMERIC_7", EV_KEY, 519 },
+  { "KEY_NUMERIC_8", EV_KEY, 520 },
+  { "KEY_NUMERIC_9", EV_KEY, 521 },
+  { "KEY_NUMERIC_STAR", EV_KEY, 522 },
+  { "KEY_NUMERIC_POUND", EV_KEY, 523 },
+  { "KEY_NUMERIC_A", EV_KEY, 524 },
+  { "KEY_NUMERIC_B", EV_KEY, 525 },
+  { "KEY_NUMERIC_C", EV_KEY, 526 },
+  { "KEY_NUMERIC_D", EV_KEY, 527 },
+  { "KEY_CAMERA_FOCUS", EV_KEY, 528 },
+  { "KEY_WPS_BUTTON", EV_KEY, 529 },
+  { "KEY_TOUCHPAD_TOGGLE", EV_KEY, 530 },
+  { "KEY_TOUCHPAD_ON", EV_KEY, 531 },
+  { "KEY_TOUCHPAD_OFF", EV_KEY, 532 },
+  { "KEY_CAMERA_ZOOMIN", EV_KEY, 533 },
+  { "KEY_CAMERA_ZOOMOUT", EV_KEY, 534 },
+  { "KEY_CAMERA_UP", EV_KEY, 535 },
+  { "KEY_CAMERA_DOWN", EV_KEY, 536 },
+  { "KEY_CAMERA_LEFT", EV_KEY, 537 },
+  { "KEY_CAMERA_RIGHT", EV_KEY, 538 },
+  { "KEY_ATTENDANT_ON", EV_KEY, 539 },
+  { "KEY_ATTENDANT_OFF", EV_KEY, 540 },
+  { "KEY_ATTENDANT_TOGGLE", EV_KEY, 541 },
+  { "KEY_LIGHTS_TOGGLE", EV_KEY, 542 },
+  { "BTN_DPAD_UP", EV_KEY, 544 },
+  { "BTN_DPAD_DOWN", EV_KEY, 545 },
+  { "BTN_DPAD_LEFT", EV_KEY, 546 },
+  { "BTN_DPAD_RIGHT", EV_KEY, 547 },
+  { "KEY_ALS_TOGGLE", EV_KEY, 560 },
+  { "KEY_ROTATE_LOCK_TOGGLE", EV_KEY, 561 },
+  { "KEY_REFRESH_RATE_TOGGLE", EV_KEY, 562 },
+  { "KEY_BUTTONCONFIG", EV_KEY, 576 },
+  { "KEY_TASKMANAGER", EV_KEY, 577 },
+  { "KEY_JOURNAL", EV_KEY, 578 },
+  { "KEY_CONTROLPANEL", EV_KEY, 579 },
+  { "KEY_APPSELECT", EV_KEY, 580 },
+  { "KEY_SCREENSAVER", EV_KEY, 581 },
+  { "KEY_VOICECOMMAND", EV_KEY, 582 },
+  { "KEY_ASSISTANT", EV_KEY, 583 },
+  { "KEY_KBD_LAYOUT_NEXT", EV_KEY, 584 },
+  { "KEY_EMOJI_PICKER", EV_KEY, 585 },
+  { "KEY_DICTATE", EV_KEY, 586 },
+  { "KEY_BRIGHTNESS_MIN", EV_KEY, 592 },
+  { "KEY_KBDINPUTASSIST_PREV", EV_KEY, 608 },
+  { "KEY_KBDINPUTASSIST_NEXT", EV_KEY, 609 },
+  { "KEY_KBDINPUTASSIST_PREVGROUP", EV_KEY, 610 },
+  { "KEY_KBDINPUTASSIST_NEXTGROUP", EV_KEY, 611 },
+  { "KEY_KBDINPUTASSIST_ACCEPT", EV_KEY, 612 },
+  { "KEY_KBDINPUTASSIST_CANCEL", EV_KEY, 613 },
+  { "KEY_RIGHT_UP", EV_KEY, 614 },
+  { "KEY_RIGHT_DOWN", EV_KEY, 615 },
+  { "KEY_LEFT_UP", EV_KEY, 616 },
+  { "KEY_LEFT_DOWN", EV_KEY, 617 },
+  { "KEY_ROOT_MENU", EV_KEY, 618 },
+  { "KEY_MEDIA_TOP_MENU", EV_KEY, 619 },
+  { "KEY_NUMERIC_11", EV_KEY, 620 },
+  { "KEY_NUMERIC_12", EV_KEY, 621 },
+  { "KEY_AUDIO_DESC", EV_KEY, 622 },
+  { "KEY_3D_MODE", EV_KEY, 623 },
+  { "KEY_NEXT_FAVORITE", EV_KEY, 624 },
+  { "KEY_STOP_RECORD", EV_KEY, 625 },
+  { "KEY_PAUSE_RECORD", EV_KEY, 626 },
+  { "KEY_VOD", EV_KEY, 627 },
+  { "KEY_UNMUTE", EV_KEY, 628 },
+  { "KEY_FASTREVERSE", EV_KEY, 629 },
+  { "KEY_SLOWREVERSE", EV_KEY, 630 },
+  { "KEY_DATA", EV_KEY, 631 },
+  { "KEY_ONSCREEN_KEYBOARD", EV_KEY, 632 },
+  { "KEY_PRIVACY_SCREEN_TOGGLE", EV_KEY, 633 },
+  { "KEY_SELECTIVE_SCREENSHOT", EV_KEY, 634 },
+  { "KEY_NEXT_ELEMENT", EV_KEY, 635 },
+  { "KEY_PREVIOUS_ELEMENT", EV_KEY, 636 },
+  { "KEY_AUTOPILOT_ENGAGE_TOGGLE", EV_KEY, 637 },
+  { "KEY_MARK_WAYPOINT", EV_KEY, 638 },
+  { "KEY_SOS", EV_KEY, 639 },
+  { "KEY_NAV_CHART", EV_KEY, 640 },
+  { "KEY_FISHING_CHART", EV_KEY, 641 },
+  { "KEY_SINGLE_RANGE_RADAR", EV_KEY, 642 },
+  { "KEY_DUAL_RANGE_RADAR", EV_KEY, 643 },
+  { "KEY_RADAR_OVERLAY", EV_KEY, 644 },
+  { "KEY_TRADITIONAL_SONAR", EV_KEY, 645 },
+  { "KEY_CLEARVU_SONAR", EV_KEY, 646 },
+  { "KEY_SIDEVU_SONAR", EV_KEY, 647 },
+  { "KEY_NAV_INFO", EV_KEY, 648 },
+  { "KEY_BRIGHTNESS_MENU", EV_KEY, 649 },
+  { "KEY_MACRO1", EV_KEY, 656 },
+  { "KEY_MACRO2", EV_KEY, 657 },
+  { "KEY_MACRO3", EV_KEY, 658 },
+  { "KEY_MACRO4", EV_KEY, 659 },
+  { "KEY_MACRO5", EV_KEY, 660 },
+  { "KEY_MACRO6", EV_KEY, 661 },
+  { "KEY_MACRO7", EV_KEY, 662 },
+  { "KEY_MACRO8", EV_KEY, 663 },
+  { "KEY_MACRO9", EV_KEY, 664 },
+  { "KEY_MACRO10", EV_KEY, 665 },
+  { "KEY_MACRO11", EV_KEY, 666 },
+  { "KEY_MACRO12", EV_KEY, 667 },
+  { "KEY_MACRO13", EV_KEY, 668 },
+  { "KEY_MACRO14", EV_KEY, 669 },
+  { "KEY_MACRO15", EV_KEY, 670 },
+  { "KEY_MACRO16", EV_KEY, 671 },
+  { "KEY_MACRO17", EV_KEY, 672 },
+  { "KEY_MACRO18", EV_KEY, 673 },
+  { "KEY_MACRO19", EV_KEY, 674 },
+  { "KEY_MACRO20", EV_KEY, 675 },
+  { "KEY_MACRO21", EV_KEY, 676 },
+  { "KEY_MACRO22", EV_KEY, 677 },
+  { "KEY_MACRO23", EV_KEY, 678 },
+  { "KEY_MACRO24", EV_KEY, 679 },
+  { "KEY_MACRO25", EV_KEY, 680 },
+  { "KEY_MACRO26", EV_KEY, 681 },
+  { "KEY_MACRO27", EV_KEY, 682 },
+  { "KEY_MACRO28", EV_KEY, 683 },
+  { "KEY_MACRO29", EV_KEY, 684 },
+  { "KEY_MACRO30", EV_KEY, 685 },
+  { "KEY_MACRO_RECORD_START", EV_KEY, 688 },
+  { "KEY_MACRO_RECORD_STOP", EV_KEY, 689 },
+  { "KEY_MACRO_PRESET_CYCLE", EV_KEY, 690 },
+  { "KEY_MACRO_PRESET1", EV_KEY, 691 },
+  { "KEY_MACRO_PRESET2", EV_KEY, 692 },
+  { "KEY_MACRO_PRESET3", EV_KEY, 693 },
+  { "KEY_KBD_LCD_MENU1", EV_KEY, 696 },
+  { "KEY_KBD_LCD_MENU2", EV_KEY, 697 },
+  { "KEY_KBD_LCD_MENU3", EV_KEY, 698 },
+  { "KEY_KBD_LCD_MENU4", EV_KEY, 699 },
+  { "KEY_KBD_LCD_MENU5", EV_KEY, 700 },
+  { "BTN_TRIGGER_HAPPY", EV_KEY, 704 },
+  { "BTN_TRIGGER_HAPPY1", EV_KEY, 704 },
+  { "BTN_TRIGGER_HAPPY2", EV_KEY, 705 },
+  { "BTN_TRIGGER_HAPPY3", EV_KEY, 706 },
+  { "BTN_TRIGGER_HAPPY4", EV_KEY, 707 },
+  { "BTN_TRIGGER_HAPPY5", EV_KEY, 708 },
+  { "BTN_TRIGGER_HAPPY6", EV_KEY, 709 },
+  { "BTN_TRIGGER_HAPPY7", EV_KEY, 710 },
+  { "BTN_TRIGGER_HAPPY8", EV_KEY, 711 },
+  { "BTN_TRIGGER_HAPPY9", EV_KEY, 712 },
+  { "BTN_TRIGGER_HAPPY10", EV_KEY, 713 },
+  { "BTN_TRIGGER_HAPPY11", EV_KEY, 714 },
+  { "BTN_TRIGGER_HAPPY12", EV_KEY, 715 },
+  { "BTN_TRIGGER_HAPPY13", EV_KEY, 716 },
+  { "BTN_TRIGGER_HAPPY14", EV_KEY, 717 },
+  { "BTN_TRIGGER_HAPPY15", EV_KEY, 718 },
+  { "BTN_TRIGGER_HAPPY16", EV_KEY, 719 },
+  { "BTN_TRIGGER_HAPPY17", EV_KEY, 720 },
+  { "BTN_TRIGGER_HAPPY18", EV_KEY, 721 },
+  { "BTN_TRIGGER_HAPPY19", EV_KEY, 722 },
+  { "BTN_TRIGGER_HAPPY20", EV_KEY, 723 },
+  { "BTN_TRIGGER_HAPPY21", EV_KEY, 724 },
+  { "BTN_TRIGGER_HAPPY22", EV_KEY, 725 },
+  { "BTN_TRIGGER_HAPPY23", EV_KEY, 726 },
+  { "BTN_TRIGGER_HAPPY24", EV_KEY, 727 },
+  { "BTN_TRIGGER_HAPPY25", EV_KEY, 728 },
+  { "BTN_TRIGGER_HAPPY26", EV_KEY, 729 },
+  { "BTN_TRIGGER_HAPPY27", EV_KEY, 730 },
+  { "BTN_TRIGGER_HAPPY28", EV_KEY, 731 },
+  { "BTN_TRIGGER_HAPPY29", EV_KEY, 732 },
+  { "BTN_TRIGGER_HAPPY30", EV_KEY, 733 },
+  { "BTN_TRIGGER_HAPPY31", EV_KEY, 734 },
+  { "BTN_TRIGGER_HAPPY32", EV_KEY, 735 },
+  { "BTN_TRIGGER_HAPPY33", EV_KEY, 736 },
+  { "BTN_TRIGGER_HAPPY34", EV_KEY, 737 },
+  { "BTN_TRIGGER_HAPPY35", EV_KEY, 738 },
+  { "BTN_TRIGGER_HAPPY36", EV_KEY, 739 },
+  { "BTN_TRIGGER_HAPPY37", EV_KEY, 740 },
+  { "BTN_TRIGGER_HAPPY38", EV_KEY, 741 },
+  { "BTN_TRIGGER_HAPPY39", EV_KEY, 742 },
+  { "BTN_TRIGGER_HAPPY40", EV_KEY, 743 },
+  { "REL_X", EV_REL, 0 },
+  { "REL_Y", EV_REL, 1 },
+  { "REL_Z", EV_REL, 2 },
+  { "REL_RX", EV_REL, 3 },
+  { "REL_RY", EV_REL, 4 },
+  { "REL_RZ", EV_REL, 5 },
+  { "REL_HWHEEL", EV_REL, 6 },
+  { "REL_DIAL", EV_REL, 7 },
+  { "REL_WHEEL", EV_REL, 8 },
+  { "REL_MISC", EV_REL, 9 },
+  { "REL_RESERVED", EV_REL, 10 },
+  { "REL_WHEEL_HI_RES", EV_REL, 11 },
+  { "REL_HWHEEL_HI_RES", EV_REL, 12 },
+  { "ABS_X", EV_ABS, 0 },
+  { "ABS_Y", EV_ABS, 1 },
+  { "ABS_Z", EV_ABS, 2 },
+  { "ABS_RX", EV_ABS, 3 },
+  { "ABS_RY", EV_ABS, 4 },
+  { "ABS_RZ", EV_ABS, 5 },
+  { "ABS_THROTTLE", EV_ABS, 6 },
+  { "ABS_RUDDER", EV_ABS, 7 },
+  { "ABS_WHEEL", EV_ABS, 8 },
+  { "ABS_GAS", EV_ABS, 9 },
+  { "ABS_BRAKE", EV_ABS, 10 },
+  { "ABS_HAT0X", EV_ABS, 16 },
+  { "ABS_HAT0Y", EV_ABS, 17 },
+  { "ABS_HAT1X", EV_ABS, 18 },
+  { "ABS_HAT1Y", EV_ABS, 19 },
+  { "ABS_HAT2X", EV_ABS, 20 },
+  { "ABS_HAT2Y", EV_ABS, 21 },
+  { "ABS_HAT3X", EV_ABS, 22 },
+  { "ABS_HAT3Y", EV_ABS, 23 },
+  { "ABS_PRESSURE", EV_ABS, 24 },
+  { "ABS_DISTANCE", EV_ABS, 25 },
+  { "ABS_TILT_X", EV_ABS, 26 },
+  { "ABS_TILT_Y", EV_ABS, 27 },
+  { "ABS_TOOL_WIDTH", EV_ABS, 28 },
+  { "ABS_VOLUME", EV_ABS, 32 },
+  { "ABS_PROFILE", EV_ABS, 33 },
+  { "ABS_MISC", EV_ABS, 40 },
+  { "ABS_RESERVED", EV_ABS, 46 },
+  { "ABS_MT_SLOT", EV_ABS, 47 },
+  { "ABS_MT_TOUCH_MAJOR", EV_ABS, 48 },
+  { "ABS_MT_TOUCH_MINOR", EV_ABS, 49 },
+  { "ABS_MT_WIDTH_MAJOR", EV_ABS, 50 },
+  { "ABS_MT_WIDTH_MINOR", EV_ABS, 51 },
+  { "ABS_MT_ORIENTATION", EV_ABS, 52 },
+  { "ABS_MT_POSITION_X", EV_ABS, 53 },
+  { "ABS_MT_POSITION_Y", EV_ABS, 54 },
+  { "ABS_MT_TOOL_TYPE", EV_ABS, 55 },
+  { "ABS_MT_BLOB_ID", EV_ABS, 56 },
+  { "ABS_MT_TRACKING_ID", EV_ABS, 57 },
+  { "ABS_MT_PRESSURE", EV_ABS, 58 },
+  { "ABS_MT_DISTANCE", EV_ABS, 59 },
+  { "ABS_MT_TOOL_X", EV_ABS, 60 },
+  { "ABS_MT_TOOL_Y", EV_ABS, 61 },
+};
+
+bool parseEventCode(std::string const& name, EventCode& result)
+{
+  for(EventCode const& ec : EVENT_CODES)
+  {
+    if(name == ec.name)
+    {
+      result = ec;
+      return true;
+    }
+  }
+
+  char* end = nullptr;
+  unsigned long code = std::strtoul(name.data(), &end, 0);
+  if(!name.empty() && *end == '\0' && code <= KEY_MAX)
+  {
+    result = {nullptr, EV_KEY, static_cast<unsigned int>(code)};
+    return true;
+  }
+
+  return false;
+}
+
+char const* eventCodeName(unsigned int type, unsigned int code)
+{
+  for(EventCode const& ec : EVENT_CODES)
+  {
+    if(ec.type == type && ec.code == code)
+      return ec.name;
+  }
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+// Bump allocator for memory that only lives until reset(), eg. a plugin's
+// temporaries while handling one input frame. Allocating moves a pointer,
+// reset() releases everything at once and nothing is ever destroyed. What
+// does not fit comes from the heap until the next reset, which grows the
+// block to fit it, so a steady workload stops allocating after a few frames.
+class FrameArena
+{
+public:
+  explicit FrameArena(std::size_t size = 64 * 1024);
+  FrameArena(FrameArena const&) = delete;
+  // Alignment is a power of two
+  void* allocate(std::size_t size, std::size_t alignment);
+  void reset();
+  std::size_t capacity() const;
+
+private:
+  static std::uintptr_t align(std::uintptr_t address, std::size_t alignment);
+
+  std::unique_ptr<char[]> _block;
+  std::size_t _size;
+  std::size_t _used;
+  std::vector<std::unique_ptr<char[]>> _overflow;
+  std::size_t _overflowSize;
+};
+
+FrameArena::FrameArena(std::size_t size) :
+  _block(new char[size]), _size(size), _used(0), _overflow(), _overflowSize(0)
+{
+}
+
+std::uintptr_t FrameArena::align(std::uintptr_t address, std::size_t alignment)
+{
+  return (address + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+}
+
+void* FrameArena::allocate(std::size_t size, std::size_t alignment)
+{
+  std::uintptr_t const base = reinterpret_cast<std::uintptr_t>(_block.get());
+  std::uintptr_t const start = align(base + _used, alignment);
+  if(start + size <= base + _size)
+  {
+    _used = start + size - base;
+    return reinterpret_cast<void*>(start);
+  }
+
+  std::size_t const extra = size + alignment;
+  _overflow.emplace_back(new char[extra]);
+  _overflowSize += extra;
+  return reinterpret_cast<void*>(align(
+        reinterpret_cast<std::uintptr_t>(_overflow.back().get()), alignment));
+}
+
+void FrameArena::reset()
+{
+  if(!_overflow.empty())
+  {
+    // Doubling at least, a frame that needed more will likely come again
+    _size = std::max(_size * 2, _size + _overflowSize);
+    _block.reset(new char[_size]);
+    _overflow.clear();
+    _overflowSize = 0;
+  }
+  _used = 0;
+}
+
+std::size_t FrameArena::capacity() const
+{
+  return _size;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef FUNKEYMONKEY_HOST_H
+#define FUNKEYMONKEY_HOST_H
+
+#include "uinputdevice.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Services FunKeyMonkey offers to plugins. A plugin receives the host
+// through the optional attach() hook before init() is called.
+class FunKeyMonkeyHost
+{
+public:
+  typedef int OutputId;
+  static constexpr OutputId INVALID_OUTPUT = -1;
+  typedef int TimerId;
+  static constexpr TimerId INVALID_TIMER = -1;
+
+  // Declare a virtual output device, typically in init(). Declaring an
+  // output with the same name again, eg. after a hot reload, returns the
+  // existing device if its capabilities are unchanged.
+  virtual OutputId output(std::string const& name, unsigned int bus,
+      unsigned int vendor, unsigned int product, unsigned int version,
+      std::vector<UinputDevice::PossibleEvent> const& possibleEvents,
+      std::vector<UinputDevice::AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData
+        = std::vector<UinputDevice::AbsoluteAxisCalibrationData>()) = 0;
+
+  // Queue an event on an output. The host writes queued events out after
+  // each input frame. Threads of a plugin that emit outside of its
+  // callbacks must call flush() themselves.
+  virtual void emit(OutputId output, unsigned int type, unsigned int code, int value) = 0;
+  virtual void flush(OutputId output) = 0;
+
+  // Call callback(data) once CLOCK_MONOTONIC reaches deadline, given in
+  // nanoseconds like input event timestamps. Callbacks run between input
+  // frames on the thread that calls handle(), and events they emit are
+  // written out right after. Timers are dropped when the plugin is
+  // reloaded.
+  virtual TimerId timer(unsigned long long deadline, void (*callback)(void*), void* data) = 0;
+  virtual void cancel(TimerId timer) = 0;
+
+  // Memory for temporaries of the callback asking for it, eg. text built
+  // per event, without touching the heap. It is all released when the host
+  // writes out the events after the callback, so nothing may be kept in it
+  // any longer, and nothing put there is destroyed. Only for the thread
+  // that calls handle().
+  virtual void* scratch(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) = 0;
+  template<typename T>
+  T* scratch(std::size_t count)
+  {
+    return static_cast<T*>(scratch(sizeof(T) * count, alignof(T)));
+  }
+
+protected:
+  ~FunKeyMonkeyHost() {}
+};
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <linux/input.h>
 
+class FunKeyMonkeyHost;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,6 +16,23 @@ void destroy();
 void user1();
 void user2();
 
+// Optional, receives the host before init. Plugins declare their output
+// devices and emit events through it, see funkeymonkeyhost.h.
+void attach(FunKeyMonkeyHost* host);
+
+// Optional hot reload hooks. On reload exportState is called on the running
+// plugin, first with a null buffer to query the size and then to fill the
+// buffer, returning the number of bytes written. The running plugin is then
+// destroyed and importState is called on the new plugin right before its
+// init. Outputs declared through the host survive the swap by themselves,
+// anything else the plugin wants to keep must be handed over in the state.
+unsigned int exportState(void* buffer, unsigned int size);
+void importState(void const* buffer, unsigned int size);
+
+// Optional, takes a key=value setting at runtime, eg. from the control
+// socket. Returns false for settings it does not know or cannot apply.
+bool configure(char const* setting);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,10 +1,24 @@
 #ifndef FUNKEYMONKEY_MODULE_LOADER_H
 #define FUNKEYMONKEY_MODULE_LOADER_H
 
+#include "funkeymonkeyhost.h"
+#include "moduleprofiler.h"
+#include "watchdog.h"
+#include "metrics.h"
+
 #include <linux/input.h>
 #include <string>
+#include <vector>
 #include <iostream>
+#include <functional>
+#include <cstdlib>
+#include <cerrno>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 
 class FunKeyMonkeyModule
 {
@@ -17,83 +31,327 @@ public:
   void destroy();
   void user1();
   void user2();
+  // Hand the plugin a key=value setting at runtime. False if the plugin
+  // rejects it or takes no runtime settings.
+  bool configure(std::string const& setting);
+  bool configurable() const;
+
+  // Replace the running plugin with the one at path. The new library is
+  // loaded and resolved before the current one is touched, so on failure,
+  // including a library without init, handle or destroy, the current
+  // plugin keeps running. Must be called between frames.
+  // The library is loaded from a private copy of the file, so reloading
+  // from the path already loaded picks up whatever is there now.
+  // unloaded is called between destroying the current plugin and
+  // initializing the new one.
+  bool reload(std::string const& path, char const** argv, unsigned int argc,
+      std::function<void()> const& unloaded = nullptr);
+  std::string const& path() const;
+
+  // Time every callback into profiler, or stop profiling with nullptr.
+  // The handle dispatch is chosen here so an unprofiled module pays nothing.
+  void profile(ModuleProfiler* profiler);
+  void report(std::ostream& os);
+  // Report callbacks to watchdog, or stop with nullptr
+  void watch(Watchdog* watchdog);
+  // Count dispatched events per role and reloads, or stop with nullptr
+  void metrics(Metrics* metrics);
+  // Host handed to the plugin before every init
+  void host(FunKeyMonkeyHost* host);
+
 private:
-  void *_lib;
-  void (*_init)(char const**, unsigned int);
-  void (*_handle)(input_event const&, int src);
-  void (*_destroy)();
-  void (*_user1)();
-  void (*_user2)();
+  struct Library
+  {
+    void *lib;
+    void (*init)(char const**, unsigned int);
+    void (*handle)(input_event const&, int src);
+    void (*destroy)();
+    void (*user1)();
+    void (*user2)();
+    unsigned int (*exportState)(void*, unsigned int);
+    void (*importState)(void const*, unsigned int);
+    void (*attach)(FunKeyMonkeyHost*);
+    bool (*configure)(char const*);
+    // The copy a reloaded library was loaded from, -1 for none
+    int copy;
+  };
+
+  // With copy, loads the library from a copy of the file in memory. dlopen
+  // hands back the library already loaded under a name instead of loading
+  // it again, even if the file has been replaced since.
+  static Library open(std::string const& path, bool copy = false);
+  static void unload(Library const& library);
+
+  void handlePlain(input_event const& e, int src);
+  void handleInstrumented(input_event const& e, int src);
+  void selectDispatch();
+
+  // Wraps the non-handle callbacks in whatever instrumentation is active
+  template<typename Call>
+  void instrumented(ModuleProfiler::Callback callback, char const* name, Call call);
+
+  Library _library;
+  std::string _path;
+  ModuleProfiler* _profiler;
+  Watchdog* _watchdog;
+  Metrics* _metrics;
+  RoleCounters _dispatched;
+  Metrics::Counter _reloads;
+  FunKeyMonkeyHost* _host;
+  void (FunKeyMonkeyModule::*_dispatchHandle)(input_event const&, int);
 };
 
 FunKeyMonkeyModule::FunKeyMonkeyModule(std::string const& path) :
-  _lib(nullptr), _init(nullptr), _handle(nullptr), _destroy(nullptr)
+  _library(open(path)), _path(path), _profiler(nullptr),
+  _watchdog(nullptr), _metrics(nullptr), _dispatched(), _reloads(), _host(nullptr),
+  _dispatchHandle(&FunKeyMonkeyModule::handlePlain)
+{
+}
+FunKeyMonkeyModule::~FunKeyMonkeyModule()
 {
+  unload(_library);
+}
+FunKeyMonkeyModule::Library FunKeyMonkeyModule::open(std::string const& path, bool copy)
+{
+  Library library = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+    nullptr, -1};
+
   char* absPath = realpath(path.data(), nullptr);
-  if(absPath)
+  if(absPath && copy)
+  {
+    // The copy stays open while the library is loaded, so the next copy
+    // never gets the same /proc/self/fd name
+    int source = ::open(absPath, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    library.copy = memfd_create(path.data(), MFD_CLOEXEC);
+    if(source < 0 || library.copy < 0 || fstat(source, &st) < 0
+        || sendfile(library.copy, source, nullptr, st.st_size) != st.st_size)
+    {
+      std::cerr << "ERROR: Could not copy module " << path << ", error code "
+        << errno << std::endl;
+    }
+    else
+    {
+      library.lib = dlopen(("/proc/self/fd/" + std::to_string(library.copy)).data(), RTLD_LAZY);
+    }
+    if(source >= 0)
+      ::close(source);
+    if(!library.lib && library.copy >= 0)
+    {
+      ::close(library.copy);
+      library.copy = -1;
+    }
+  }
+  else if(absPath)
   {
-    _lib = dlopen(absPath, RTLD_LAZY);
-    delete absPath;
+    library.lib = dlopen(absPath, RTLD_LAZY);
   }
-  if (!_lib)
+  free(absPath);
+  if (!library.lib)
   {
-    std::cerr << "ERROR: Error opening module " << path << ": " << dlerror() << std::endl;
+    char const* error = dlerror();
+    std::cerr << "ERROR: Error opening module " << path << ": "
+      << (error ? error : "file not found") << std::endl;
   }
   else
   {
-    auto load = [this](std::string const& name) {
-      void* value = dlsym(_lib, name.data());
+    void* lib = library.lib;
+    auto load = [lib](std::string const& name, bool optional) {
+      dlerror();
+      void* value = dlsym(lib, name.data());
       auto error = dlerror();
       if(error)
       {
-        std::cerr << "ERROR: While loading " << name << ": " << error << std::endl;
+        if(!optional)
+          std::cerr << "ERROR: While loading " << name << ": " << error << std::endl;
         value = nullptr;
       }
       return value;
     };
-    _init = reinterpret_cast<decltype(_init)>(load("init"));
-    _handle = reinterpret_cast<decltype(_handle)>(load("handle"));
-    _destroy = reinterpret_cast<decltype(_destroy)>(load("destroy"));
-    _user1 = reinterpret_cast<decltype(_user1)>(load("user1"));
-    _user2 = reinterpret_cast<decltype(_user2)>(load("user2"));
+    library.init = reinterpret_cast<decltype(library.init)>(load("init", false));
+    library.handle = reinterpret_cast<decltype(library.handle)>(load("handle", false));
+    library.destroy = reinterpret_cast<decltype(library.destroy)>(load("destroy", false));
+    library.user1 = reinterpret_cast<decltype(library.user1)>(load("user1", false));
+    library.user2 = reinterpret_cast<decltype(library.user2)>(load("user2", false));
+    library.exportState = reinterpret_cast<decltype(library.exportState)>(load("exportState", true));
+    library.importState = reinterpret_cast<decltype(library.importState)>(load("importState", true));
+    library.attach = reinterpret_cast<decltype(library.attach)>(load("attach", true));
+    library.configure = reinterpret_cast<decltype(library.configure)>(load("configure", true));
   }
+
+  return library;
 }
-FunKeyMonkeyModule::~FunKeyMonkeyModule()
+void FunKeyMonkeyModule::unload(Library const& library)
 {
-  if(_lib)
-    dlclose(_lib);
+  if(library.lib)
+    dlclose(library.lib);
+  if(library.copy >= 0)
+    ::close(library.copy);
 }
 bool FunKeyMonkeyModule::ready() const
 {
-  return _lib != 0;
+  return _library.lib != 0;
+}
+std::string const& FunKeyMonkeyModule::path() const
+{
+  return _path;
+}
+void FunKeyMonkeyModule::profile(ModuleProfiler* profiler)
+{
+  _profiler = profiler;
+  selectDispatch();
+}
+void FunKeyMonkeyModule::watch(Watchdog* watchdog)
+{
+  _watchdog = watchdog;
+  selectDispatch();
+}
+void FunKeyMonkeyModule::metrics(Metrics* metrics)
+{
+  _metrics = metrics;
+  _dispatched.declare(metrics, "funkeymonkey_dispatched_events_total",
+      "Events handed to the plugin");
+  _reloads = metrics ? metrics->counter("funkeymonkey_plugin_reloads_total",
+      "Plugin reloads") : Metrics::Counter();
+  selectDispatch();
+}
+void FunKeyMonkeyModule::host(FunKeyMonkeyHost* host)
+{
+  _host = host;
+}
+void FunKeyMonkeyModule::selectDispatch()
+{
+  _dispatchHandle = _profiler || _watchdog || _metrics ? &FunKeyMonkeyModule::handleInstrumented
+    : &FunKeyMonkeyModule::handlePlain;
+}
+void FunKeyMonkeyModule::report(std::ostream& os)
+{
+  if(_profiler)
+    _profiler->report(os);
+}
+template<typename Call>
+void FunKeyMonkeyModule::instrumented(ModuleProfiler::Callback callback, char const* name, Call call)
+{
+  if(_watchdog)
+    _watchdog->begin(name);
+  unsigned long long start = _profiler ? ModuleProfiler::now() : 0;
+
+  call();
+
+  if(_profiler)
+    _profiler->call(callback, ModuleProfiler::now() - start);
+  if(_watchdog)
+    _watchdog->end();
 }
 void FunKeyMonkeyModule::init(char const** argv, unsigned int argc)
 {
-  if(_init)
-    (*_init)(argv, argc);
+  if(_library.attach)
+    (*_library.attach)(_host);
+  if(_library.init)
+    instrumented(ModuleProfiler::INIT, "init", [&]{ (*_library.init)(argv, argc); });
 }
 void FunKeyMonkeyModule::handle(input_event const& e, int src)
 {
-  if(_handle)
-    (*_handle)(e, src);
+  (this->*_dispatchHandle)(e, src);
+}
+void FunKeyMonkeyModule::handlePlain(input_event const& e, int src)
+{
+  if(_library.handle)
+    (*_library.handle)(e, src);
+}
+void FunKeyMonkeyModule::handleInstrumented(input_event const& e, int src)
+{
+  if(!_library.handle)
+    return;
+
+  _dispatched.add(src);
+  if(_watchdog)
+    _watchdog->begin("handle");
+  unsigned long long start = _profiler ? ModuleProfiler::now() : 0;
 
+  (*_library.handle)(e, src);
+
+  if(_profiler)
+    _profiler->handle(e, src, ModuleProfiler::now() - start);
+  if(_watchdog)
+    _watchdog->end();
 }
 void FunKeyMonkeyModule::destroy()
 {
-  if(_destroy)
-    (*_destroy)();
+  if(_library.destroy)
+    instrumented(ModuleProfiler::DESTROY, "destroy", [&]{ (*_library.destroy)(); });
 }
 
 void FunKeyMonkeyModule::user1()
 {
-  if(_user1)
-    (*_user1)();
+  if(_library.user1)
+    instrumented(ModuleProfiler::USER1, "user1", [&]{ (*_library.user1)(); });
 }
 
 void FunKeyMonkeyModule::user2()
 {
-  if(_user2)
-    (*_user2)();
+  if(_library.user2)
+    instrumented(ModuleProfiler::USER2, "user2", [&]{ (*_library.user2)(); });
+}
+
+bool FunKeyMonkeyModule::configure(std::string const& setting)
+{
+  bool accepted = false;
+  if(_library.configure)
+    instrumented(ModuleProfiler::CONFIGURE, "configure", [&]{
+      accepted = (*_library.configure)(setting.data());
+    });
+  return accepted;
+}
+
+bool FunKeyMonkeyModule::configurable() const
+{
+  return _library.configure != nullptr;
+}
+
+bool FunKeyMonkeyModule::reload(std::string const& path, char const** argv, unsigned int argc,
+    std::function<void()> const& unloaded)
+{
+  Library next = open(path, true);
+  if(!next.lib)
+    return false;
+  // A build missing any of these would swallow all input from here on
+  if(!next.init || !next.handle || !next.destroy)
+  {
+    std::cerr << "ERROR: " << path << " lacks init, handle or destroy, keeping the running plugin"
+      << std::endl;
+    unload(next);
+    return false;
+  }
+
+  std::vector<char> state;
+  bool const transferState = _library.exportState && next.importState;
+  if(transferState)
+  {
+    // First call queries the size, second one fills the buffer
+    state.resize((*_library.exportState)(nullptr, 0));
+    state.resize((*_library.exportState)(state.data(), state.size()));
+  }
+
+  destroy();
+  if(unloaded)
+    unloaded();
+  Library previous = _library;
+  _library = next;
+  _path = path;
+
+  if(transferState)
+  {
+    if(_library.attach)
+      (*_library.attach)(_host);
+    (*_library.importState)(state.data(), state.size());
+  }
+  init(argv, argc);
+
+  unload(previous);
+  _reloads.add();
+
+  return true;
 }
 
 #endif
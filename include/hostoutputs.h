@@ -0,0 +1,598 @@
+#ifndef HOST_OUTPUTS_H
+#define HOST_OUTPUTS_H
+
+#include "funkeymonkeyhost.h"
+#include "outputsink.h"
+#include "hosttimers.h"
+#include "moduleprofiler.h"
+#include "metrics.h"
+#include "framearena.h"
+
+#include <linux/input.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+// The host side of plugin outputs. Events emitted by plugins are buffered
+// per output and written out with one write per output and frame. Redundant
+// SYN_REPORTs are dropped, and the time from the originating input event to
+// the write is tracked. Plugin timers are kept here as well, for the
+// dispatch loop to fire, and the scratch memory of the plugin, released
+// whenever flushAll() writes everything out.
+class HostOutputs : public FunKeyMonkeyHost
+{
+public:
+  enum SinkType { UINPUT_SINK, FILE_SINK, MEMORY_SINK, TRACE_SINK, SOCKET_SINK, NULL_SINK };
+
+  // Outputs flush early if a plugin emits this much within one frame
+  static constexpr unsigned int MAX_BUFFERED = 256;
+
+  HostOutputs();
+  HostOutputs(HostOutputs const&) = delete;
+
+  // Where outputs declared from now on send their events
+  bool sinks(SinkType type, std::string const& path = "");
+  // Where the output of this name sends its events, switching it right
+  // away if it was declared already
+  bool sinks(std::string const& output, SinkType type, std::string const& path = "");
+  // NAME=SINK for one output or SINK for all without one of their own, where
+  // SINK is uinput, file:PATH, trace:PATH, socket:PATH, null or memory.
+  // Outputs declared already switch right away.
+  bool sinks(std::string const& option);
+  // Output names with where they send their events, as given to sinks()
+  std::vector<std::pair<std::string, std::string>> sinkNames() const;
+  OutputSink* sink(OutputId output) const;
+  // Replace where one output's events go, eg. with a stub in benchmarks
+  void sink(OutputId output, std::unique_ptr<OutputSink> sink);
+
+  OutputId output(std::string const& name, unsigned int bus,
+      unsigned int vendor, unsigned int product, unsigned int version,
+      std::vector<UinputDevice::PossibleEvent> const& possibleEvents,
+      std::vector<UinputDevice::AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData
+        = std::vector<UinputDevice::AbsoluteAxisCalibrationData>()) override;
+  void emit(OutputId output, unsigned int type, unsigned int code, int value) override;
+  void flush(OutputId output) override;
+  TimerId timer(unsigned long long deadline, void (*callback)(void*), void* data) override;
+  void cancel(TimerId timer) override;
+  void* scratch(std::size_t size, std::size_t alignment) override;
+  using FunKeyMonkeyHost::scratch;
+  HostTimers& timers();
+
+  // Input event currently dispatched to the plugin, 0 when none
+  void origin(unsigned long long timestamp);
+  static unsigned long long timestamp(input_event const& e);
+  void flushAll();
+
+  // Outputs not declared again by a reloaded plugin are destroyed
+  void markUnclaimed();
+  void destroyUnclaimed();
+
+  void report(std::ostream& os) const;
+  // Count emitted events and buffered ones per output into metrics
+  void metrics(Metrics* metrics);
+
+private:
+  struct Output
+  {
+    std::string name;
+    unsigned int bus;
+    unsigned int vendor;
+    unsigned int product;
+    unsigned int version;
+    std::vector<UinputDevice::PossibleEvent> possibleEvents;
+    std::vector<UinputDevice::AbsoluteAxisCalibrationData> absoluteAxesCalibrationData;
+    std::unique_ptr<OutputSink> sink;
+    std::string sinkName;
+    bool claimed;
+
+    // Guards everything below, plugin threads may emit concurrently
+    std::mutex mutex;
+    std::vector<input_event> buffer;
+    bool frameOpen;
+    unsigned long long origin;
+    unsigned long long events;
+    unsigned long long writes;
+    unsigned long long coalesced;
+    ModuleProfiler::Histogram latency;
+    Metrics::Counter emitted;
+    Metrics::Gauge buffered;
+  };
+
+  struct SinkSpec
+  {
+    SinkType type;
+    std::string path;
+  };
+
+  void flush(Output& output);
+  void declareMetrics(Output& output);
+  std::unique_ptr<OutputSink> createSink(Output const& output, SinkSpec const& spec);
+  std::shared_ptr<SharedFile> file(std::string const& path);
+  // Whether a sink of this kind can be created, ie. its file opened
+  bool check(SinkSpec const& spec);
+  bool switchSink(Output& output, SinkSpec const& spec);
+  static std::string name(SinkSpec const& spec);
+  static bool sameEvents(Output const& output,
+      std::vector<UinputDevice::PossibleEvent> const& possibleEvents,
+      std::vector<UinputDevice::AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData);
+
+  SinkSpec _sinks;
+  std::map<std::string, SinkSpec> _outputSinks;
+  // Log and trace files by path, outputs writing to the same path share one
+  std::map<std::string, std::shared_ptr<SharedFile>> _files;
+  std::vector<std::unique_ptr<Output>> _outputs;
+  std::atomic<unsigned long long> _origin;
+  HostTimers _timers;
+  FrameArena _scratch;
+  Metrics* _metrics;
+};
+
+HostOutputs::HostOutputs() :
+  _sinks{UINPUT_SINK, ""}, _outputSinks(), _files(), _outputs(), _origin(0), _timers(), _scratch(), _metrics(nullptr)
+{
+}
+
+bool HostOutputs::sinks(SinkType type, std::string const& path)
+{
+  _sinks = {type, path};
+  return check(_sinks);
+}
+
+bool HostOutputs::sinks(std::string const& name, SinkType type, std::string const& path)
+{
+  SinkSpec const spec = {type, path};
+  if(!check(spec))
+    return false;
+
+  _outputSinks[name] = spec;
+  bool success = true;
+  for(auto& output : _outputs)
+  {
+    if(output->name == name && output->sink)
+      success &= switchSink(*output, spec);
+  }
+  return success;
+}
+
+bool HostOutputs::sinks(std::string const& option)
+{
+  std::size_t const equals = option.find('=');
+  std::string const text = equals == std::string::npos ? option : option.substr(equals + 1);
+  std::size_t const colon = text.find(':');
+  std::string const kind = text.substr(0, colon);
+  std::string const path = colon == std::string::npos ? "" : text.substr(colon + 1);
+
+  SinkSpec spec = {UINPUT_SINK, path};
+  if(kind == "file")
+    spec.type = FILE_SINK;
+  else if(kind == "trace")
+    spec.type = TRACE_SINK;
+  else if(kind == "socket")
+    spec.type = SOCKET_SINK;
+  else if(kind == "null")
+    spec.type = NULL_SINK;
+  else if(kind == "memory")
+    spec.type = MEMORY_SINK;
+  else if(kind != "uinput")
+  {
+    std::cerr << "ERROR: Unknown output sink '" << kind << "'" << std::endl;
+    return false;
+  }
+
+  bool const needsPath = spec.type == FILE_SINK || spec.type == TRACE_SINK
+    || spec.type == SOCKET_SINK;
+  if(needsPath == path.empty())
+  {
+    std::cerr << "ERROR: Output sink '" << kind << "' "
+      << (needsPath ? "needs a path" : "takes no path") << std::endl;
+    return false;
+  }
+
+  if(equals != std::string::npos)
+    return sinks(option.substr(0, equals), spec.type, spec.path);
+
+  if(!sinks(spec.type, spec.path))
+    return false;
+
+  bool success = true;
+  for(auto& output : _outputs)
+  {
+    if(output->sink && !_outputSinks.count(output->name))
+      success &= switchSink(*output, spec);
+  }
+  return success;
+}
+
+std::vector<std::pair<std::string, std::string>> HostOutputs::sinkNames() const
+{
+  std::vector<std::pair<std::string, std::string>> names;
+  for(auto const& output : _outputs)
+  {
+    if(output->sink)
+      names.push_back({output->name, output->sinkName});
+  }
+  return names;
+}
+
+OutputSink* HostOutputs::sink(OutputId output) const
+{
+  if(output < 0 || output >= static_cast<OutputId>(_outputs.size()))
+    return nullptr;
+  return _outputs[output]->sink.get();
+}
+
+void HostOutputs::sink(OutputId id, std::unique_ptr<OutputSink> sink)
+{
+  if(id < 0 || id >= static_cast<OutputId>(_outputs.size()))
+    return;
+
+  Output& output = *_outputs[id];
+  std::lock_guard<std::mutex> lk(output.mutex);
+  flush(output);
+  output.sink = std::move(sink);
+  output.sinkName = "custom";
+  if(_metrics && output.sink)
+    output.sink->metrics(_metrics, Metrics::label("output", output.name));
+}
+
+std::shared_ptr<SharedFile> HostOutputs::file(std::string const& path)
+{
+  std::shared_ptr<SharedFile>& file = _files[path];
+  if(!file)
+  {
+    file = std::make_shared<SharedFile>();
+    file->stream.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    file->traced = 0;
+  }
+  return file;
+}
+
+bool HostOutputs::check(SinkSpec const& spec)
+{
+  if((spec.type == FILE_SINK || spec.type == TRACE_SINK) && !file(spec.path)->stream)
+  {
+    std::cerr << "ERROR: Could not open output file " << spec.path << std::endl;
+    _files.erase(spec.path);
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<OutputSink> HostOutputs::createSink(Output const& output, SinkSpec const& spec)
+{
+  std::unique_ptr<OutputSink> sink;
+  switch(spec.type)
+  {
+    case UINPUT_SINK:
+      sink.reset(new UinputSink(output.name, output.bus, output.vendor, output.product,
+            output.version, output.possibleEvents, output.absoluteAxesCalibrationData));
+      break;
+    case FILE_SINK:
+      sink.reset(new FileSink(file(spec.path), output.name));
+      break;
+    case MEMORY_SINK:
+      sink.reset(new MemorySink);
+      break;
+    case TRACE_SINK:
+      sink.reset(new TraceSink(file(spec.path), output.name));
+      break;
+    case SOCKET_SINK:
+      sink.reset(new SocketSink(spec.path, output.name));
+      break;
+    case NULL_SINK:
+      sink.reset(new NullSink);
+      break;
+  }
+  return sink;
+}
+
+bool HostOutputs::switchSink(Output& output, SinkSpec const& spec)
+{
+  std::unique_ptr<OutputSink> sink = createSink(output, spec);
+  if(!sink->ready())
+  {
+    std::cerr << "ERROR: Could not switch output '" << output.name << "' to "
+      << name(spec) << std::endl;
+    return false;
+  }
+
+  OutputId id = 0;
+  while(_outputs[id].get() != &output)
+  {
+    ++id;
+  }
+  this->sink(id, std::move(sink));
+  output.sinkName = name(spec);
+  return true;
+}
+
+std::string HostOutputs::name(SinkSpec const& spec)
+{
+  switch(spec.type)
+  {
+    case UINPUT_SINK: return "uinput";
+    case FILE_SINK: return "file:" + spec.path;
+    case MEMORY_SINK: return "memory";
+    case TRACE_SINK: return "trace:" + spec.path;
+    case SOCKET_SINK: return "socket:" + spec.path;
+    case NULL_SINK: return "null";
+  }
+  return "";
+}
+
+FunKeyMonkeyHost::OutputId HostOutputs::output(std::string const& name, unsigned int bus,
+    unsigned int vendor, unsigned int product, unsigned int version,
+    std::vector<UinputDevice::PossibleEvent> const& possibleEvents,
+    std::vector<UinputDevice::AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData)
+{
+  for(OutputId i = 0; i < static_cast<OutputId>(_outputs.size()); ++i)
+  {
+    Output& existing = *_outputs[i];
+    if(existing.name != name || !existing.sink)
+      continue;
+
+    if(existing.bus == bus && existing.vendor == vendor
+        && existing.product == product && existing.version == version
+        && sameEvents(existing, possibleEvents, absoluteAxesCalibrationData))
+    {
+      existing.claimed = true;
+      return i;
+    }
+
+    // Capabilities changed, the device has to be recreated
+    flush(existing);
+    existing.sink.reset();
+  }
+
+  std::unique_ptr<Output> output(new Output);
+  output->name = name;
+  output->bus = bus;
+  output->vendor = vendor;
+  output->product = product;
+  output->version = version;
+  output->possibleEvents = possibleEvents;
+  output->absoluteAxesCalibrationData = absoluteAxesCalibrationData;
+  output->claimed = true;
+  output->buffer.reserve(MAX_BUFFERED);
+  output->frameOpen = false;
+  output->origin = 0;
+  output->events = 0;
+  output->writes = 0;
+  output->coalesced = 0;
+  output->latency = {0, 0, 0, {}};
+
+  auto const own = _outputSinks.find(name);
+  SinkSpec const& spec = own != _outputSinks.end() ? own->second : _sinks;
+  output->sink = createSink(*output, spec);
+  output->sinkName = this->name(spec);
+
+  if(!output->sink->ready())
+  {
+    std::cerr << "ERROR: Could not create output '" << name << "'" << std::endl;
+  }
+
+  declareMetrics(*output);
+  _outputs.push_back(std::move(output));
+  return _outputs.size() - 1;
+}
+
+void HostOutputs::emit(OutputId id, unsigned int type, unsigned int code, int value)
+{
+  if(id < 0 || id >= static_cast<OutputId>(_outputs.size()))
+    return;
+
+  Output& output = *_outputs[id];
+  std::lock_guard<std::mutex> lk(output.mutex);
+
+  if(type == EV_SYN && code == SYN_REPORT)
+  {
+    // A report without anything to report is noise
+    if(!output.frameOpen)
+    {
+      output.coalesced += 1;
+      return;
+    }
+    output.frameOpen = false;
+  }
+  else
+  {
+    output.frameOpen = true;
+  }
+
+  if(output.buffer.empty())
+  {
+    output.origin = _origin.load(std::memory_order_relaxed);
+  }
+
+  input_event e;
+  memset(&e, 0, sizeof(e));
+  e.type = type;
+  e.code = code;
+  e.value = value;
+  output.buffer.push_back(e);
+  output.events += 1;
+  output.emitted.add();
+  output.buffered.set(output.buffer.size());
+
+  if(output.buffer.size() >= MAX_BUFFERED)
+  {
+    flush(output);
+  }
+}
+
+void HostOutputs::flush(OutputId id)
+{
+  if(id < 0 || id >= static_cast<OutputId>(_outputs.size()))
+    return;
+
+  Output& output = *_outputs[id];
+  std::lock_guard<std::mutex> lk(output.mutex);
+  flush(output);
+}
+
+void HostOutputs::flush(Output& output)
+{
+  if(output.buffer.empty())
+    return;
+
+  if(output.sink)
+  {
+    output.sink->write(output.buffer.data(), output.buffer.size());
+  }
+  output.writes += 1;
+
+  if(output.origin)
+  {
+    output.latency.add(ModuleProfiler::now() - output.origin);
+  }
+  output.buffer.clear();
+  output.buffered.set(0);
+}
+
+FunKeyMonkeyHost::TimerId HostOutputs::timer(unsigned long long deadline,
+    void (*callback)(void*), void* data)
+{
+  return _timers.schedule(deadline, callback, data);
+}
+
+void HostOutputs::cancel(TimerId timer)
+{
+  _timers.cancel(timer);
+}
+
+void* HostOutputs::scratch(std::size_t size, std::size_t alignment)
+{
+  return _scratch.allocate(size, alignment);
+}
+
+HostTimers& HostOutputs::timers()
+{
+  return _timers;
+}
+
+void HostOutputs::origin(unsigned long long timestamp)
+{
+  _origin.store(timestamp, std::memory_order_relaxed);
+}
+
+unsigned long long HostOutputs::timestamp(input_event const& e)
+{
+  // Input devices are switched to CLOCK_MONOTONIC, see EvdevDevice
+  return e.time.tv_sec * 1000000000ull + e.time.tv_usec * 1000ull;
+}
+
+void HostOutputs::flushAll()
+{
+  for(auto& output : _outputs)
+  {
+    std::lock_guard<std::mutex> lk(output->mutex);
+    flush(*output);
+  }
+  _scratch.reset();
+}
+
+void HostOutputs::markUnclaimed()
+{
+  for(auto& output : _outputs)
+  {
+    output->claimed = false;
+  }
+}
+
+void HostOutputs::destroyUnclaimed()
+{
+  for(auto& output : _outputs)
+  {
+    if(!output->claimed && output->sink)
+    {
+      std::lock_guard<std::mutex> lk(output->mutex);
+      output->buffer.clear();
+      output->sink.reset();
+    }
+  }
+}
+
+void HostOutputs::report(std::ostream& os) const
+{
+  os << std::left << std::setw(24) << "output"
+    << std::right << std::setw(12) << "events"
+    << std::setw(12) << "writes"
+    << std::setw(12) << "coalesced"
+    << std::setw(12) << "p50 ns"
+    << std::setw(12) << "p99 ns"
+    << std::setw(12) << "max ns" << std::endl;
+
+  for(auto const& output : _outputs)
+  {
+    std::lock_guard<std::mutex> lk(output->mutex);
+    os << std::left << std::setw(24) << output->name
+      << std::right << std::setw(12) << output->events
+      << std::setw(12) << output->writes
+      << std::setw(12) << output->coalesced
+      << std::setw(12) << output->latency.percentile(0.5)
+      << std::setw(12) << output->latency.percentile(0.99)
+      << std::setw(12) << output->latency.max << std::endl;
+  }
+}
+
+void HostOutputs::metrics(Metrics* metrics)
+{
+  _metrics = metrics;
+  for(auto& output : _outputs)
+  {
+    std::lock_guard<std::mutex> lk(output->mutex);
+    declareMetrics(*output);
+  }
+}
+
+void HostOutputs::declareMetrics(Output& output)
+{
+  // Without metrics only the pointer is dropped, a forked plugin runner
+  // must not touch a registry whose lock another thread may have held
+  if(!_metrics)
+    return;
+
+  std::string const labels = Metrics::label("output", output.name);
+  output.emitted = _metrics->counter("funkeymonkey_output_events_total",
+      "Events emitted by the plugin", labels);
+  output.buffered = _metrics->gauge("funkeymonkey_output_buffered_events",
+      "Events emitted and not yet written out", labels);
+  if(output.sink)
+    output.sink->metrics(_metrics, labels);
+}
+
+bool HostOutputs::sameEvents(Output const& output,
+    std::vector<UinputDevice::PossibleEvent> const& possibleEvents,
+    std::vector<UinputDevice::AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData)
+{
+  if(output.possibleEvents.size() != possibleEvents.size()
+      || output.absoluteAxesCalibrationData.size() != absoluteAxesCalibrationData.size())
+    return false;
+
+  for(unsigned int i = 0; i < possibleEvents.size(); ++i)
+  {
+    if(output.possibleEvents[i].type != possibleEvents[i].type
+        || output.possibleEvents[i].codes != possibleEvents[i].codes)
+      return false;
+  }
+
+  for(unsigned int i = 0; i < absoluteAxesCalibrationData.size(); ++i)
+  {
+    auto const& a = output.absoluteAxesCalibrationData[i];
+    auto const& b = absoluteAxesCalibrationData[i];
+    if(a.axis != b.axis || a.min != b.min || a.max != b.max
+        || a.fuzz != b.fuzz || a.flat != b.flat)
+      return false;
+  }
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef HOST_TIMERS_H
+#define HOST_TIMERS_H
+
+#include "funkeymonkeyhost.h"
+
+#include <vector>
+
+// Timers plugins schedule through the host. Nothing runs on its own: the
+// dispatch loop asks for the next deadline to bound its wait for input and
+// calls fire() with the current time, which may also be a virtual one.
+// Plugins rarely have more than a few timers, so they are kept unordered.
+class HostTimers
+{
+public:
+  typedef FunKeyMonkeyHost::TimerId TimerId;
+
+  HostTimers();
+  TimerId schedule(unsigned long long deadline, void (*callback)(void*), void* data);
+  void cancel(TimerId timer);
+  // Drop every timer, eg. when the plugin owning the callbacks is unloaded
+  void clear();
+
+  bool pending() const;
+  // Earliest deadline, only meaningful if pending()
+  unsigned long long next() const;
+  // Run the callbacks of timers due at now in deadline order, including
+  // ones scheduled by those callbacks. Returns whether any ran.
+  bool fire(unsigned long long now);
+
+private:
+  struct Timer
+  {
+    TimerId id;
+    unsigned long long deadline;
+    void (*callback)(void*);
+    void* data;
+  };
+
+  std::vector<Timer> _timers;
+  TimerId _nextId;
+};
+
+HostTimers::HostTimers() :
+  _timers(), _nextId(0)
+{
+}
+
+HostTimers::TimerId HostTimers::schedule(unsigned long long deadline,
+    void (*callback)(void*), void* data)
+{
+  TimerId id = _nextId;
+  // Ids wrap around without ever becoming INVALID_TIMER
+  _nextId = _nextId == 0x7fffffff ? 0 : _nextId + 1;
+  _timers.push_back({id, deadline, callback, data});
+  return id;
+}
+
+void HostTimers::cancel(TimerId timer)
+{
+  for(unsigned int i = 0; i < _timers.size(); ++i)
+  {
+    if(_timers[i].id == timer)
+    {
+      _timers[i] = _timers.back();
+      _timers.pop_back();
+      return;
+    }
+  }
+}
+
+void HostTimers::clear()
+{
+  _timers.clear();
+}
+
+bool HostTimers::pending() const
+{
+  return !_timers.empty();
+}
+
+unsigned long long HostTimers::next() const
+{
+  unsigned long long deadline = ~0ull;
+  for(Timer const& timer : _timers)
+  {
+    if(timer.deadline < deadline)
+      deadline = timer.deadline;
+  }
+  return deadline;
+}
+
+bool HostTimers::fire(unsigned long long now)
+{
+  bool fired = false;
+  while(!_timers.empty())
+  {
+    unsigned int earliest = 0;
+    for(unsigned int i = 1; i < _timers.size(); ++i)
+    {
+      if(_timers[i].deadline < _timers[earliest].deadline)
+        earliest = i;
+    }
+
+    if(_timers[earliest].deadline > now)
+      break;
+
+    // Remove before calling, the callback may schedule or cancel timers
+    Timer timer = _timers[earliest];
+    _timers[earliest] = _timers.back();
+    _timers.pop_back();
+    timer.callback(timer.data);
+    fired = true;
+  }
+  return fired;
+}
+
+#endif
@@ -0,0 +1,452 @@
+#ifndef INPUT_SOURCE_H
+#define INPUT_SOURCE_H
+
+#include "recording.h"
+#include "sharedring.h"
+
+#include <linux/input.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <cmath>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+// One input device as EvdevDevice reads it. EvdevDevice waits for fd() to
+// become readable, or for sleep() to say there is something already, and
+// then reads a batch of events.
+class InputSource
+{
+public:
+  // What read() returns instead of a count of events
+  static constexpr int END = -1;
+  static constexpr int ERROR = -2;
+
+  virtual ~InputSource() {}
+  virtual bool ready() const = 0;
+  // Readable when read() may have events
+  virtual int fd() const = 0;
+  // Events read, 0 if there were none after all, END once the input ended
+  // for good or ERROR
+  virtual int read(input_event* events, unsigned int count) = 0;
+  virtual bool grab(bool value) = 0;
+  // Before waiting on fd(). False if there is something to read already,
+  // then there is no waiting.
+  virtual bool sleep() { return true; }
+  // After the wait, with whether fd() was readable
+  virtual void wake(bool) {}
+};
+
+// A real device under /dev/input
+class EvdevSource : public InputSource
+{
+public:
+  explicit EvdevSource(std::string const& path);
+  ~EvdevSource();
+  bool ready() const override;
+  int fd() const override;
+  int read(input_event* events, unsigned int count) override;
+  bool grab(bool value) override;
+
+private:
+  int _fd;
+};
+
+// Synthetic input, for running the host without devices: frames of typing,
+// mouse motion or stick movement stamped with the time they are made, or
+// the events of a recording shifted to start now. Recorded events are
+// produced as fast as they are taken, not with their original timing.
+class InputGenerator
+{
+public:
+  // generator:typing|mouse|stick[:FRAMES], endless without FRAMES, or the
+  // path of a recording
+  explicit InputGenerator(std::string const& spec);
+  bool ready() const;
+  // Appends the next frame, false once there are no more
+  bool next(std::vector<input_event>& events);
+
+private:
+  enum Kind { TYPING, MOUSE, STICK, RECORDING, INVALID };
+  static unsigned long long now();
+
+  Kind _kind;
+  unsigned long long _frames;
+  unsigned long long _frame;
+  Recording _recording;
+  long long _shift;
+};
+
+// Feeds a generator's events through a socket pair from a thread of its
+// own, so they are read like a device's. The thread starts with the first
+// wait or read, after the host may have daemonized, threads do not survive
+// fork().
+class PipeSource : public InputSource
+{
+public:
+  explicit PipeSource(std::string const& spec);
+  ~PipeSource();
+  bool ready() const override;
+  int fd() const override;
+  int read(input_event* events, unsigned int count) override;
+  bool grab(bool value) override;
+  bool sleep() override;
+
+private:
+  void start();
+  void feed();
+
+  InputGenerator _generator;
+  int _fds[2];
+  std::atomic<bool> _stop;
+  std::thread _feeder;
+};
+
+// Feeds a generator's events through an in-process ring from a thread of
+// its own, with no system call per batch while both sides keep up. The
+// thread starts like PipeSource's.
+class RingSource : public InputSource
+{
+public:
+  typedef SharedRing<input_event, 4096> Ring;
+
+  explicit RingSource(std::string const& spec);
+  ~RingSource();
+  bool ready() const override;
+  int fd() const override;
+  int read(input_event* events, unsigned int count) override;
+  bool grab(bool value) override;
+  bool sleep() override;
+  void wake(bool signalled) override;
+
+private:
+  void start();
+  void feed();
+
+  InputGenerator _generator;
+  Ring* _ring;
+  std::atomic<bool> _ended;
+  std::atomic<bool> _stop;
+  std::thread _feeder;
+};
+
+constexpr int InputSource::END;
+constexpr int InputSource::ERROR;
+
+EvdevSource::EvdevSource(std::string const& path) :
+  _fd(open(path.data(), O_RDONLY | O_NDELAY))
+{
+  // Timestamp events with the same clock as the host uses for timing
+  int clock = CLOCK_MONOTONIC;
+  if(_fd >= 0)
+    ioctl(_fd, EVIOCSCLOCKID, &clock);
+}
+EvdevSource::~EvdevSource()
+{
+  if(_fd >= 0)
+    close(_fd);
+}
+bool EvdevSource::ready() const
+{
+  return _fd >= 0;
+}
+int EvdevSource::fd() const
+{
+  return _fd;
+}
+int EvdevSource::read(input_event* events, unsigned int count)
+{
+  ssize_t bytes = ::read(_fd, events, sizeof(input_event) * count);
+  if(bytes < 0 && errno == EAGAIN)
+    return 0;
+  if(bytes <= 0)
+    return bytes == 0 ? END : ERROR;
+  return bytes / sizeof(input_event);
+}
+bool EvdevSource::grab(bool value)
+{
+  return ioctl(_fd, EVIOCGRAB, value ? 1 : 0) >= 0;
+}
+
+InputGenerator::InputGenerator(std::string const& spec) :
+  _kind(INVALID), _frames(0), _frame(0), _recording(), _shift(0)
+{
+  std::string const prefix = "generator:";
+  if(spec.compare(0, prefix.size(), prefix) != 0)
+  {
+    if(!_recording.open(spec))
+      return;
+
+    Recording::Event first;
+    if(_recording.next(first))
+    {
+      unsigned long long const start = first.event.time.tv_sec * 1000000000ull
+        + first.event.time.tv_usec * 1000ull;
+      _shift = now() - start;
+    }
+    _recording.rewind();
+    _kind = RECORDING;
+    return;
+  }
+
+  std::string name = spec.substr(prefix.size());
+  std::size_t colon = name.find(':');
+  _frames = colon == std::string::npos ? 0 : std::strtoull(name.data() + colon + 1, nullptr, 10);
+  name = name.substr(0, colon);
+  if(name == "typing")
+    _kind = TYPING;
+  else if(name == "mouse")
+    _kind = MOUSE;
+  else if(name == "stick")
+    _kind = STICK;
+  else
+    std::cerr << "ERROR: Unknown generator '" << name << "'" << std::endl;
+}
+
+bool InputGenerator::ready() const
+{
+  return _kind != INVALID;
+}
+
+unsigned long long InputGenerator::now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool InputGenerator::next(std::vector<input_event>& events)
+{
+  if(_kind == INVALID || (_frames && _frame >= _frames))
+    return false;
+
+  auto add = [&events](unsigned long long time, unsigned int type, unsigned int code, int value) {
+    input_event e;
+    e.time.tv_sec = time / 1000000000;
+    e.time.tv_usec = time % 1000000000 / 1000;
+    e.type = type;
+    e.code = code;
+    e.value = value;
+    events.push_back(e);
+  };
+
+  if(_kind == RECORDING)
+  {
+    // Up to and including the next SYN_REPORT
+    Recording::Event event;
+    bool any = false;
+    while(_recording.next(event))
+    {
+      unsigned long long const time = event.event.time.tv_sec * 1000000000ull
+        + event.event.time.tv_usec * 1000ull + _shift;
+      add(time, event.event.type, event.event.code, event.event.value);
+      any = true;
+      if(event.event.type == EV_SYN && event.event.code == SYN_REPORT)
+        break;
+    }
+    return any;
+  }
+
+  unsigned long long const time = now();
+  unsigned long long const i = _frame++;
+  switch(_kind)
+  {
+    case TYPING:
+      // Letters pressed in one frame and released in the next
+      add(time, EV_KEY, KEY_A + i / 2 % 15, i % 2 == 0);
+      break;
+    case MOUSE:
+      add(time, EV_REL, REL_X, static_cast<int>(i % 7) - 3);
+      add(time, EV_REL, REL_Y, static_cast<int>(i % 5) - 2);
+      break;
+    case STICK:
+    {
+      // Circling once every thousand frames
+      double const angle = 2 * M_PI * (i % 1000) / 1000;
+      add(time, EV_ABS, ABS_X, std::lround(32767 * std::cos(angle)));
+      add(time, EV_ABS, ABS_Y, std::lround(32767 * std::sin(angle)));
+      break;
+    }
+    default:
+      break;
+  }
+  add(time, EV_SYN, SYN_REPORT, 0);
+  return true;
+}
+
+PipeSource::PipeSource(std::string const& spec) :
+  _generator(spec), _fds{-1, -1}, _stop(false), _feeder()
+{
+  // Datagrams keep every batch whole, a stream could split an event
+  if(!_generator.ready() || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, _fds) < 0)
+  {
+    _fds[0] = _fds[1] = -1;
+  }
+}
+
+PipeSource::~PipeSource()
+{
+  _stop = true;
+  // Unblocks the feeder if it is waiting for room
+  if(_fds[0] >= 0)
+    shutdown(_fds[0], SHUT_RDWR);
+  if(_feeder.joinable())
+    _feeder.join();
+  for(int fd : _fds)
+  {
+    if(fd >= 0)
+      close(fd);
+  }
+}
+
+bool PipeSource::ready() const
+{
+  return _fds[0] >= 0;
+}
+
+int PipeSource::fd() const
+{
+  return _fds[0];
+}
+
+int PipeSource::read(input_event* events, unsigned int count)
+{
+  start();
+  ssize_t bytes = recv(_fds[0], events, sizeof(input_event) * count, MSG_DONTWAIT);
+  if(bytes < 0 && errno == EAGAIN)
+    return 0;
+  if(bytes <= 0)
+    return bytes == 0 ? END : ERROR;
+  return bytes / sizeof(input_event);
+}
+
+bool PipeSource::grab(bool)
+{
+  return true;
+}
+
+bool PipeSource::sleep()
+{
+  start();
+  return true;
+}
+
+void PipeSource::start()
+{
+  if(!_feeder.joinable())
+    _feeder = std::thread(&PipeSource::feed, this);
+}
+
+void PipeSource::feed()
+{
+  // As many events as EvdevDevice reads at once
+  unsigned int const BATCH = 64;
+  std::vector<input_event> events;
+  bool more = true;
+  while(!_stop && (more || !events.empty()))
+  {
+    while(more && events.size() < BATCH)
+    {
+      more = _generator.next(events);
+    }
+
+    unsigned int const count = std::min<std::size_t>(events.size(), BATCH);
+    if(send(_fds[1], events.data(), sizeof(input_event) * count, MSG_NOSIGNAL) < 0)
+      break;
+    events.erase(events.begin(), events.begin() + count);
+  }
+  // The reader sees the end of the input
+  shutdown(_fds[1], SHUT_WR);
+}
+
+RingSource::RingSource(std::string const& spec) :
+  _generator(spec), _ring(nullptr), _ended(false), _stop(false), _feeder()
+{
+  if(_generator.ready())
+    _ring = Ring::create();
+}
+
+RingSource::~RingSource()
+{
+  _stop = true;
+  if(_feeder.joinable())
+    _feeder.join();
+  Ring::destroy(_ring);
+}
+
+bool RingSource::ready() const
+{
+  return _ring != nullptr;
+}
+
+int RingSource::fd() const
+{
+  return _ring->fd();
+}
+
+int RingSource::read(input_event* events, unsigned int count)
+{
+  start();
+  // The end counts once everything before it was read
+  bool const ended = _ended.load(std::memory_order_acquire);
+  unsigned int read = 0;
+  while(read < count && _ring->pop(events[read]))
+  {
+    ++read;
+  }
+  return read || !ended ? read : END;
+}
+
+bool RingSource::grab(bool)
+{
+  return true;
+}
+
+bool RingSource::sleep()
+{
+  start();
+  return !_ended.load(std::memory_order_acquire) && _ring->sleep();
+}
+
+void RingSource::wake(bool signalled)
+{
+  _ring->wake(signalled);
+}
+
+void RingSource::start()
+{
+  if(!_feeder.joinable())
+    _feeder = std::thread(&RingSource::feed, this);
+}
+
+void RingSource::feed()
+{
+  std::vector<input_event> events;
+  while(!_stop && _generator.next(events))
+  {
+    for(input_event const& e : events)
+    {
+      // Full, give the reader a moment
+      while(!_ring->push(e))
+      {
+        if(_stop)
+          return;
+        usleep(50);
+      }
+    }
+    events.clear();
+  }
+  _ended.store(true, std::memory_order_release);
+  _ring->notify();
+}
+
+#endif
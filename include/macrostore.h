@@ -0,0 +1,228 @@
+#ifndef MACRO_STORE_H
+#define MACRO_STORE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Recorded key macros, kept in a binary file that is memory mapped as is,
+// so loading costs nothing but the mapping. The file is a header, a table
+// of (first event, event count) per slot and the events of all slots:
+//
+//   "FKMM" version slots 0 | (first, count) * slots | MacroEvent * total
+//
+// All fields are in native byte order, the file is only meant for the
+// machine that recorded it.
+class MacroStore
+{
+public:
+  static constexpr unsigned int MAX_SLOTS = 16;
+  static constexpr std::uint32_t VERSION = 1;
+
+  // Time is microseconds since the start of the recording
+  struct MacroEvent
+  {
+    std::uint32_t time;
+    std::uint16_t code;
+    std::int16_t value;
+  };
+
+  MacroStore();
+  MacroStore(MacroStore const&) = delete;
+  ~MacroStore();
+
+  // Map an existing file, a missing one is simply empty. Recordings are
+  // saved to path from now on, or only kept in memory with an empty path.
+  bool open(std::string const& path);
+  bool save(unsigned int slot, std::vector<MacroEvent> const& events);
+  // Events of a slot, valid until the next open() or save()
+  MacroEvent const* events(unsigned int slot, unsigned int& count) const;
+
+private:
+  struct Header
+  {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t slots;
+    std::uint32_t reserved;
+  };
+  struct Slot
+  {
+    std::uint32_t first;
+    std::uint32_t count;
+  };
+
+  void unmap();
+  bool valid(char const* data, std::size_t size) const;
+
+  std::string _path;
+  // Either the mapped file or _memory
+  char const* _data;
+  std::size_t _size;
+  bool _mapped;
+  std::vector<char> _memory;
+};
+
+constexpr unsigned int MacroStore::MAX_SLOTS;
+constexpr std::uint32_t MacroStore::VERSION;
+
+MacroStore::MacroStore() :
+  _path(), _data(nullptr), _size(0), _mapped(false), _memory()
+{
+}
+
+MacroStore::~MacroStore()
+{
+  unmap();
+}
+
+bool MacroStore::open(std::string const& path)
+{
+  unmap();
+  _path = path;
+  if(path.empty())
+    return true;
+
+  int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return errno == ENOENT;
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    return false;
+
+  if(!valid(static_cast<char const*>(data), st.st_size))
+  {
+    std::cerr << "ERROR: Invalid macro file " << path << std::endl;
+    munmap(data, st.st_size);
+    return false;
+  }
+
+  _data = static_cast<char const*>(data);
+  _size = st.st_size;
+  _mapped = true;
+  return true;
+}
+
+bool MacroStore::save(unsigned int slot, std::vector<MacroEvent> const& events)
+{
+  if(slot >= MAX_SLOTS)
+    return false;
+
+  std::vector<std::vector<MacroEvent>> slots(MAX_SLOTS);
+  for(unsigned int i = 0; i < MAX_SLOTS; ++i)
+  {
+    unsigned int count = 0;
+    MacroEvent const* existing = i == slot ? nullptr : this->events(i, count);
+    if(existing)
+      slots[i].assign(existing, existing + count);
+  }
+  slots[slot] = events;
+
+  std::vector<char> image(sizeof(Header) + MAX_SLOTS * sizeof(Slot));
+  Header header = {{'F', 'K', 'M', 'M'}, VERSION, MAX_SLOTS, 0};
+  std::memcpy(image.data(), &header, sizeof(header));
+  std::uint32_t first = 0;
+  for(unsigned int i = 0; i < MAX_SLOTS; ++i)
+  {
+    Slot s = {first, static_cast<std::uint32_t>(slots[i].size())};
+    std::memcpy(image.data() + sizeof(Header) + i * sizeof(Slot), &s, sizeof(s));
+    first += s.count;
+  }
+  for(auto const& s : slots)
+  {
+    char const* begin = reinterpret_cast<char const*>(s.data());
+    image.insert(image.end(), begin, begin + s.size() * sizeof(MacroEvent));
+  }
+
+  unmap();
+  if(_path.empty())
+  {
+    _memory.swap(image);
+    _data = _memory.data();
+    _size = _memory.size();
+    return true;
+  }
+
+  // Replace the file in one go so a crash never leaves half of it
+  std::string tmp = _path + ".tmp";
+  FILE* file = fopen(tmp.data(), "wb");
+  bool written = file && fwrite(image.data(), 1, image.size(), file) == image.size();
+  written = file && fclose(file) == 0 && written;
+  if(!written || rename(tmp.data(), _path.data()) != 0)
+  {
+    std::cerr << "ERROR: Could not write macro file " << _path << std::endl;
+    unlink(tmp.data());
+    _memory.swap(image);
+    _data = _memory.data();
+    _size = _memory.size();
+    return false;
+  }
+
+  return open(_path);
+}
+
+MacroStore::MacroEvent const* MacroStore::events(unsigned int slot, unsigned int& count) const
+{
+  count = 0;
+  if(!_data || slot >= MAX_SLOTS)
+    return nullptr;
+
+  Slot s;
+  std::memcpy(&s, _data + sizeof(Header) + slot * sizeof(Slot), sizeof(s));
+  count = s.count;
+  return reinterpret_cast<MacroEvent const*>(_data + sizeof(Header)
+      + MAX_SLOTS * sizeof(Slot)) + s.first;
+}
+
+void MacroStore::unmap()
+{
+  if(_mapped)
+  {
+    munmap(const_cast<char*>(_data), _size);
+  }
+  _data = nullptr;
+  _size = 0;
+  _mapped = false;
+}
+
+bool MacroStore::valid(char const* data, std::size_t size) const
+{
+  std::size_t const tables = sizeof(Header) + MAX_SLOTS * sizeof(Slot);
+  if(size < tables)
+    return false;
+
+  Header header;
+  std::memcpy(&header, data, sizeof(header));
+  if(std::memcmp(header.magic, "FKMM", 4) != 0 || header.version != VERSION
+      || header.slots != MAX_SLOTS)
+    return false;
+
+  std::size_t const total = (size - tables) / sizeof(MacroEvent);
+  for(unsigned int i = 0; i < MAX_SLOTS; ++i)
+  {
+    Slot s;
+    std::memcpy(&s, data + sizeof(Header) + i * sizeof(Slot), sizeof(s));
+    if(static_cast<std::size_t>(s.first) + s.count > total)
+      return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,356 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+
+// Counters and gauges for monitoring, rendered in the Prometheus text
+// format. Every counter handed out is a cell of its own with a single
+// writer, so counting is a relaxed load and store without any locked
+// instruction. Cells of the same series, eg. from several threads, are
+// only summed when the metrics are rendered. A default constructed Counter
+// or Gauge counts nothing, so code without metrics pays one branch.
+class Metrics
+{
+public:
+  class Counter
+  {
+  public:
+    Counter();
+    // Only from the thread owning the counter, or under a lock it holds
+    void add(unsigned long long n = 1);
+
+  private:
+    friend class Metrics;
+    explicit Counter(std::atomic<unsigned long long>* cell);
+    std::atomic<unsigned long long>* _cell;
+  };
+
+  class Gauge
+  {
+  public:
+    Gauge();
+    void set(long long value);
+
+  private:
+    friend class Metrics;
+    explicit Gauge(std::atomic<long long>* cell);
+    std::atomic<long long>* _cell;
+  };
+
+  Metrics();
+  Metrics(Metrics const&) = delete;
+
+  // labels is a list of label pairs from label(), eg. for device and role.
+  // Every call makes a new cell of the series.
+  Counter counter(std::string const& name, std::string const& help,
+      std::string const& labels = "");
+  // Gauges of a series share one cell, the last value set wins
+  Gauge gauge(std::string const& name, std::string const& help,
+      std::string const& labels = "");
+
+  // name="value", with the value escaped. Pairs are joined with commas.
+  static std::string label(std::string const& name, std::string const& value);
+  static std::string label(std::string const& name, unsigned int value);
+
+  void render(std::ostream& os) const;
+  // Replaces path in one go, so a collector never reads half a file
+  bool write(std::string const& path) const;
+
+private:
+  enum Type { COUNTER, GAUGE };
+  struct Series
+  {
+    std::string name;
+    std::string help;
+    std::string labels;
+    Type type;
+    // Gauge cell, counters sum up their cells
+    std::atomic<long long>* gauge;
+  };
+  struct Cell
+  {
+    unsigned int series;
+    std::atomic<unsigned long long> value;
+  };
+
+  unsigned int series(std::string const& name, std::string const& help,
+      std::string const& labels, Type type);
+
+  // Guards the lists, never the cells
+  mutable std::mutex _mutex;
+  std::vector<Series> _series;
+  // Deques keep their elements in place as they grow
+  std::deque<Cell> _cells;
+  std::deque<std::atomic<long long>> _gauges;
+};
+
+// One counter per device role, each declared when its role first shows up
+// so only roles in use are rendered
+class RoleCounters
+{
+public:
+  // Roles past the last one are counted with it
+  static constexpr unsigned int NUM_ROLES = 16;
+
+  RoleCounters();
+  // Counting stops with a null metrics
+  void declare(Metrics* metrics, std::string const& name, std::string const& help);
+  void add(unsigned int role, unsigned long long n = 1);
+
+private:
+  Metrics* _metrics;
+  std::string _name;
+  std::string _help;
+  std::array<Metrics::Counter, NUM_ROLES> _counters;
+  std::array<bool, NUM_ROLES> _declared;
+};
+
+// Writes the metrics to a file every interval from a thread of its own,
+// eg. for the node exporter's textfile collector
+class MetricsFile
+{
+public:
+  MetricsFile(Metrics const* metrics, std::string const& path, unsigned int intervalMs);
+  MetricsFile(MetricsFile const&) = delete;
+  ~MetricsFile();
+
+private:
+  void run();
+
+  Metrics const* _metrics;
+  std::string _path;
+  unsigned int _intervalMs;
+  std::mutex _mutex;
+  std::condition_variable _signal;
+  bool _stop;
+  std::thread _thread;
+};
+
+Metrics::Counter::Counter() :
+  _cell(nullptr)
+{
+}
+
+Metrics::Counter::Counter(std::atomic<unsigned long long>* cell) :
+  _cell(cell)
+{
+}
+
+void Metrics::Counter::add(unsigned long long n)
+{
+  if(_cell)
+    _cell->store(_cell->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+Metrics::Gauge::Gauge() :
+  _cell(nullptr)
+{
+}
+
+Metrics::Gauge::Gauge(std::atomic<long long>* cell) :
+  _cell(cell)
+{
+}
+
+void Metrics::Gauge::set(long long value)
+{
+  if(_cell)
+    _cell->store(value, std::memory_order_relaxed);
+}
+
+Metrics::Metrics() :
+  _mutex(), _series(), _cells(), _gauges()
+{
+}
+
+Metrics::Counter Metrics::counter(std::string const& name, std::string const& help,
+    std::string const& labels)
+{
+  std::lock_guard<std::mutex> lk(_mutex);
+  unsigned int const s = series(name, help, labels, COUNTER);
+  _cells.emplace_back();
+  _cells.back().series = s;
+  _cells.back().value.store(0, std::memory_order_relaxed);
+  return Counter(&_cells.back().value);
+}
+
+Metrics::Gauge Metrics::gauge(std::string const& name, std::string const& help,
+    std::string const& labels)
+{
+  std::lock_guard<std::mutex> lk(_mutex);
+  return Gauge(_series[series(name, help, labels, GAUGE)].gauge);
+}
+
+unsigned int Metrics::series(std::string const& name, std::string const& help,
+    std::string const& labels, Type type)
+{
+  for(unsigned int i = 0; i < _series.size(); ++i)
+  {
+    if(_series[i].name == name && _series[i].labels == labels)
+      return i;
+  }
+
+  std::atomic<long long>* gauge = nullptr;
+  if(type == GAUGE)
+  {
+    _gauges.emplace_back(0);
+    gauge = &_gauges.back();
+  }
+  _series.push_back({name, help, labels, type, gauge});
+  return _series.size() - 1;
+}
+
+std::string Metrics::label(std::string const& name, std::string const& value)
+{
+  std::string escaped;
+  for(char c : value)
+  {
+    if(c == '\\' || c == '"')
+      escaped += '\\';
+    if(c == '\n')
+      escaped += "\\n";
+    else
+      escaped += c;
+  }
+  return name + "=\"" + escaped + "\"";
+}
+
+std::string Metrics::label(std::string const& name, unsigned int value)
+{
+  return label(name, std::to_string(value));
+}
+
+void Metrics::render(std::ostream& os) const
+{
+  std::lock_guard<std::mutex> lk(_mutex);
+  std::vector<unsigned long long> sums(_series.size(), 0);
+  for(Cell const& cell : _cells)
+  {
+    sums[cell.series] += cell.value.load(std::memory_order_relaxed);
+  }
+
+  // Series of one name are rendered together under one header, in the
+  // order the names were first declared
+  std::vector<bool> done(_series.size(), false);
+  for(unsigned int i = 0; i < _series.size(); ++i)
+  {
+    if(done[i])
+      continue;
+
+    Series const& first = _series[i];
+    os << "# HELP " << first.name << " " << first.help << "\n"
+      << "# TYPE " << first.name << (first.type == COUNTER ? " counter" : " gauge") << "\n";
+    for(unsigned int j = i; j < _series.size(); ++j)
+    {
+      Series const& s = _series[j];
+      if(s.name != first.name)
+        continue;
+      done[j] = true;
+
+      os << s.name;
+      if(!s.labels.empty())
+        os << "{" << s.labels << "}";
+      if(s.type == COUNTER)
+        os << " " << sums[j] << "\n";
+      else
+        os << " " << s.gauge->load(std::memory_order_relaxed) << "\n";
+    }
+  }
+}
+
+bool Metrics::write(std::string const& path) const
+{
+  std::ostringstream text;
+  render(text);
+
+  std::string const tmp = path + ".tmp";
+  std::ofstream file(tmp, std::ios::trunc);
+  file << text.str();
+  file.close();
+  if(!file || std::rename(tmp.data(), path.data()) != 0)
+  {
+    unlink(tmp.data());
+    return false;
+  }
+  return true;
+}
+
+constexpr unsigned int RoleCounters::NUM_ROLES;
+
+RoleCounters::RoleCounters() :
+  _metrics(nullptr), _name(), _help(), _counters(), _declared()
+{
+}
+
+void RoleCounters::declare(Metrics* metrics, std::string const& name, std::string const& help)
+{
+  _metrics = metrics;
+  _name = name;
+  _help = help;
+  _counters.fill(Metrics::Counter());
+  _declared.fill(false);
+}
+
+void RoleCounters::add(unsigned int role, unsigned long long n)
+{
+  if(!_metrics)
+    return;
+
+  if(role >= NUM_ROLES)
+    role = NUM_ROLES - 1;
+  if(!_declared[role])
+  {
+    _counters[role] = _metrics->counter(_name, _help, Metrics::label("role", role));
+    _declared[role] = true;
+  }
+  _counters[role].add(n);
+}
+
+MetricsFile::MetricsFile(Metrics const* metrics, std::string const& path, unsigned int intervalMs) :
+  _metrics(metrics), _path(path), _intervalMs(intervalMs), _mutex(), _signal(),
+  _stop(false), _thread(&MetricsFile::run, this)
+{
+}
+
+MetricsFile::~MetricsFile()
+{
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _stop = true;
+  }
+  _signal.notify_all();
+  _thread.join();
+  // Final values, eg. for a short test run
+  _metrics->write(_path);
+}
+
+void MetricsFile::run()
+{
+  bool failed = false;
+  std::unique_lock<std::mutex> lk(_mutex);
+  while(!_stop)
+  {
+    // Report a file that cannot be written once, not every interval
+    bool const written = _metrics->write(_path);
+    if(!written && !failed)
+      std::cerr << "ERROR: Could not write metrics to " << _path << std::endl;
+    failed = !written;
+
+    _signal.wait_for(lk, std::chrono::milliseconds(_intervalMs), [this]() { return _stop; });
+  }
+}
+
+#endif
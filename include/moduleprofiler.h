@@ -0,0 +1,183 @@
+#ifndef MODULE_PROFILER_H
+#define MODULE_PROFILER_H
+
+#include <linux/input.h>
+#include <array>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <time.h>
+
+class ModuleProfiler
+{
+public:
+  enum Callback { INIT, HANDLE, USER1, USER2, CONFIGURE, DESTROY, NUM_CALLBACKS };
+
+  // Roles past the last one are accounted to it
+  static constexpr unsigned int NUM_ROLES = 16;
+  // Power-of-two nanosecond buckets, the last one catches everything above
+  static constexpr unsigned int NUM_BUCKETS = 32;
+
+  struct Histogram
+  {
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long max;
+    std::array<unsigned long long, NUM_BUCKETS> buckets;
+    void add(unsigned long long ns);
+    unsigned long long percentile(double p) const;
+  };
+
+  static unsigned long long now();
+
+  ModuleProfiler();
+  void reset();
+  void call(Callback callback, unsigned long long ns);
+  void handle(input_event const& e, unsigned int role, unsigned long long ns);
+  void report(std::ostream& os) const;
+
+private:
+  static char const* callbackName(Callback callback);
+  static char const* eventTypeName(unsigned int type);
+  static void reportLine(std::ostream& os, std::string const& name, Histogram const& h);
+
+  std::array<Histogram, NUM_CALLBACKS> _callbacks;
+  std::array<Histogram, EV_CNT> _eventTypes;
+  std::array<Histogram, NUM_ROLES> _roles;
+};
+
+unsigned long long ModuleProfiler::now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void ModuleProfiler::Histogram::add(unsigned long long ns)
+{
+  count += 1;
+  total += ns;
+  if(ns > max)
+    max = ns;
+
+  unsigned int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+  buckets[bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1] += 1;
+}
+
+unsigned long long ModuleProfiler::Histogram::percentile(double p) const
+{
+  // Nearest rank
+  unsigned long long target = std::ceil(count * p);
+  if(target == 0)
+    target = 1;
+
+  unsigned long long seen = 0;
+  for(unsigned int i = 0; i < NUM_BUCKETS; ++i)
+  {
+    seen += buckets[i];
+    if(seen >= target)
+    {
+      // Upper bound of the bucket, capped to the largest value seen
+      unsigned long long bound = i ? (1ull << i) - 1 : 0;
+      return bound < max ? bound : max;
+    }
+  }
+  return max;
+}
+
+ModuleProfiler::ModuleProfiler()
+{
+  reset();
+}
+
+void ModuleProfiler::reset()
+{
+  Histogram const empty = {0, 0, 0, {}};
+  _callbacks.fill(empty);
+  _eventTypes.fill(empty);
+  _roles.fill(empty);
+}
+
+void ModuleProfiler::call(Callback callback, unsigned long long ns)
+{
+  _callbacks[callback].add(ns);
+}
+
+void ModuleProfiler::handle(input_event const& e, unsigned int role, unsigned long long ns)
+{
+  _callbacks[HANDLE].add(ns);
+  _eventTypes[e.type < EV_CNT ? e.type : EV_MAX].add(ns);
+  _roles[role < NUM_ROLES ? role : NUM_ROLES - 1].add(ns);
+}
+
+void ModuleProfiler::report(std::ostream& os) const
+{
+  os << std::left << std::setw(12) << "callback"
+    << std::right << std::setw(12) << "calls"
+    << std::setw(12) << "mean ns"
+    << std::setw(12) << "p50 ns"
+    << std::setw(12) << "p99 ns"
+    << std::setw(12) << "max ns" << std::endl;
+
+  for(unsigned int i = 0; i < NUM_CALLBACKS; ++i)
+  {
+    reportLine(os, callbackName(static_cast<Callback>(i)), _callbacks[i]);
+  }
+  for(unsigned int i = 0; i < EV_CNT; ++i)
+  {
+    if(_eventTypes[i].count)
+      reportLine(os, std::string("  ") + eventTypeName(i), _eventTypes[i]);
+  }
+  for(unsigned int i = 0; i < NUM_ROLES; ++i)
+  {
+    if(_roles[i].count)
+    {
+      std::string name = "  role " + std::to_string(i);
+      reportLine(os, i + 1 < NUM_ROLES ? name : name + "+", _roles[i]);
+    }
+  }
+}
+
+void ModuleProfiler::reportLine(std::ostream& os, std::string const& name, Histogram const& h)
+{
+  os << std::left << std::setw(12) << name
+    << std::right << std::setw(12) << h.count
+    << std::setw(12) << (h.count ? h.total / h.count : 0)
+    << std::setw(12) << h.percentile(0.5)
+    << std::setw(12) << h.percentile(0.99)
+    << std::setw(12) << h.max << std::endl;
+}
+
+char const* ModuleProfiler::callbackName(Callback callback)
+{
+  switch(callback)
+  {
+    case INIT: return "init";
+    case HANDLE: return "handle";
+    case USER1: return "user1";
+    case USER2: return "user2";
+    case CONFIGURE: return "configure";
+    case DESTROY: return "destroy";
+    default: return "?";
+  }
+}
+
+char const* ModuleProfiler::eventTypeName(unsigned int type)
+{
+  switch(type)
+  {
+    case EV_SYN: return "EV_SYN";
+    case EV_KEY: return "EV_KEY";
+    case EV_REL: return "EV_REL";
+    case EV_ABS: return "EV_ABS";
+    case EV_MSC: return "EV_MSC";
+    case EV_SW: return "EV_SW";
+    case EV_LED: return "EV_LED";
+    case EV_SND: return "EV_SND";
+    case EV_REP: return "EV_REP";
+    case EV_FF: return "EV_FF";
+    default: return "EV_other";
+  }
+}
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include "uinputdevice.h"
+#include "metrics.h"
+
+#include <linux/input.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Destination of the events a host-owned output emits
+class OutputSink
+{
+public:
+  virtual ~OutputSink() {}
+  virtual bool write(input_event const* events, unsigned int count) = 0;
+  virtual bool ready() const = 0;
+  // Count what the sink does into metrics, if it has anything to count
+  virtual void metrics(Metrics*, std::string const&) {}
+};
+
+// A real virtual device
+class UinputSink : public OutputSink
+{
+public:
+  UinputSink(std::string const& name, unsigned int bus,
+      unsigned int vendor, unsigned int product, unsigned int version,
+      std::vector<UinputDevice::PossibleEvent> const& possibleEvents,
+      std::vector<UinputDevice::AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData);
+  bool write(input_event const* events, unsigned int count) override;
+  bool ready() const override;
+  void metrics(Metrics* metrics, std::string const& labels) override;
+
+private:
+  UinputDevice _device;
+};
+
+// A log file shared by several outputs, which plugin threads may flush
+// concurrently
+struct SharedFile
+{
+  std::ofstream stream;
+  std::mutex mutex;
+  // Outputs tracing to the file so far, numbering them in the trace
+  std::uint32_t traced;
+};
+
+// Human readable event log, one line per event prefixed by the output name.
+// Several outputs can share one file.
+class FileSink : public OutputSink
+{
+public:
+  FileSink(std::shared_ptr<SharedFile> const& file, std::string const& name);
+  bool write(input_event const* events, unsigned int count) override;
+  bool ready() const override;
+
+private:
+  std::shared_ptr<SharedFile> _file;
+  std::string _name;
+};
+
+// Keeps everything in memory, for tests and benchmarks
+class MemorySink : public OutputSink
+{
+public:
+  bool write(input_event const* events, unsigned int count) override;
+  bool ready() const override;
+  std::vector<input_event> events;
+};
+
+// Binary trace, compact and free of timestamps so that the traces of two
+// runs on the same input compare equal byte for byte. Several outputs can
+// share one file. All numbers are in host byte order:
+//
+//   "FKMT", uint32 version
+//   records, each starting with a uint8 tag:
+//     OUTPUT  uint32 id, uint32 name length, name
+//     EVENTS  uint32 id, uint32 count, count * (uint16 type, uint16 code, int32 value)
+//
+// An output's OUTPUT record comes before its first EVENTS record, ids count
+// up from 0 in the order of the OUTPUT records. Each EVENTS record is one
+// write, ie. usually one frame.
+class TraceSink : public OutputSink
+{
+public:
+  enum Tag : std::uint8_t { OUTPUT = 1, EVENTS };
+  static std::uint32_t const VERSION = 1;
+
+  TraceSink(std::shared_ptr<SharedFile> const& file, std::string const& name);
+  bool write(input_event const* events, unsigned int count) override;
+  bool ready() const override;
+
+private:
+  template<typename T>
+  void put(T value);
+
+  std::shared_ptr<SharedFile> _file;
+  std::uint32_t _id;
+};
+
+// Sends each write as one datagram to a unix socket, eg. for another local
+// process to verify or visualize the output. Datagrams start with the
+// output's name, as a uint32 length and the name padded with zeros to a
+// multiple of 8 bytes from the start, followed by input_events without
+// timestamps. Nothing waits for the receiver: datagrams it is not there
+// for or has no room for are dropped and counted.
+class SocketSink : public OutputSink
+{
+public:
+  SocketSink(std::string const& path, std::string const& name);
+  ~SocketSink();
+  bool write(input_event const* events, unsigned int count) override;
+  bool ready() const override;
+  void metrics(Metrics* metrics, std::string const& labels) override;
+
+private:
+  int _fd;
+  sockaddr_un _address;
+  std::uint32_t _nameLength;
+  std::vector<char> _header;
+  Metrics::Counter _dropped;
+};
+
+// Discards everything and only counts it, for profiling plugins without
+// any output overhead
+class NullSink : public OutputSink
+{
+public:
+  NullSink();
+  bool write(input_event const* events, unsigned int count) override;
+  bool ready() const override;
+  unsigned long long events;
+  unsigned long long writes;
+};
+
+UinputSink::UinputSink(std::string const& name, unsigned int bus,
+    unsigned int vendor, unsigned int product, unsigned int version,
+    std::vector<UinputDevice::PossibleEvent> const& possibleEvents,
+    std::vector<UinputDevice::AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData) :
+  _device("/dev/uinput", bus, name, vendor, product, version,
+      possibleEvents, absoluteAxesCalibrationData)
+{
+}
+bool UinputSink::write(input_event const* events, unsigned int count)
+{
+  return _device.send(events, count);
+}
+bool UinputSink::ready() const
+{
+  return _device.ready();
+}
+void UinputSink::metrics(Metrics* metrics, std::string const& labels)
+{
+  _device.metrics(metrics, labels);
+}
+
+FileSink::FileSink(std::shared_ptr<SharedFile> const& file, std::string const& name) :
+  _file(file), _name(name)
+{
+}
+bool FileSink::write(input_event const* events, unsigned int count)
+{
+  std::lock_guard<std::mutex> lk(_file->mutex);
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    _file->stream << _name << " " << events[i].type << " " << events[i].code
+      << " " << events[i].value << "\n";
+  }
+  // Keep the log complete even if the process dies
+  _file->stream.flush();
+  return _file->stream.good();
+}
+bool FileSink::ready() const
+{
+  if(!_file)
+    return false;
+  std::lock_guard<std::mutex> lk(_file->mutex);
+  return _file->stream.good();
+}
+
+bool MemorySink::write(input_event const* e, unsigned int count)
+{
+  events.insert(events.end(), e, e + count);
+  return true;
+}
+bool MemorySink::ready() const
+{
+  return true;
+}
+
+TraceSink::TraceSink(std::shared_ptr<SharedFile> const& file, std::string const& name) :
+  _file(file), _id(0)
+{
+  std::lock_guard<std::mutex> lk(_file->mutex);
+  if(_file->stream.tellp() == 0)
+  {
+    _file->stream.write("FKMT", 4);
+    put(VERSION);
+  }
+  _id = _file->traced++;
+  put<std::uint8_t>(OUTPUT);
+  put(_id);
+  put<std::uint32_t>(name.size());
+  _file->stream.write(name.data(), name.size());
+}
+template<typename T>
+void TraceSink::put(T value)
+{
+  _file->stream.write(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+bool TraceSink::write(input_event const* events, unsigned int count)
+{
+  std::lock_guard<std::mutex> lk(_file->mutex);
+  put<std::uint8_t>(EVENTS);
+  put(_id);
+  put<std::uint32_t>(count);
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    put<std::uint16_t>(events[i].type);
+    put<std::uint16_t>(events[i].code);
+    put<std::int32_t>(events[i].value);
+  }
+  // Keep the trace complete even if the process dies
+  _file->stream.flush();
+  return _file->stream.good();
+}
+bool TraceSink::ready() const
+{
+  std::lock_guard<std::mutex> lk(_file->mutex);
+  return _file->stream.good();
+}
+
+SocketSink::SocketSink(std::string const& path, std::string const& name) :
+  _fd(socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)), _address(),
+  _nameLength(name.size()), _header(), _dropped()
+{
+  _address.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(_address.sun_path))
+  {
+    std::cerr << "ERROR: Socket path too long: " << path << std::endl;
+    if(_fd >= 0)
+      close(_fd);
+    _fd = -1;
+    return;
+  }
+  path.copy(_address.sun_path, path.size());
+
+  // Length and name once, the events are sent from the caller's buffer
+  _header.resize((sizeof(_nameLength) + name.size() + 7) / 8 * 8, 0);
+  std::memcpy(_header.data(), &_nameLength, sizeof(_nameLength));
+  name.copy(_header.data() + sizeof(_nameLength), name.size());
+}
+SocketSink::~SocketSink()
+{
+  if(_fd >= 0)
+    close(_fd);
+}
+bool SocketSink::write(input_event const* events, unsigned int count)
+{
+  iovec parts[2] = {
+    {_header.data(), _header.size()},
+    {const_cast<input_event*>(events), sizeof(input_event) * count}
+  };
+  msghdr message = {};
+  message.msg_name = &_address;
+  message.msg_namelen = sizeof(_address);
+  message.msg_iov = parts;
+  message.msg_iovlen = 2;
+  if(sendmsg(_fd, &message, MSG_NOSIGNAL) < 0)
+  {
+    _dropped.add(count);
+    return false;
+  }
+  return true;
+}
+bool SocketSink::ready() const
+{
+  return _fd >= 0;
+}
+void SocketSink::metrics(Metrics* metrics, std::string const& labels)
+{
+  _dropped = metrics ? metrics->counter("funkeymonkey_output_socket_dropped_total",
+      "Events dropped because no one received an output socket's datagrams", labels)
+    : Metrics::Counter();
+}
+
+NullSink::NullSink() :
+  events(0), writes(0)
+{
+}
+bool NullSink::write(input_event const*, unsigned int count)
+{
+  events += count;
+  writes += 1;
+  return true;
+}
+bool NullSink::ready() const
+{
+  return true;
+}
+
+#endif
@@ -0,0 +1,429 @@
+#ifndef PLUGIN_SANDBOX_H
+#define PLUGIN_SANDBOX_H
+
+#include "funkeymonkeymoduleloader.h"
+#include "hostoutputs.h"
+#include "moduleprofiler.h"
+#include "sharedring.h"
+#include "metrics.h"
+
+#include <linux/input.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <cstdlib>
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// Runs a plugin in a forked runner process. Events are streamed to it over
+// a shared memory ring and the runner owns the plugin's outputs.
+// The host keeps the input devices, so when the runner crashes it is simply
+// restarted and the grabs are never released. Nothing here makes the
+// dispatch thread wait on the runner for long: restarts of a crash looping
+// runner are deferred through a host timer, and events are dropped while
+// there is no runner or it stops taking them.
+class PluginSandbox
+{
+public:
+  // The runner gets its own copy of outputs as it was at fork time
+  PluginSandbox(std::string const& path, HostOutputs* outputs, bool profile = false);
+  PluginSandbox(PluginSandbox const&) = delete;
+  ~PluginSandbox();
+  bool ready() const;
+  void init(char const** argv, unsigned int argc);
+  void handle(input_event const& e, int src);
+  void destroy();
+  void user1();
+  void user2();
+  // Runtime settings only reach plugins loaded in process
+  bool configure(std::string const& setting);
+  bool configurable() const;
+  bool reload(std::string const& path, char const** argv, unsigned int argc,
+      std::function<void()> const& unloaded = nullptr);
+  std::string const& path() const;
+  void report(std::ostream& os);
+  // Count dispatched and dropped events, reloads, runner restarts and the
+  // ring's depth. The runner's own outputs are not counted.
+  void metrics(Metrics* metrics);
+
+  // Restart the runner if it has died, call after SIGCHLD
+  void check();
+
+  // How long the runner busy-waits for the next message before sleeping
+  static constexpr unsigned int RUNNER_SPINS = 20000;
+  // Crash looping runners are restarted at most this often
+  static constexpr unsigned int RESTART_INTERVAL_MS = 1000;
+  // How long to wait for room in a full ring before dropping a message
+  static constexpr unsigned int SEND_TIMEOUT_MS = 100;
+  // How long a stopping runner gets before it is killed
+  static constexpr unsigned int STOP_TIMEOUT_MS = 1000;
+
+private:
+  struct Message
+  {
+    enum Kind { EVENT, USER1, USER2, REPORT, STOP };
+    unsigned int kind;
+    unsigned int role;
+    input_event event;
+  };
+  typedef SharedRing<Message, 1024> Ring;
+
+  bool start();
+  // Start now or, for a runner crashing right after its last start, once
+  // the restart interval has passed
+  void restart();
+  static void restartTimeout(void* data);
+  bool exited(bool block);
+  void send(Message const& message);
+  static void run(Ring* ring, std::string const& path, HostOutputs* outputs,
+      std::vector<std::string> const& args, bool profile);
+
+  Ring* _ring;
+  pid_t _pid;
+  std::string _path;
+  HostOutputs* _outputs;
+  std::vector<std::string> _args;
+  bool _profile;
+  unsigned long long _started;
+  FunKeyMonkeyHost::TimerId _restartTimer;
+  // Messages dropped since the last report of them
+  unsigned long long _dropped;
+  RoleCounters _dispatched;
+  Metrics::Counter _droppedEvents;
+  Metrics::Counter _restarts;
+  Metrics::Counter _reloads;
+  Metrics::Gauge _queued;
+};
+
+PluginSandbox::PluginSandbox(std::string const& path, HostOutputs* outputs, bool profile) :
+  _ring(Ring::create()), _pid(0), _path(path), _outputs(outputs), _args(), _profile(profile),
+  _started(0), _restartTimer(FunKeyMonkeyHost::INVALID_TIMER), _dropped(0),
+  _dispatched(), _droppedEvents(), _restarts(), _reloads(), _queued()
+{
+  if(!_ring)
+  {
+    std::cerr << "ERROR: Could not create plugin sandbox ring" << std::endl;
+  }
+}
+
+PluginSandbox::~PluginSandbox()
+{
+  destroy();
+  Ring::destroy(_ring);
+}
+
+bool PluginSandbox::ready() const
+{
+  return _ring && access(_path.data(), R_OK) == 0;
+}
+
+void PluginSandbox::init(char const** argv, unsigned int argc)
+{
+  _args.assign(argv, argv + argc);
+  start();
+}
+
+void PluginSandbox::handle(input_event const& e, int src)
+{
+  _dispatched.add(src);
+  send({Message::EVENT, static_cast<unsigned int>(src), e});
+}
+
+void PluginSandbox::destroy()
+{
+  if(_restartTimer != FunKeyMonkeyHost::INVALID_TIMER)
+  {
+    _outputs->timers().cancel(_restartTimer);
+    _restartTimer = FunKeyMonkeyHost::INVALID_TIMER;
+  }
+  if(!_pid)
+    return;
+
+  send({Message::STOP, 0, {}});
+  unsigned long long const deadline = ModuleProfiler::now() + STOP_TIMEOUT_MS * 1000000ull;
+  while(!exited(false))
+  {
+    if(ModuleProfiler::now() >= deadline)
+    {
+      std::cerr << "ERROR: Plugin runner did not stop, killing it" << std::endl;
+      kill(_pid, SIGKILL);
+      exited(true);
+      return;
+    }
+    usleep(1000);
+  }
+}
+
+void PluginSandbox::user1()
+{
+  send({Message::USER1, 0, {}});
+}
+
+void PluginSandbox::user2()
+{
+  send({Message::USER2, 0, {}});
+}
+
+bool PluginSandbox::configure(std::string const&)
+{
+  return false;
+}
+
+bool PluginSandbox::configurable() const
+{
+  return false;
+}
+
+bool PluginSandbox::reload(std::string const& path, char const** argv, unsigned int argc,
+    std::function<void()> const& unloaded)
+{
+  // A fresh runner loads whatever is at path now and starts out without
+  // the old plugin's state, timers and anything else it left behind
+  destroy();
+  if(unloaded)
+    unloaded();
+  _path = path;
+  _args.assign(argv, argv + argc);
+  _reloads.add();
+  return start();
+}
+
+std::string const& PluginSandbox::path() const
+{
+  return _path;
+}
+
+void PluginSandbox::report(std::ostream&)
+{
+  // The runner owns the profile and prints it to the shared stdout
+  send({Message::REPORT, 0, {}});
+}
+
+void PluginSandbox::metrics(Metrics* metrics)
+{
+  _dispatched.declare(metrics, "funkeymonkey_dispatched_events_total",
+      "Events handed to the plugin");
+  _droppedEvents = metrics ? metrics->counter("funkeymonkey_sandbox_dropped_total",
+      "Messages dropped because the plugin runner stalled") : Metrics::Counter();
+  _restarts = metrics ? metrics->counter("funkeymonkey_sandbox_restarts_total",
+      "Plugin runner restarts after crashes") : Metrics::Counter();
+  _reloads = metrics ? metrics->counter("funkeymonkey_plugin_reloads_total",
+      "Plugin reloads") : Metrics::Counter();
+  _queued = metrics ? metrics->gauge("funkeymonkey_sandbox_queued_messages",
+      "Messages waiting for the plugin runner as of the last one sent") : Metrics::Gauge();
+}
+
+void PluginSandbox::check()
+{
+  if(_pid && exited(false))
+  {
+    restart();
+  }
+}
+
+void PluginSandbox::restart()
+{
+  if(_restartTimer != FunKeyMonkeyHost::INVALID_TIMER)
+    return;
+
+  unsigned long long const deadline = _started + RESTART_INTERVAL_MS * 1000000ull;
+  _restarts.add();
+  if(ModuleProfiler::now() < deadline)
+    _restartTimer = _outputs->timers().schedule(deadline, restartTimeout, this);
+  else
+    start();
+}
+
+void PluginSandbox::restartTimeout(void* data)
+{
+  PluginSandbox* sandbox = static_cast<PluginSandbox*>(data);
+  sandbox->_restartTimer = FunKeyMonkeyHost::INVALID_TIMER;
+  sandbox->start();
+}
+
+bool PluginSandbox::start()
+{
+  if(!_ring)
+    return false;
+
+  _ring->clear();
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t pid = fork();
+  if(pid < 0)
+  {
+    std::cerr << "ERROR: Could not fork plugin runner, error code " << errno << std::endl;
+    return false;
+  }
+  else if(pid == 0)
+  {
+    run(_ring, _path, _outputs, _args, _profile);
+  }
+
+  _pid = pid;
+  _started = ModuleProfiler::now();
+  return true;
+}
+
+bool PluginSandbox::exited(bool block)
+{
+  int status = 0;
+  pid_t result = waitpid(_pid, &status, block ? 0 : WNOHANG);
+  if(result == 0)
+    return false;
+
+  if(result == _pid && WIFSIGNALED(status))
+  {
+    std::cerr << "ERROR: Plugin runner killed by signal " << WTERMSIG(status) << std::endl;
+  }
+  else if(result == _pid && WEXITSTATUS(status) != EXIT_SUCCESS)
+  {
+    std::cerr << "ERROR: Plugin runner exited with status " << WEXITSTATUS(status) << std::endl;
+  }
+
+  _pid = 0;
+  return true;
+}
+
+void PluginSandbox::send(Message const& message)
+{
+  if(!_pid)
+    return;
+
+  unsigned long long deadline = 0;
+  while(!_ring->push(message))
+  {
+    // Runner is not keeping up, see whether it is still there at all
+    if(exited(false))
+    {
+      restart();
+      return;
+    }
+
+    // Once the runner stalled, drop right away until it takes messages again
+    unsigned long long const now = ModuleProfiler::now();
+    if(!deadline && !_dropped)
+    {
+      deadline = now + SEND_TIMEOUT_MS * 1000000ull;
+    }
+    else if(_dropped || now >= deadline)
+    {
+      _droppedEvents.add();
+      if(_dropped++ == 0)
+        std::cerr << "ERROR: Plugin runner stalled, dropping input" << std::endl;
+      return;
+    }
+    sched_yield();
+  }
+  _dropped = 0;
+  _queued.set(_ring->size());
+}
+
+void PluginSandbox::run(Ring* ring, std::string const& path, HostOutputs* outputs,
+    std::vector<std::string> const& args, bool profile)
+{
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+  // Signals are the host's business
+  signal(SIGINT, SIG_IGN);
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGUSR1, SIG_IGN);
+  signal(SIGUSR2, SIG_IGN);
+
+  std::vector<char const*> argv;
+  std::transform(args.begin(), args.end(),
+      std::inserter(argv, argv.begin()), [](std::string const& s) {
+      return s.c_str();
+  });
+
+  FunKeyMonkeyModule module(path);
+  ModuleProfiler profiler;
+  if(!module.ready())
+  {
+    _exit(EXIT_FAILURE);
+  }
+  if(profile)
+  {
+    module.profile(&profiler);
+  }
+
+  // Whatever the host had scheduled at fork time is not the runner's, and
+  // the metrics registry's lock may have been held by another host thread
+  outputs->timers().clear();
+  outputs->metrics(nullptr);
+  module.host(outputs);
+  module.init(argv.data(), argv.size());
+  outputs->flushAll();
+
+  Message message;
+  HostTimers& timers = outputs->timers();
+  bool frameOpen = false;
+  while(true)
+  {
+    if(timers.pending() && !frameOpen)
+    {
+      unsigned long long now = ModuleProfiler::now();
+      unsigned long long next = timers.next();
+      if(next > now)
+        ring->wait(RUNNER_SPINS, next - now);
+      if(timers.fire(ModuleProfiler::now()))
+        outputs->flushAll();
+    }
+    else
+    {
+      ring->wait(RUNNER_SPINS);
+    }
+
+    while(ring->pop(message))
+    {
+      switch(message.kind)
+      {
+        case Message::EVENT:
+          outputs->origin(HostOutputs::timestamp(message.event));
+          module.handle(message.event, message.role);
+          outputs->origin(0);
+          frameOpen = message.event.type != EV_SYN
+            || message.event.code != SYN_REPORT;
+          if((message.event.type == EV_SYN && message.event.code == SYN_REPORT)
+              || ring->empty())
+          {
+            outputs->flushAll();
+          }
+          break;
+        case Message::USER1:
+          module.user1();
+          outputs->flushAll();
+          break;
+        case Message::USER2:
+          module.user2();
+          outputs->flushAll();
+          break;
+        case Message::REPORT:
+          module.report(std::cout);
+          outputs->report(std::cout);
+          break;
+        case Message::STOP:
+          module.destroy();
+          outputs->flushAll();
+          module.report(std::cout);
+          if(profile)
+          {
+            outputs->report(std::cout);
+          }
+          std::cout.flush();
+          _exit(EXIT_SUCCESS);
+        default: break;
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,794 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <linux/input.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+Raw input recordings. A recording is a header followed by records, each
+starting with a tag byte:
+
+  "FKMR" version                                        header
+  BLOCK time                                            seek point
+  DEVICE id role path name bus vendor product version
+         types (type length bits) * types               an input device
+  EVENTS device count (time type code value) * count    events of one read
+  GAP count                                             events not recorded
+  END                                                   start of the trailer
+
+Numbers are LEB128 varints, signed ones zigzag encoded, and strings are a
+length and the bytes. Only the header's version and a BLOCK's time are
+fixed size. Event times are nanoseconds on the devices' clock, each stored
+as the difference to the previous event, which is 0 for the rest of a
+frame. A BLOCK starts over from its absolute time, so reading can start at
+any of them. Blocks start on frame boundaries every BLOCK_EVENTS events or
+so.
+
+The trailer repeats all DEVICE records, followed by the fixed size index of
+the blocks and a footer pointing at the trailer:
+
+  devices DEVICE * devices | count (offset time) * count | trailer "FKMI"
+
+A recording cut short, eg. by a crash, has no trailer. It can still be
+read from the start, only seeking has to scan. Multi-byte fixed size
+fields are in native byte order, recordings are meant for the machine that
+made them or one like it.
+*/
+
+// Writes a recording of the events read from input devices. The dispatch
+// thread only encodes events into a buffer, a thread of its own writes the
+// buffers out. The buffers are swapped when one is full or has waited long
+// enough, so recording never waits for the disk. If the disk cannot keep
+// up, events are dropped and the gap is recorded.
+class InputRecorder
+{
+public:
+  static constexpr std::uint32_t VERSION = 1;
+  // Events between seek points
+  static constexpr unsigned int BLOCK_EVENTS = 256;
+  // A buffer is handed to the writer at this size or after HANDOVER_NS
+  static constexpr std::size_t HANDOVER_BYTES = 64 * 1024;
+  static constexpr unsigned long long HANDOVER_NS = 100000000ull;
+  // Events are dropped while the writer is behind by this much
+  static constexpr std::size_t MAX_BUFFERED = 16 * 1024 * 1024;
+
+  explicit InputRecorder(std::string const& path);
+  InputRecorder(InputRecorder const&) = delete;
+  // Writes whatever is left and the trailer
+  ~InputRecorder();
+  bool ready() const;
+
+  // Records a device and its capabilities, read from fd if it is an evdev
+  // device. Returns the device's id in the recording.
+  unsigned int device(std::string const& path, unsigned int role, int fd);
+  // Events as read from a device, on the thread that added the device
+  void record(unsigned int device, input_event const* events, unsigned int count);
+
+  enum Tag : std::uint8_t { BLOCK = 1, DEVICE, EVENTS, GAP, END };
+
+private:
+  struct IndexEntry
+  {
+    std::uint64_t offset;
+    std::uint64_t time;
+  };
+
+  void run();
+  void handOver();
+  static void writeAll(int fd, std::vector<std::uint8_t> const& data);
+
+  int _fd;
+  std::vector<std::vector<std::uint8_t>> _devices;
+  std::vector<IndexEntry> _index;
+
+  // Only touched by the recording thread
+  std::vector<std::uint8_t> _active;
+  std::uint64_t _handedOver;
+  unsigned long long _lastTime;
+  unsigned long long _lastHandover;
+  unsigned int _blockEvents;
+  bool _frameEnded;
+  unsigned long long _dropped;
+
+  // Shared with the writer
+  std::mutex _mutex;
+  std::condition_variable _signal;
+  std::vector<std::uint8_t> _pending;
+  std::atomic<bool> _busy;
+  bool _stop;
+  std::thread _writer;
+};
+
+// Reads a recording from a memory mapping
+class Recording
+{
+public:
+  struct Device
+  {
+    unsigned int id;
+    unsigned int role;
+    std::string path;
+    std::string name;
+    input_id info;
+    // Capability bits per event type, as from EVIOCGBIT
+    std::vector<std::pair<unsigned int, std::vector<std::uint8_t>>> capabilities;
+
+    bool has(unsigned int type, unsigned int code) const;
+  };
+
+  struct Event
+  {
+    unsigned int device;
+    unsigned int role;
+    input_event event;
+  };
+
+  Recording();
+  Recording(Recording const&) = delete;
+  ~Recording();
+
+  bool open(std::string const& path);
+  // Devices known so far, all of them if the recording has a trailer
+  std::vector<Device> const& devices() const;
+  // False at the end of the recording
+  bool next(Event& event);
+  // Continue from the last seek point at or before time. Seeking in a
+  // recording without a trailer scans it once for the seek points.
+  void seek(unsigned long long time);
+  void rewind();
+  // Events the recorder had to drop in what was read since the start
+  unsigned long long dropped() const;
+  // Whether the recording has its trailer
+  bool indexed() const;
+
+private:
+  struct IndexEntry
+  {
+    std::uint64_t offset;
+    std::uint64_t time;
+  };
+
+  void unmap();
+  bool readTrailer();
+  // Builds the index of a recording without a trailer
+  void scan();
+  bool varint(std::uint64_t& value);
+  bool signedVarint(std::int64_t& value);
+  bool text(std::string& value);
+  bool fixed(void* value, std::size_t size);
+  bool device();
+  void addDevice(Device const& device);
+
+  std::uint8_t const* _data;
+  std::size_t _size;
+  // End of the records, the trailer's start or the file's end
+  std::size_t _end;
+  std::size_t _offset;
+  std::vector<Device> _devices;
+  std::vector<IndexEntry> _index;
+  bool _indexed;
+  unsigned long long _time;
+  unsigned long long _dropped;
+  // Remaining events of the current EVENTS record
+  std::uint64_t _remaining;
+  unsigned int _device;
+  unsigned int _role;
+};
+
+namespace
+{
+  void putVarint(std::vector<std::uint8_t>& out, std::uint64_t value)
+  {
+    while(value >= 0x80)
+    {
+      out.push_back(static_cast<std::uint8_t>(value) | 0x80);
+      value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+  }
+
+  void putSigned(std::vector<std::uint8_t>& out, std::int64_t value)
+  {
+    putVarint(out, (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+  }
+
+  void putText(std::vector<std::uint8_t>& out, std::string const& text)
+  {
+    putVarint(out, text.size());
+    out.insert(out.end(), text.begin(), text.end());
+  }
+
+  void putFixed(std::vector<std::uint8_t>& out, void const* value, std::size_t size)
+  {
+    std::uint8_t const* bytes = static_cast<std::uint8_t const*>(value);
+    out.insert(out.end(), bytes, bytes + size);
+  }
+
+  unsigned long long eventTime(input_event const& e)
+  {
+    return e.time.tv_sec * 1000000000ull + e.time.tv_usec * 1000ull;
+  }
+}
+
+constexpr std::uint32_t InputRecorder::VERSION;
+constexpr unsigned int InputRecorder::BLOCK_EVENTS;
+constexpr std::size_t InputRecorder::HANDOVER_BYTES;
+constexpr unsigned long long InputRecorder::HANDOVER_NS;
+constexpr std::size_t InputRecorder::MAX_BUFFERED;
+
+InputRecorder::InputRecorder(std::string const& path) :
+  _fd(::open(path.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+  _devices(), _index(), _active(), _handedOver(0), _lastTime(0), _lastHandover(0),
+  _blockEvents(BLOCK_EVENTS), _frameEnded(true), _dropped(0),
+  _mutex(), _signal(), _pending(), _busy(false), _stop(false), _writer()
+{
+  if(_fd < 0)
+  {
+    std::cerr << "ERROR: Could not open recording " << path << ", error code "
+      << errno << std::endl;
+    return;
+  }
+
+  _active.reserve(2 * HANDOVER_BYTES);
+  _pending.reserve(2 * HANDOVER_BYTES);
+  putFixed(_active, "FKMR", 4);
+  putFixed(_active, &VERSION, sizeof(VERSION));
+  _writer = std::thread(&InputRecorder::run, this);
+}
+
+InputRecorder::~InputRecorder()
+{
+  if(_fd < 0)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _stop = true;
+  }
+  _signal.notify_all();
+  _writer.join();
+
+  // The writer is gone, the rest goes out from here
+  std::uint64_t const trailer = _handedOver + _active.size() + 1;
+  _active.push_back(END);
+  putVarint(_active, _devices.size());
+  for(auto const& device : _devices)
+  {
+    _active.insert(_active.end(), device.begin(), device.end());
+  }
+  std::uint32_t const count = _index.size();
+  putFixed(_active, &count, sizeof(count));
+  for(IndexEntry const& entry : _index)
+  {
+    putFixed(_active, &entry.offset, sizeof(entry.offset));
+    putFixed(_active, &entry.time, sizeof(entry.time));
+  }
+  putFixed(_active, &trailer, sizeof(trailer));
+  putFixed(_active, "FKMI", 4);
+  writeAll(_fd, _active);
+  close(_fd);
+}
+
+bool InputRecorder::ready() const
+{
+  return _fd >= 0;
+}
+
+unsigned int InputRecorder::device(std::string const& path, unsigned int role, int fd)
+{
+  unsigned int const id = _devices.size();
+  char name[256] = {};
+  input_id info = {0, 0, 0, 0};
+  // Anything but an evdev device simply has no name and capabilities
+  ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+  ioctl(fd, EVIOCGID, &info);
+
+  std::vector<std::uint8_t> record;
+  putVarint(record, id);
+  putVarint(record, role);
+  putText(record, path);
+  putText(record, name);
+  putVarint(record, info.bustype);
+  putVarint(record, info.vendor);
+  putVarint(record, info.product);
+  putVarint(record, info.version);
+
+  std::uint8_t types[EV_MAX / 8 + 1] = {};
+  std::vector<std::pair<unsigned int, std::vector<std::uint8_t>>> capabilities;
+  if(ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) >= 0)
+  {
+    for(unsigned int type = 1; type < EV_MAX; ++type)
+    {
+      if(!(types[type / 8] & (1 << type % 8)))
+        continue;
+      std::vector<std::uint8_t> bits(KEY_MAX / 8 + 1, 0);
+      int length = ioctl(fd, EVIOCGBIT(type, bits.size()), bits.data());
+      bits.resize(length > 0 ? length : 0);
+      while(!bits.empty() && bits.back() == 0)
+        bits.pop_back();
+      capabilities.push_back({type, bits});
+    }
+  }
+  putVarint(record, capabilities.size());
+  for(auto const& capability : capabilities)
+  {
+    putVarint(record, capability.first);
+    putVarint(record, capability.second.size());
+    record.insert(record.end(), capability.second.begin(), capability.second.end());
+  }
+
+  _devices.push_back(record);
+  _active.push_back(DEVICE);
+  _active.insert(_active.end(), record.begin(), record.end());
+  return id;
+}
+
+void InputRecorder::record(unsigned int device, input_event const* events, unsigned int count)
+{
+  if(_fd < 0 || count == 0)
+    return;
+
+  unsigned long long const now = eventTime(events[count - 1]);
+  if(_active.size() >= HANDOVER_BYTES || now - _lastHandover >= HANDOVER_NS)
+    handOver();
+
+  if(_active.size() >= MAX_BUFFERED)
+  {
+    _dropped += count;
+    return;
+  }
+  if(_dropped)
+  {
+    _active.push_back(GAP);
+    putVarint(_active, _dropped);
+    _dropped = 0;
+  }
+
+  if(_blockEvents >= BLOCK_EVENTS && _frameEnded)
+  {
+    std::uint64_t const time = eventTime(events[0]);
+    _index.push_back({_handedOver + _active.size(), time});
+    _active.push_back(BLOCK);
+    putFixed(_active, &time, sizeof(time));
+    _lastTime = time;
+    _blockEvents = 0;
+  }
+
+  _active.push_back(EVENTS);
+  putVarint(_active, device);
+  putVarint(_active, count);
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    input_event const& e = events[i];
+    unsigned long long const time = eventTime(e);
+    putSigned(_active, static_cast<std::int64_t>(time - _lastTime));
+    putVarint(_active, e.type);
+    putVarint(_active, e.code);
+    putSigned(_active, e.value);
+    _lastTime = time;
+  }
+  _blockEvents += count;
+  _frameEnded = events[count - 1].type == EV_SYN && events[count - 1].code == SYN_REPORT;
+}
+
+void InputRecorder::handOver()
+{
+  // Still writing the last one, this one keeps growing for now
+  if(_busy.load(std::memory_order_acquire) || _active.empty())
+    return;
+
+  _handedOver += _active.size();
+  _lastHandover = _lastTime;
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _pending.swap(_active);
+    _busy.store(true, std::memory_order_release);
+  }
+  _signal.notify_one();
+}
+
+void InputRecorder::run()
+{
+  std::unique_lock<std::mutex> lk(_mutex);
+  while(true)
+  {
+    _signal.wait(lk, [this]() { return _busy.load() || _stop; });
+    if(_busy.load())
+    {
+      lk.unlock();
+      writeAll(_fd, _pending);
+      lk.lock();
+      _pending.clear();
+      _busy.store(false, std::memory_order_release);
+    }
+    else if(_stop)
+    {
+      return;
+    }
+  }
+}
+
+void InputRecorder::writeAll(int fd, std::vector<std::uint8_t> const& data)
+{
+  std::size_t written = 0;
+  while(written < data.size())
+  {
+    ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+    if(result < 0 && errno == EINTR)
+      continue;
+    if(result <= 0)
+    {
+      std::cerr << "ERROR: Could not write recording, error code " << errno << std::endl;
+      return;
+    }
+    written += result;
+  }
+}
+
+bool Recording::Device::has(unsigned int type, unsigned int code) const
+{
+  for(auto const& capability : capabilities)
+  {
+    if(capability.first == type)
+      return code / 8 < capability.second.size()
+        && (capability.second[code / 8] & (1 << code % 8));
+  }
+  return false;
+}
+
+Recording::Recording() :
+  _data(nullptr), _size(0), _end(0), _offset(0), _devices(), _index(),
+  _indexed(false), _time(0), _dropped(0), _remaining(0), _device(0), _role(0)
+{
+}
+
+Recording::~Recording()
+{
+  unmap();
+}
+
+void Recording::unmap()
+{
+  if(_data)
+    munmap(const_cast<std::uint8_t*>(_data), _size);
+  _data = nullptr;
+  _size = 0;
+}
+
+bool Recording::open(std::string const& path)
+{
+  unmap();
+  _devices.clear();
+  _index.clear();
+
+  int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0 || st.st_size < 8)
+  {
+    std::cerr << "ERROR: Could not open recording " << path << std::endl;
+    if(fd >= 0)
+      close(fd);
+    return false;
+  }
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+  {
+    std::cerr << "ERROR: Could not map recording " << path << std::endl;
+    return false;
+  }
+  _data = static_cast<std::uint8_t const*>(data);
+  _size = st.st_size;
+
+  std::uint32_t version = 0;
+  std::memcpy(&version, _data + 4, sizeof(version));
+  if(std::memcmp(_data, "FKMR", 4) != 0 || version != InputRecorder::VERSION)
+  {
+    std::cerr << "ERROR: " << path << " is not a recording of this version" << std::endl;
+    unmap();
+    return false;
+  }
+
+  _end = _size;
+  _indexed = readTrailer();
+  if(!_indexed)
+  {
+    // Cut short, whatever is there can still be read
+    _end = _size;
+    _devices.clear();
+    _index.clear();
+  }
+  rewind();
+  return true;
+}
+
+bool Recording::readTrailer()
+{
+  std::uint64_t trailer = 0;
+  if(_size < 8 + 12 || std::memcmp(_data + _size - 4, "FKMI", 4) != 0)
+    return false;
+  std::memcpy(&trailer, _data + _size - 12, sizeof(trailer));
+  if(trailer < 8 || trailer > _size - 12)
+    return false;
+
+  _offset = trailer;
+  std::uint64_t devices = 0;
+  if(!varint(devices))
+    return false;
+  for(std::uint64_t i = 0; i < devices; ++i)
+  {
+    if(!device())
+      return false;
+  }
+
+  std::uint32_t count = 0;
+  if(!fixed(&count, sizeof(count)) || (_size - 12 - _offset) != count * 16ull)
+    return false;
+  for(std::uint32_t i = 0; i < count; ++i)
+  {
+    IndexEntry entry;
+    fixed(&entry.offset, sizeof(entry.offset));
+    fixed(&entry.time, sizeof(entry.time));
+    if(entry.offset >= trailer)
+      return false;
+    _index.push_back(entry);
+  }
+  // The END tag is right before the trailer
+  _end = trailer - 1;
+  return true;
+}
+
+std::vector<Recording::Device> const& Recording::devices() const
+{
+  return _devices;
+}
+
+unsigned long long Recording::dropped() const
+{
+  return _dropped;
+}
+
+bool Recording::indexed() const
+{
+  return _indexed;
+}
+
+void Recording::rewind()
+{
+  _offset = 8;
+  _time = 0;
+  _dropped = 0;
+  _remaining = 0;
+}
+
+void Recording::seek(unsigned long long time)
+{
+  if(_index.empty())
+    scan();
+  auto after = std::upper_bound(_index.begin(), _index.end(), time,
+      [](unsigned long long t, IndexEntry const& entry) { return t < entry.time; });
+  if(after == _index.begin())
+  {
+    rewind();
+    return;
+  }
+  _offset = (after - 1)->offset;
+  _time = 0;
+  _remaining = 0;
+}
+
+void Recording::scan()
+{
+  // Devices come along, the dropped count does not matter here
+  rewind();
+  while(_offset < _end)
+  {
+    std::size_t const start = _offset;
+    std::uint8_t const tag = _data[_offset++];
+    std::uint64_t count = 0;
+    std::uint64_t value = 0;
+    std::int64_t signedValue = 0;
+    bool valid = true;
+    switch(tag)
+    {
+      case InputRecorder::BLOCK:
+        valid = fixed(&value, sizeof(value));
+        if(valid)
+          _index.push_back({start, value});
+        break;
+      case InputRecorder::DEVICE:
+        valid = device();
+        break;
+      case InputRecorder::EVENTS:
+        valid = varint(value) && varint(count);
+        for(std::uint64_t i = 0; valid && i < count; ++i)
+        {
+          valid = signedVarint(signedValue) && varint(value) && varint(value)
+            && signedVarint(signedValue);
+        }
+        break;
+      case InputRecorder::GAP:
+        valid = varint(value);
+        break;
+      default:
+        valid = false;
+    }
+    if(!valid)
+    {
+      // Whatever follows cannot be read either
+      _end = start;
+      break;
+    }
+  }
+  rewind();
+}
+
+bool Recording::next(Event& event)
+{
+  while(_remaining == 0)
+  {
+    if(_offset >= _end)
+      return false;
+
+    std::uint8_t const tag = _data[_offset++];
+    std::uint64_t value = 0;
+    switch(tag)
+    {
+      case InputRecorder::BLOCK:
+        if(!fixed(&_time, sizeof(_time)))
+          return false;
+        break;
+      case InputRecorder::DEVICE:
+        if(!device())
+          return false;
+        break;
+      case InputRecorder::EVENTS:
+      {
+        std::uint64_t device = 0;
+        if(!varint(device) || !varint(_remaining))
+          return false;
+        _device = device;
+        _role = 0;
+        for(Device const& d : _devices)
+        {
+          if(d.id == _device)
+            _role = d.role;
+        }
+        break;
+      }
+      case InputRecorder::GAP:
+        if(!varint(value))
+          return false;
+        _dropped += value;
+        break;
+      default:
+        // END or garbage after a crash
+        _offset = _end;
+        return false;
+    }
+  }
+
+  std::int64_t delta = 0;
+  std::uint64_t type = 0;
+  std::uint64_t code = 0;
+  std::int64_t value = 0;
+  if(!signedVarint(delta) || !varint(type) || !varint(code) || !signedVarint(value))
+  {
+    _offset = _end;
+    _remaining = 0;
+    return false;
+  }
+  _remaining -= 1;
+  _time += delta;
+
+  event.device = _device;
+  event.role = _role;
+  std::memset(&event.event, 0, sizeof(event.event));
+  event.event.time.tv_sec = _time / 1000000000;
+  event.event.time.tv_usec = _time % 1000000000 / 1000;
+  event.event.type = type;
+  event.event.code = code;
+  event.event.value = value;
+  return true;
+}
+
+bool Recording::varint(std::uint64_t& value)
+{
+  value = 0;
+  for(unsigned int shift = 0; shift < 64 && _offset < _size; shift += 7)
+  {
+    std::uint8_t const byte = _data[_offset++];
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if(!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool Recording::signedVarint(std::int64_t& value)
+{
+  std::uint64_t raw = 0;
+  if(!varint(raw))
+    return false;
+  value = static_cast<std::int64_t>(raw >> 1) ^ -static_cast<std::int64_t>(raw & 1);
+  return true;
+}
+
+bool Recording::text(std::string& value)
+{
+  std::uint64_t length = 0;
+  if(!varint(length) || _size - _offset < length)
+    return false;
+  value.assign(reinterpret_cast<char const*>(_data + _offset), length);
+  _offset += length;
+  return true;
+}
+
+bool Recording::fixed(void* value, std::size_t size)
+{
+  if(_size - _offset < size)
+    return false;
+  std::memcpy(value, _data + _offset, size);
+  _offset += size;
+  return true;
+}
+
+bool Recording::device()
+{
+  Device device;
+  std::uint64_t id = 0;
+  std::uint64_t role = 0;
+  std::uint64_t info[4] = {};
+  std::uint64_t types = 0;
+  if(!varint(id) || !varint(role) || !text(device.path) || !text(device.name)
+      || !varint(info[0]) || !varint(info[1]) || !varint(info[2]) || !varint(info[3])
+      || !varint(types))
+    return false;
+
+  device.id = id;
+  device.role = role;
+  device.info = {static_cast<std::uint16_t>(info[0]), static_cast<std::uint16_t>(info[1]),
+    static_cast<std::uint16_t>(info[2]), static_cast<std::uint16_t>(info[3])};
+  for(std::uint64_t i = 0; i < types; ++i)
+  {
+    std::uint64_t type = 0;
+    std::uint64_t length = 0;
+    if(!varint(type) || !varint(length) || _size - _offset < length)
+      return false;
+    device.capabilities.push_back({static_cast<unsigned int>(type),
+        std::vector<std::uint8_t>(_data + _offset, _data + _offset + length)});
+    _offset += length;
+  }
+  addDevice(device);
+  return true;
+}
+
+void Recording::addDevice(Device const& device)
+{
+  for(Device& known : _devices)
+  {
+    if(known.id == device.id)
+    {
+      known = device;
+      return;
+    }
+  }
+  _devices.push_back(device);
+}
+
+#endif
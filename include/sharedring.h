@@ -0,0 +1,228 @@
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <atomic>
+#include <new>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+
+// Single producer, single consumer ring buffer living in anonymous shared
+// memory, so it keeps working across fork(). The consumer spins for a while
+// and then sleeps on an eventfd. The producer only pays for a write() when
+// the consumer is actually asleep.
+template<typename T, unsigned int N>
+class SharedRing
+{
+  static_assert((N & (N - 1)) == 0, "SharedRing size must be a power of two");
+public:
+  // Map a new ring, call before fork(). Returns nullptr on failure.
+  static SharedRing* create();
+  static void destroy(SharedRing* ring);
+
+  bool push(T const& value);
+  bool pop(T& value);
+  bool empty() const;
+  // Items waiting to be popped, exact only on the consumer's side
+  unsigned int size() const;
+  // Block until there is something to pop, spinning first on SMP systems.
+  // With a non-negative timeout gives up after that many nanoseconds of
+  // sleeping and returns false.
+  bool wait(unsigned int spins, long long timeoutNs = -1);
+  // For the consumer to wait on fd() along with other descriptors instead
+  // of wait(): marks it asleep, or returns false if there is something to
+  // pop already
+  bool sleep();
+  // After such a wait, with whether fd() was readable
+  void wake(bool signalled);
+  // Wake the consumer even with nothing new, eg. once the producer is done
+  void notify();
+  // Forget anything left in the ring, only when neither side is running
+  void clear();
+  int fd() const;
+
+private:
+  SharedRing(int fd);
+
+  alignas(64) std::atomic<unsigned int> _head;
+  alignas(64) std::atomic<unsigned int> _tail;
+  alignas(64) std::atomic<bool> _sleeping;
+  int _fd;
+  T _items[N];
+};
+
+template<typename T, unsigned int N>
+SharedRing<T, N>* SharedRing<T, N>::create()
+{
+  void* memory = mmap(nullptr, sizeof(SharedRing), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(memory == MAP_FAILED)
+    return nullptr;
+
+  int fd = eventfd(0, EFD_CLOEXEC);
+  if(fd < 0)
+  {
+    munmap(memory, sizeof(SharedRing));
+    return nullptr;
+  }
+
+  return new(memory) SharedRing(fd);
+}
+
+template<typename T, unsigned int N>
+void SharedRing<T, N>::destroy(SharedRing* ring)
+{
+  if(ring)
+  {
+    close(ring->_fd);
+    ring->~SharedRing();
+    munmap(ring, sizeof(SharedRing));
+  }
+}
+
+template<typename T, unsigned int N>
+SharedRing<T, N>::SharedRing(int fd) :
+  _head(0), _tail(0), _sleeping(false), _fd(fd), _items()
+{
+}
+
+template<typename T, unsigned int N>
+bool SharedRing<T, N>::push(T const& value)
+{
+  unsigned int tail = _tail.load(std::memory_order_relaxed);
+  if(tail - _head.load(std::memory_order_acquire) == N)
+    return false;
+
+  _items[tail & (N - 1)] = value;
+  _tail.store(tail + 1, std::memory_order_release);
+
+  // Pairs with the fence in wait(), either the consumer sees the new tail
+  // or we see it sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(_sleeping.load(std::memory_order_relaxed))
+  {
+    eventfd_write(_fd, 1);
+  }
+  return true;
+}
+
+template<typename T, unsigned int N>
+bool SharedRing<T, N>::pop(T& value)
+{
+  unsigned int head = _head.load(std::memory_order_relaxed);
+  if(head == _tail.load(std::memory_order_acquire))
+    return false;
+
+  value = _items[head & (N - 1)];
+  _head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+template<typename T, unsigned int N>
+bool SharedRing<T, N>::empty() const
+{
+  return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+}
+
+template<typename T, unsigned int N>
+unsigned int SharedRing<T, N>::size() const
+{
+  return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+}
+
+template<typename T, unsigned int N>
+bool SharedRing<T, N>::wait(unsigned int spins, long long timeoutNs)
+{
+  // Spinning on a single CPU only keeps the producer from running
+  static bool const uniprocessor = sysconf(_SC_NPROCESSORS_ONLN) < 2;
+  if(uniprocessor)
+    spins = 0;
+
+  for(unsigned int i = 0; i < spins; ++i)
+  {
+    if(!empty())
+      return true;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  while(empty())
+  {
+    bool timedOut = false;
+    _sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(empty())
+    {
+      eventfd_t value;
+      if(timeoutNs < 0)
+      {
+        eventfd_read(_fd, &value);
+      }
+      else
+      {
+        pollfd pfd = {_fd, POLLIN, 0};
+        timespec timeout = {static_cast<time_t>(timeoutNs / 1000000000),
+          static_cast<long>(timeoutNs % 1000000000)};
+        if(ppoll(&pfd, 1, &timeout, nullptr) > 0)
+          eventfd_read(_fd, &value);
+        else
+          timedOut = true;
+      }
+    }
+    _sleeping.store(false, std::memory_order_relaxed);
+    if(timedOut)
+      return !empty();
+  }
+  return true;
+}
+
+template<typename T, unsigned int N>
+bool SharedRing<T, N>::sleep()
+{
+  _sleeping.store(true, std::memory_order_relaxed);
+  // Pairs with the fence in push() like in wait()
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(!empty())
+  {
+    _sleeping.store(false, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+template<typename T, unsigned int N>
+void SharedRing<T, N>::wake(bool signalled)
+{
+  _sleeping.store(false, std::memory_order_relaxed);
+  if(signalled)
+  {
+    eventfd_t value;
+    eventfd_read(_fd, &value);
+  }
+}
+
+template<typename T, unsigned int N>
+void SharedRing<T, N>::notify()
+{
+  eventfd_write(_fd, 1);
+}
+
+template<typename T, unsigned int N>
+void SharedRing<T, N>::clear()
+{
+  _head.store(0);
+  _tail.store(0);
+  _sleeping.store(false);
+}
+
+template<typename T, unsigned int N>
+int SharedRing<T, N>::fd() const
+{
+  return _fd;
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef STICK_RESPONSE_H
+#define STICK_RESPONSE_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+
+// Maps the deflection of an analog stick to a speed from 0 to 1 along each
+// axis. Deadzone, response curve and anti-deadzone are folded into one table
+// by build(), so mapping a stick position costs a table lookup rather than
+// evaluating the curve.
+//
+// Deadzones are either per axis, or radial around the center so diagonals
+// behave like straight movement. A scaled deadzone rescales the rest of the
+// deflection to start from 0 at its edge, a plain radial one passes it on
+// unchanged. The anti-deadzone is the speed right outside the deadzone, eg.
+// to overcome a game's own deadzone, 1 makes the speed constant.
+struct StickResponse
+{
+  enum Shape { AXIAL, RADIAL, SCALED_RADIAL };
+  enum Curve { LINEAR, POWER, CLASSIC, POINTS };
+
+  static constexpr unsigned int TABLE_SIZE = 1024;
+
+  // Parse eg. "power 2.5", false if invalid
+  bool curve(std::string const& spec);
+  bool shape(std::string const& spec);
+
+  // Rebuild the table after changing any of the parameters
+  void build(int deadzone, int range);
+  // Whether a stick at x, y is outside the deadzone
+  bool active(int x, int y) const;
+  // Speeds along the axes for a stick at x, y
+  void apply(int x, int y, float& outX, float& outY) const;
+  // The curve alone, evaluated directly
+  float evaluate(float deflection) const;
+
+  Shape shapeType = AXIAL;
+  Curve curveType = LINEAR;
+  // POWER: exponent, CLASSIC: how much faster full deflection is relative
+  // to linear growth
+  float parameter = 1;
+  // POINTS: deflection and speed pairs, sorted by deflection
+  std::vector<std::pair<float, float>> points;
+  float antiDeadzone = 0;
+
+private:
+  float lookup(float magnitude) const;
+
+  int _deadzone = 0;
+  int _range = 1;
+  // Table positions per stick unit
+  float _scale = 0;
+  // Speed by deflection from 0 to the full range, TABLE_SIZE + 1 entries
+  std::vector<float> _table;
+};
+
+constexpr unsigned int StickResponse::TABLE_SIZE;
+
+bool StickResponse::curve(std::string const& spec)
+{
+  std::istringstream words(spec);
+  std::string name;
+  words >> name;
+  std::transform(name.begin(), name.end(), name.begin(), tolower);
+
+  float number = 0;
+  if(name == "linear")
+  {
+    curveType = LINEAR;
+    return true;
+  }
+  else if((name == "power" || name == "classic") && words >> number && number >= 0)
+  {
+    curveType = name == "power" ? POWER : CLASSIC;
+    parameter = number;
+    return true;
+  }
+  else if(name == "points")
+  {
+    std::vector<std::pair<float, float>> parsed;
+    std::string point;
+    while(words >> point)
+    {
+      std::istringstream pair(point);
+      float x = 0;
+      float y = 0;
+      char colon = 0;
+      if(!(pair >> x >> colon >> y) || colon != ':' || x <= 0 || x > 1 || y < 0)
+      {
+        std::cerr << "ERROR: Invalid response curve point " << point << std::endl;
+        return false;
+      }
+      parsed.push_back({x, y});
+    }
+    if(parsed.empty())
+    {
+      std::cerr << "ERROR: Invalid response curve " << spec << std::endl;
+      return false;
+    }
+
+    std::sort(parsed.begin(), parsed.end());
+    curveType = POINTS;
+    points.swap(parsed);
+    return true;
+  }
+
+  std::cerr << "ERROR: Invalid response curve " << spec << std::endl;
+  return false;
+}
+
+bool StickResponse::shape(std::string const& spec)
+{
+  std::string s(spec);
+  std::transform(s.begin(), s.end(), s.begin(), tolower);
+  if(s == "axial")
+    shapeType = AXIAL;
+  else if(s == "radial")
+    shapeType = RADIAL;
+  else if(s == "scaled_radial")
+    shapeType = SCALED_RADIAL;
+  else
+  {
+    std::cerr << "ERROR: Invalid deadzone shape " << spec << std::endl;
+    return false;
+  }
+  return true;
+}
+
+float StickResponse::evaluate(float x) const
+{
+  switch(curveType)
+  {
+    case POWER:
+      return std::pow(x, parameter);
+    case CLASSIC:
+      // Speed grows with deflection, normalized to reach 1 at the end
+      return x * (1 + parameter * x) / (1 + parameter);
+    case POINTS:
+    {
+      // Piecewise linear from the origin, flat after the last point
+      float previousX = 0;
+      float previousY = 0;
+      for(auto const& point : points)
+      {
+        if(x <= point.first)
+          return previousY + (point.second - previousY) * (x - previousX)
+            / (point.first - previousX);
+        previousX = point.first;
+        previousY = point.second;
+      }
+      return previousY;
+    }
+    case LINEAR:
+      break;
+  }
+  return x;
+}
+
+void StickResponse::build(int deadzone, int range)
+{
+  _deadzone = std::max(deadzone, 0);
+  _range = std::max(range, _deadzone + 1);
+  float const edge = static_cast<float>(_deadzone) / _range;
+  _scale = static_cast<float>(TABLE_SIZE) / _range;
+
+  _table.resize(TABLE_SIZE + 1);
+  for(unsigned int i = 0; i <= TABLE_SIZE; ++i)
+  {
+    // Entries within the deadzone are only ever interpolated towards, they
+    // continue the speed at its edge. apply() handles the deadzone itself.
+    float magnitude = std::max(static_cast<float>(i) / TABLE_SIZE, edge);
+    float deflection = shapeType == RADIAL ? magnitude
+      : (magnitude - edge) / (1 - edge);
+    _table[i] = antiDeadzone + (1 - antiDeadzone) * evaluate(deflection);
+  }
+}
+
+bool StickResponse::active(int x, int y) const
+{
+  if(shapeType == AXIAL)
+    return x > _deadzone || x < -_deadzone || y > _deadzone || y < -_deadzone;
+
+  long long const squared = static_cast<long long>(x) * x + static_cast<long long>(y) * y;
+  return squared > static_cast<long long>(_deadzone) * _deadzone;
+}
+
+float StickResponse::lookup(float magnitude) const
+{
+  float position = std::min(magnitude * _scale, static_cast<float>(TABLE_SIZE));
+  unsigned int i = std::min(static_cast<unsigned int>(position), TABLE_SIZE - 1);
+  float fraction = position - i;
+  return _table[i] + (_table[i + 1] - _table[i]) * fraction;
+}
+
+void StickResponse::apply(int x, int y, float& outX, float& outY) const
+{
+  if(shapeType == AXIAL)
+  {
+    outX = x > _deadzone ? lookup(x) : x < -_deadzone ? -lookup(-x) : 0;
+    outY = y > _deadzone ? lookup(y) : y < -_deadzone ? -lookup(-y) : 0;
+    return;
+  }
+
+  if(!active(x, y))
+  {
+    outX = 0;
+    outY = 0;
+    return;
+  }
+
+  float const magnitude = std::sqrt(static_cast<float>(x) * x + static_cast<float>(y) * y);
+  float const speed = lookup(magnitude) / magnitude;
+  outX = x * speed;
+  outY = y * speed;
+}
+
+#endif
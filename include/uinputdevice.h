@@ -7,6 +7,9 @@
 #include <unistd.h>
 #include <memory.h>
 #include <linux/uinput.h>
+#include <errno.h>
+
+#include "metrics.h"
 
 #include <iostream>
 #include <string>
@@ -28,19 +31,31 @@ public:
     int flat;
   };
   explicit UinputDevice(std::string const& path, unsigned int bus, std::string const& name, unsigned int vendor, unsigned int product, unsigned int version, std::vector<PossibleEvent> const& possibleEvents, std::vector<AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData = std::vector<AbsoluteAxisCalibrationData>());
+  // Adopt a device created earlier and handed over with release()
+  explicit UinputDevice(int fd);
   ~UinputDevice();
   bool send(unsigned int type, unsigned int code, int value);
+  // Write a batch of events with a single syscall
+  bool send(input_event const* events, unsigned int count);
   bool ready() const; 
   operator bool() const; 
   void destroy();
+  // Give up ownership of the device without destroying it
+  int release();
+  // Count writes and events dropped by a full device under labels
+  void metrics(Metrics* metrics, std::string const& labels);
 protected:
   int _fd;
+  Metrics::Counter _writes;
+  Metrics::Counter _dropped;
   void open(std::string const& path);
 };
 
 void UinputDevice::open(std::string const& path) {
   destroy();
   _fd = ::open(path.data(), O_WRONLY | O_NONBLOCK);
+  if(_fd < 0)
+    _fd = 0;
 }
 
 UinputDevice::UinputDevice(std::string const& path, unsigned int bus, std::string const& name, unsigned int vendor, unsigned int product, unsigned int version, std::vector<PossibleEvent> const& possibleEvents, std::vector<AbsoluteAxisCalibrationData> const& absoluteAxesCalibrationData)
@@ -103,6 +118,9 @@ UinputDevice::UinputDevice(std::string const& path, unsigned int bus, std::strin
     }
   }
 }
+UinputDevice::UinputDevice(int fd) : _fd(fd), _writes(), _dropped()
+{
+}
 UinputDevice::~UinputDevice()
 {
   destroy();
@@ -119,6 +137,19 @@ bool UinputDevice::send(unsigned int type, unsigned int code, int value)
   event.value = value;
   return write(_fd, &event, sizeof(event)) == sizeof(event);
 }
+bool UinputDevice::send(input_event const* events, unsigned int count)
+{
+  if(!_fd)
+    return false;
+
+  ssize_t const size = sizeof(input_event) * count;
+  ssize_t const written = write(_fd, events, size);
+  _writes.add();
+  // The device is non-blocking, events nobody reads fast enough are lost
+  if(written < 0 && errno == EAGAIN)
+    _dropped.add(count);
+  return written == size;
+}
 
 bool UinputDevice::ready() const
 {
@@ -137,4 +168,17 @@ void UinputDevice::destroy()
     _fd = 0;
   }
 }
+int UinputDevice::release()
+{
+  int fd = _fd;
+  _fd = 0;
+  return fd;
+}
+void UinputDevice::metrics(Metrics* metrics, std::string const& labels)
+{
+  _writes = metrics ? metrics->counter("funkeymonkey_uinput_writes_total",
+      "Writes to uinput devices", labels) : Metrics::Counter();
+  _dropped = metrics ? metrics->counter("funkeymonkey_uinput_eagain_dropped_total",
+      "Events dropped because a uinput device was full (EAGAIN)", labels) : Metrics::Counter();
+}
 #endif
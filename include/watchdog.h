@@ -0,0 +1,180 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include "evdevdevice.h"
+#include "moduleprofiler.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+// Watches plugin dispatches from a separate thread. A callback running past
+// its budget is logged together with a backtrace of the dispatching thread
+// and, if asked to, the grabbed input devices are released until it returns
+// so the user is not left without input. They are grabbed again by the
+// dispatching thread once the callback returns.
+class Watchdog
+{
+public:
+  // Signal used to make the stalled thread print its own backtrace
+  static constexpr int BACKTRACE_SIGNAL = SIGURG;
+
+  Watchdog(unsigned int budgetMs, EvdevDevice* ungrab = nullptr);
+  Watchdog(Watchdog const&) = delete;
+  ~Watchdog();
+
+  // Called by the dispatching thread around each plugin callback
+  void begin(char const* callback);
+  void end();
+
+  unsigned long long incidents() const;
+
+private:
+  void run();
+  // Release the devices if the callback started at started is still running
+  void release(unsigned long long started);
+  // On the dispatching thread
+  void restore();
+  static void printBacktrace(int);
+
+  unsigned long long const _budget;
+  EvdevDevice* const _ungrab;
+  pthread_t const _dispatcher;
+
+  std::atomic<unsigned long long> _started;
+  std::atomic<unsigned long long> _dispatch;
+  std::atomic<char const*> _callback;
+  std::atomic<unsigned long long> _incidents;
+  std::atomic<bool> _released;
+  std::mutex _releaseMutex;
+
+  bool _stop;
+  std::mutex _mutex;
+  std::condition_variable _signal;
+  std::thread _thread;
+};
+
+Watchdog::Watchdog(unsigned int budgetMs, EvdevDevice* ungrab) :
+  _budget(budgetMs * 1000000ull), _ungrab(ungrab), _dispatcher(pthread_self()),
+  _started(0), _dispatch(0), _callback(""), _incidents(0),
+  _released(false), _releaseMutex(), _stop(false), _mutex(), _signal(), _thread()
+{
+  // The first backtrace() loads libgcc, get that done outside the handler
+  void* frames[1];
+  backtrace(frames, 1);
+
+  struct sigaction sigAction;
+  sigAction.sa_handler = printBacktrace;
+  sigAction.sa_flags = SA_RESTART;
+  sigemptyset(&sigAction.sa_mask);
+  if(sigaction(BACKTRACE_SIGNAL, &sigAction, NULL) == -1)
+  {
+    std::cerr << "ERROR: Could not register watchdog signal handler" << std::endl;
+  }
+
+  _thread = std::thread(&Watchdog::run, this);
+}
+
+Watchdog::~Watchdog()
+{
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _stop = true;
+  }
+  _signal.notify_all();
+  _thread.join();
+  restore();
+}
+
+void Watchdog::begin(char const* callback)
+{
+  _callback.store(callback, std::memory_order_relaxed);
+  _dispatch.fetch_add(1, std::memory_order_relaxed);
+  _started.store(ModuleProfiler::now(), std::memory_order_release);
+}
+
+void Watchdog::end()
+{
+  // Sequentially consistent with release(), so either it sees the callback
+  // return or this sees the devices released
+  _started.store(0);
+  if(_released.load())
+    restore();
+}
+
+unsigned long long Watchdog::incidents() const
+{
+  return _incidents.load();
+}
+
+void Watchdog::run()
+{
+  // Check often enough to notice a stall within one and a half budgets
+  auto const interval = std::chrono::nanoseconds(_budget / 2);
+  unsigned long long reported = 0;
+
+  std::unique_lock<std::mutex> lk(_mutex);
+  while(!_signal.wait_for(lk, interval, [this]{ return _stop; }))
+  {
+    unsigned long long started = _started.load(std::memory_order_acquire);
+    unsigned long long dispatch = _dispatch.load(std::memory_order_relaxed);
+    bool const stalled = started && ModuleProfiler::now() - started > _budget;
+
+    if(stalled && dispatch != reported)
+    {
+      reported = dispatch;
+      _incidents.fetch_add(1);
+      std::cerr << "WARNING: Plugin callback " << _callback.load()
+        << " has been running for over " << _budget / 1000000 << " ms"
+        << " (incident " << _incidents.load() << ")" << std::endl;
+      pthread_kill(_dispatcher, BACKTRACE_SIGNAL);
+
+      if(_ungrab)
+        release(started);
+    }
+  }
+}
+
+void Watchdog::release(unsigned long long started)
+{
+  std::lock_guard<std::mutex> lk(_releaseMutex);
+  _released.store(true);
+  if(_started.load() != started || !_ungrab->release())
+  {
+    // Returned meanwhile, or nothing was grabbed
+    _released.store(false);
+    return;
+  }
+  std::cerr << "WARNING: Released input devices until the plugin recovers" << std::endl;
+}
+
+void Watchdog::restore()
+{
+  std::lock_guard<std::mutex> lk(_releaseMutex);
+  if(_released.load())
+  {
+    _ungrab->restore();
+    _released.store(false);
+    std::cerr << "Plugin recovered, input devices grabbed again" << std::endl;
+  }
+}
+
+void Watchdog::printBacktrace(int)
+{
+  static char const header[] = "Backtrace of the stalled plugin callback:\n";
+  void* frames[64];
+  int count = backtrace(frames, 64);
+  if(write(STDERR_FILENO, header, sizeof(header) - 1) > 0)
+  {
+    backtrace_symbols_fd(frames, count, STDERR_FILENO);
+  }
+}
+
+#endif
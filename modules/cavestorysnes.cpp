@@ -1,5 +1,5 @@
 #include "funkeymonkeymodule.h"
-#include "uinputdevice.h"
+#include "funkeymonkeyhost.h"
 #include <iostream>
 
 /*
@@ -23,18 +23,22 @@ good luck!
 
 bool menu; // whether we're in the menu or not.
 
-UinputDevice* out;
+FunKeyMonkeyHost* host;
+FunKeyMonkeyHost::OutputId out;
+void attach(FunKeyMonkeyHost* h)
+{
+  host = h;
+}
 void init(char const** argv, unsigned int argc)
 {
-  std::cout << "Init!";
+  std::cout << "Init!" << std::endl;
   menu = 0; // do not start on menu
-  out = new UinputDevice("/dev/uinput", BUS_USB, "FunKeySNES", 1, 1, 1, {
+  out = host->output("FunKeySNES", BUS_USB, 1, 1, 1, {
     { EV_KEY, { KEY_Q, KEY_W, KEY_A, KEY_S, KEY_Z, KEY_X, KEY_UP, KEY_DOWN, KEY_RIGHT, KEY_LEFT, KEY_ESC, KEY_F1, KEY_F2 } }
   });
 }
 void handle(input_event const& e, unsigned int)
 {
-  std::cout << "\nEvent! " << e.type << " " << e.code << " " << e.value << " " << std::endl;
   if (e.type != 3) // not an x/y axis
   {
     unsigned int sendkey = 0;
@@ -75,57 +79,57 @@ void handle(input_event const& e, unsigned int)
           menu = not menu;
       break;
     }
-    if (out && sendkey)
+    if (sendkey)
     {
       if (e.value)
-        out->send(EV_KEY, sendkey, 1);
+        host->emit(out, EV_KEY, sendkey, 1);
       else
       {
-        out->send(EV_KEY, sendkey, 0);
+        host->emit(out, EV_KEY, sendkey, 0);
       }
-      out->send(EV_SYN, 0, 0);
+      host->emit(out, EV_SYN, 0, 0);
     }
   }
   else if (e.code == 0) // x axis 
   {
     if (e.value == 128) // off
     {
-      out->send(EV_KEY, KEY_RIGHT, 0);
-      out->send(EV_KEY, KEY_LEFT, 0);
-      out->send(EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_RIGHT, 0);
+      host->emit(out, EV_KEY, KEY_LEFT, 0);
+      host->emit(out, EV_SYN, 0, 0);
     }
     else if (e.value == 255) // right
     {
-      out->send(EV_KEY, KEY_LEFT, 0);
-      out->send(EV_KEY, KEY_RIGHT, 1);
-      out->send(EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_LEFT, 0);
+      host->emit(out, EV_KEY, KEY_RIGHT, 1);
+      host->emit(out, EV_SYN, 0, 0);
     }
     else // left
     {
-      out->send(EV_KEY, KEY_RIGHT, 0);
-      out->send(EV_KEY, KEY_LEFT, 1);
-      out->send(EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_RIGHT, 0);
+      host->emit(out, EV_KEY, KEY_LEFT, 1);
+      host->emit(out, EV_SYN, 0, 0);
     }
   }
   else // code == 1, y axis
   {
     if (e.value == 128) // off
     {
-      out->send(EV_KEY, KEY_UP, 0);
-      out->send(EV_KEY, KEY_DOWN, 0);
-      out->send(EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_UP, 0);
+      host->emit(out, EV_KEY, KEY_DOWN, 0);
+      host->emit(out, EV_SYN, 0, 0);
     }
     else if (e.value == 255) // down
     {
-      out->send(EV_KEY, KEY_UP, 0);
-      out->send(EV_KEY, KEY_DOWN, 1);
-      out->send(EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_UP, 0);
+      host->emit(out, EV_KEY, KEY_DOWN, 1);
+      host->emit(out, EV_SYN, 0, 0);
     }
     else // up
     {
-      out->send(EV_KEY, KEY_DOWN, 0);
-      out->send(EV_KEY, KEY_UP, 1);
-      out->send(EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_DOWN, 0);
+      host->emit(out, EV_KEY, KEY_UP, 1);
+      host->emit(out, EV_SYN, 0, 0);
     }
   }
 }
@@ -133,10 +137,6 @@ void handle(input_event const& e, unsigned int)
 void destroy()
 {
   std::cout << "Destroy!" << std::endl;
-  if(out)
-  {
-    delete out;
-  }
 }
 
 void user1()
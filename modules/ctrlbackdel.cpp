@@ -1,15 +1,20 @@
 #include "funkeymonkeymodule.h"
-#include "uinputdevice.h"
+#include "funkeymonkeyhost.h"
 #include <iostream>
 
-UinputDevice* out;
+FunKeyMonkeyHost* host;
+FunKeyMonkeyHost::OutputId out;
+void attach(FunKeyMonkeyHost* h)
+{
+  host = h;
+}
 void init(char const** argv, unsigned int argc)
 {
   // need to list all possible keys that we want to output in uinput
   std::vector<unsigned int> keycodes;
   for (unsigned int i = KEY_RESERVED; i <= KEY_UNKNOWN; ++i)
     keycodes.push_back(i);
-  out = new UinputDevice("/dev/uinput", BUS_USB, "FunKeyCtrlBackDel", 1, 1, 1, {
+  out = host->output("FunKeyCtrlBackDel", BUS_USB, 1, 1, 1, {
     { EV_KEY, keycodes }
   });
 }
@@ -21,7 +26,7 @@ void handle(input_event const& e, unsigned int)
   if (e.type != EV_KEY)
   {
     if (e.type == EV_SYN)
-        out->send(EV_SYN, e.code, e.value);
+        host->emit(out, EV_SYN, e.code, e.value);
     return;
   }
   static bool left_ctrl_depressed = false;
@@ -35,29 +40,25 @@ void handle(input_event const& e, unsigned int)
     // (e.g. Ctrl+Delete means something different in the browser)
     if (e.value)
     {
-      out->send(EV_KEY, KEY_LEFTCTRL, 0);
-      out->send(EV_SYN, 0, 0);
-      out->send(EV_KEY, KEY_DELETE, 1);
+      host->emit(out, EV_KEY, KEY_LEFTCTRL, 0);
+      host->emit(out, EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_DELETE, 1);
     }
     else
     {
-      out->send(EV_KEY, KEY_DELETE, 0);
-      out->send(EV_SYN, 0, 0);
-      out->send(EV_KEY, KEY_LEFTCTRL, 1);
+      host->emit(out, EV_KEY, KEY_DELETE, 0);
+      host->emit(out, EV_SYN, 0, 0);
+      host->emit(out, EV_KEY, KEY_LEFTCTRL, 1);
     }
     return;
   }
   // pass through everything else, including ctrl
-  out->send(e.type, e.code, e.value);
+  host->emit(out, e.type, e.code, e.value);
 }
 
 void destroy()
 {
   std::cout << "Destroy!" << std::endl;
-  if (out)
-  {
-    delete out;
-  }
 }
 
 void user1()
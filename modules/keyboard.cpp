@@ -1,142 +1,1565 @@
 #include "funkeymonkeymodule.h"
-#include "uinputdevice.h"
+#include "funkeymonkeyhost.h"
+#include "eventcodes.h"
+#include "asciikeys.h"
+#include "ahocorasick.h"
+#include "macrostore.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <functional>
 #include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+/*
+Without parameters the keyboard plugin applies a couple of example
+mappings. With -X config=FILE it reads layered mappings instead, one per
+line:
+
+  LAYER.KEY = ACTION
+
+where ACTION is one of
+
+  KEY                 KEY is sent instead
+  momentary NAME      layer NAME is active while KEY is held
+  toggle NAME         KEY switches layer NAME on and off
+  oneshot NAME        layer NAME is active for the next key press, or
+                      while KEY is held if other keys are pressed meanwhile
+  taphold TAP HOLD [TERM] [permissive|interrupt]
+                      tapping KEY sends TAP, holding it sends HOLD
+  transparent         the next active layer below decides
+  record SLOT         KEY starts and stops recording macro SLOT, 0 to 15
+  play SLOT [SPEED]   KEY plays macro SLOT back, SPEED times as fast as it
+                      was recorded, or as fast as possible with 0
+
+The base layer is called "base". Other layers are created when first
+mentioned, and layers mentioned later take precedence over earlier ones.
+Keys a layer does not map are transparent. SIGUSR1 reloads the file.
+
+eg. an Fn key on right alt:
+
+  base.KEY_RIGHTALT = momentary fn
+  fn.KEY_H = KEY_LEFT
+  fn.KEY_L = KEY_RIGHT
+
+Chords are keys pressed together, within WINDOW milliseconds (50 by
+default) of the first one, and produce OUTPUT until one of them is
+released:
+
+  LAYER.KEY+KEY... = OUTPUT [WINDOW]
+
+A chord only applies while its layer is active. Keys that could start a
+chord are held back until the chord is complete or can no longer happen,
+and are then passed on in their original order.
+
+With -X expansions=FILE typed abbreviations are replaced by text. Each
+line of the file has an abbreviation, whitespace and the text it expands
+to, where \n, \t and \\ stand for newline, tab and backslash:
+
+  :sig Best regards,\nFunKeyMonkey
+
+Abbreviations are matched against the keys as typed on each input device,
+before any remapping, assuming a US layout. Once one has been typed it is
+erased with backspaces and the text is typed in its place.
+
+A tap-hold key is held if it is down for longer than TERM milliseconds,
+200 by default. Keys pressed in the meantime are held back until that is
+decided. With permissive it is also held once another key is pressed and
+released within the term, with interrupt as soon as another key is
+pressed. Decisions use the input event timestamps, a host timer covers
+the case of no further input.
+
+Macros record the keys as they come from the input devices, with their
+timestamps, and play them back through the layers on host timers, so
+other input is handled normally in between. With -X macros=FILE they are
+saved to FILE, which is simply memory mapped at startup. Keys still held
+when recording stops are released at the end of the macro.
+*/
 
 static constexpr unsigned int FIRST_KEY = KEY_RESERVED;
-static constexpr unsigned int LAST_KEY = KEY_UNKNOWN;
+static constexpr unsigned int LAST_KEY = KEY_MAX;
+// Buttons are handled too, eg. to map mouse side buttons to keys, but the
+// output only declares keyboard keys so it is not taken for a mouse or
+// joystick
+static constexpr unsigned int LAST_OUTPUT_KEY = KEY_UNKNOWN;
 
+// Per key behavior kept as a struct of arrays. handle() only touches the
+// type and mapping arrays for plain and mapped keys, about three bytes per
+// key. Behaviors that need more than that live in side tables indexed by
+// the mapping.
 template<int FIRST_KEY, int LAST_KEY>
 class KeyBehaviors
 {
 public:
+  enum Type : std::uint8_t { PASSTHROUGH, MAPPED, ALTMAPPED, COMPLEX,
+    TRANSPARENT, MOMENTARY, TOGGLE, ONESHOT, TAPHOLD, RECORD, PLAY };
+  static constexpr unsigned int NUM_KEYS = LAST_KEY - FIRST_KEY + 1;
+
+  struct TapHold
+  {
+    enum Mode { TAPPING_TERM, PERMISSIVE, INTERRUPT };
+    std::uint16_t tap;
+    std::uint16_t hold;
+    unsigned long long term;
+    Mode mode;
+  };
+
+  struct Macro
+  {
+    std::uint8_t slot;
+    float speed;
+  };
+
+  explicit KeyBehaviors(Type initial = PASSTHROUGH);
   void passthrough(unsigned int code);
   void map(unsigned int code, unsigned int result);
-  void altmap(unsigned int code, bool* flag, 
-              unsigned int regular, 
+  void altmap(unsigned int code, bool* flag,
+              unsigned int regular,
               unsigned int alternative);
   void complex(unsigned int code, std::function<void(int)> function);
+  // Layer switching keys, handled by KeyLayers
+  void transparent(unsigned int code);
+  void layer(unsigned int code, Type type, unsigned int layer);
+  // Dual role key, handled by KeyLayers. term is in nanoseconds.
+  void tapHold(unsigned int code, unsigned int tap, unsigned int hold,
+      unsigned long long term, typename TapHold::Mode mode);
+  // Macro keys, handled by KeyLayers. speed is ignored for RECORD.
+  void macro(unsigned int code, Type type, unsigned int slot, float speed);
   void handle(unsigned int code, int value);
 
+  // code must be within the table
+  Type type(unsigned int code) const;
+  unsigned int mapping(unsigned int code) const;
+  TapHold const& tapHold(unsigned int code) const;
+  Macro const& macro(unsigned int code) const;
+
 private:
-  struct KeyBehavior
+  struct AltMapping
   {
-    KeyBehavior() : type(PASSTHROUGH), mapping(0), function() {}
-    enum Type  { PASSTHROUGH, MAPPED, ALTMAPPED, COMPLEX };
-    Type type;
-    int mapping;
-    int alternative;
     bool* flag;
-    std::function<void(int)> function;
+    std::uint16_t regular;
+    std::uint16_t alternative;
   };
 
-  static constexpr unsigned int NUM_KEYS = LAST_KEY - FIRST_KEY + 1;
-  std::array<KeyBehavior, NUM_KEYS> behaviors;
+  bool set(unsigned int code, Type type, unsigned int mapping);
+
+  std::array<Type, NUM_KEYS> _types;
+  // Output code for MAPPED, side table index for ALTMAPPED, COMPLEX,
+  // TAPHOLD and macro keys, layer index for layer switching keys
+  std::array<std::uint16_t, NUM_KEYS> _mappings;
+  std::vector<AltMapping> _altmaps;
+  std::vector<std::function<void(int)>> _complex;
+  std::vector<TapHold> _tapHolds;
+  std::vector<Macro> _macros;
+};
+
+typedef KeyBehaviors<FIRST_KEY, LAST_KEY> Behaviors;
+
+// A stack of behavior tables. The active layers are a bit mask, so
+// switching layers is a bit operation and a key press looks up the highest
+// active layer, walking further down only past transparent keys.
+class KeyLayers
+{
+public:
+  static constexpr unsigned int MAX_LAYERS = 32;
+
+  KeyLayers();
+  ~KeyLayers();
+  // Layer by name, created if necessary. Null if there are too many.
+  Behaviors* layer(std::string const& name);
+  int index(std::string const& name);
+  // Chord of keys pressed within window nanoseconds. False if the chords
+  // use more than MAX_CHORD_KEYS different keys.
+  bool chord(std::string const& layer, std::vector<unsigned int> const& keys,
+      unsigned int output, unsigned long long window);
+  // time is the event timestamp in nanoseconds
+  void handle(unsigned int code, int value, unsigned long long time);
+  // The tapping term of the undecided tap-hold key ran out
+  void tapHoldTimeout();
+  // The window of the pending chord closed
+  void chordTimeout();
+  // Whether code records or plays macros on any layer
+  bool macroKey(unsigned int code) const;
+  // Settles pending chords and tap-hold keys and releases every key still
+  // held, so whatever they produced is released before the table goes
+  void release();
+
+  static constexpr unsigned int MAX_CHORD_KEYS = 64;
+
+private:
+  struct Buffered
+  {
+    std::uint16_t code;
+    int value;
+    unsigned long long time;
+  };
+
+  // A tap-hold key that is down but not yet decided, code is -1 if none
+  struct Undecided
+  {
+    int code;
+    unsigned int layer;
+    unsigned long long deadline;
+    FunKeyMonkeyHost::TimerId timer;
+    std::vector<Buffered> events;
+  };
+
+  struct Chord
+  {
+    std::uint64_t keys;
+    std::uint16_t output;
+    unsigned int layer;
+    unsigned long long window;
+  };
+
+  // What a set of pressed chord keys may become, indexed by its bit mask
+  struct ChordCandidates
+  {
+    std::vector<unsigned int> complete;
+    bool extendable;
+  };
+
+  // Chord keys held back since the first one went down, keys is 0 if none
+  struct PendingChord
+  {
+    std::uint64_t keys;
+    unsigned long long first;
+    unsigned long long deadline;
+    FunKeyMonkeyHost::TimerId timer;
+    std::vector<Buffered> events;
+  };
+
+  // A chord that fired, until all its keys are released
+  struct HeldChord
+  {
+    std::uint64_t keys;
+    std::uint16_t output;
+    bool down;
+  };
+
+  void dispatch(unsigned int code, int value, unsigned long long time);
+  unsigned int resolve(unsigned int code) const;
+  void activate(unsigned int layer, bool active);
+  void oneshotUsed();
+  bool buffer(unsigned int code, int value, unsigned long long time);
+  void decide(bool hold);
+  bool chordStage(unsigned int code, int value, unsigned long long time);
+  void resolveChord();
+
+  std::vector<std::string> _names;
+  std::vector<std::unique_ptr<Behaviors>> _layers;
+  std::uint32_t _active;
+  // Layer each key was resolved in when pressed, so its release matches
+  std::array<std::uint8_t, Behaviors::NUM_KEYS> _pressedLayer;
+  std::array<bool, Behaviors::NUM_KEYS> _held;
+  int _oneshot;
+  bool _oneshotHeld;
+  bool _oneshotUsed;
+  Undecided _undecided;
+
+  std::vector<Chord> _chords;
+  // Bit of each key in chord masks, -1 for keys in no chord
+  std::array<std::int8_t, Behaviors::NUM_KEYS> _chordBit;
+  // Longest window of the chords each bit is part of
+  std::array<unsigned long long, MAX_CHORD_KEYS> _chordWindow;
+  unsigned int _chordKeys;
+  std::unordered_map<std::uint64_t, ChordCandidates> _chordIndex;
+  PendingChord _pendingChord;
+  std::uint64_t _chordHeld;
+  std::vector<HeldChord> _heldChords;
 };
 
-KeyBehaviors<FIRST_KEY, LAST_KEY>* behaviors;
-UinputDevice* out;
+// Watches the typed keys for abbreviations. All abbreviations are compiled
+// into one automaton over (key, shift) symbols, so a key press costs one
+// table lookup however many there are.
+class TextExpander
+{
+public:
+  TextExpander();
+  bool load(std::string const& filename);
+  void handle(unsigned int code, int value, unsigned int role);
+
+private:
+  struct Expansion
+  {
+    unsigned int length;
+    std::vector<AsciiKey> keys;
+  };
+
+  // Typing state of one input device
+  struct Typist
+  {
+    unsigned int state;
+    bool leftShift;
+    bool rightShift;
+    // Ctrl, alt or meta held, keys are shortcuts rather than text
+    unsigned int modifiers;
+  };
+
+  static unsigned int symbol(unsigned int code, bool shift);
+  void expand(Expansion const& expansion, Typist const& typist);
+
+  AhoCorasick _automaton;
+  std::vector<Expansion> _expansions;
+  std::vector<Typist> _typists;
+};
+
+// Records the keys typed into macro slots and types them again through the
+// layers. Only one macro records and one plays at a time.
+class Macros
+{
+public:
+  Macros();
+  ~Macros();
+  bool open(std::string const& filename);
+
+  bool recording() const;
+  // Starts recording slot, or stops if it is already being recorded
+  void record(unsigned int slot, unsigned long long time);
+  void capture(unsigned int code, int value, unsigned long long time);
+  // Restarts playback if a macro is already playing
+  void play(unsigned int slot, float speed, unsigned long long time);
+  // The next played event is due
+  void playTimeout();
+
+private:
+  void stopRecording(unsigned long long time);
+  void stopPlaying();
+  unsigned long long due(unsigned int i) const;
+
+  MacroStore _store;
+  int _recording;
+  unsigned long long _recordStart;
+  std::vector<MacroStore::MacroEvent> _recorded;
+  std::vector<std::uint16_t> _recordHeld;
+
+  std::vector<MacroStore::MacroEvent> _playing;
+  unsigned int _next;
+  unsigned long long _playStart;
+  float _speed;
+  FunKeyMonkeyHost::TimerId _timer;
+  std::vector<std::uint16_t> _playHeld;
+};
+
+KeyLayers* layers;
+TextExpander* expander;
+Macros* macros;
+std::string configFile;
+std::string expansionsFile;
+std::string macrosFile;
+FunKeyMonkeyHost* host;
+FunKeyMonkeyHost::OutputId out;
+
+bool loadConfig(std::string const& filename, KeyLayers& layers);
+
+void attach(FunKeyMonkeyHost* h)
+{
+  host = h;
+}
 
 void init(char const** argv, unsigned int argc)
 {
   std::vector<unsigned int> keycodes;
-  for(unsigned int i = FIRST_KEY; i <= LAST_KEY; ++i)
+  for(unsigned int i = FIRST_KEY; i <= LAST_OUTPUT_KEY; ++i)
   {
     keycodes.push_back(i);
   }
 
-  out = new UinputDevice("/dev/uinput", BUS_USB, "FunKeyMonkey keyboard", 1, 1, 1, {
+  out = host->output("FunKeyMonkey keyboard", BUS_USB, 1, 1, 1, {
     { EV_KEY, keycodes }
   });
 
-  behaviors = new KeyBehaviors<FIRST_KEY, LAST_KEY>();
+  for(unsigned int i = 0; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if(arg.compare(0, 7, "config=") == 0)
+    {
+      configFile = arg.substr(7);
+    }
+    else if(arg.compare(0, 11, "expansions=") == 0)
+    {
+      expansionsFile = arg.substr(11);
+    }
+    else if(arg.compare(0, 7, "macros=") == 0)
+    {
+      macrosFile = arg.substr(7);
+    }
+  }
+
+  layers = new KeyLayers();
+  expander = new TextExpander();
+  macros = new Macros();
+
+  if(!macros->open(macrosFile))
+  {
+    std::cerr << "ERROR: Could not open macro file " << macrosFile << std::endl;
+  }
+
+  if(!expansionsFile.empty())
+  {
+    expander->load(expansionsFile);
+  }
+
+  if(!configFile.empty())
+  {
+    loadConfig(configFile, *layers);
+  }
+
+  if(!configFile.empty() || !expansionsFile.empty())
+    return;
 
   // Example mappings
+  Behaviors* behaviors = layers->layer("base");
   behaviors->map(KEY_K, KEY_L);
   behaviors->complex(KEY_O, [](int value) {
-    out->send(EV_KEY, KEY_I, value);
-    out->send(EV_KEY, KEY_O, value);
+    host->emit(out, EV_KEY, KEY_I, value);
+    host->emit(out, EV_KEY, KEY_O, value);
   });
 }
-void handle(input_event const& e, unsigned int)
+void handle(input_event const& e, unsigned int role)
 {
   if(e.type != EV_KEY)
     return;
 
-  behaviors->handle(e.code, e.value);
-  out->send(EV_SYN, 0, 0);
+  unsigned long long time = e.time.tv_sec * 1000000000ull + e.time.tv_usec * 1000ull;
+  if(macros->recording() && !layers->macroKey(e.code))
+  {
+    macros->capture(e.code, e.value, time);
+  }
+
+  layers->handle(e.code, e.value, time);
+  host->emit(out, EV_SYN, 0, 0);
+  expander->handle(e.code, e.value, role);
 }
 void destroy()
 {
-  if(out)
+  if(macros)
+  {
+    delete macros;
+  }
+  if(layers)
   {
-    delete out;
+    delete layers;
   }
-  if(behaviors)
+  if(expander)
   {
-    delete behaviors;
+    delete expander;
   }
 }
 void user1()
 {
+  if(!configFile.empty())
+  {
+    KeyLayers* reloaded = new KeyLayers();
+    if(loadConfig(configFile, *reloaded))
+    {
+      // The new table knows nothing of the keys held now, their releases
+      // would come out as something else or not at all
+      layers->release();
+      delete layers;
+      layers = reloaded;
+      std::cout << "Reloaded " << configFile << std::endl;
+    }
+    else
+    {
+      delete reloaded;
+    }
+  }
+
+  if(!expansionsFile.empty())
+  {
+    TextExpander* reloaded = new TextExpander();
+    if(reloaded->load(expansionsFile))
+    {
+      delete expander;
+      expander = reloaded;
+      std::cout << "Reloaded " << expansionsFile << std::endl;
+    }
+    else
+    {
+      delete reloaded;
+    }
+  }
 }
 void user2()
 {
 }
 
+bool loadConfig(std::string const& filename, KeyLayers& layers)
+{
+  std::ifstream file(filename);
+  if(!file)
+  {
+    std::cerr << "ERROR: Could not open config file " << filename << std::endl;
+    return false;
+  }
+
+  auto trim = [](std::string const& s) {
+    auto first = s.find_first_not_of(" \t");
+    auto last = s.find_last_not_of(" \t\r");
+    return first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+  };
+
+  bool ok = true;
+  unsigned int lineNumber = 0;
+  std::string line;
+  while(std::getline(file, line))
+  {
+    ++lineNumber;
+    line = trim(line);
+    if(line.empty() || line.at(0) == '#')
+      continue;
+
+    auto fail = [&](std::string const& message) {
+      std::cerr << "ERROR: " << filename << ":" << lineNumber << ": "
+        << message << std::endl;
+      ok = false;
+    };
+
+    auto equals = line.find('=');
+    auto dot = line.find('.');
+    if(equals == std::string::npos || dot == std::string::npos || dot > equals)
+    {
+      fail("invalid line: " + line);
+      continue;
+    }
+
+    std::string layerName = trim(line.substr(0, dot));
+    std::string keyName = trim(line.substr(dot + 1, equals - dot - 1));
+    std::vector<std::string> chordNames;
+    std::istringstream keyStream(keyName);
+    std::string chordName;
+    while(std::getline(keyStream, chordName, '+'))
+      chordNames.push_back(trim(chordName));
+    std::istringstream actionStream(line.substr(equals + 1));
+    std::vector<std::string> words;
+    std::string word;
+    while(actionStream >> word)
+      words.push_back(word);
+    std::string action = words.empty() ? std::string() : words[0];
+
+    EventCode key;
+    EventCode result;
+    EventCode tap;
+    EventCode hold;
+    Behaviors* behaviors = layers.layer(layerName);
+    if(!behaviors)
+    {
+      fail("too many layers");
+    }
+    else if(chordNames.size() > 1)
+    {
+      std::vector<unsigned int> keys;
+      for(std::string const& name : chordNames)
+      {
+        if(parseEventCode(name, key) && key.type == EV_KEY
+            && std::find(keys.begin(), keys.end(), key.code) == keys.end())
+          keys.push_back(key.code);
+      }
+
+      char* end = nullptr;
+      unsigned long long windowMs = words.size() == 2
+        ? std::strtoull(words[1].data(), &end, 10) : 50;
+      if(keys.size() != chordNames.size())
+        fail("invalid chord " + keyName);
+      else if(words.empty() || words.size() > 2
+          || !parseEventCode(words[0], result) || result.type != EV_KEY
+          || (end && *end != '\0') || windowMs == 0)
+        fail("invalid chord action " + trim(line.substr(equals + 1)));
+      else if(!layers.chord(layerName, keys, result.code, windowMs * 1000000))
+        fail("too many different keys in chords");
+    }
+    else if(!parseEventCode(keyName, key) || key.type != EV_KEY)
+    {
+      fail("unknown key " + keyName);
+    }
+    else if((action == "momentary" || action == "toggle" || action == "oneshot")
+        && words.size() == 2)
+    {
+      int target = layers.index(words[1]);
+      if(target < 0)
+        fail("too many layers");
+      else
+        behaviors->layer(key.code, action == "momentary" ? Behaviors::MOMENTARY
+            : action == "toggle" ? Behaviors::TOGGLE : Behaviors::ONESHOT, target);
+    }
+    else if(action == "taphold" && words.size() >= 3 && words.size() <= 5)
+    {
+      unsigned long long termMs = 200;
+      Behaviors::TapHold::Mode mode = Behaviors::TapHold::TAPPING_TERM;
+      bool valid = true;
+      for(unsigned int i = 3; i < words.size(); ++i)
+      {
+        char* end = nullptr;
+        unsigned long long number = std::strtoull(words[i].data(), &end, 10);
+        if(words[i] == "permissive")
+          mode = Behaviors::TapHold::PERMISSIVE;
+        else if(words[i] == "interrupt")
+          mode = Behaviors::TapHold::INTERRUPT;
+        else if(*end == '\0' && number > 0)
+          termMs = number;
+        else
+          valid = false;
+      }
+
+      if(!parseEventCode(words[1], tap) || tap.type != EV_KEY)
+        fail("unknown key " + words[1]);
+      else if(!parseEventCode(words[2], hold) || hold.type != EV_KEY)
+        fail("unknown key " + words[2]);
+      else if(!valid)
+        fail("invalid tap-hold options");
+      else
+        behaviors->tapHold(key.code, tap.code, hold.code, termMs * 1000000, mode);
+    }
+    else if((action == "record" && words.size() == 2)
+        || (action == "play" && (words.size() == 2 || words.size() == 3)))
+    {
+      char* end = nullptr;
+      unsigned long slot = std::strtoul(words[1].data(), &end, 10);
+      bool validSlot = *end == '\0' && slot < MacroStore::MAX_SLOTS;
+      float speed = words.size() == 3 ? std::strtof(words[2].data(), &end) : 1;
+      if(!validSlot)
+        fail("invalid macro slot " + words[1]);
+      else if(*end != '\0' || speed < 0)
+        fail("invalid macro speed " + words[2]);
+      else
+        behaviors->macro(key.code, action == "record" ? Behaviors::RECORD
+            : Behaviors::PLAY, slot, speed);
+    }
+    else if(action == "transparent" && words.size() == 1)
+    {
+      behaviors->transparent(key.code);
+    }
+    else if(words.size() == 1 && parseEventCode(action, result) && result.type == EV_KEY)
+    {
+      behaviors->map(key.code, result.code);
+    }
+    else
+    {
+      fail("invalid action " + trim(line.substr(equals + 1)));
+    }
+  }
+
+  return ok;
+}
+
+
+TextExpander::TextExpander() :
+  _automaton(), _expansions(), _typists()
+{
+  _automaton.build();
+}
+
+bool TextExpander::load(std::string const& filename)
+{
+  std::ifstream file(filename);
+  if(!file)
+  {
+    std::cerr << "ERROR: Could not open expansions file " << filename << std::endl;
+    return false;
+  }
+
+  bool ok = true;
+  unsigned int lineNumber = 0;
+  std::string line;
+  while(std::getline(file, line))
+  {
+    ++lineNumber;
+    if(!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if(line.empty() || line.at(0) == '#')
+      continue;
+
+    auto fail = [&](std::string const& message) {
+      std::cerr << "ERROR: " << filename << ":" << lineNumber << ": "
+        << message << std::endl;
+      ok = false;
+    };
+
+    auto space = line.find_first_of(" \t");
+    auto text = line.find_first_not_of(" \t", space);
+    if(space == std::string::npos || text == std::string::npos)
+    {
+      fail("expected an abbreviation and its text");
+      continue;
+    }
+
+    std::vector<unsigned int> pattern;
+    Expansion expansion = {static_cast<unsigned int>(space), {}};
+    AsciiKey key;
+    bool valid = true;
+    for(unsigned int i = 0; i < space; ++i)
+    {
+      valid = valid && asciiKey(line[i], key);
+      pattern.push_back(symbol(key.code, key.shift));
+    }
+    for(unsigned int i = text; i < line.size(); ++i)
+    {
+      char c = line[i];
+      if(c == '\\' && i + 1 < line.size())
+      {
+        c = line[++i];
+        c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+      }
+      valid = valid && asciiKey(c, key);
+      expansion.keys.push_back(key);
+    }
+
+    if(!valid)
+    {
+      fail("characters that cannot be typed");
+      continue;
+    }
+
+    _automaton.add(pattern, _expansions.size());
+    _expansions.push_back(expansion);
+  }
+
+  _automaton.build();
+  return ok;
+}
+
+unsigned int TextExpander::symbol(unsigned int code, bool shift)
+{
+  return code << 1 | (shift ? 1 : 0);
+}
+
+void TextExpander::handle(unsigned int code, int value, unsigned int role)
+{
+  if(role >= _typists.size())
+    _typists.resize(role + 1, {AhoCorasick::ROOT, false, false, 0});
+  Typist& typist = _typists[role];
+
+  switch(code)
+  {
+    case KEY_LEFTSHIFT:
+      typist.leftShift = value != 0;
+      return;
+    case KEY_RIGHTSHIFT:
+      typist.rightShift = value != 0;
+      return;
+    case KEY_LEFTCTRL: case KEY_RIGHTCTRL:
+    case KEY_LEFTALT: case KEY_RIGHTALT:
+    case KEY_LEFTMETA: case KEY_RIGHTMETA:
+      if(value == 1)
+        typist.modifiers += 1;
+      else if(value == 0 && typist.modifiers > 0)
+        typist.modifiers -= 1;
+      return;
+    default: break;
+  }
+
+  if(value != 1)
+    return;
+
+  if(typist.modifiers)
+  {
+    typist.state = AhoCorasick::ROOT;
+    return;
+  }
+
+  typist.state = _automaton.step(typist.state,
+      symbol(code, typist.leftShift || typist.rightShift));
+  int match = _automaton.match(typist.state);
+  if(match != AhoCorasick::NO_MATCH)
+  {
+    expand(_expansions[match], typist);
+    typist.state = AhoCorasick::ROOT;
+  }
+}
+
+void TextExpander::expand(Expansion const& expansion, Typist const& typist)
+{
+  // The whole expansion goes out in one write after this frame
+  auto tap = [](unsigned int code) {
+    host->emit(out, EV_KEY, code, 1);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+    host->emit(out, EV_KEY, code, 0);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+  };
+  auto shift = [](unsigned int code, bool down) {
+    host->emit(out, EV_KEY, code, down ? 1 : 0);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+  };
+
+  bool shifted = typist.leftShift || typist.rightShift;
+  if(typist.leftShift)
+    shift(KEY_LEFTSHIFT, false);
+  if(typist.rightShift)
+    shift(KEY_RIGHTSHIFT, false);
+
+  for(unsigned int i = 0; i < expansion.length; ++i)
+  {
+    tap(KEY_BACKSPACE);
+  }
+
+  bool down = false;
+  for(AsciiKey const& key : expansion.keys)
+  {
+    if(key.shift != down)
+    {
+      shift(KEY_LEFTSHIFT, key.shift);
+      down = key.shift;
+    }
+    tap(key.code);
+  }
+  if(down)
+    shift(KEY_LEFTSHIFT, false);
+
+  // Shift is still physically held
+  if(shifted)
+  {
+    if(typist.leftShift)
+      shift(KEY_LEFTSHIFT, true);
+    if(typist.rightShift)
+      shift(KEY_RIGHTSHIFT, true);
+  }
+}
+
+Macros::Macros() :
+  _store(), _recording(-1), _recordStart(0), _recorded(), _recordHeld(),
+  _playing(), _next(0), _playStart(0), _speed(1),
+  _timer(FunKeyMonkeyHost::INVALID_TIMER), _playHeld()
+{
+}
+
+Macros::~Macros()
+{
+  if(_timer != FunKeyMonkeyHost::INVALID_TIMER)
+  {
+    host->cancel(_timer);
+  }
+}
+
+void onMacroTimeout(void* macros)
+{
+  static_cast<Macros*>(macros)->playTimeout();
+}
+
+bool Macros::open(std::string const& filename)
+{
+  return _store.open(filename);
+}
+
+bool Macros::recording() const
+{
+  return _recording >= 0;
+}
+
+void Macros::record(unsigned int slot, unsigned long long time)
+{
+  if(_recording >= 0)
+  {
+    bool stopped = _recording == static_cast<int>(slot);
+    stopRecording(time);
+    if(stopped)
+      return;
+  }
+
+  _recording = slot;
+  _recordStart = time;
+  _recorded.clear();
+  _recordHeld.clear();
+  std::cout << "Recording macro " << slot << std::endl;
+}
+
+void Macros::capture(unsigned int code, int value, unsigned long long time)
+{
+  unsigned long long offset = (time - _recordStart) / 1000;
+  MacroStore::MacroEvent e = {
+    static_cast<std::uint32_t>(std::min<unsigned long long>(offset, 0xffffffffull)),
+    static_cast<std::uint16_t>(code), static_cast<std::int16_t>(value)
+  };
+  _recorded.push_back(e);
+
+  auto held = std::find(_recordHeld.begin(), _recordHeld.end(), code);
+  if(value == 1 && held == _recordHeld.end())
+    _recordHeld.push_back(code);
+  else if(value == 0 && held != _recordHeld.end())
+    _recordHeld.erase(held);
+}
+
+void Macros::stopRecording(unsigned long long time)
+{
+  // Keys held at the end, eg. a modifier for the stop key, are released so
+  // playback never leaves keys down
+  for(std::uint16_t code : std::vector<std::uint16_t>(_recordHeld))
+  {
+    capture(code, 0, time);
+  }
+
+  unsigned int slot = _recording;
+  _recording = -1;
+  if(_store.save(slot, _recorded))
+  {
+    std::cout << "Recorded " << _recorded.size() << " events in macro " << slot << std::endl;
+  }
+}
+
+void Macros::play(unsigned int slot, float speed, unsigned long long time)
+{
+  stopPlaying();
+
+  unsigned int count = 0;
+  MacroStore::MacroEvent const* events = _store.events(slot, count);
+  if(count == 0)
+    return;
+
+  _playing.assign(events, events + count);
+  _next = 0;
+  _playStart = time;
+  _speed = speed;
+  _timer = host->timer(due(0), &onMacroTimeout, this);
+}
+
+unsigned long long Macros::due(unsigned int i) const
+{
+  unsigned long long offset = _playing[i].time * 1000ull;
+  return _speed > 0 ? _playStart + static_cast<unsigned long long>(offset / _speed) : _playStart;
+}
+
+void Macros::playTimeout()
+{
+  _timer = FunKeyMonkeyHost::INVALID_TIMER;
+
+  // Events due at the same time, eg. all of them at speed 0, go out at once
+  unsigned long long now = due(_next);
+  while(_next < _playing.size() && due(_next) <= now)
+  {
+    MacroStore::MacroEvent const& e = _playing[_next++];
+    auto held = std::find(_playHeld.begin(), _playHeld.end(), e.code);
+    if(e.value == 1 && held == _playHeld.end())
+      _playHeld.push_back(e.code);
+    else if(e.value == 0 && held != _playHeld.end())
+      _playHeld.erase(held);
+
+    layers->handle(e.code, e.value, now);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+  }
+
+  if(_next < _playing.size())
+  {
+    _timer = host->timer(due(_next), &onMacroTimeout, this);
+  }
+}
+
+void Macros::stopPlaying()
+{
+  if(_timer != FunKeyMonkeyHost::INVALID_TIMER)
+  {
+    host->cancel(_timer);
+    _timer = FunKeyMonkeyHost::INVALID_TIMER;
+  }
+
+  // An interrupted macro releases what it pressed
+  for(std::uint16_t code : _playHeld)
+  {
+    layers->handle(code, 0, _playStart);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+  }
+  _playHeld.clear();
+  _playing.clear();
+}
+
+KeyLayers::KeyLayers() :
+  _names(), _layers(), _active(1), _pressedLayer(), _held(), _oneshot(-1),
+  _oneshotHeld(false), _oneshotUsed(false),
+  _undecided({-1, 0, 0, FunKeyMonkeyHost::INVALID_TIMER, {}}),
+  _chords(), _chordBit(), _chordWindow(), _chordKeys(0), _chordIndex(),
+  _pendingChord({0, 0, 0, FunKeyMonkeyHost::INVALID_TIMER, {}}),
+  _chordHeld(0), _heldChords()
+{
+  _names.push_back("base");
+  _layers.emplace_back(new Behaviors(Behaviors::PASSTHROUGH));
+  _chordBit.fill(-1);
+}
+
+KeyLayers::~KeyLayers()
+{
+  if(_undecided.code >= 0)
+  {
+    host->cancel(_undecided.timer);
+  }
+  if(_pendingChord.keys)
+  {
+    host->cancel(_pendingChord.timer);
+  }
+}
+
+void onTapHoldTimeout(void* layers)
+{
+  static_cast<KeyLayers*>(layers)->tapHoldTimeout();
+}
+
+void onChordTimeout(void* layers)
+{
+  static_cast<KeyLayers*>(layers)->chordTimeout();
+}
+
+Behaviors* KeyLayers::layer(std::string const& name)
+{
+  int i = index(name);
+  return i < 0 ? nullptr : _layers[i].get();
+}
+
+int KeyLayers::index(std::string const& name)
+{
+  for(unsigned int i = 0; i < _names.size(); ++i)
+  {
+    if(_names[i] == name)
+      return i;
+  }
+
+  if(_names.size() == MAX_LAYERS)
+    return -1;
+
+  _names.push_back(name);
+  _layers.emplace_back(new Behaviors(Behaviors::TRANSPARENT));
+  return _names.size() - 1;
+}
+
+unsigned int KeyLayers::resolve(unsigned int code) const
+{
+  std::uint32_t active = _active;
+  while(true)
+  {
+    unsigned int layer = 31 - __builtin_clz(active);
+    if(layer == 0 || _layers[layer]->type(code) != Behaviors::TRANSPARENT)
+      return layer;
+    active &= ~(1u << layer);
+  }
+}
+
+void KeyLayers::activate(unsigned int layer, bool active)
+{
+  // The base layer always stays active
+  if(layer == 0)
+    return;
+  _active = active ? _active | (1u << layer) : _active & ~(1u << layer);
+}
+
+bool KeyLayers::chord(std::string const& layerName, std::vector<unsigned int> const& keys,
+    unsigned int output, unsigned long long window)
+{
+  int layer = index(layerName);
+  if(layer < 0)
+    return false;
+
+  Chord chord = {0, static_cast<std::uint16_t>(output),
+    static_cast<unsigned int>(layer), window};
+  for(unsigned int code : keys)
+  {
+    std::int8_t& bit = _chordBit[code - FIRST_KEY];
+    if(bit < 0)
+    {
+      if(_chordKeys == MAX_CHORD_KEYS)
+        return false;
+      bit = _chordKeys++;
+      _chordWindow[bit] = 0;
+    }
+    chord.keys |= 1ull << bit;
+    _chordWindow[bit] = std::max(_chordWindow[bit], window);
+  }
+
+  // Every proper subset of the chord can grow into it. Chords are a
+  // handful of keys so enumerating the subsets is cheap.
+  for(std::uint64_t subset = (chord.keys - 1) & chord.keys; subset;
+      subset = (subset - 1) & chord.keys)
+  {
+    _chordIndex[subset].extendable = true;
+  }
+  _chordIndex[chord.keys].complete.push_back(_chords.size());
+  _chords.push_back(chord);
+  return true;
+}
+
+void KeyLayers::handle(unsigned int code, int value, unsigned long long time)
+{
+  unsigned int const i = code - FIRST_KEY;
+  if(i >= Behaviors::NUM_KEYS)
+    return;
+
+  // Keys already down when the table was loaded were released by the old
+  // one, what they do now is unknown
+  if(value != 1 && !_held[i])
+    return;
+  _held[i] = value != 0;
+  if(!_chords.empty() && chordStage(code, value, time))
+    return;
+
+  dispatch(code, value, time);
+}
+
+bool KeyLayers::chordStage(unsigned int code, int value, unsigned long long time)
+{
+  int const bit = _chordBit[code - FIRST_KEY];
+  std::uint64_t const mask = bit < 0 ? 0 : 1ull << bit;
+
+  // Keys of a fired chord produce nothing themselves, the first release
+  // ends the chord output
+  if(_chordHeld & mask)
+  {
+    if(value == 0)
+    {
+      _chordHeld &= ~mask;
+      for(unsigned int j = 0; j < _heldChords.size(); ++j)
+      {
+        HeldChord& held = _heldChords[j];
+        if(!(held.keys & mask))
+          continue;
+        if(held.down)
+        {
+          host->emit(out, EV_KEY, held.output, 0);
+          held.down = false;
+        }
+        held.keys &= ~mask;
+        if(!held.keys)
+        {
+          _heldChords.erase(_heldChords.begin() + j);
+        }
+        break;
+      }
+    }
+    return true;
+  }
+
+  if(_pendingChord.keys)
+  {
+    if(value == 2 && (_pendingChord.keys & mask))
+      return true;
+
+    if(value == 1 && mask && time < _pendingChord.deadline
+        && !(_pendingChord.keys & mask))
+    {
+      auto candidates = _chordIndex.find(_pendingChord.keys | mask);
+      if(candidates != _chordIndex.end())
+      {
+        _pendingChord.keys |= mask;
+        _pendingChord.events.push_back({static_cast<std::uint16_t>(code), value, time});
+        // Nothing longer to wait for
+        if(!candidates->second.extendable)
+          resolveChord();
+        return true;
+      }
+    }
+
+    // Anything else ends the chord, and is handled afresh after it
+    resolveChord();
+    return chordStage(code, value, time);
+  }
+
+  if(value == 1 && mask)
+  {
+    unsigned long long deadline = time + _chordWindow[bit];
+    _pendingChord.keys = mask;
+    _pendingChord.first = time;
+    _pendingChord.deadline = deadline;
+    _pendingChord.timer = host->timer(deadline, &onChordTimeout, this);
+    _pendingChord.events.clear();
+    _pendingChord.events.push_back({static_cast<std::uint16_t>(code), value, time});
+    return true;
+  }
+
+  return false;
+}
+
+void KeyLayers::resolveChord()
+{
+  unsigned long long last = _pendingChord.events.back().time;
+  int chord = -1;
+  auto candidates = _chordIndex.find(_pendingChord.keys);
+  if(candidates != _chordIndex.end())
+  {
+    // The highest active layer wins, as with keys
+    for(unsigned int c : candidates->second.complete)
+    {
+      Chord const& candidate = _chords[c];
+      if((_active & (1u << candidate.layer))
+          && last - _pendingChord.first < candidate.window
+          && (chord < 0 || candidate.layer > _chords[chord].layer))
+        chord = c;
+    }
+  }
+
+  // Replaying may start another chord, the events are copied out of the
+  // way into scratch memory so the buffer keeps its capacity
+  std::size_t const count = chord >= 0 ? 0 : _pendingChord.events.size();
+  Buffered* const events = host->scratch<Buffered>(count);
+  std::copy(_pendingChord.events.begin(), _pendingChord.events.begin() + count, events);
+  _pendingChord.events.clear();
+  std::uint64_t keys = _pendingChord.keys;
+  host->cancel(_pendingChord.timer);
+  _pendingChord.keys = 0;
+
+  if(chord >= 0)
+  {
+    host->emit(out, EV_KEY, _chords[chord].output, 1);
+    _chordHeld |= keys;
+    _heldChords.push_back({keys, _chords[chord].output, true});
+    return;
+  }
+
+  for(std::size_t i = 0; i < count; ++i)
+  {
+    dispatch(events[i].code, events[i].value, events[i].time);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+  }
+}
+
+bool KeyLayers::macroKey(unsigned int code) const
+{
+  if(code - FIRST_KEY >= Behaviors::NUM_KEYS)
+    return false;
+
+  for(auto const& layer : _layers)
+  {
+    if(layer->type(code) == Behaviors::RECORD || layer->type(code) == Behaviors::PLAY)
+      return true;
+  }
+  return false;
+}
+
+void KeyLayers::release()
+{
+  // Held back keys go out as they would have, a settled tap-hold key
+  // counts as held since it is still down
+  while(_pendingChord.keys || _undecided.code >= 0)
+  {
+    if(_pendingChord.keys)
+      resolveChord();
+    else
+      decide(true);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+  }
+
+  // Nothing is pending now, so the time of the releases does not matter
+  for(unsigned int i = 0; i < Behaviors::NUM_KEYS; ++i)
+  {
+    if(_held[i])
+    {
+      handle(FIRST_KEY + i, 0, 0);
+      host->emit(out, EV_SYN, SYN_REPORT, 0);
+    }
+  }
+}
+
+void KeyLayers::chordTimeout()
+{
+  if(!_pendingChord.keys)
+    return;
+
+  resolveChord();
+  host->emit(out, EV_SYN, SYN_REPORT, 0);
+}
+
+void KeyLayers::dispatch(unsigned int code, int value, unsigned long long time)
+{
+  unsigned int const i = code - FIRST_KEY;
+  if(_undecided.code >= 0)
+  {
+    // An event after the tapping term means the key was held all along,
+    // whether or not the timer got to run yet
+    if(time >= _undecided.deadline)
+      decide(true);
+    else if(buffer(code, value, time))
+      return;
+  }
+
+  unsigned int layer;
+  if(value == 1)
+  {
+    layer = resolve(code);
+    _pressedLayer[i] = layer;
+  }
+  else
+  {
+    layer = _pressedLayer[i];
+  }
+
+  Behaviors const& behaviors = *_layers[layer];
+  unsigned int target = behaviors.mapping(code);
+  switch(behaviors.type(code))
+  {
+    case Behaviors::MOMENTARY:
+      if(value != 2)
+        activate(target, value == 1);
+      break;
+    case Behaviors::TOGGLE:
+      if(value == 1)
+        activate(target, !(_active & (1u << target)));
+      break;
+    case Behaviors::TAPHOLD:
+      if(value == 1)
+      {
+        unsigned long long deadline = time + behaviors.tapHold(code).term;
+        _undecided.code = code;
+        _undecided.layer = layer;
+        _undecided.deadline = deadline;
+        _undecided.timer = host->timer(deadline, &onTapHoldTimeout, this);
+        _undecided.events.clear();
+      }
+      else if(value == 0)
+      {
+        // Only decided holds get here, taps are finished by decide()
+        host->emit(out, EV_KEY, behaviors.tapHold(code).hold, 0);
+      }
+      break;
+    case Behaviors::ONESHOT:
+      if(value == 1)
+      {
+        activate(target, true);
+        _oneshot = target;
+        _oneshotHeld = true;
+        _oneshotUsed = false;
+      }
+      else if(value == 0 && _oneshot == static_cast<int>(target))
+      {
+        // Held while typing it was a momentary layer, otherwise it waits
+        // for the next key
+        _oneshotHeld = false;
+        if(_oneshotUsed)
+        {
+          activate(target, false);
+          _oneshot = -1;
+        }
+      }
+      break;
+    case Behaviors::RECORD:
+      if(value == 1)
+        macros->record(behaviors.macro(code).slot, time);
+      break;
+    case Behaviors::PLAY:
+      if(value == 1)
+        macros->play(behaviors.macro(code).slot, behaviors.macro(code).speed, time);
+      break;
+    default:
+      _layers[layer]->handle(code, value);
+      if(value == 1 && _oneshot >= 0)
+        oneshotUsed();
+      break;
+  }
+}
+
+bool KeyLayers::buffer(unsigned int code, int value, unsigned long long time)
+{
+  Behaviors::TapHold const& tapHold = _layers[_undecided.layer]->tapHold(_undecided.code);
+  if(static_cast<int>(code) == _undecided.code)
+  {
+    // Released within the term
+    if(value == 0)
+      decide(false);
+    return true;
+  }
+
+  bool pressedMeanwhile = false;
+  for(Buffered const& b : _undecided.events)
+  {
+    pressedMeanwhile = pressedMeanwhile || (b.code == code && b.value == 1);
+  }
+
+  _undecided.events.push_back({static_cast<std::uint16_t>(code), value, time});
+  if((tapHold.mode == Behaviors::TapHold::INTERRUPT && value == 1)
+      || (tapHold.mode == Behaviors::TapHold::PERMISSIVE && value == 0 && pressedMeanwhile))
+  {
+    decide(true);
+  }
+  return true;
+}
+
+void KeyLayers::decide(bool hold)
+{
+  Behaviors::TapHold const& tapHold = _layers[_undecided.layer]->tapHold(_undecided.code);
+  // Replaying may hold back keys again, like resolveChord()
+  std::size_t const count = _undecided.events.size();
+  Buffered* const events = host->scratch<Buffered>(count);
+  std::copy(_undecided.events.begin(), _undecided.events.end(), events);
+  _undecided.events.clear();
+  host->cancel(_undecided.timer);
+  _undecided.code = -1;
+
+  host->emit(out, EV_KEY, hold ? tapHold.hold : tapHold.tap, 1);
+  host->emit(out, EV_SYN, SYN_REPORT, 0);
+  for(std::size_t i = 0; i < count; ++i)
+  {
+    dispatch(events[i].code, events[i].value, events[i].time);
+    host->emit(out, EV_SYN, SYN_REPORT, 0);
+  }
+  if(!hold)
+  {
+    host->emit(out, EV_KEY, tapHold.tap, 0);
+  }
+}
+
+void KeyLayers::tapHoldTimeout()
+{
+  if(_undecided.code < 0)
+    return;
+
+  decide(true);
+  host->emit(out, EV_SYN, SYN_REPORT, 0);
+}
+
+void KeyLayers::oneshotUsed()
+{
+  if(_oneshotHeld)
+  {
+    _oneshotUsed = true;
+  }
+  else
+  {
+    activate(_oneshot, false);
+    _oneshot = -1;
+  }
+}
+
+
+template<int FIRST_KEY, int LAST_KEY>
+KeyBehaviors<FIRST_KEY, LAST_KEY>::KeyBehaviors(Type initial) :
+  _types(), _mappings(), _altmaps(), _complex(), _tapHolds(), _macros()
+{
+  _types.fill(initial);
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+bool KeyBehaviors<FIRST_KEY, LAST_KEY>::set(unsigned int code, Type type, unsigned int mapping)
+{
+  if(code < FIRST_KEY || code > LAST_KEY)
+  {
+    std::cerr << "ERROR: Key code " << code << " out of range" << std::endl;
+    return false;
+  }
+  _types[code - FIRST_KEY] = type;
+  _mappings[code - FIRST_KEY] = mapping;
+  return true;
+}
 
 template<int FIRST_KEY, int LAST_KEY>
 void KeyBehaviors<FIRST_KEY, LAST_KEY>::passthrough(unsigned int code)
 {
-  behaviors.at(code - FIRST_KEY).type = KeyBehavior::PASSTHROUGH;
+  set(code, PASSTHROUGH, 0);
 }
 
 template<int FIRST_KEY, int LAST_KEY>
 void KeyBehaviors<FIRST_KEY, LAST_KEY>::map(unsigned int code, unsigned int result)
 {
-  auto& b = behaviors.at(code - FIRST_KEY);
-  b.type = KeyBehavior::MAPPED;
-  b.mapping = result;
+  set(code, MAPPED, result);
 }
 
 template<int FIRST_KEY, int LAST_KEY>
 void KeyBehaviors<FIRST_KEY, LAST_KEY>::altmap(unsigned int code, bool* flag,
-    unsigned int regular, 
+    unsigned int regular,
     unsigned int alternative)
 {
-  auto& b = behaviors.at(code - FIRST_KEY);
-  b.type = KeyBehavior::ALTMAPPED;
-  b.mapping = regular;
-  b.alternative = alternative;
-  b.flag = flag;
+  if(set(code, ALTMAPPED, _altmaps.size()))
+  {
+    _altmaps.push_back({flag, static_cast<std::uint16_t>(regular),
+        static_cast<std::uint16_t>(alternative)});
+  }
 }
 
 template<int FIRST_KEY, int LAST_KEY>
 void KeyBehaviors<FIRST_KEY, LAST_KEY>::complex(unsigned int code, std::function<void(int)> function)
 {
-  auto& b = behaviors.at(code - FIRST_KEY);
-  b.type = KeyBehavior::COMPLEX;
-  b.function = function;
+  if(set(code, COMPLEX, _complex.size()))
+  {
+    _complex.push_back(function);
+  }
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+void KeyBehaviors<FIRST_KEY, LAST_KEY>::transparent(unsigned int code)
+{
+  set(code, TRANSPARENT, 0);
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+void KeyBehaviors<FIRST_KEY, LAST_KEY>::layer(unsigned int code, Type type, unsigned int layer)
+{
+  set(code, type, layer);
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+void KeyBehaviors<FIRST_KEY, LAST_KEY>::tapHold(unsigned int code, unsigned int tap,
+    unsigned int hold, unsigned long long term, typename TapHold::Mode mode)
+{
+  if(set(code, TAPHOLD, _tapHolds.size()))
+  {
+    _tapHolds.push_back({static_cast<std::uint16_t>(tap),
+        static_cast<std::uint16_t>(hold), term, mode});
+  }
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+typename KeyBehaviors<FIRST_KEY, LAST_KEY>::TapHold const& KeyBehaviors<FIRST_KEY, LAST_KEY>::tapHold(unsigned int code) const
+{
+  return _tapHolds[_mappings[code - FIRST_KEY]];
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+void KeyBehaviors<FIRST_KEY, LAST_KEY>::macro(unsigned int code, Type type,
+    unsigned int slot, float speed)
+{
+  if(set(code, type, _macros.size()))
+  {
+    _macros.push_back({static_cast<std::uint8_t>(slot), speed});
+  }
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+typename KeyBehaviors<FIRST_KEY, LAST_KEY>::Macro const& KeyBehaviors<FIRST_KEY, LAST_KEY>::macro(unsigned int code) const
+{
+  return _macros[_mappings[code - FIRST_KEY]];
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+typename KeyBehaviors<FIRST_KEY, LAST_KEY>::Type KeyBehaviors<FIRST_KEY, LAST_KEY>::type(unsigned int code) const
+{
+  return _types[code - FIRST_KEY];
+}
+
+template<int FIRST_KEY, int LAST_KEY>
+unsigned int KeyBehaviors<FIRST_KEY, LAST_KEY>::mapping(unsigned int code) const
+{
+  return _mappings[code - FIRST_KEY];
 }
 
 template<int FIRST_KEY, int LAST_KEY>
 void KeyBehaviors<FIRST_KEY, LAST_KEY>::handle(unsigned int code, int value)
 {
-  KeyBehavior const& kb = behaviors.at(code - FIRST_KEY);
-  switch(kb.type)
+  unsigned int const i = code - FIRST_KEY;
+  if(i >= NUM_KEYS)
+    return;
+
+  switch(_types[i])
   {
-    case KeyBehavior::PASSTHROUGH:
-      out->send(EV_KEY, code, value);
+    case PASSTHROUGH:
+    case TRANSPARENT:
+      host->emit(out, EV_KEY, code, value);
+      break;
+    case MAPPED:
+      host->emit(out, EV_KEY, _mappings[i], value);
+      break;
+    case ALTMAPPED:
+    {
+      AltMapping const& a = _altmaps[_mappings[i]];
+      host->emit(out, EV_KEY, *a.flag ? a.alternative : a.regular, value);
       break;
-    case KeyBehavior::MAPPED:
-      out->send(EV_KEY, kb.mapping, value);
+    }
+    case COMPLEX:
+      _complex[_mappings[i]](value);
       break;
-    case KeyBehavior::ALTMAPPED:
-      out->send(EV_KEY, *kb.flag ? kb.alternative : kb.mapping, value);
-      break; 
-    case KeyBehavior::COMPLEX:
-      kb.function(value);
+    case MOMENTARY:
+    case TOGGLE:
+    case ONESHOT:
+    case TAPHOLD:
+    case RECORD:
+    case PLAY:
       break;
   };
 
@@ -1,36 +1,41 @@
 #include "funkeymonkeymodule.h"
-#include "uinputdevice.h"
+#include "funkeymonkeyhost.h"
+#include "stickresponse.h"
+#include "configfile.h"
 
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <mutex>
 #include <condition_variable>
-#include <regex>
-#include <fstream>
-#include <algorithm>
-#include <cctype>
-#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <climits>
 
 // Default role: both nubs, Role 1: left nub, Role 2: right nub
 enum Role { ROLE_ANY, ROLE_LEFT_NUB, ROLE_RIGHT_NUB };
 
 struct Mouse
 {
-  // Any thread using device must hold mutex
-  UinputDevice device;
+  explicit Mouse(FunKeyMonkeyHost::OutputId device);
 
-  // May be changed from any thread at any time
-  int dx;
-  int dy;
-  int dwx;
-  int dwy;
+  // The host orders events from different threads per output, so clicks
+  // and movement are emitted without further locking
+  FunKeyMonkeyHost::OutputId device;
 
-  // Used to signal changes in above values, uses mutex
-  std::condition_variable signal;
+  // Latest stick values, written by the dispatch thread and read by the
+  // mouse thread on every tick
+  std::atomic<int> dx;
+  std::atomic<int> dy;
+  std::atomic<int> dwx;
+  std::atomic<int> dwy;
 
-  // Mouse device mutex
+  // Only for the mouse thread to sleep on, never held while emitting. The
+  // dispatch thread only takes the mutex to wake the thread while asleep.
   std::mutex mutex;
+  std::condition_variable signal;
+  std::atomic<bool> asleep;
 };
 
 struct Settings
@@ -55,58 +60,57 @@ struct Settings
   NubClickMode leftNubClickMode = NUB_CLICK_LEFT;
   NubClickMode rightNubClickMode = NUB_CLICK_RIGHT;
 
-  // May be changed from any thread at any time
+  Settings();
+
   int mouseDeadzone = 100;
   int mouseSensitivity = 15;
   int mouseWheelDeadzone = 500;
+  // Mouse and scroll updates per second, at most 1000
+  int mouseRate = 125;
+  // Stick value at full deflection
+  int mouseRange = 32767;
+  // Wheel notches per second at full deflection
+  float mouseWheelSpeed = 62.5f;
 
-  std::string configFile;
-};
-
-using NubAxisModeMap = std::unordered_map<std::string, Settings::NubAxisMode>;
-NubAxisModeMap const NUB_AXIS_MODES = {
-{ "left_joystick_x", Settings::LEFT_JOYSTICK_X },
-{ "left_joystick_y", Settings::LEFT_JOYSTICK_Y },
-{ "right_joystick_x", Settings::RIGHT_JOYSTICK_X },
-{ "right_joystick_y", Settings::RIGHT_JOYSTICK_Y },
-  { "mouse_x", Settings::MOUSE_X },
-  { "mouse_y", Settings::MOUSE_Y },
-  { "scroll_x", Settings::SCROLL_X },
-  { "scroll_y", Settings::SCROLL_Y }
-};
+  // Built from the settings above by buildResponses()
+  StickResponse mouseResponse;
+  StickResponse wheelResponse;
 
-using NubClickModeMap = std::unordered_map<std::string, Settings::NubClickMode>;
-NubClickModeMap const NUB_CLICK_MODES = {
-  { "nub_click_left", Settings::NUB_CLICK_LEFT },
-  { "nub_click_right", Settings::NUB_CLICK_RIGHT },
-  { "mouse_left", Settings::MOUSE_LEFT },
-  { "mouse_right", Settings::MOUSE_RIGHT }
+  std::string configFile;
+  // Binary cache of the parsed config file, optional
+  std::string configCache;
 };
 
 void handleArgs(char const** argv, unsigned int argc, Settings& settings);
-void loadConfig(std::string const& filename, Settings& settings);
-Settings::NubAxisMode parseNubAxisMode(std::string const& str);
-Settings::NubClickMode parseNubClickMode(std::string const& str);
-void handleNubAxis(Settings::NubAxisMode mode, int value, Mouse* mouse, UinputDevice* gamepad, Settings const& settings);
-void handleNubClick(Settings::NubClickMode mode, int value, Mouse* mouse, UinputDevice* gamepad, Settings const& settings);
+ConfigSchema<Settings> const& settingsSchema();
+bool loadConfig(Settings& settings);
+void buildResponses(Settings& settings);
+void handleNubAxis(Settings::NubAxisMode mode, int value, Mouse* mouse, FunKeyMonkeyHost::OutputId gamepad, Settings const& settings);
+void handleNubClick(Settings::NubClickMode mode, int value, Mouse* mouse, FunKeyMonkeyHost::OutputId gamepad, Settings const& settings);
 
 // Mouse movement/scroll thread handler
-void handleMouse(Mouse* mouse, Settings* settings, bool* stop);
+void handleMouse(Mouse* mouse, Published<Settings> const* settings,
+    std::atomic<bool>* stop);
+void wakeMouse(Mouse* mouse);
 
 struct
 {
-  bool stop = false;
-  UinputDevice* gamepad = nullptr;
+  std::atomic<bool> stop{false};
+  FunKeyMonkeyHost* host = nullptr;
+  FunKeyMonkeyHost::OutputId gamepad = FunKeyMonkeyHost::INVALID_OUTPUT;
   Mouse* mouse = nullptr;
   std::thread mouseThread;
-  Settings settings;
+  Published<Settings> settings;
 } global;
 
+void attach(FunKeyMonkeyHost* host)
+{
+  global.host = host;
+}
 
 void init(char const** argv, unsigned int argc)
 {
-  global.gamepad = new UinputDevice("/dev/uinput", BUS_USB,
-      "Modal Gamepad", 1, 1, 1, {
+  global.gamepad = global.host->output("Modal Gamepad", BUS_USB, 1, 1, 1, {
     { EV_KEY, {
       BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, 
       BTN_TL, BTN_TR, BTN_TL2, BTN_TR2,
@@ -116,25 +120,33 @@ void init(char const** argv, unsigned int argc)
     } },
     { EV_ABS, { REL_X, REL_Y, REL_RX, REL_RY } }
   });
-  global.mouse = new Mouse {
-    UinputDevice("/dev/uinput", BUS_USB, "Modal Gamepad Mouse", 1, 1, 1, {
+  global.mouse = new Mouse(
+    global.host->output("Modal Gamepad Mouse", BUS_USB, 1, 1, 1, {
         { EV_KEY, { BTN_LEFT, BTN_RIGHT } },
         { EV_REL, { REL_X, REL_Y, REL_HWHEEL, REL_WHEEL } }
-        }), 0, 0, 0, 0, {}, {}
-  };
-  global.mouseThread = std::move(std::thread(handleMouse,
-        global.mouse, &global.settings, &global.stop));
+        }));
 
-  handleArgs(argv, argc, global.settings);
+  std::unique_ptr<Settings> settings(new Settings());
+  handleArgs(argv, argc, *settings);
 
-  if(!global.settings.configFile.empty())
+  if(!settings->configFile.empty() && !loadConfig(*settings))
   {
-    loadConfig(global.settings.configFile, global.settings);
+    // Partially applied, start from the defaults instead
+    std::unique_ptr<Settings> defaults(new Settings());
+    defaults->configFile = settings->configFile;
+    defaults->configCache = settings->configCache;
+    settings.swap(defaults);
   }
+  buildResponses(*settings);
+  global.settings.publish(std::move(settings));
+
+  global.mouseThread = std::move(std::thread(handleMouse,
+        global.mouse, &global.settings, &global.stop));
 }
 
 void handle(input_event const& e, unsigned int role)
 {
+  Settings const& settings = *global.settings.get();
   if(role == ROLE_ANY || role == ROLE_LEFT_NUB)
   {
     switch(e.type)
@@ -143,12 +155,12 @@ void handle(input_event const& e, unsigned int role)
         switch(e.code)
         {
           case ABS_RX:
-            handleNubAxis(global.settings.rightNubModeX, e.value,
-                global.mouse, global.gamepad, global.settings);
+            handleNubAxis(settings.rightNubModeX, e.value,
+                global.mouse, global.gamepad, settings);
             break;
           case ABS_RY:
-            handleNubAxis(global.settings.rightNubModeY, e.value,
-                global.mouse, global.gamepad, global.settings);
+            handleNubAxis(settings.rightNubModeY, e.value,
+                global.mouse, global.gamepad, settings);
             break;
           default: break;
         };
@@ -157,8 +169,8 @@ void handle(input_event const& e, unsigned int role)
         switch(e.code)
         {
           case BTN_THUMBR:
-            handleNubClick(global.settings.rightNubClickMode, e.value,
-                global.mouse, global.gamepad, global.settings);
+            handleNubClick(settings.rightNubClickMode, e.value,
+                global.mouse, global.gamepad, settings);
             break;
           default: break;
         }
@@ -174,12 +186,12 @@ void handle(input_event const& e, unsigned int role)
         switch(e.code)
         {
           case ABS_X:
-            handleNubAxis(global.settings.leftNubModeX, e.value,
-                global.mouse, global.gamepad, global.settings);
+            handleNubAxis(settings.leftNubModeX, e.value,
+                global.mouse, global.gamepad, settings);
             break;
           case ABS_Y:
-            handleNubAxis(global.settings.leftNubModeY, e.value,
-                global.mouse, global.gamepad, global.settings);
+            handleNubAxis(settings.leftNubModeY, e.value,
+                global.mouse, global.gamepad, settings);
             break;
           default: break;
         };
@@ -188,8 +200,8 @@ void handle(input_event const& e, unsigned int role)
         switch(e.code)
         {
           case BTN_THUMBL:
-            handleNubClick(global.settings.leftNubClickMode, e.value,
-                global.mouse, global.gamepad, global.settings);
+            handleNubClick(settings.leftNubClickMode, e.value,
+                global.mouse, global.gamepad, settings);
             break;
           default: break;
         }
@@ -201,309 +213,354 @@ void handle(input_event const& e, unsigned int role)
 void destroy()
 {
   global.stop = true;
-  global.mouse->signal.notify_all();
-
-  if(global.gamepad)
   {
-    delete global.gamepad;
+    std::lock_guard<std::mutex> lk(global.mouse->mutex);
+    global.mouse->signal.notify_all();
   }
-
   global.mouseThread.join();
+  delete global.mouse;
+  global.settings.clear();
 }
 
 void user1()
 {
-  loadConfig(global.settings.configFile, global.settings);
+  // Reloads start from the defaults so removed lines take effect. A config
+  // with errors is reported and the previous settings stay in effect.
+  Settings const* current = global.settings.get();
+  std::unique_ptr<Settings> reloaded(new Settings());
+  reloaded->configFile = current->configFile;
+  reloaded->configCache = current->configCache;
+  if(reloaded->configFile.empty() || !loadConfig(*reloaded))
+    return;
+  buildResponses(*reloaded);
+  global.settings.publish(std::move(reloaded));
 }
 void user2()
 {
 }
 
-void handleArgs(char const** argv, unsigned int argc, Settings& settings)
+bool configure(char const* setting)
 {
-  std::string configFile;
-  std::regex configRegex("config=(.*)");
-
-  for(unsigned int i = 0; i < argc; ++i)
+  // config= and cache= switch files and reload from the defaults, anything
+  // else is a single setting applied on top of the current ones
+  Settings const& current = *global.settings.get();
+  std::string arg(setting);
+  std::size_t equals = arg.find('=');
+  std::unique_ptr<Settings> changed;
+  if(arg.compare(0, 7, "config=") == 0 || arg.compare(0, 6, "cache=") == 0)
   {
-    std::string arg(argv[i]);
-    std::smatch match;
-    if(std::regex_match(arg, match, configRegex))
-    {
-      settings.configFile = match[1];
-    }
+    changed.reset(new Settings());
+    changed->configFile = current.configFile;
+    changed->configCache = current.configCache;
+    handleArgs(&setting, 1, *changed);
+    if(!changed->configFile.empty() && !loadConfig(*changed))
+      return false;
   }
+  else
+  {
+    changed.reset(new Settings(current));
+    if(equals == std::string::npos
+        || !settingsSchema().set(arg.substr(0, equals), arg.substr(equals + 1), *changed))
+      return false;
+  }
+  buildResponses(*changed);
+  global.settings.publish(std::move(changed));
+  return true;
 }
 
-using SettingHandler = std::function<void(std::string const&,Settings&)>;
-using SettingHandlerMap = std::unordered_map<std::string, SettingHandler>;
-SettingHandlerMap const SETTING_HANDLERS = {
-  { "mouse.sensitivity", [](std::string const& value, Settings& settings)
-    {
-      settings.mouseSensitivity = std::stoi(value);
-    }
-  },
-  { "mouse.deadzone", [](std::string const& value, Settings& settings)
-    {
-      settings.mouseDeadzone = std::stoi(value);
-    }
-  },
-  { "mouse.wheel.deadzone", [](std::string const& value, Settings& settings)
-    {
-      settings.mouseWheelDeadzone = std::stoi(value);
-    }
-  },
-  { "nubs.left.x", [](std::string const& value, Settings& settings)
-    {
-      settings.leftNubModeX = parseNubAxisMode(value);
-    }
-  },
-  { "nubs.left.y", [](std::string const& value, Settings& settings)
-    {
-      settings.leftNubModeY = parseNubAxisMode(value);
-    }
-  },
-  { "nubs.right.x", [](std::string const& value, Settings& settings)
-    {
-      settings.rightNubModeX = parseNubAxisMode(value);
-    }
-  },
-  { "nubs.right.y", [](std::string const& value, Settings& settings)
-    {
-      settings.rightNubModeY = parseNubAxisMode(value);
-    }
-  },
-  { "nubs.left.click", [](std::string const& value, Settings& settings)
+void handleArgs(char const** argv, unsigned int argc, Settings& settings)
+{
+  for(unsigned int i = 0; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if(arg.compare(0, 7, "config=") == 0)
     {
-      settings.leftNubClickMode = parseNubClickMode(value);
+      settings.configFile = arg.substr(7);
     }
-  },
-  { "nubs.right.click", [](std::string const& value, Settings& settings)
+    else if(arg.compare(0, 6, "cache=") == 0)
     {
-      settings.rightNubClickMode = parseNubClickMode(value);
+      settings.configCache = arg.substr(6);
     }
   }
-};
+}
 
-void loadConfig(std::string const& filename, Settings& settings)
+// Anti-deadzones belong to the responses, so they cannot be set through a
+// plain member
+bool parseAntiDeadzone(std::string const& value, StickResponse& response)
 {
-  std::regex re("^([\\w.]+)\\s*=\\s*(.*)$");
-  std::regex emptyRe("^\\s*$");
-  std::ifstream configFile(filename);
+  char* end = nullptr;
+  float antiDeadzone = std::strtof(value.data(), &end);
+  if(value.empty() || *end != '\0' || !(antiDeadzone >= 0 && antiDeadzone <= 1))
+    return false;
+  response.antiDeadzone = antiDeadzone;
+  return true;
+}
 
-  if(!configFile)
-  {
-    std::cerr << "ERROR: Could not open config file " << filename << std::endl;
-    return;
-  }
-  std::string line;
-  while(std::getline(configFile, line))
-  {
-    if(line.empty() || line.at(0) == '#' || std::regex_match(line, emptyRe))
-      continue;
+ConfigSchema<Settings> makeSchema()
+{
+  std::vector<std::pair<std::string, Settings::NubAxisMode>> const axisModes = {
+    { "left_joystick_x", Settings::LEFT_JOYSTICK_X },
+    { "left_joystick_y", Settings::LEFT_JOYSTICK_Y },
+    { "right_joystick_x", Settings::RIGHT_JOYSTICK_X },
+    { "right_joystick_y", Settings::RIGHT_JOYSTICK_Y },
+    { "mouse_x", Settings::MOUSE_X },
+    { "mouse_y", Settings::MOUSE_Y },
+    { "scroll_x", Settings::SCROLL_X },
+    { "scroll_y", Settings::SCROLL_Y }
+  };
+  std::vector<std::pair<std::string, Settings::NubClickMode>> const clickModes = {
+    { "nub_click_left", Settings::NUB_CLICK_LEFT },
+    { "nub_click_right", Settings::NUB_CLICK_RIGHT },
+    { "mouse_left", Settings::MOUSE_LEFT },
+    { "mouse_right", Settings::MOUSE_RIGHT }
+  };
 
-    std::smatch match;
-    if(std::regex_match(line, match, re))
-    {
-      std::string key = match[1];
-      std::string value = match[2];
-      std::transform(key.begin(), key.end(), key.begin(), tolower);
-      auto iter = SETTING_HANDLERS.find(key);
-      if(iter == SETTING_HANDLERS.end())
-      {
-        std::cout << "WARNING: Unknown setting in config file: " 
-          << key << std::endl;
-      }
-      else
-      {
-        iter->second(value, settings);
-      }
-    }
-    else
-    {
-      std::cerr << "Invalid line in config file: " << line << std::endl;
-    }
-  }
+  ConfigSchema<Settings> schema;
+  schema.integer("mouse.sensitivity", &Settings::mouseSensitivity, 0, 100000);
+  schema.integer("mouse.deadzone", &Settings::mouseDeadzone, 0, INT_MAX);
+  schema.integer("mouse.wheel.deadzone", &Settings::mouseWheelDeadzone, 0, INT_MAX);
+  schema.integer("mouse.rate", &Settings::mouseRate, 1, 1000);
+  schema.integer("mouse.range", &Settings::mouseRange, 1, INT_MAX);
+  schema.number("mouse.wheel.speed", &Settings::mouseWheelSpeed, 0, 100000);
+  schema.custom("mouse.curve", [](std::string const& value, Settings& settings) {
+    return settings.mouseResponse.curve(value);
+  });
+  schema.custom("mouse.deadzone.shape", [](std::string const& value, Settings& settings) {
+    return settings.mouseResponse.shape(value);
+  });
+  schema.custom("mouse.antideadzone", [](std::string const& value, Settings& settings) {
+    return parseAntiDeadzone(value, settings.mouseResponse);
+  });
+  schema.custom("mouse.wheel.curve", [](std::string const& value, Settings& settings) {
+    return settings.wheelResponse.curve(value);
+  });
+  schema.custom("mouse.wheel.deadzone.shape", [](std::string const& value, Settings& settings) {
+    return settings.wheelResponse.shape(value);
+  });
+  schema.custom("mouse.wheel.antideadzone", [](std::string const& value, Settings& settings) {
+    return parseAntiDeadzone(value, settings.wheelResponse);
+  });
+  schema.choice("nubs.left.x", &Settings::leftNubModeX, axisModes);
+  schema.choice("nubs.left.y", &Settings::leftNubModeY, axisModes);
+  schema.choice("nubs.right.x", &Settings::rightNubModeX, axisModes);
+  schema.choice("nubs.right.y", &Settings::rightNubModeY, axisModes);
+  schema.choice("nubs.left.click", &Settings::leftNubClickMode, clickModes);
+  schema.choice("nubs.right.click", &Settings::rightNubClickMode, clickModes);
+  return schema;
 }
 
-Settings::NubAxisMode parseNubAxisMode(std::string const& str)
+ConfigSchema<Settings> const& settingsSchema()
 {
-  std::string s(str);
-  std::transform(s.begin(), s.end(), s.begin(), tolower);
-  auto iter = NUB_AXIS_MODES.find(s);
-  if(iter == NUB_AXIS_MODES.end())
-  {
-    return Settings::UNKNOWN_NUB_AXIS_MODE;
-  }
-  else
-  {
-    return iter->second;
-  }
+  static ConfigSchema<Settings> const schema = makeSchema();
+  return schema;
 }
 
-Settings::NubClickMode parseNubClickMode(std::string const& str)
+bool loadConfig(Settings& settings)
 {
-  std::string s(str);
-  std::transform(s.begin(), s.end(), s.begin(), tolower);
-  auto iter = NUB_CLICK_MODES.find(s);
-  if(iter == NUB_CLICK_MODES.end())
-  {
-    return Settings::UNKNOWN_NUB_CLICK_MODE;
-  }
-  else
-  {
-    return iter->second;
-  }
+  return settingsSchema().load(settings.configFile, settings, settings.configCache);
+}
+
+Settings::Settings()
+{
+  // The wheel scrolls at full speed as soon as it leaves the deadzone,
+  // unless configured otherwise
+  wheelResponse.antiDeadzone = 1;
 }
 
-void handleNubAxis(Settings::NubAxisMode mode, int value, Mouse* mouse, UinputDevice* gamepad, Settings const& settings)
+void buildResponses(Settings& settings)
+{
+  settings.mouseResponse.build(settings.mouseDeadzone, settings.mouseRange);
+  settings.wheelResponse.build(settings.mouseWheelDeadzone, settings.mouseRange);
+}
+
+void handleNubAxis(Settings::NubAxisMode mode, int value, Mouse* mouse, FunKeyMonkeyHost::OutputId gamepad, Settings const& settings)
 {
   switch(mode)
   {
     case Settings::MOUSE_X:
       mouse->dx = value;
-      if(mouse->dx > settings.mouseDeadzone 
-          || mouse->dx < -settings.mouseDeadzone)
-        mouse->signal.notify_all();
+      if(settings.mouseResponse.active(value, mouse->dy))
+        wakeMouse(mouse);
       break;
     case Settings::MOUSE_Y:
       mouse->dy = value;
-      if(mouse->dy > settings.mouseDeadzone 
-          || mouse->dy < -settings.mouseDeadzone)
-        mouse->signal.notify_all();
+      if(settings.mouseResponse.active(mouse->dx, value))
+        wakeMouse(mouse);
       break;
     case Settings::SCROLL_X:
       mouse->dwx = value;
-      if(mouse->dwx > settings.mouseDeadzone 
-          || mouse->dwx < -settings.mouseDeadzone)
-        mouse->signal.notify_all();
+      if(settings.wheelResponse.active(value, mouse->dwy))
+        wakeMouse(mouse);
       break;
     case Settings::SCROLL_Y:
       mouse->dwy = value;
-      if(mouse->dwy > settings.mouseDeadzone 
-          || mouse->dwy < -settings.mouseDeadzone)
-        mouse->signal.notify_all();
+      if(settings.wheelResponse.active(mouse->dwx, value))
+        wakeMouse(mouse);
       break;
     case Settings::LEFT_JOYSTICK_X:
-      gamepad->send(EV_ABS, ABS_X, value);
-      gamepad->send(EV_SYN, 0, 0);
+      global.host->emit(gamepad, EV_ABS, ABS_X, value);
+      global.host->emit(gamepad, EV_SYN, 0, 0);
       break;
     case Settings::LEFT_JOYSTICK_Y:
-      gamepad->send(EV_ABS, ABS_Y, value);
-      gamepad->send(EV_SYN, 0, 0);
+      global.host->emit(gamepad, EV_ABS, ABS_Y, value);
+      global.host->emit(gamepad, EV_SYN, 0, 0);
       break;
     case Settings::RIGHT_JOYSTICK_X:
-      gamepad->send(EV_ABS, ABS_RX, value);
-      gamepad->send(EV_SYN, 0, 0);
+      global.host->emit(gamepad, EV_ABS, ABS_RX, value);
+      global.host->emit(gamepad, EV_SYN, 0, 0);
       break;
     case Settings::RIGHT_JOYSTICK_Y:
-      gamepad->send(EV_ABS, ABS_RY, value);
-      gamepad->send(EV_SYN, 0, 0);
+      global.host->emit(gamepad, EV_ABS, ABS_RY, value);
+      global.host->emit(gamepad, EV_SYN, 0, 0);
       break;
     case Settings::UNKNOWN_NUB_AXIS_MODE:
       break;
   }
 }
 
-void handleNubClick(Settings::NubClickMode mode, int value, Mouse* mouse, UinputDevice* gamepad, Settings const& settings)
+void handleNubClick(Settings::NubClickMode mode, int value, Mouse* mouse, FunKeyMonkeyHost::OutputId gamepad, Settings const& settings)
 {
   switch(mode)
   {
     case Settings::MOUSE_LEFT:
-      {
-        std::lock_guard<std::mutex> lk(mouse->mutex);
-        mouse->device.send(EV_KEY, BTN_LEFT, value);
-        mouse->device.send(EV_SYN, 0, 0);
-        break;
-      }
+      global.host->emit(mouse->device, EV_KEY, BTN_LEFT, value);
+      global.host->emit(mouse->device, EV_SYN, 0, 0);
+      break;
     case Settings::MOUSE_RIGHT:
-      {
-        std::lock_guard<std::mutex> lk(mouse->mutex);
-        mouse->device.send(EV_KEY, BTN_RIGHT, value);
-        mouse->device.send(EV_SYN, 0, 0);
-        break;
-      }
+      global.host->emit(mouse->device, EV_KEY, BTN_RIGHT, value);
+      global.host->emit(mouse->device, EV_SYN, 0, 0);
+      break;
     case Settings::NUB_CLICK_LEFT:
-      gamepad->send(EV_KEY, BTN_THUMBL, value);
-      gamepad->send(EV_SYN, 0, 0);
+      global.host->emit(gamepad, EV_KEY, BTN_THUMBL, value);
+      global.host->emit(gamepad, EV_SYN, 0, 0);
       break;
     case Settings::NUB_CLICK_RIGHT:
-      gamepad->send(EV_KEY, BTN_THUMBR, value);
-      gamepad->send(EV_SYN, 0, 0);
+      global.host->emit(gamepad, EV_KEY, BTN_THUMBR, value);
+      global.host->emit(gamepad, EV_SYN, 0, 0);
       break;
   case Settings::UNKNOWN_NUB_CLICK_MODE:
       break;
   }
 }
 
-void handleMouse(Mouse* mouse, Settings* settings, bool* stop)
+Mouse::Mouse(FunKeyMonkeyHost::OutputId device) :
+  device(device), dx(0), dy(0), dwx(0), dwy(0), mutex(), signal(), asleep(false)
 {
+}
+
+void wakeMouse(Mouse* mouse)
+{
+  // The thread marks itself asleep before its last look at the stick values,
+  // and this looks after storing them, so either it sees the new values or
+  // this sees it asleep. The lock keeps the notification from slipping in
+  // between that look and the actual wait.
+  if(mouse->asleep)
+  {
+    std::lock_guard<std::mutex> lk(mouse->mutex);
+    mouse->signal.notify_all();
+  }
+}
+
+// Whether any stick is outside its deadzone
+bool mouseActive(Mouse const& mouse, Settings const& settings)
+{
+  return settings.mouseResponse.active(mouse.dx, mouse.dy)
+    || settings.wheelResponse.active(mouse.dwx, mouse.dwy);
+}
+
+// Counts to move along one axis this tick. Fractions of a count are carried
+// over in remainder, so slow stick movement adds up instead of truncating
+// to nothing.
+int mouseStep(float velocity, float seconds, float& remainder)
+{
+  remainder += velocity * seconds;
+  int whole = static_cast<int>(remainder);
+  remainder -= whole;
+  return whole;
+}
+
+void handleMouse(Mouse* mouse, Published<Settings> const* currentSettings,
+    std::atomic<bool>* stop)
+{
+  // Sensitivity is per update at the fixed 16 ms this used to run at, so
+  // the rate changes smoothness but not speed
+  float const REFERENCE_RATE = 62.5f;
+
+  float x = 0;
+  float y = 0;
+  float wx = 0;
+  float wy = 0;
+  auto deadline = std::chrono::steady_clock::now();
   while(!*stop)
   {
-    if(mouse->dx > settings->mouseDeadzone
-        || mouse->dx < -settings->mouseDeadzone
-        || mouse->dy > settings->mouseDeadzone
-        || mouse->dy < -settings->mouseDeadzone
-        || mouse->dwx > settings->mouseWheelDeadzone
-        || mouse->dwx < -settings->mouseWheelDeadzone
-        || mouse->dwy > settings->mouseWheelDeadzone
-        || mouse->dwy < -settings->mouseWheelDeadzone)
+    Settings const* settings = currentSettings->acquire();
+    // Counts per second at full deflection, the linear response matches
+    // the original (value - deadzone) * sensitivity
+    float const pointer = (settings->mouseRange - settings->mouseDeadzone)
+      * settings->mouseSensitivity / 1000.0f * REFERENCE_RATE;
+    float vx;
+    float vy;
+    float vwx;
+    float vwy;
+    settings->mouseResponse.apply(mouse->dx, mouse->dy, vx, vy);
+    settings->wheelResponse.apply(mouse->dwx, mouse->dwy, vwx, vwy);
+    vx *= pointer;
+    vy *= pointer;
+    // Pushing the stick up scrolls up
+    vwx *= settings->mouseWheelSpeed;
+    vwy *= -settings->mouseWheelSpeed;
+
+    if(vx == 0 && vy == 0 && vwx == 0 && vwy == 0)
     {
-      std::lock_guard<std::mutex> lk(mouse->mutex);
-
-      if(mouse->dx > settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_X, 
-            (mouse->dx - settings->mouseDeadzone)
-            * settings->mouseSensitivity / 1000);
-      }
-      else if(mouse->dx < -settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_X, 
-            (mouse->dx + settings->mouseDeadzone)
-            * settings->mouseSensitivity / 1000);
-      }
-
-      if(mouse->dy > settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_Y, 
-            (mouse->dy - settings->mouseDeadzone)
-            * settings->mouseSensitivity / 1000);
-      }
-      else if(mouse->dy < -settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_Y, 
-            (mouse->dy + settings->mouseDeadzone)
-            * settings->mouseSensitivity / 1000);
-      }
-
-      if(mouse->dwx > settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_HWHEEL, 1);
-      }
-      else if(mouse->dwx < -settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_HWHEEL, -1);
-      }
-
-      if(mouse->dwy > settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_WHEEL, -1);
-      }
-      else if(mouse->dwy < -settings->mouseDeadzone)
-      {
-        mouse->device.send(EV_REL, REL_WHEEL, 1);
-      }
-
-      mouse->device.send(EV_SYN, 0, 0);
+      // Nothing to do until the stick leaves the deadzone
+      x = y = wx = wy = 0;
+      std::unique_lock<std::mutex> lk(mouse->mutex);
+      mouse->asleep = true;
+      mouse->signal.wait(lk, [mouse, currentSettings, stop]() {
+        return *stop || mouseActive(*mouse, *currentSettings->acquire());
+      });
+      mouse->asleep = false;
+      deadline = std::chrono::steady_clock::now();
+      continue;
     }
-    else
+
+    float const seconds = 1.0f / settings->mouseRate;
+    if(vx == 0)
+      x = 0;
+    if(vy == 0)
+      y = 0;
+    if(vwx == 0)
+      wx = 0;
+    if(vwy == 0)
+      wy = 0;
+
+    int stepX = mouseStep(vx, seconds, x);
+    int stepY = mouseStep(vy, seconds, y);
+    int stepWX = mouseStep(vwx, seconds, wx);
+    int stepWY = mouseStep(vwy, seconds, wy);
+
+    if(stepX || stepY || stepWX || stepWY)
     {
-      std::unique_lock<std::mutex> lk(mouse->mutex);
-      mouse->signal.wait(lk);
+      if(stepX)
+        global.host->emit(mouse->device, EV_REL, REL_X, stepX);
+      if(stepY)
+        global.host->emit(mouse->device, EV_REL, REL_Y, stepY);
+      if(stepWX)
+        global.host->emit(mouse->device, EV_REL, REL_HWHEEL, stepWX);
+      if(stepWY)
+        global.host->emit(mouse->device, EV_REL, REL_WHEEL, stepWY);
+      global.host->emit(mouse->device, EV_SYN, 0, 0);
+      global.host->flush(mouse->device);
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(16));
+
+    // Deadlines advance by whole periods on the monotonic clock so time
+    // spent emitting does not slow the rate down. After falling behind,
+    // eg. when suspended, it restarts from now rather than catching up.
+    auto const now = std::chrono::steady_clock::now();
+    deadline += std::chrono::nanoseconds(1000000000 / settings->mouseRate);
+    if(deadline < now)
+      deadline = now;
+    std::unique_lock<std::mutex> lk(mouse->mutex);
+    mouse->signal.wait_until(lk, deadline, [stop]() { return bool(*stop); });
   }
-  delete mouse;
 }
-
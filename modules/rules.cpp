@@ -0,0 +1,581 @@
+#include "funkeymonkeymodule.h"
+#include "funkeymonkeyhost.h"
+#include "eventcodes.h"
+#include "ahocorasick.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+/*
+Remaps keys according to a rules file given with -X rules=FILE. The file is
+compiled into flat lookup tables when the plugin starts and again on
+SIGUSR1, so handling a key costs one table lookup.
+
+  map FROM TO [if MODIFIER]   FROM produces TO, optionally only while the
+                              physical key MODIFIER is held
+  block FROM [if MODIFIER]    FROM produces nothing
+  layer NAME                  following key rules belong to layer NAME,
+                              "layer base" returns to the base layer
+  hold FROM LAYER             LAYER is active while FROM is held
+  toggle FROM LAYER           FROM switches LAYER on and off
+  axis AXIS < VALUE KEY       KEY is held while AXIS is below VALUE,
+                              use > for above
+  sequence KEY... = OUTPUT    typing the keys in order taps OUTPUT, the keys
+                              themselves are passed on as usual
+
+Keys without a rule in the active layer fall through to the base layer,
+and keys and buttons without any rule pass through unchanged, as do
+relative axes, eg. of a mouse, and miscellaneous events other than scan
+codes, which would name the original keys. The most recently activated
+layer wins. A release always produces the same key as the matching press
+did. Absolute axes only drive axis rules and are not passed through, the
+output could not declare their ranges.
+*/
+
+namespace
+{
+  static constexpr unsigned int MAX_LAYERS = 32;
+  static constexpr std::uint16_t NO_MODIFIER = 0xffff;
+
+  struct Action
+  {
+    enum Type : std::uint8_t { TRANSPARENT, PASS, MAP, BLOCK, HOLD, TOGGLE, CONDITIONAL };
+    Type type;
+    std::uint16_t arg;
+  };
+
+  // A key with conditional rules points to a run of these ending in one
+  // with NO_MODIFIER, which holds the action when no modifier matches
+  struct Conditional
+  {
+    std::uint16_t modifier;
+    Action action;
+  };
+
+  struct AxisRule
+  {
+    std::uint16_t axis;
+    bool below;
+    int threshold;
+    std::uint16_t key;
+  };
+
+  struct Rules
+  {
+    std::vector<std::string> layers;
+    // layers.size() * KEY_CNT actions, fall-through already resolved
+    std::vector<Action> keys;
+    std::vector<Conditional> conditionals;
+    // Index of the first rule per axis, rules are sorted by axis
+    std::array<std::uint16_t, ABS_CNT + 1> axisStart;
+    std::vector<AxisRule> axes;
+    AhoCorasick sequences;
+    // Key tapped by each sequence, indexed by its pattern id
+    std::vector<std::uint16_t> sequenceOutputs;
+  };
+
+  struct State
+  {
+    std::uint32_t activeLayers = 0;
+    unsigned int topLayer = 0;
+    // Layer activation order, newest last
+    std::vector<unsigned int> layerStack;
+    std::array<Action, KEY_CNT> pressed;
+    std::array<bool, KEY_CNT> held;
+    std::vector<bool> axisActive;
+    unsigned int sequence = AhoCorasick::ROOT;
+  };
+}
+
+bool compileRules(std::string const& filename, Rules& rules);
+void applyAction(Action action, unsigned int code, int value);
+void handleKey(unsigned int code, int value);
+void handleAxis(unsigned int axis, int value);
+void advanceSequence(unsigned int code);
+
+struct
+{
+  FunKeyMonkeyHost* host = nullptr;
+  FunKeyMonkeyHost::OutputId out = FunKeyMonkeyHost::INVALID_OUTPUT;
+  std::string rulesFile;
+  Rules rules;
+  State state;
+} global;
+
+void attach(FunKeyMonkeyHost* host)
+{
+  global.host = host;
+}
+
+void declareOutput()
+{
+  // Whatever can pass through, which includes whatever the rules produce
+  std::vector<unsigned int> keys;
+  for(unsigned int code = KEY_RESERVED; code < KEY_CNT; ++code)
+    keys.push_back(code);
+  std::vector<unsigned int> axes;
+  for(unsigned int code = 0; code < REL_CNT; ++code)
+    axes.push_back(code);
+  std::vector<unsigned int> misc;
+  for(unsigned int code = 0; code < MSC_CNT; ++code)
+  {
+    if(code != MSC_SCAN)
+      misc.push_back(code);
+  }
+  global.out = global.host->output("FunKeyMonkey rules", BUS_USB, 1, 1, 1, {
+    { EV_KEY, keys }, { EV_REL, axes }, { EV_MSC, misc }
+  });
+}
+
+void useRules(Rules&& rules)
+{
+  State& state = global.state;
+  // Keys held by axes are released under the rules that pressed them, the
+  // new rules may not even have the axis
+  bool released = false;
+  for(unsigned int i = 0; i < state.axisActive.size(); ++i)
+  {
+    if(state.axisActive[i])
+    {
+      global.host->emit(global.out, EV_KEY, global.rules.axes[i].key, 0);
+      released = true;
+    }
+  }
+  if(released)
+    global.host->emit(global.out, EV_SYN, SYN_REPORT, 0);
+
+  global.rules = std::move(rules);
+  state.activeLayers = 0;
+  state.topLayer = 0;
+  state.layerStack.clear();
+  state.axisActive.assign(global.rules.axes.size(), false);
+  state.sequence = AhoCorasick::ROOT;
+}
+
+void init(char const** argv, unsigned int argc)
+{
+  for(unsigned int i = 0; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if(arg.compare(0, 6, "rules=") == 0)
+    {
+      global.rulesFile = arg.substr(6);
+    }
+  }
+
+  if(global.rulesFile.empty())
+  {
+    std::cerr << "ERROR: No rules file given, use -X rules=FILE" << std::endl;
+  }
+
+  global.state.pressed.fill({Action::PASS, 0});
+  global.state.held.fill(false);
+
+  Rules rules;
+  if(global.rulesFile.empty() || !compileRules(global.rulesFile, rules))
+  {
+    // Pass everything through rather than swallow the keyboard
+    compileRules("", rules);
+  }
+
+  useRules(std::move(rules));
+  declareOutput();
+}
+
+void handle(input_event const& e, unsigned int)
+{
+  switch(e.type)
+  {
+    case EV_KEY:
+      if(e.code < KEY_CNT)
+        handleKey(e.code, e.value);
+      break;
+    case EV_ABS:
+      if(e.code < ABS_CNT)
+        handleAxis(e.code, e.value);
+      break;
+    case EV_REL:
+      global.host->emit(global.out, EV_REL, e.code, e.value);
+      break;
+    case EV_MSC:
+      if(e.code != MSC_SCAN)
+        global.host->emit(global.out, EV_MSC, e.code, e.value);
+      break;
+    case EV_SYN:
+      if(e.code == SYN_REPORT)
+        global.host->emit(global.out, EV_SYN, SYN_REPORT, 0);
+      break;
+    default: break;
+  }
+}
+
+void destroy()
+{
+}
+
+void user1()
+{
+  Rules rules;
+  if(compileRules(global.rulesFile, rules))
+  {
+    useRules(std::move(rules));
+    std::cout << "Reloaded rules from " << global.rulesFile << std::endl;
+  }
+}
+
+void user2()
+{
+}
+
+void handleKey(unsigned int code, int value)
+{
+  State& state = global.state;
+  state.held[code] = value != 0;
+
+  Action action;
+  if(value == 1)
+  {
+    action = global.rules.keys[state.topLayer * KEY_CNT + code];
+    if(action.type == Action::CONDITIONAL)
+    {
+      Conditional const* c = &global.rules.conditionals[action.arg];
+      while(c->modifier != NO_MODIFIER && !state.held[c->modifier])
+        ++c;
+      action = c->action;
+    }
+    state.pressed[code] = action;
+  }
+  else
+  {
+    // Repeats and releases follow whatever the press did
+    action = state.pressed[code];
+  }
+
+  applyAction(action, code, value);
+
+  if(value == 1)
+    advanceSequence(code);
+}
+
+void activateLayer(unsigned int layer, bool active)
+{
+  State& state = global.state;
+  if(layer == 0 || layer >= global.rules.layers.size())
+    return;
+
+  auto i = std::find(state.layerStack.begin(), state.layerStack.end(), layer);
+  if(i != state.layerStack.end())
+    state.layerStack.erase(i);
+  if(active)
+    state.layerStack.push_back(layer);
+
+  state.activeLayers = active ? state.activeLayers | (1u << layer)
+    : state.activeLayers & ~(1u << layer);
+  state.topLayer = state.layerStack.empty() ? 0 : state.layerStack.back();
+}
+
+void applyAction(Action action, unsigned int code, int value)
+{
+  switch(action.type)
+  {
+    case Action::TRANSPARENT:
+    case Action::PASS:
+      global.host->emit(global.out, EV_KEY, code, value);
+      break;
+    case Action::MAP:
+      global.host->emit(global.out, EV_KEY, action.arg, value);
+      break;
+    case Action::HOLD:
+      if(value != 2)
+        activateLayer(action.arg, value == 1);
+      break;
+    case Action::TOGGLE:
+      if(value == 1)
+        activateLayer(action.arg, !(global.state.activeLayers & (1u << action.arg)));
+      break;
+    case Action::BLOCK:
+    case Action::CONDITIONAL:
+      break;
+  }
+}
+
+void handleAxis(unsigned int axis, int value)
+{
+  Rules const& rules = global.rules;
+  for(unsigned int i = rules.axisStart[axis]; i < rules.axisStart[axis + 1]; ++i)
+  {
+    AxisRule const& rule = rules.axes[i];
+    bool active = rule.below ? value < rule.threshold : value > rule.threshold;
+    if(active != global.state.axisActive[i])
+    {
+      global.state.axisActive[i] = active;
+      global.host->emit(global.out, EV_KEY, rule.key, active ? 1 : 0);
+    }
+  }
+}
+
+void advanceSequence(unsigned int code)
+{
+  // The automaton falls back to the longest typed suffix that is still
+  // the start of a sequence, so "a a b" is found in "a a a b"
+  Rules const& rules = global.rules;
+  unsigned int next = rules.sequences.step(global.state.sequence, code);
+  int match = rules.sequences.match(next);
+  if(match != AhoCorasick::NO_MATCH)
+  {
+    std::uint16_t output = rules.sequenceOutputs[match];
+    global.host->emit(global.out, EV_KEY, output, 1);
+    global.host->emit(global.out, EV_SYN, SYN_REPORT, 0);
+    global.host->emit(global.out, EV_KEY, output, 0);
+    next = AhoCorasick::ROOT;
+  }
+  global.state.sequence = next;
+}
+
+bool parseKey(std::string const& name, std::uint16_t& code)
+{
+  EventCode ec;
+  if(!parseEventCode(name, ec) || ec.type != EV_KEY)
+    return false;
+  code = ec.code;
+  return true;
+}
+
+bool compileRules(std::string const& filename, Rules& rules)
+{
+  struct KeyRule
+  {
+    unsigned int layer;
+    std::uint16_t key;
+    std::uint16_t modifier;
+    Action action;
+  };
+  std::vector<KeyRule> keyRules;
+  std::vector<std::pair<std::vector<std::uint16_t>, std::uint16_t>> sequences;
+
+  rules = Rules();
+  rules.layers.push_back("base");
+
+  auto layerIndex = [&rules](std::string const& name) {
+    auto i = std::find(rules.layers.begin(), rules.layers.end(), name);
+    if(i != rules.layers.end())
+      return static_cast<unsigned int>(i - rules.layers.begin());
+    rules.layers.push_back(name);
+    return static_cast<unsigned int>(rules.layers.size() - 1);
+  };
+
+  std::ifstream file;
+  if(!filename.empty())
+  {
+    file.open(filename);
+    if(!file)
+    {
+      std::cerr << "ERROR: Could not open rules file " << filename << std::endl;
+      return false;
+    }
+  }
+
+  bool ok = true;
+  unsigned int currentLayer = 0;
+  unsigned int lineNumber = 0;
+  std::string line;
+  while(std::getline(file, line))
+  {
+    ++lineNumber;
+    auto comment = line.find('#');
+    if(comment != std::string::npos)
+      line.erase(comment);
+
+    std::istringstream iss(line);
+    std::vector<std::string> words;
+    std::string word;
+    while(iss >> word)
+      words.push_back(word);
+
+    if(words.empty())
+      continue;
+
+    auto fail = [&](std::string const& message) {
+      std::cerr << "ERROR: " << filename << ":" << lineNumber << ": "
+        << message << std::endl;
+      ok = false;
+    };
+
+    std::string const& rule = words[0];
+    if(rule == "layer" && words.size() == 2)
+    {
+      currentLayer = layerIndex(words[1]);
+    }
+    else if((rule == "map" && (words.size() == 3 || words.size() == 5))
+        || (rule == "block" && (words.size() == 2 || words.size() == 4)))
+    {
+      bool const map = rule == "map";
+      unsigned int const conditionAt = map ? 3 : 2;
+      KeyRule r = {currentLayer, 0, NO_MODIFIER, {map ? Action::MAP : Action::BLOCK, 0}};
+      if(!parseKey(words[1], r.key))
+        fail("unknown key " + words[1]);
+      else if(map && !parseKey(words[2], r.action.arg))
+        fail("unknown key " + words[2]);
+      else if(words.size() > conditionAt && words[conditionAt] != "if")
+        fail("expected 'if', got " + words[conditionAt]);
+      else if(words.size() > conditionAt && !parseKey(words[conditionAt + 1], r.modifier))
+        fail("unknown key " + words[conditionAt + 1]);
+      else
+        keyRules.push_back(r);
+    }
+    else if((rule == "hold" || rule == "toggle") && words.size() == 3)
+    {
+      KeyRule r = {currentLayer, 0, NO_MODIFIER,
+        {rule == "hold" ? Action::HOLD : Action::TOGGLE, 0}};
+      if(!parseKey(words[1], r.key))
+        fail("unknown key " + words[1]);
+      else
+      {
+        r.action.arg = layerIndex(words[2]);
+        keyRules.push_back(r);
+      }
+    }
+    else if(rule == "axis" && words.size() == 5)
+    {
+      EventCode axis;
+      AxisRule r = {0, words[2] == "<", 0, 0};
+      char* end = nullptr;
+      r.threshold = std::strtol(words[3].data(), &end, 0);
+      if(!parseEventCode(words[1], axis) || axis.type != EV_ABS)
+        fail("unknown axis " + words[1]);
+      else if(words[2] != "<" && words[2] != ">")
+        fail("expected < or >, got " + words[2]);
+      else if(*end != '\0')
+        fail("invalid threshold " + words[3]);
+      else if(!parseKey(words[4], r.key))
+        fail("unknown key " + words[4]);
+      else
+      {
+        r.axis = axis.code;
+        rules.axes.push_back(r);
+      }
+    }
+    else if(rule == "sequence" && words.size() >= 4 && words[words.size() - 2] == "=")
+    {
+      std::vector<std::uint16_t> keys(words.size() - 3);
+      std::uint16_t output = 0;
+      for(unsigned int i = 0; i < keys.size(); ++i)
+      {
+        if(!parseKey(words[i + 1], keys[i]))
+          fail("unknown key " + words[i + 1]);
+      }
+      if(!parseKey(words.back(), output))
+        fail("unknown key " + words.back());
+      else
+        sequences.push_back({keys, output});
+    }
+    else
+    {
+      fail("invalid rule: " + line);
+    }
+  }
+
+  if(rules.layers.size() > MAX_LAYERS)
+  {
+    std::cerr << "ERROR: " << filename << ": at most " << MAX_LAYERS
+      << " layers are supported" << std::endl;
+    ok = false;
+  }
+
+  if(!ok)
+    return false;
+
+  // Key tables, each layer starts out transparent to the base layer
+  unsigned int const numLayers = rules.layers.size();
+  rules.keys.assign(numLayers * KEY_CNT, {Action::TRANSPARENT, 0});
+  for(unsigned int code = 0; code < KEY_CNT; ++code)
+  {
+    rules.keys[code] = {Action::PASS, 0};
+  }
+
+  // Conditional rules of a key are collected into one run, in file order,
+  // with the unconditional rule (or passing through) as the last resort
+  for(unsigned int layer = 0; layer < numLayers; ++layer)
+  {
+    for(unsigned int code = 0; code < KEY_CNT; ++code)
+    {
+      Action fallback = rules.keys[layer * KEY_CNT + code];
+      std::vector<Conditional> conditionals;
+      for(KeyRule const& r : keyRules)
+      {
+        if(r.layer != layer || r.key != code)
+          continue;
+        if(r.modifier == NO_MODIFIER)
+          fallback = r.action;
+        else
+          conditionals.push_back({r.modifier, r.action});
+      }
+
+      if(conditionals.empty())
+      {
+        rules.keys[layer * KEY_CNT + code] = fallback;
+        continue;
+      }
+
+      if(fallback.type == Action::TRANSPARENT && rules.keys[code].type == Action::CONDITIONAL)
+      {
+        // Falling through to conditional base rules, which are tried after
+        // this layer's own and end in a concrete action
+        for(Conditional const* c = &rules.conditionals[rules.keys[code].arg]; ; ++c)
+        {
+          conditionals.push_back(*c);
+          if(c->modifier == NO_MODIFIER)
+            break;
+        }
+      }
+      else
+      {
+        if(fallback.type == Action::TRANSPARENT)
+          fallback = rules.keys[code];
+        conditionals.push_back({NO_MODIFIER, fallback});
+      }
+      rules.keys[layer * KEY_CNT + code] = {Action::CONDITIONAL,
+        static_cast<std::uint16_t>(rules.conditionals.size())};
+      rules.conditionals.insert(rules.conditionals.end(),
+          conditionals.begin(), conditionals.end());
+    }
+  }
+
+  // Resolve fall-through so lookups never have to walk down the layers
+  for(unsigned int layer = 1; layer < numLayers; ++layer)
+  {
+    for(unsigned int code = 0; code < KEY_CNT; ++code)
+    {
+      Action& action = rules.keys[layer * KEY_CNT + code];
+      if(action.type == Action::TRANSPARENT)
+        action = rules.keys[code];
+    }
+  }
+
+  std::stable_sort(rules.axes.begin(), rules.axes.end(),
+      [](AxisRule const& a, AxisRule const& b) { return a.axis < b.axis; });
+  unsigned int rule = 0;
+  for(unsigned int axis = 0; axis <= ABS_CNT; ++axis)
+  {
+    while(rule < rules.axes.size() && rules.axes[rule].axis < axis)
+      ++rule;
+    rules.axisStart[axis] = rule;
+  }
+
+  for(auto const& sequence : sequences)
+  {
+    rules.sequences.add(std::vector<unsigned int>(sequence.first.begin(), sequence.first.end()),
+        rules.sequenceOutputs.size());
+    rules.sequenceOutputs.push_back(sequence.second);
+  }
+  rules.sequences.build();
+
+  return true;
+}
@@ -0,0 +1,78 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Sends one command to a funkeymonkey started with --control and prints
+// the reply. Exits with failure if the host answers with an error.
+
+int main(int argc, char** argv)
+{
+  std::string path;
+  std::string command;
+  bool help = false;
+  for(int i = 1; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if((arg == "-c" || arg == "--control") && i + 1 < argc)
+    {
+      path = argv[++i];
+    }
+    else if(arg == "-h" || arg == "--help")
+    {
+      help = true;
+      break;
+    }
+    else
+    {
+      command += (command.empty() ? "" : " ") + arg;
+    }
+  }
+
+  if(help || path.empty() || command.empty())
+  {
+    (help ? std::cout : std::cerr) << "Usage: " << argv[0] << " -c SOCKET COMMAND [ARGUMENTS...]"
+      << std::endl << "Run '" << argv[0] << " -c SOCKET help' for the commands" << std::endl;
+    return help ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(address.sun_path))
+  {
+    std::cerr << "ERROR: Control socket path too long: " << path << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::strcpy(address.sun_path, path.data());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+  {
+    std::cerr << "ERROR: Could not connect to " << path << ", error code " << errno << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  command += '\n';
+  if(send(fd, command.data(), command.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(command.size()))
+  {
+    std::cerr << "ERROR: Could not send command, error code " << errno << std::endl;
+    return EXIT_FAILURE;
+  }
+  shutdown(fd, SHUT_WR);
+
+  std::string reply;
+  char buffer[4096];
+  ssize_t received;
+  while((received = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+  {
+    reply.append(buffer, received);
+  }
+  close(fd);
+
+  std::cout << reply;
+  return reply.compare(0, 6, "ERROR:") == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,13 +1,25 @@
 #include "funkeymonkeymodule.h"
 #include "evdevdevice.h"
 #include "funkeymonkeymoduleloader.h"
+#include "pluginsandbox.h"
+#include "hostoutputs.h"
+#include "controlsocket.h"
+#include "metrics.h"
+#include "recording.h"
 #include "cxxopts.hpp"
 
+// Counted only in builds configured with -DFKM_ALLOCATION_CHECK=ON
+#ifndef FKM_ALLOCATION_CHECK
+#define ALLOCATION_COUNTER_DISABLED
+#endif
+#include "allocationcounter.h"
+
 #include <iostream>
 #include <cstdlib>
 #include <regex>
 #include <algorithm>
 #include <iterator>
+#include <memory>
 
 #include <memory.h>
 #include <signal.h>
@@ -15,6 +27,9 @@
 volatile sig_atomic_t done = 0;
 volatile sig_atomic_t usr1 = 0;
 volatile sig_atomic_t usr2 = 0;
+volatile sig_atomic_t reload = 0;
+volatile sig_atomic_t report = 0;
+volatile sig_atomic_t child = 0;
 
 EvdevDevice *p_evdev;
 
@@ -31,12 +46,172 @@ void sighandle(int sig)
     case SIGUSR2:
       usr2 = 1;
       break;
+    case SIGHUP:
+      reload = 1;
+      break;
+    case SIGQUIT:
+      report = 1;
+      break;
+    case SIGCHLD:
+      child = 1;
+      break;
     default: break;
   }
 }
 
-void process(EvdevDevice& evdev, FunKeyMonkeyModule& module,
-    std::vector<std::string> const& moduleArgs)
+// Plugins loaded in process never have a runner to restart
+void restartCrashed(FunKeyMonkeyModule&)
+{
+}
+void restartCrashed(PluginSandbox& sandbox)
+{
+  sandbox.check();
+}
+
+void stats(FunKeyMonkeyModule& module, HostOutputs& outputs, std::ostream& os)
+{
+  module.report(os);
+  outputs.report(os);
+}
+void stats(PluginSandbox& sandbox, HostOutputs&, std::ostream& os)
+{
+  // The runner owns the plugin's profile and outputs
+  sandbox.report(os);
+  os << "Statistics are written to the plugin runner's output" << std::endl;
+}
+
+void switchSinks(FunKeyMonkeyModule&, HostOutputs& outputs, std::string const& option,
+    std::ostream& reply)
+{
+  if(option.empty())
+  {
+    for(auto const& sink : outputs.sinkNames())
+    {
+      reply << sink.first << "=" << sink.second << std::endl;
+    }
+  }
+  else if(!outputs.sinks(option))
+    reply << "ERROR: Could not switch to " << option << ", see the log" << std::endl;
+  else
+    reply << "OK" << std::endl;
+}
+void switchSinks(PluginSandbox&, HostOutputs&, std::string const&, std::ostream& reply)
+{
+  reply << "ERROR: The plugin runner owns the outputs, use --output-sink" << std::endl;
+}
+
+char const* const CONTROL_HELP =
+  "stats                  callback and output counters and latencies\n"
+  "devices                input devices with their roles and grabs\n"
+  "add PATH [ROLE]        read another input device\n"
+  "remove PATH            stop reading an input device\n"
+  "grab PATH on|off       grab or release an input device\n"
+  "reload                 reload the plugin\n"
+  "config                 have the plugin reload its config, like SIGUSR1\n"
+  "set KEY=VALUE          pass a setting to the plugin\n"
+  "metrics                counters and gauges in the Prometheus text format\n"
+  "sink [[NAME=]SINK]     list outputs or switch them, see --output-sink\n";
+
+// Answers one control socket command. Reloads wait for the end of the
+// current frame, like SIGHUP.
+template<typename Plugin>
+void control(std::string const& line, std::ostream& reply, EvdevDevice& evdev,
+    Plugin& module, HostOutputs& outputs, Metrics const& metrics)
+{
+  std::istringstream words(line);
+  std::string command;
+  std::string argument;
+  words >> command >> argument;
+
+  if(command == "stats")
+  {
+    stats(module, outputs, reply);
+  }
+  else if(command == "devices")
+  {
+    for(EvdevDevice::DeviceState const& device : evdev.devices())
+    {
+      reply << device.path << " role " << device.role
+        << (device.grabbed ? " grabbed" : "") << std::endl;
+    }
+  }
+  else if(command == "add" && !argument.empty())
+  {
+    unsigned int role = 0;
+    if(!(words >> std::ws).eof() && !(words >> role))
+      reply << "ERROR: Invalid role" << std::endl;
+    else if(!evdev.addDevice({argument, role}))
+      reply << "ERROR: Could not add " << argument << std::endl;
+    else
+      reply << "OK" << std::endl;
+  }
+  else if(command == "remove" && !argument.empty())
+  {
+    if(evdev.devices().size() == 1)
+      reply << "ERROR: Cannot remove the last device" << std::endl;
+    else if(!evdev.removeDevice(argument))
+      reply << "ERROR: No device " << argument << std::endl;
+    else
+      reply << "OK" << std::endl;
+  }
+  else if(command == "grab" && !argument.empty())
+  {
+    std::string state;
+    words >> state;
+    if(state != "on" && state != "off")
+      reply << "ERROR: Expected grab PATH on|off" << std::endl;
+    else if(!evdev.grab(argument, state == "on"))
+      reply << "ERROR: Could not " << (state == "on" ? "grab " : "release ")
+        << argument << std::endl;
+    else
+      reply << "OK" << std::endl;
+  }
+  else if(command == "reload")
+  {
+    reload = 1;
+    reply << "OK" << std::endl;
+  }
+  else if(command == "config")
+  {
+    module.user1();
+    outputs.flushAll();
+    reply << "OK" << std::endl;
+  }
+  else if(command == "set" && argument.find('=') != std::string::npos)
+  {
+    if(!module.configurable())
+      reply << "ERROR: The plugin takes no runtime settings" << std::endl;
+    else if(!module.configure(argument))
+      reply << "ERROR: The plugin rejected " << argument << std::endl;
+    else
+      reply << "OK" << std::endl;
+    outputs.flushAll();
+  }
+  else if(command == "sink")
+  {
+    // Output names may have spaces, the rest of the line is the option
+    std::string option = line.substr(line.find(command) + command.size());
+    option.erase(0, option.find_first_not_of(" \t"));
+    switchSinks(module, outputs, option, reply);
+  }
+  else if(command == "metrics")
+  {
+    metrics.render(reply);
+  }
+  else if(command == "help")
+  {
+    reply << CONTROL_HELP;
+  }
+  else
+  {
+    reply << "ERROR: Unknown command '" << line << "', try help" << std::endl;
+  }
+}
+
+template<typename Plugin>
+void process(EvdevDevice& evdev, Plugin& module, HostOutputs& outputs,
+    std::vector<std::string> const& moduleArgs, bool profile, ControlSocket* controlSocket,
+    Metrics const& metrics)
 {
   struct sigaction sigAction;
   sigAction.sa_handler = sighandle;
@@ -45,7 +220,15 @@ void process(EvdevDevice& evdev, FunKeyMonkeyModule& module,
 
   if(sigaction(SIGINT, &sigAction, NULL) == -1
       || sigaction(SIGUSR1, &sigAction, NULL) == -1
-      || sigaction(SIGUSR2, &sigAction, NULL) == -1)
+      || sigaction(SIGUSR2, &sigAction, NULL) == -1
+      || sigaction(SIGHUP, &sigAction, NULL) == -1
+      || sigaction(SIGCHLD, &sigAction, NULL) == -1)
+  {
+    std::cerr << "ERROR: Could not register signal handlers" << std::endl;
+  }
+
+  // Profile report on demand, otherwise SIGQUIT keeps its default action
+  if(profile && sigaction(SIGQUIT, &sigAction, NULL) == -1)
   {
     std::cerr << "ERROR: Could not register signal handlers" << std::endl;
   }
@@ -57,36 +240,132 @@ void process(EvdevDevice& evdev, FunKeyMonkeyModule& module,
   });
 
   module.init(args.data(), args.size());
+  outputs.flushAll();
+
+  ControlSocket::Handler const handler = [&](std::string const& line, std::ostream& reply) {
+    control(line, reply, evdev, module, outputs, metrics);
+  };
+  if(controlSocket)
+  {
+    evdev.watch(controlSocket->fds());
+  }
+
+  // True while the plugin has seen part of a frame but not its SYN_REPORT
+  bool frameOpen = false;
+  // Heap allocations in callbacks and writing out their events, process
+  // wide, so threads of the plugin and eg. the recorder count as well
+  unsigned long long allocations = 0;
+  unsigned long long dispatched = 0;
 
   while(!done)
   {
+    // Only swap plugins between frames so none sees half a frame
+    if(reload && !frameOpen)
+    {
+      outputs.markUnclaimed();
+      // Callbacks of pending timers point into the unloaded plugin, they
+      // go before the new one can set its own
+      if(module.reload(module.path(), args.data(), args.size(),
+            [&outputs]() { outputs.timers().clear(); }))
+      {
+        outputs.destroyUnclaimed();
+        outputs.flushAll();
+        std::cout << "Reloaded plugin '" << module.path() << "'." << std::endl;
+      }
+      reload = 0;
+    }
+
+    if(child)
+    {
+      child = 0;
+      restartCrashed(module);
+    }
+
+    if(report)
+    {
+      module.report(std::cout);
+      outputs.report(std::cout);
+      report = 0;
+    }
+
     if(usr1)
     {
       module.user1();
+      outputs.flushAll();
       usr1 = 0;
     }
 
     if(usr2)
     {
       module.user2();
+      outputs.flushAll();
       usr2 = 0;
     }
 
-    auto result = evdev.poll();
+    // Timers fire between frames, like reloads
+    HostTimers& timers = outputs.timers();
+    unsigned long long allocated = AllocationCounter::count();
+    if(timers.pending() && !frameOpen && timers.fire(ModuleProfiler::now()))
+    {
+      outputs.flushAll();
+    }
+    allocations += AllocationCounter::count() - allocated;
+
+    EvdevDevice::PollResult result;
+    if(timers.pending() && !frameOpen && !evdev.pending())
+    {
+      unsigned long long now = ModuleProfiler::now();
+      unsigned long long next = timers.next();
+      result = evdev.pollFor(next > now ? next - now : 0);
+    }
+    else
+    {
+      result = evdev.poll();
+    }
     switch(result.status)
     {
       case EvdevDevice::POLL_OK:
       {
+        allocated = AllocationCounter::count();
+        outputs.origin(HostOutputs::timestamp(result.event));
         module.handle(result.event, result.role);
+        outputs.origin(0);
+        frameOpen = result.event.type != EV_SYN
+          || result.event.code != SYN_REPORT;
+
+        // Write out whatever the plugin emitted once the input frame is
+        // complete, or at the latest before blocking for more input
+        if(!frameOpen || !evdev.pending())
+        {
+          outputs.flushAll();
+        }
+        allocations += AllocationCounter::count() - allocated;
+        dispatched += 1;
+        break;
+      }
+      case EvdevDevice::POLL_WATCHED:
+      {
+        controlSocket->service(handler);
+        evdev.watch(controlSocket->fds());
         break;
       }
       case EvdevDevice::POLL_TIMEOUT:
+      case EvdevDevice::POLL_INTERRUPTED:
       {
         break;
       }
+      case EvdevDevice::POLL_END:
+      {
+        // Once all input has ended there is nothing left to do
+        if(!evdev.ready())
+        {
+          done = 1;
+        }
+        break;
+      }
       case EvdevDevice::POLL_ERROR:
       {
-        if(!done && !usr1 && !usr2)
+        if(!done && !usr1 && !usr2 && !reload && !report && !child)
         {
           std::cerr << "ERROR: Reading devices failed." << std::endl;
           done = 1;
@@ -97,6 +376,17 @@ void process(EvdevDevice& evdev, FunKeyMonkeyModule& module,
   }
 
   module.destroy();
+  outputs.flushAll();
+  module.report(std::cout);
+  if(profile)
+  {
+    outputs.report(std::cout);
+  }
+  if(AllocationCounter::available())
+  {
+    std::cout << allocations << " heap allocations while dispatching " << dispatched
+      << " events" << std::endl;
+  }
 }
 
 int main(int argc, char** argv)
@@ -111,8 +401,29 @@ int main(int argc, char** argv)
     ("p,plugin", "Path to plugin", cxxopts::value<std::string>(), "PATH")
     ("g,grab", "Grab the input device, preventing others from accessing it")
     ("v,verbose", "Print extra runtime information")
+    ("P,profile", "Time plugin callbacks, report on SIGQUIT and at exit")
+    ("s,sandbox", "Run the plugin in a separate process that is restarted if it crashes")
+    ("w,watchdog", "Warn with a backtrace when a plugin callback runs longer than MS milliseconds",
+     cxxopts::value<unsigned int>(), "MS")
+    ("watchdog-ungrab", "Release grabbed devices while the watchdog sees a plugin stalled")
     ("d,daemonize", "Daemonize process")
     ("l,list-devices", "List available devices")
+    ("o,output-file", "Write plugin output to FILE instead of virtual devices",
+     cxxopts::value<std::string>(), "FILE")
+    ("output-sink", "Where outputs send their events: NAME=SINK for the output NAME or SINK "
+     "for all, where SINK is uinput, file:PATH, trace:PATH, socket:PATH or null, "
+     "multiple can be provided", cxxopts::value<std::vector<std::string>>(), "[NAME=]SINK")
+    ("c,control", "Serve runtime commands on a unix socket at PATH, see funkeymonkey-ctl",
+     cxxopts::value<std::string>(), "PATH")
+    ("M,metrics", "Write metrics in the Prometheus text format to FILE",
+     cxxopts::value<std::string>(), "FILE")
+    ("metrics-interval", "Seconds between metrics writes, default 15",
+     cxxopts::value<unsigned int>(), "SECONDS")
+    ("input-backend", "How devices are read: evdev (default), epoll, or pipe and ring "
+     "that take generator:typing|mouse|stick[:FRAMES] or a recording as -i PATH",
+     cxxopts::value<std::string>(), "NAME")
+    ("record", "Record every input event with its device to FILE, see recording.h",
+     cxxopts::value<std::string>(), "FILE")
     ("X,plugin-parameter", "Plugin parameter",
      cxxopts::value<std::vector<std::string>>(), "ARG")
     ("h,help", "Print help");
@@ -156,6 +467,23 @@ int main(int argc, char** argv)
     return EXIT_SUCCESS;
   }
 
+  EvdevDevice::Backend backend = EvdevDevice::EVDEV_BACKEND;
+  if(options.count("input-backend"))
+  {
+    std::string const name = options["input-backend"].as<std::string>();
+    if(name == "epoll")
+      backend = EvdevDevice::EPOLL_BACKEND;
+    else if(name == "pipe")
+      backend = EvdevDevice::PIPE_BACKEND;
+    else if(name == "ring")
+      backend = EvdevDevice::RING_BACKEND;
+    else if(name != "evdev")
+    {
+      std::cerr << "ERROR: Unknown input backend '" << name << "'" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
   if(options.count("i") < 1 && options.count("m") < 1)
   {
     std::cerr << "ERROR: at least one input device path or match pattern is required" << std::endl;
@@ -235,7 +563,7 @@ int main(int argc, char** argv)
     }
   }
 
-  EvdevDevice evdev(inputs);
+  EvdevDevice evdev(inputs, backend);
   p_evdev  = &evdev;
 
   if(!evdev.ready())
@@ -244,9 +572,42 @@ int main(int argc, char** argv)
     return EXIT_FAILURE;
   }
 
-  FunKeyMonkeyModule module(options["p"].as<std::string>());
+  std::string const pluginPath = options["p"].as<std::string>();
+  bool const profile = options.count("P") > 0;
+  bool const sandbox = options.count("s") > 0;
+  if(sandbox && (options.count("w") || options.count("watchdog-ungrab")))
+  {
+    std::cerr << "ERROR: The watchdog only covers plugins loaded in process, "
+      "the sandbox drops the input of a stalled runner itself" << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  if(!module.ready())
+  // Outlives everything counting into it
+  Metrics metrics;
+  HostOutputs outputs;
+  if(options.count("o") && !outputs.sinks(HostOutputs::FILE_SINK, options["o"].as<std::string>()))
+  {
+    return EXIT_FAILURE;
+  }
+  for(std::string const& sink : options["output-sink"].as<std::vector<std::string>>())
+  {
+    if(!outputs.sinks(sink))
+      return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<FunKeyMonkeyModule> module;
+  std::unique_ptr<PluginSandbox> sandboxed;
+  if(sandbox)
+  {
+    sandboxed.reset(new PluginSandbox(pluginPath, &outputs, profile));
+  }
+  else
+  {
+    module.reset(new FunKeyMonkeyModule(pluginPath));
+    module->host(&outputs);
+  }
+
+  if(sandbox ? !sandboxed->ready() : !module->ready())
   {
     std::cerr << "ERROR: Could not open plugin" << std::endl;
     return EXIT_FAILURE;
@@ -264,9 +625,86 @@ int main(int argc, char** argv)
     return EXIT_FAILURE;
   }
 
+  if(options.count("w") && options["w"].as<unsigned int>() == 0)
+  {
+    std::cerr << "ERROR: Watchdog budget must be at least 1 ms" << std::endl;
+    return EXIT_FAILURE;
+  }
+
   std::vector<std::string> moduleArgs = options["X"].as<std::vector<std::string>>();
 
-  process(evdev, module, moduleArgs);
+  std::unique_ptr<ControlSocket> controlSocket;
+  if(options.count("c"))
+  {
+    controlSocket.reset(new ControlSocket(options["c"].as<std::string>()));
+    if(!controlSocket->ready())
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(options.count("metrics-interval") && options["metrics-interval"].as<unsigned int>() == 0)
+  {
+    std::cerr << "ERROR: Metrics interval must be at least 1 second" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Only counted when someone can look at them
+  std::unique_ptr<MetricsFile> metricsFile;
+  if(options.count("M") || controlSocket)
+  {
+    evdev.metrics(&metrics);
+    outputs.metrics(&metrics);
+    if(sandbox)
+      sandboxed->metrics(&metrics);
+    else
+      module->metrics(&metrics);
+  }
+  if(options.count("M"))
+  {
+    unsigned int const interval = options.count("metrics-interval")
+      ? options["metrics-interval"].as<unsigned int>() : 15;
+    metricsFile.reset(new MetricsFile(&metrics, options["M"].as<std::string>(), interval * 1000));
+  }
+
+  std::unique_ptr<InputRecorder> recorder;
+  if(options.count("record"))
+  {
+    recorder.reset(new InputRecorder(options["record"].as<std::string>()));
+    if(!recorder->ready())
+    {
+      return EXIT_FAILURE;
+    }
+    evdev.record(recorder.get());
+  }
+
+  if(sandbox)
+  {
+    process(evdev, *sandboxed, outputs, moduleArgs, profile, controlSocket.get(), metrics);
+  }
+  else
+  {
+    ModuleProfiler profiler;
+    if(profile)
+    {
+      module->profile(&profiler);
+    }
+
+    std::unique_ptr<Watchdog> watchdog;
+    if(options.count("w"))
+    {
+      watchdog.reset(new Watchdog(options["w"].as<unsigned int>(),
+            options.count("watchdog-ungrab") && options.count("g") ? &evdev : nullptr));
+      module->watch(watchdog.get());
+    }
+
+    process(evdev, *module, outputs, moduleArgs, profile, controlSocket.get(), metrics);
+
+    if(watchdog && watchdog->incidents())
+    {
+      std::cerr << "WARNING: Plugin stalled " << watchdog->incidents() << " times" << std::endl;
+    }
+  }
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,227 @@
+#include "funkeymonkeymoduleloader.h"
+#include "hostoutputs.h"
+#include "moduleprofiler.h"
+#include "recording.h"
+#include "cxxopts.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <algorithm>
+#include <iterator>
+#include <time.h>
+
+// Feeds a recording made with funkeymonkey --record through a plugin, without
+// any devices. Host timers run on the recording's clock: as fast as possible
+// they fire exactly where the recorded events put them, so the same
+// recording always gives the same output. With --speed the events are
+// spaced out in real time instead, eg. for plugins with threads of their own
+// that go by the real clock. With -o the output is logged like
+// funkeymonkey -o does, for diffing against another plugin version.
+
+namespace
+{
+  // Timers due this long after the last event still fire, eg. a tap-hold
+  // key released just before the recording ended
+  unsigned long long const DRAIN_NS = 1000000000ull;
+
+  // Sleeps until the real time a virtual time maps to, when replaying timed
+  class Pace
+  {
+  public:
+    Pace(double speed, unsigned long long start) :
+      _speed(speed), _start(start), _realStart(ModuleProfiler::now())
+    {
+    }
+
+    void wait(unsigned long long time) const
+    {
+      if(_speed <= 0 || time <= _start)
+        return;
+
+      unsigned long long const real = _realStart + (time - _start) / _speed;
+      timespec const until = {static_cast<time_t>(real / 1000000000),
+        static_cast<long>(real % 1000000000)};
+      while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR)
+        ;
+    }
+
+  private:
+    double _speed;
+    unsigned long long _start;
+    unsigned long long _realStart;
+  };
+}
+
+int main(int argc, char** argv)
+{
+  cxxopts::Options options(argv[0], " - Replays a recording through a plugin");
+  options.add_options()
+    ("i,recording", "Recording to replay, see funkeymonkey --record",
+     cxxopts::value<std::string>(), "FILE")
+    ("p,plugin", "Path to plugin", cxxopts::value<std::string>(), "PATH")
+    ("o,output-file", "Write plugin output to FILE", cxxopts::value<std::string>(), "FILE")
+    ("output-sink", "Where outputs send their events, like funkeymonkey --output-sink",
+     cxxopts::value<std::vector<std::string>>(), "[NAME=]SINK")
+    ("s,speed", "Replay in real time, FACTOR times as fast as recorded, instead of as fast as possible",
+     cxxopts::value<double>(), "FACTOR")
+    ("start", "Start SECONDS into the recording", cxxopts::value<double>(), "SECONDS")
+    ("X,plugin-parameter", "Plugin parameter",
+     cxxopts::value<std::vector<std::string>>(), "ARG")
+    ("h,help", "Print help");
+
+  if(argc == 1)
+  {
+    std::cout << options.help({""}) << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  try
+  {
+    options.parse(argc, argv);
+  }
+  catch(cxxopts::OptionException const& e)
+  {
+    std::cerr << "ERROR: parsing options failed: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(options.count("h"))
+  {
+    std::cout << options.help({""}) << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  if(!options.count("i") || !options.count("p"))
+  {
+    std::cerr << "ERROR: A recording and a plugin are required" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  double const speed = options.count("s") ? options["s"].as<double>() : 0;
+  if(options.count("s") && speed <= 0)
+  {
+    std::cerr << "ERROR: Speed must be above 0" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Recording recording;
+  if(!recording.open(options["i"].as<std::string>()))
+  {
+    return EXIT_FAILURE;
+  }
+
+  Recording::Event event;
+  if(!recording.next(event))
+  {
+    std::cerr << "ERROR: The recording has no events" << std::endl;
+    return EXIT_FAILURE;
+  }
+  unsigned long long start = HostOutputs::timestamp(event.event);
+  recording.rewind();
+  if(options.count("start"))
+  {
+    start += options["start"].as<double>() * 1e9;
+    recording.seek(start);
+  }
+
+  HostOutputs outputs;
+  if(options.count("o") ? !outputs.sinks(HostOutputs::FILE_SINK, options["o"].as<std::string>())
+      : !outputs.sinks(HostOutputs::MEMORY_SINK))
+  {
+    return EXIT_FAILURE;
+  }
+  for(std::string const& sink : options["output-sink"].as<std::vector<std::string>>())
+  {
+    if(!outputs.sinks(sink))
+      return EXIT_FAILURE;
+  }
+
+  FunKeyMonkeyModule module(options["p"].as<std::string>());
+  if(!module.ready())
+  {
+    std::cerr << "ERROR: Could not open plugin" << std::endl;
+    return EXIT_FAILURE;
+  }
+  module.host(&outputs);
+
+  std::vector<std::string> moduleArgs = options["X"].as<std::vector<std::string>>();
+  std::vector<char const*> args;
+  std::transform(moduleArgs.begin(), moduleArgs.end(),
+      std::inserter(args, args.begin()), [](std::string const& s) {
+      return s.c_str();
+  });
+
+  module.init(args.data(), args.size());
+  outputs.flushAll();
+
+  HostTimers& timers = outputs.timers();
+  auto fireUntil = [&](unsigned long long time, Pace const& pace) {
+    while(timers.pending() && timers.next() <= time)
+    {
+      unsigned long long const next = timers.next();
+      pace.wait(next);
+      timers.fire(next);
+      outputs.flushAll();
+    }
+  };
+
+  // Events before the start are skipped up to the seek point's frame end,
+  // the plugin never sees half a frame
+  bool frameOpen = false;
+  bool started = !options.count("start");
+  unsigned long long events = 0;
+  unsigned long long frames = 0;
+  unsigned long long last = start;
+  Pace const pace(speed, start);
+  unsigned long long const realStart = ModuleProfiler::now();
+  while(recording.next(event))
+  {
+    input_event const& e = event.event;
+    bool const report = e.type == EV_SYN && e.code == SYN_REPORT;
+    unsigned long long const time = HostOutputs::timestamp(e);
+    if(!started)
+    {
+      started = report && time >= start;
+      continue;
+    }
+
+    // Timers fire between frames, like in funkeymonkey
+    if(!frameOpen)
+      fireUntil(time, pace);
+    pace.wait(time);
+
+    module.handle(e, event.role);
+    frameOpen = !report;
+    if(!frameOpen)
+    {
+      outputs.flushAll();
+      frames += 1;
+    }
+    events += 1;
+    last = std::max(last, time);
+  }
+  fireUntil(last + DRAIN_NS, pace);
+  unsigned long long const realEnd = ModuleProfiler::now();
+
+  module.destroy();
+  outputs.flushAll();
+
+  double const seconds = (realEnd - realStart) / 1e9;
+  std::cout << "Replayed " << events << " events in " << frames << " frames, "
+    << std::fixed << std::setprecision(3) << (last - start) / 1e9 << " s of input in "
+    << seconds << " s";
+  if(events)
+  {
+    std::cout << ", " << std::setprecision(0) << (realEnd - realStart) / static_cast<double>(events)
+      << " ns per event";
+  }
+  std::cout << std::endl;
+  if(recording.dropped())
+  {
+    std::cerr << "WARNING: The recording is missing " << recording.dropped()
+      << " events the recorder dropped" << std::endl;
+  }
+  outputs.report(std::cout);
+  return EXIT_SUCCESS;
+}